@@ -0,0 +1,477 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <iostream>
+#include "server_config.h"
+#include "load_table.h"
+#include "locker.h"
+#include "utils.h"
+
+#define LOG_RING_RECORDS 2048       // 每个线程环形缓冲区的记录数（2的幂）
+#define LOG_MAX_THREADS 64          // 同时写日志的线程数上限（工作线程 + reactor + 管理线程）
+#define LOG_URL_LEN 80              // 记录中URL的长度上限，超出部分截断
+#define LOG_LINE_MAX 256            // 格式化后一行的长度上限
+#define LOG_FORMAT_BUF (256 << 10)  // 每个日志文件一次批量写入的格式化缓冲区
+
+// 日志记录的类型
+enum LOG_RECORD_TYPE {
+    LRT_ACCESS = 0,     // 访问日志：一个请求的响应
+    LRT_ERROR,          // 错误日志
+    LRT_INFO            // 运行状态（写到错误日志中）
+};
+
+// 一条日志记录：定长，工作线程只做拷贝，格式化由后台线程完成
+struct Log_Record {
+    uint64_t time_us;           // 单调时钟，后台线程换算成墙上时间
+    uint64_t value;             // 访问：响应字节数；错误：附带的数值（如进程序号）
+    const char *message;        // 错误：必须是字符串常量
+    uint32_t peer_ip;           // 网络字节序
+    uint32_t duration_us;       // 从解析完请求到响应发送完成
+    int32_t err;                // 错误：errno
+    uint16_t type;
+    uint16_t status;
+    char method[8];
+    char url[LOG_URL_LEN];
+};
+static_assert(sizeof(Log_Record) == 128, "Log_Record should be two cache lines");
+
+/**
+ * desc: 单生产者单消费者的环形缓冲区
+ *      生产者是拥有它的线程，消费者是后台写日志的线程
+ *      head和tail各占一个cache line；生产者缓存上一次看到的tail，只有看起来已满时
+ *      才重新读取消费者的cache line
+ */
+struct Log_Ring {
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t cached_tail = 0;
+    std::atomic<uint64_t> dropped{0};       // 缓冲区满时丢弃的记录数
+
+    alignas(64) std::atomic<uint64_t> tail{0};
+    uint64_t dropped_reported = 0;
+
+    alignas(64) std::atomic<bool> owned{false};     // 是否有线程正在使用
+    Log_Record records[LOG_RING_RECORDS];
+};
+
+// 线程领取的缓冲区，线程退出时归还
+struct Log_Ring_Owner {
+    Log_Ring *ring = NULL;
+    ~Log_Ring_Owner() {
+        if (ring) ring->owned.store(false, std::memory_order_release);
+    }
+};
+
+// 一个日志文件，path为空表示标准输出（不轮转）
+struct Log_File {
+    std::string path;
+    int fd = -1;
+    char *buf = NULL;
+    iovec iov[LOG_MAX_THREADS + 1];
+    int iovcnt = 0;
+    size_t used = 0;
+};
+
+/**
+ * desc: 异步的访问日志和错误日志（每个子进程一份）
+ *      - 线程第一次写日志时领取一个环形缓冲区，线程退出时归还，之后由新线程复用
+ *      - 写日志只是填一条定长记录并发布head，不加锁、不做系统调用、不格式化
+ *      - 后台线程每log_flush_interval_ms把全部缓冲区格式化，每个文件一次writev写入
+ *      - 缓冲区满时丢弃新记录而不是等待，丢弃数计入负载表，并写一行错误日志
+ *      - 文件超过log_rotate_bytes时轮转为path.1 ~ path.N：多个子进程写同一个文件，
+ *        用flock决定由谁改名，其他进程发现path指向新文件后重新打开
+ *      后台线程没有启动时（父进程、启动之前），错误日志直接同步写到标准输出
+ */
+class Access_Log final {
+public:
+    // 子进程：打开日志文件并启动后台线程
+    static bool start(const ServerConfig &config, ChildLoad *load) {
+
+        _load = load;
+        _flush_interval_ms = config.log_flush_interval_ms > 0 ? config.log_flush_interval_ms : 50;
+        _rotate_bytes = config.log_rotate_bytes;
+        _rotate_keep = config.log_rotate_keep;
+
+        _init_wall_offset();
+
+        _access.path = config.access_log_path;
+        _error.path = config.error_log_path;
+        if (!_access.path.empty() && !_open(_access)) return false;
+        if (!_error.path.empty() && !_open(_error)) return false;
+        if (_error.path.empty()) _error.fd = STDOUT_FILENO;
+        _access.buf = new char[LOG_FORMAT_BUF];
+        _error.buf = new char[LOG_FORMAT_BUF];
+
+        _access_enabled = _access.fd >= 0;
+        _stop.store(false);
+        if (pthread_create(&_thread, NULL, _flush_routine, NULL) != 0) {
+            std::cout << "pthread_create() log thread failed, errno: " << errno << std::endl;
+            return false;
+        }
+        _running.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // 停止后台线程，写出剩余的记录（应在其他线程都退出之后调用）
+    static void stop() {
+
+        if (!_running.load()) return;
+        _stop.store(true);
+        pthread_join(_thread, NULL);
+        _running.store(false);
+        _access_enabled = false;
+
+        if (_access.fd >= 0) close(_access.fd);
+        if (_error.fd >= 0 && _error.fd != STDOUT_FILENO) close(_error.fd);
+        _access.fd = _error.fd = -1;
+        delete[] _access.buf;
+        delete[] _error.buf;
+        _access.buf = _error.buf = NULL;
+    }
+
+    static bool access_enabled() {
+        return _access_enabled;
+    }
+
+    // 记录一个请求的响应，start_us为解析完请求时的now_us()
+    static void access(uint32_t peer_ip, const std::string &method, const std::string &url, \
+            int status, uint64_t bytes, uint64_t start_us) {
+
+        Log_Ring *ring = _reserve();
+        if (ring == NULL) return;
+
+        Log_Record &rec = ring->records[ring->head.load(std::memory_order_relaxed) & (LOG_RING_RECORDS - 1)];
+        rec.time_us = now_us();
+        rec.value = bytes;
+        rec.message = NULL;
+        rec.peer_ip = peer_ip;
+        rec.duration_us = start_us > 0 && rec.time_us > start_us ? rec.time_us - start_us : 0;
+        rec.err = 0;
+        rec.type = LRT_ACCESS;
+        rec.status = status;
+        _copy(rec.method, sizeof(rec.method), method);
+        _copy(rec.url, sizeof(rec.url), url);
+        _publish(ring);
+    }
+
+    // 错误日志，message必须是字符串常量（记录中只保存指针）
+    static void error(const char *message, int err = 0, uint64_t value = 0) {
+        _event(LRT_ERROR, message, err, value);
+    }
+
+    static void info(const char *message, uint64_t value = 0) {
+        _event(LRT_INFO, message, 0, value);
+    }
+
+private:
+    static inline Log_File _access;
+    static inline Log_File _error;
+    static inline bool _access_enabled = false;
+    static inline ChildLoad *_load = NULL;
+    static inline int _flush_interval_ms = 50;
+    static inline size_t _rotate_bytes = 0;
+    static inline int _rotate_keep = 0;
+    static inline int64_t _wall_offset_us = 0;
+
+    static inline pthread_t _thread;
+    static inline std::atomic<bool> _running{false};
+    static inline std::atomic<bool> _stop{false};
+
+    static inline std::atomic<Log_Ring*> _rings[LOG_MAX_THREADS];
+    static inline Locker _rings_locker;
+    static inline std::atomic<uint64_t> _unowned_dropped{0};   // 没有领到缓冲区的线程丢弃的记录
+
+    static inline thread_local Log_Ring_Owner _owner;
+
+    static void _event(LOG_RECORD_TYPE type, const char *message, int err, uint64_t value) {
+
+        if (!_running.load(std::memory_order_acquire)) {
+            if (_wall_offset_us == 0) _init_wall_offset();
+            char line[LOG_LINE_MAX];
+            Log_Record rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.time_us = now_us();
+            rec.type = type;
+            rec.message = message;
+            rec.err = err;
+            rec.value = value;
+            int n = _format(rec, line);
+            fwrite(line, 1, n, stdout);
+            fflush(stdout);
+            return;
+        }
+
+        Log_Ring *ring = _reserve();
+        if (ring == NULL) return;
+
+        Log_Record &rec = ring->records[ring->head.load(std::memory_order_relaxed) & (LOG_RING_RECORDS - 1)];
+        rec.time_us = now_us();
+        rec.value = value;
+        rec.message = message;
+        rec.peer_ip = 0;
+        rec.duration_us = 0;
+        rec.err = err;
+        rec.type = type;
+        rec.status = 0;
+        _publish(ring);
+    }
+
+    // 单调时钟和墙上时间的差：记录只取单调时钟，格式化时再换算
+    static void _init_wall_offset() {
+        timespec real;
+        clock_gettime(CLOCK_REALTIME, &real);
+        _wall_offset_us = (int64_t)real.tv_sec * 1000000 + real.tv_nsec / 1000 - (int64_t)now_us();
+    }
+
+    // 取得本线程的缓冲区中下一个空位，缓冲区已满时返回NULL并计数
+    static Log_Ring *_reserve() {
+
+        Log_Ring *ring = _owner.ring;
+        if (ring == NULL) {
+            ring = _claim_ring();
+            if (ring == NULL) {
+                _unowned_dropped.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+        }
+
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->cached_tail >= LOG_RING_RECORDS) {
+            ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+            if (head - ring->cached_tail >= LOG_RING_RECORDS) {
+                ring->dropped.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+        }
+        return ring;
+    }
+
+    static void _publish(Log_Ring *ring) {
+        ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // 领取一个没有线程使用的缓冲区（每个线程只在第一次写日志时调用）
+    static Log_Ring *_claim_ring() {
+
+        _rings_locker.lock();
+        Log_Ring *claimed = NULL;
+        for (int i = 0; i < LOG_MAX_THREADS && claimed == NULL; ++i) {
+            Log_Ring *ring = _rings[i].load(std::memory_order_acquire);
+            if (ring == NULL) {
+                ring = new Log_Ring();
+                ring->owned.store(true);
+                _rings[i].store(ring, std::memory_order_release);
+                claimed = ring;
+            }else if (!ring->owned.load(std::memory_order_acquire)) {
+                ring->owned.store(true);
+                claimed = ring;
+            }
+        }
+        _rings_locker.unlock();
+
+        _owner.ring = claimed;
+        return claimed;
+    }
+
+    static void _copy(char *dst, size_t cap, const std::string &src) {
+        size_t n = src.size() < cap - 1 ? src.size() : cap - 1;
+        memcpy(dst, src.data(), n);
+        dst[n] = '\0';
+    }
+
+    // 后台线程：周期性地写出全部缓冲区，退出前再写一次
+    static void *_flush_routine(void *) {
+
+        while (!_stop.load()) {
+            _flush();
+            timespec ts = {_flush_interval_ms / 1000, (_flush_interval_ms % 1000) * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+        _flush();
+        return NULL;
+    }
+
+    static void _flush() {
+
+        // 一轮写不下时继续，直到缓冲区都读空
+        while (_drain_rings()) {}
+
+        _rotate_if_needed(_access);
+        _rotate_if_needed(_error);
+    }
+
+    // 格式化各缓冲区中的记录，每个文件一次writev；返回是否还有没读完的记录
+    static bool _drain_rings() {
+
+        bool more = false;
+        uint64_t dropped = _unowned_dropped.exchange(0, std::memory_order_relaxed);
+
+        for (int i = 0; i < LOG_MAX_THREADS; ++i) {
+            Log_Ring *ring = _rings[i].load(std::memory_order_acquire);
+            if (ring == NULL) break;
+
+            size_t access_begin = _access.used, error_begin = _error.used;
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail < head; ++tail) {
+                const Log_Record &rec = ring->records[tail & (LOG_RING_RECORDS - 1)];
+                Log_File &file = rec.type == LRT_ACCESS ? _access : _error;
+                if (file.used + LOG_LINE_MAX > LOG_FORMAT_BUF) {
+                    more = true;
+                    break;
+                }
+                if (file.fd < 0) continue;
+                file.used += _format(rec, file.buf + file.used);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            _add_segment(_access, access_begin);
+            _add_segment(_error, error_begin);
+
+            uint64_t ring_dropped = ring->dropped.load(std::memory_order_relaxed);
+            dropped += ring_dropped - ring->dropped_reported;
+            ring->dropped_reported = ring_dropped;
+        }
+
+        if (dropped > 0) {
+            if (_load) _load->log_dropped.fetch_add(dropped, std::memory_order_relaxed);
+            if (_error.used + LOG_LINE_MAX <= LOG_FORMAT_BUF) {
+                Log_Record rec;
+                memset(&rec, 0, sizeof(rec));
+                rec.time_us = now_us();
+                rec.type = LRT_ERROR;
+                rec.message = "log buffers full, records dropped:";
+                rec.value = dropped;
+                size_t begin = _error.used;
+                _error.used += _format(rec, _error.buf + _error.used);
+                _add_segment(_error, begin);
+            }
+        }
+
+        _write(_access);
+        _write(_error);
+        return more;
+    }
+
+    static void _add_segment(Log_File &file, size_t begin) {
+        if (file.used == begin) return;
+        file.iov[file.iovcnt].iov_base = file.buf + begin;
+        file.iov[file.iovcnt++].iov_len = file.used - begin;
+    }
+
+    // 日志尽力而为：写入失败或只写了一部分时不重试
+    static void _write(Log_File &file) {
+        if (file.iovcnt > 0 && file.fd >= 0) {
+            ssize_t ret = writev(file.fd, file.iov, file.iovcnt);
+            (void)ret;
+        }
+        file.iovcnt = 0;
+        file.used = 0;
+    }
+
+    // 访问日志：2026-01-01T08:00:00.123Z 10.0.0.1 "GET /index.html" 200 1234 85us
+    // 错误日志：2026-01-01T08:00:00.123Z [error] accept4() failed errno=24 (Too many open files)
+    // 一行最多LOG_LINE_MAX - 1字节，过长时截断，截断的行仍以换行结尾
+    static int _format(const Log_Record &rec, char *out) {
+
+        int64_t wall_us = (int64_t)rec.time_us + _wall_offset_us;
+        time_t sec = wall_us / 1000000;
+        tm t;
+        gmtime_r(&sec, &t);
+        int n = strftime(out, 32, "%Y-%m-%dT%H:%M:%S", &t);
+        _append(out, n, ".%03dZ ", (int)(wall_us % 1000000 / 1000));
+
+        if (rec.type == LRT_ACCESS) {
+            const uint8_t *ip = (const uint8_t *)&rec.peer_ip;
+            _append(out, n, "%u.%u.%u.%u \"%s %s\" %u %llu %uus\n", \
+                ip[0], ip[1], ip[2], ip[3], rec.method, rec.url, rec.status, \
+                (unsigned long long)rec.value, rec.duration_us);
+        }else {
+            _append(out, n, "[%s] %s", \
+                rec.type == LRT_ERROR ? "error" : "info", rec.message ? rec.message : "");
+            if (rec.value != 0) {
+                _append(out, n, " %llu", (unsigned long long)rec.value);
+            }
+            if (rec.err != 0) {
+                char buf[64];
+                _append(out, n, " errno=%d (%s)", rec.err, strerror_r(rec.err, buf, sizeof(buf)));
+            }
+            _append(out, n, "\n");
+        }
+        if (out[n - 1] != '\n') out[n - 1] = '\n';
+        return n;
+    }
+
+    // 在out + n处追加；snprintf返回的是不截断时的长度，n要限制在LOG_LINE_MAX - 1以内，
+    // 否则下一次的LOG_LINE_MAX - n会变成负数（转为size_t后是一个很大的长度）
+    [[gnu::format(printf, 3, 4)]]
+    static void _append(char *out, int &n, const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        int ret = vsnprintf(out + n, LOG_LINE_MAX - n, fmt, args);
+        va_end(args);
+        if (ret > 0) n = n + ret < LOG_LINE_MAX - 1 ? n + ret : LOG_LINE_MAX - 1;
+    }
+
+    static bool _open(Log_File &file) {
+        file.fd = open(file.path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (file.fd < 0) {
+            std::cout << "open log " << file.path << " failed, errno: " << errno << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static void _reopen(Log_File &file) {
+        int old = file.fd;
+        if (_open(file)) {
+            close(old);
+        }else {
+            file.fd = old;
+        }
+    }
+
+    // 文件过大时轮转：path.(N-1) -> path.N ... path -> path.1，然后重新打开path
+    static void _rotate_if_needed(Log_File &file) {
+
+        if (file.path.empty() || file.fd < 0 || _rotate_bytes == 0) return;
+
+        struct stat by_fd, by_path;
+        if (fstat(file.fd, &by_fd) != 0) return;
+        if (stat(file.path.c_str(), &by_path) != 0 || by_path.st_ino != by_fd.st_ino) {
+            // 其他子进程已经完成了轮转
+            _reopen(file);
+            return;
+        }
+        if ((size_t)by_fd.st_size < _rotate_bytes) return;
+
+        // 拿不到锁说明另一个子进程正在轮转，下一次再检查
+        if (flock(file.fd, LOCK_EX | LOCK_NB) != 0) return;
+        if (stat(file.path.c_str(), &by_path) == 0 && by_path.st_ino == by_fd.st_ino) {
+            for (int i = _rotate_keep; i > 1; --i) {
+                rename((file.path + "." + std::to_string(i - 1)).c_str(), \
+                    (file.path + "." + std::to_string(i)).c_str());
+            }
+            if (_rotate_keep > 0) {
+                rename(file.path.c_str(), (file.path + ".1").c_str());
+            }else {
+                unlink(file.path.c_str());
+            }
+        }
+        flock(file.fd, LOCK_UN);
+        _reopen(file);
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+/**
+ * desc: 跟踪chunked编码的消息体在哪里结束
+ *      反向代理把上游的响应原样转发给客户端，只需要判断边界；
+ *      接收请求体时处于CT_DATA的字节是块数据，其余是分块的格式
+ */
+struct Chunk_Tracker {
+    enum STATE {
+        CT_SIZE = 0, CT_EXT, CT_SIZE_LF, CT_DATA, CT_DATA_CR, CT_DATA_LF,
+        CT_TRAILER_START, CT_TRAILER_LINE, CT_FINAL_LF, CT_DONE, CT_BAD
+    };
+    STATE state = CT_SIZE;
+    uint64_t size = 0;      // 当前块剩余的字节数
+    bool digits = false;    // 块大小行中是否已有十六进制数字
+
+    void reset() {
+        state = CT_SIZE;
+        size = 0;
+        digits = false;
+    }
+
+    bool done() const { return state == CT_DONE; }
+    bool bad() const { return state == CT_BAD; }
+
+    // 处理n个字节，返回属于响应体的字节数（在结束处停止）
+    size_t feed(const char *p, size_t n) {
+
+        size_t i = 0;
+        while (i < n && state != CT_DONE && state != CT_BAD) {
+            char c = p[i];
+            switch (state) {
+                case CT_SIZE: {
+                    int v = _hex(c);
+                    if (v >= 0) {
+                        if (size >> 59) { state = CT_BAD; break; }
+                        size = size * 16 + v;
+                        digits = true;
+                    }else if (c == ';' || c == ' ' || c == '\t') {
+                        state = CT_EXT;
+                    }else if (c == '\r') {
+                        state = CT_SIZE_LF;
+                    }else {
+                        state = CT_BAD;
+                    }
+                    ++i;
+                    break;
+                }
+                case CT_EXT:
+                    if (c == '\r') state = CT_SIZE_LF;
+                    ++i;
+                    break;
+                case CT_SIZE_LF:
+                    // 没有数字的块大小行（如单独的"\r\n"）不是最后一块
+                    state = c != '\n' || !digits ? CT_BAD : size == 0 ? CT_TRAILER_START : CT_DATA;
+                    ++i;
+                    break;
+                case CT_DATA: {
+                    uint64_t take = std::min<uint64_t>(size, n - i);
+                    size -= take;
+                    i += take;
+                    if (size == 0) state = CT_DATA_CR;
+                    break;
+                }
+                case CT_DATA_CR:
+                    state = c == '\r' ? CT_DATA_LF : CT_BAD;
+                    ++i;
+                    break;
+                case CT_DATA_LF:
+                    state = c == '\n' ? CT_SIZE : CT_BAD;
+                    digits = false;
+                    ++i;
+                    break;
+                case CT_TRAILER_START:
+                    state = c == '\r' ? CT_FINAL_LF : CT_TRAILER_LINE;
+                    ++i;
+                    break;
+                case CT_TRAILER_LINE:
+                    if (c == '\n') state = CT_TRAILER_START;
+                    ++i;
+                    break;
+                case CT_FINAL_LF:
+                    state = c == '\n' ? CT_DONE : CT_BAD;
+                    ++i;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return i;
+    }
+
+private:
+    static int _hex(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+};
@@ -3,48 +3,218 @@
 #include <vector>
 #include <memory.h>
 #include <string>
+#include <atomic>
 #include "http_request_parser.h"
 #include "http_response_sender.h"
+#include "write_policy.h"
+#include "reverse_proxy.h"
+#include "http2.h"
+#include "tls.h"
+#include "websocket.h"
+#include "coroutine.h"
+#include "request_body.h"
 
 #define READ_BUF_SZ 1024
 #define WRITE_BUF_SZ 2048
+#define CONN_REQUEST_CACHE 64   // 每个线程最多缓存的空闲请求对象
 
+/**
+ * desc: 连接上正在处理的请求（冷数据）：读缓冲区、请求解析器和响应生成器
+ *      连接收到数据时取得，请求处理完且缓冲区中没有剩余数据时归还（请求体同时删除），
+ *      空闲的长连接只剩下ClientData本身（以及TLS连接的SSL对象、代理过的连接的Proxy_Session）
+ */
+struct Conn_Request {
+    explicit Conn_Request(const std::vector<std::string> &content_types): \
+        types(&content_types), hrs(content_types) {
+        readbuf[0] = '\0';
+    }
+
+    const std::vector<std::string> *types;  // 构造hrs所用的（共享的）content-type表
+    Conn_Request *next = NULL;              // 空闲链表
+    char readbuf[READ_BUF_SZ];              // 用于接收recv的数据
+    Http_Request_Parser hrp;
+    Http_Response_Sender hrs;
+};
+
+// 一个线程的空闲请求对象，线程退出时释放
+struct Conn_Request_Free_List {
+    Conn_Request *head = NULL;
+    int count = 0;
+
+    ~Conn_Request_Free_List() {
+        while (head != NULL) {
+            Conn_Request *req = head;
+            head = req->next;
+            delete req;
+        }
+    }
+};
+
+/**
+ * desc: 请求对象的缓存
+ *      每个线程一个空闲链表（线程退出时释放），稳态下取得/归还请求对象不需要malloc
+ *      由reactor归还（关闭连接）的对象进入reactor线程的链表，数量受CONN_REQUEST_CACHE限制
+ *      live统计本进程当前取出的对象数，写到负载表中
+ */
+class Conn_Request_Pool final {
+public:
+    static Conn_Request *acquire(const std::vector<std::string> &content_types) {
+
+        if (_live) _live->fetch_add(1, std::memory_order_relaxed);
+        Conn_Request_Free_List &list = _free;
+        while (list.head != NULL) {
+            Conn_Request *req = list.head;
+            list.head = req->next;
+            --list.count;
+            if (req->types == &content_types) return req;
+            delete req;
+        }
+        return new Conn_Request(content_types);
+    }
+
+    static void release(Conn_Request *req) {
+
+        if (_live) _live->fetch_sub(1, std::memory_order_relaxed);
+        Conn_Request_Free_List &list = _free;
+        if (list.count >= CONN_REQUEST_CACHE) {
+            delete req;
+            return;
+        }
+        req->hrs.clear_data();
+        req->hrp.reset();
+        req->readbuf[0] = '\0';
+        req->next = list.head;
+        list.head = req;
+        ++list.count;
+    }
+
+    // 子进程开始服务前设置
+    static void set_live_counter(std::atomic<int> *live) {
+        _live = live;
+    }
+
+private:
+    static inline thread_local Conn_Request_Free_List _free;
+    static inline std::atomic<int> *_live = NULL;
+};
+
+/**
+ * desc: 一个连接的状态（热数据）
+ *      表项按fd预先分配，只保存连接本身的状态和各种会话的指针；
+ *      请求相关的数据在Conn_Request中，用hrp()/hrs()访问（没有时取得一个）
+ */
 struct ClientData {
     // constructor
-    ClientData(int clientfd = -1, const std::vector<std::string> &_support_content_type): _read_buf_end_idx(0),\
-             _send_buf_end_idx(0), _clientfd(clientfd), \ 
-             _should_close(false),  hrs(_support_content_type){
+    // content-type表由全部连接共享，必须在连接表之前构造、之后析构
+    ClientData(int clientfd = -1, const std::vector<std::string> &_support_content_type = no_content_types()): \
+        _should_close(false), _clientfd(clientfd), _content_types(&_support_content_type) {
 
-        memset(_readbuf, 0, sizeof(_readbuf));
     }
 
     // copy constructor
-    ClientData(const ClientData& rhs): hrs(rhs.hrs) {
-        memcpy(_readbuf, rhs._readbuf, strlen(rhs._readbuf));
-        _read_buf_end_idx = rhs._read_buf_end_idx;
-        _send_buf_end_idx = rhs._send_buf_end_idx;
-        _should_close = rhs._should_close;
-        _clientfd = rhs._clientfd;
-        //TODO:
-        // Http_Request_Parser的拷贝构造和析构
-        // Http_Response_Sender的拷贝构造和析构
+    // 只拷贝连接本身，正在处理的请求不拷贝
+    ClientData(const ClientData& rhs): _should_close(rhs._should_close), \
+        _clientfd(rhs._clientfd), _content_types(rhs._content_types) {
+
     }
 
     // destructor
     ~ClientData() {
-        memset(_readbuf, 0, sizeof(_readbuf));
-        _read_buf_end_idx = 0;
+        delete _proxy.load();
+        delete _h2.load();
+        delete _ws.load();
+        delete _tls;
+        _co.destroy();
+        release_request();
         _send_buf_end_idx = 0;
         _should_close = false;
         _clientfd = -1;
     }
-    char _readbuf[READ_BUF_SZ]; // 用于接收recv的数据
+
+    // 内存统计：每个空闲连接/请求对象的字节数，当前取出的请求对象数写到live_requests
+    // tls_conn_bytes为实测的空闲TLS连接的字节数（没有TLS时为0）
+    static void track_memory(ChildLoad &load, size_t tls_conn_bytes) {
+        load.idle_conn_bytes.store(sizeof(ClientData) + tls_conn_bytes);
+        load.proxy_conn_bytes.store(sizeof(Proxy_Session));
+        load.request_bytes.store(sizeof(Conn_Request));
+        Conn_Request_Pool::set_live_counter(&load.live_requests);
+    }
+
+    static const std::vector<std::string> &no_content_types() {
+        static const std::vector<std::string> types;
+        return types;
+    }
+
+    // 当前请求的解析器/响应生成器，没有请求对象时取得一个
+    Http_Request_Parser &hrp() { return request().hrp; }
+    Http_Response_Sender &hrs() { return request().hrs; }
+
+    Conn_Request &request() {
+        if (_req == NULL) {
+            _req = Conn_Request_Pool::acquire(*_content_types);
+            _readbuf = _req->readbuf;
+        }
+        return *_req;
+    }
+
+    bool has_request() const {
+        return _req != NULL;
+    }
+
+    // 归还请求对象（请求处理完且_readbuf中没有剩余数据，或连接关闭）
+    // 请求体（调用者已经reset）一起删除：空闲的长连接不占用它
+    void release_request() {
+        delete _body;
+        _body = NULL;
+        if (_req == NULL) return;
+        Conn_Request_Pool::release(_req);
+        _req = NULL;
+        _readbuf = NULL;
+        _read_buf_end_idx = 0;
+    }
+
     int _read_buf_end_idx = 0;  // _readbuf的有效字符个数
     int _send_buf_end_idx = 0;  // 发送response buf的起点
     bool _should_close;         // 当前用户是否需要关闭
     int _clientfd;              // 当前用户的clientfd
+    uint32_t _peer_ip = 0;      // 对端IPv4地址（网络字节序），用于限流
+    int _head_match = 0;        // 已匹配的首部结束标记"\r\n\r\n"的字节数（可能跨越两次读取）
+    int _head_bytes = 0;        // 当前请求已收到的首部字节数
+    uint64_t _request_start_us = 0; // 解析完当前请求的时间（访问日志）
 
-    // 将HTTP数据处理和客户数据绑定在一起是比较好的解决方案，解决了很多问题
-    Http_Request_Parser hrp;    
-    Http_Response_Sender hrs;
-};
\ No newline at end of file
+    // 边缘触发模式下的就绪状态：reactor置位，工作线程在读写之前清除
+    std::atomic<bool> _readable{false};
+    std::atomic<bool> _writable{false};
+    std::atomic<bool> _scheduled{false};    // 是否已有该连接的任务在排队或正在处理
+
+    Write_State _write_state;   // TCP_CORK/零拷贝等写路径状态
+
+    // 读缓冲区：指向_req中的缓冲区，没有请求对象时为NULL
+    char *_readbuf = NULL;
+    Conn_Request *_req = NULL;
+    const std::vector<std::string> *_content_types;
+
+    // 反向代理：连接第一次被代理时创建，之后的请求复用，连接关闭时（reactor中）删除；不拷贝
+    std::atomic<Proxy_Session*> _proxy{NULL};
+
+    // 是否有正在进行的代理请求
+    bool _proxying() const {
+        Proxy_Session *s = _proxy.load(std::memory_order_acquire);
+        return s != NULL && s->active.load();
+    }
+
+    // TLS：accept时由reactor创建，连接关闭时删除；明文连接为NULL
+    Tls_Conn *_tls = NULL;
+
+    // HTTP/2：连接升级（或以序言开始）后创建，连接关闭时删除
+    std::atomic<H2_Session*> _h2{NULL};
+
+    // WebSocket：握手成功后创建，连接关闭时删除
+    std::atomic<Ws_Session*> _ws{NULL};
+
+    // 请求体：收到带请求体的请求时创建，pipelining的下一个请求复用，归还请求对象时删除
+    Request_Body *_body = NULL;
+
+    // 协程处理的HTTP/1.1连接：请求到来时创建协程，连接空闲、交给代理/HTTP/2/WebSocket或连接关闭时销毁
+    Co_Conn _co;
+};
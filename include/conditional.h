@@ -0,0 +1,110 @@
+#pragma once
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+
+#define HTTP_DATE_LEN 29    // "Sun, 06 Nov 1994 08:49:37 GMT"
+
+/**
+ * desc: 条件请求（If-None-Match / If-Modified-Since）的判断
+ *      If-None-Match按弱比较（忽略W/前缀），支持列表和"*"；
+ *      同时出现时只看If-None-Match（RFC 9110 13.2.2）
+ *      HTTP日期只接受IMF-fixdate，手工解析，不依赖locale
+ */
+class Conditional_Util final {
+public:
+    // 请求的验证器与资源一致：可以回复304
+    static bool not_modified(const std::string *if_none_match, const std::string *if_modified_since, \
+            const std::string &etag, time_t mtime) {
+
+        if (if_none_match != NULL) return etag_match(*if_none_match, etag);
+        if (if_modified_since == NULL) return false;
+        time_t since = parse_http_date(if_modified_since->c_str());
+        return since >= 0 && mtime <= since;
+    }
+
+    // If-None-Match的值中是否有etag（弱比较）
+    static bool etag_match(const std::string &list, const std::string &etag) {
+
+        const char *target = _opaque(etag.c_str());
+        size_t target_len = etag.c_str() + etag.size() - target;
+
+        const char *p = list.c_str();
+        while (*p) {
+            while (*p == ' ' || *p == '\t' || *p == ',') ++p;
+            if (*p == '*') return true;
+            if (*p == '\0') break;
+
+            const char *start = _opaque(p);
+            if (*start != '"') return false;    // 格式错误：当作不匹配
+            const char *end = strchr(start + 1, '"');
+            if (end == NULL) return false;
+            ++end;
+            if ((size_t)(end - start) == target_len && memcmp(start, target, target_len) == 0) return true;
+            p = end;
+        }
+        return false;
+    }
+
+    // IMF-fixdate，无效返回-1
+    static time_t parse_http_date(const char *s) {
+
+        static const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        if (strlen(s) < HTTP_DATE_LEN || s[3] != ',' || memcmp(s + 25, " GMT", 4) != 0) return -1;
+
+        int month = -1;
+        for (int m = 0; m < 12; ++m) {
+            if (memcmp(s + 8, MONTHS + m * 3, 3) == 0) month = m;
+        }
+        int day = _digits(s + 5, 2), year = _digits(s + 12, 4);
+        int hour = _digits(s + 17, 2), minute = _digits(s + 20, 2), second = _digits(s + 23, 2);
+        if (month < 0 || day < 1 || year < 1970 || hour < 0 || minute < 0 || second < 0) return -1;
+
+        tm t;
+        memset(&t, 0, sizeof(t));
+        t.tm_year = year - 1900;
+        t.tm_mon = month;
+        t.tm_mday = day;
+        t.tm_hour = hour;
+        t.tm_min = minute;
+        t.tm_sec = second;
+        return timegm(&t);
+    }
+
+    // 写出IMF-fixdate（HTTP_DATE_LEN个字符和'\0'）
+    static void format_http_date(time_t t, char out[HTTP_DATE_LEN + 1]) {
+        tm g;
+        gmtime_r(&t, &g);
+        strftime(out, HTTP_DATE_LEN + 1, "%a, %d %b %Y %H:%M:%S GMT", &g);
+    }
+
+    // 当前时间的HTTP日期，每个线程每秒格式化一次
+    static const char *date_now() {
+        thread_local time_t last = -1;
+        thread_local char buf[HTTP_DATE_LEN + 1];
+        time_t now = time(NULL);
+        if (now != last) {
+            format_http_date(now, buf);
+            last = now;
+        }
+        return buf;
+    }
+
+private:
+    // 跳过弱验证器的"W/"
+    static const char *_opaque(const char *p) {
+        return p[0] == 'W' && p[1] == '/' ? p + 2 : p;
+    }
+
+    static int _digits(const char *p, int n) {
+        int v = 0;
+        for (int i = 0; i < n; ++i) {
+            if (p[i] < '0' || p[i] > '9') return -1;
+            v = v * 10 + (p[i] - '0');
+        }
+        return v;
+    }
+};
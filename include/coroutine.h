@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <exception>
+#include <new>
+#include "write_policy.h"
+
+// 编译器支持C++20协程时才能使用协程处理连接，否则coroutine_handler配置不生效
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define CO_SUPPORTED 1
+#else
+#define CO_SUPPORTED 0
+#endif
+
+#define CO_FRAME_BLOCK 1024     // 池中每块的大小，更大的协程帧直接使用operator new
+#define CO_FRAME_CACHE 256      // 每个线程最多缓存的空闲块数
+
+#if CO_SUPPORTED
+
+// 一个线程的空闲协程帧，线程退出时释放
+struct Co_Frame_Free_List {
+    struct Block {
+        Block *next;
+    };
+
+    Block *head = NULL;
+    int count = 0;
+
+    ~Co_Frame_Free_List() {
+        while (head != NULL) {
+            Block *block = head;
+            head = block->next;
+            ::operator delete(block);
+        }
+    }
+};
+
+/**
+ * desc: 协程帧的内存池
+ *      每个线程一个空闲链表（线程退出时释放）：协程帧在工作线程中分配，连接结束时释放回当前线程，
+ *      稳态下处理请求不需要调用malloc
+ *      连接被reactor关闭时帧释放到reactor线程的链表中，数量受CO_FRAME_CACHE限制
+ */
+class Co_Frame_Pool final {
+public:
+    static void *allocate(size_t size) {
+
+        if (size > CO_FRAME_BLOCK) return ::operator new(size);
+        Co_Frame_Free_List &list = _free;
+        if (list.head != NULL) {
+            Co_Frame_Free_List::Block *block = list.head;
+            list.head = block->next;
+            --list.count;
+            return block;
+        }
+        return ::operator new(CO_FRAME_BLOCK);
+    }
+
+    static void release(void *p, size_t size) {
+
+        Co_Frame_Free_List &list = _free;
+        if (size > CO_FRAME_BLOCK || list.count >= CO_FRAME_CACHE) {
+            ::operator delete(p);
+            return;
+        }
+        Co_Frame_Free_List::Block *block = (Co_Frame_Free_List::Block *)p;
+        block->next = list.head;
+        list.head = block;
+        ++list.count;
+    }
+
+private:
+    static inline thread_local Co_Frame_Free_List _free;
+};
+
+/**
+ * desc: 处理一个连接的协程
+ *      创建后先挂起，由Co_Conn::start在工作线程中开始执行；
+ *      结束时也挂起，由工作线程取得co_return的值后销毁
+ */
+struct Co_Task {
+    struct promise_type {
+        int result = 0;
+
+        static void *operator new(size_t size) {
+            return Co_Frame_Pool::allocate(size);
+        }
+        static void operator delete(void *p, size_t size) {
+            Co_Frame_Pool::release(p, size);
+        }
+
+        Co_Task get_return_object() {
+            return Co_Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(int value) { result = value; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif
+
+/**
+ * desc: 协程处理的连接在ClientData上的状态
+ *      EPOLLONESHOT模式下同一连接同时只有一个工作线程，协程挂起后由工作线程按want
+ *      重新注册事件，下一个事件（可能在另一个线程中）再恢复它：
+ *          co_await conn.read(fn)      fn读取数据，返回IOS_AGAIN表示还没有读到
+ *          co_await conn.write_all(fn) fn发送数据，返回IOS_AGAIN表示还没有发完
+ *          co_await conn.wait(ev)      只等待事件
+ *      read/write_all先直接尝试，遇到EAGAIN才挂起；之后每次事件到来先由工作线程
+ *      重试fn，仍然EAGAIN时不恢复协程，完成（或出错）后才恢复
+ */
+struct Co_Conn {
+    void *frame = NULL;                     // 协程帧（coroutine_handle::address），NULL表示没有协程
+    uint32_t want = 0;                      // 挂起时等待的事件
+    IO_STATUS (*retry)(void *) = NULL;      // 等待中的I/O
+    void *retry_ctx = NULL;
+
+    bool active() const {
+        return frame != NULL;
+    }
+
+#if CO_SUPPORTED
+    template<typename Io_Fn>
+    struct Io_Awaiter {
+        Co_Conn &conn;
+        Io_Fn &fn;
+        uint32_t events;
+        IO_STATUS status;
+
+        bool await_ready() {
+            status = fn();
+            return status != IOS_AGAIN;
+        }
+        void await_suspend(std::coroutine_handle<>) {
+            conn.want = events;
+            conn.retry = &Io_Awaiter::_retry;
+            conn.retry_ctx = this;
+        }
+        IO_STATUS await_resume() {
+            return status;
+        }
+
+        static IO_STATUS _retry(void *self) {
+            Io_Awaiter *awaiter = (Io_Awaiter *)self;
+            awaiter->status = awaiter->fn();
+            return awaiter->status;
+        }
+    };
+
+    struct Event_Awaiter {
+        Co_Conn &conn;
+        uint32_t events;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<>) {
+            conn.want = events;
+            conn.retry = NULL;
+        }
+        void await_resume() {}
+    };
+
+    template<typename Io_Fn>
+    Io_Awaiter<Io_Fn> read(Io_Fn &fn) {
+        return Io_Awaiter<Io_Fn>{*this, fn, EPOLLIN, IOS_AGAIN};
+    }
+
+    template<typename Io_Fn>
+    Io_Awaiter<Io_Fn> write_all(Io_Fn &fn) {
+        return Io_Awaiter<Io_Fn>{*this, fn, EPOLLOUT, IOS_AGAIN};
+    }
+
+    Event_Awaiter wait(uint32_t events) {
+        return Event_Awaiter{*this, events};
+    }
+
+    // 开始执行协程，返回协程是否已经结束
+    bool start(Co_Task task) {
+        frame = task.handle.address();
+        task.handle.resume();
+        return task.handle.done();
+    }
+
+    // 事件到来：先重试等待中的I/O，仍然EAGAIN时继续等待；返回协程是否已经结束
+    bool on_event() {
+        if (retry != NULL) {
+            if (retry(retry_ctx) == IOS_AGAIN) return false;
+            retry = NULL;
+        }
+        std::coroutine_handle<> handle = std::coroutine_handle<>::from_address(frame);
+        handle.resume();
+        return handle.done();
+    }
+
+    // 协程已结束：取得co_return的值并销毁协程帧
+    int finish() {
+        auto handle = std::coroutine_handle<Co_Task::promise_type>::from_address(frame);
+        int result = handle.promise().result;
+        destroy();
+        return result;
+    }
+#endif
+
+    // 销毁协程帧（连接关闭时，协程可能挂起在任意一次等待中）
+    void destroy() {
+#if CO_SUPPORTED
+        if (frame != NULL) std::coroutine_handle<>::from_address(frame).destroy();
+#endif
+        frame = NULL;
+        want = 0;
+        retry = NULL;
+        retry_ctx = NULL;
+    }
+};
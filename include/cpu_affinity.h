@@ -0,0 +1,236 @@
+#pragma once
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "server_config.h"
+
+#define NODE_SYSFS_DIR "/sys/devices/system/node"
+
+// 某个进程被分配到的位置
+struct Placement {
+    int node = -1;              // 所在NUMA节点，-1表示不绑定
+    std::vector<int> cpus;      // 可以运行的CPU集合，为空表示不绑定
+};
+
+/**
+ * desc: CPU/NUMA拓扑探测与亲和性设置
+ *      不依赖libnuma：拓扑从sysfs读取，内存策略直接走set_mempolicy系统调用
+ */
+class Cpu_Affinity final {
+public:
+    // 每个NUMA节点上当前进程允许使用的CPU
+    // 没有NUMA信息的机器视为只有一个节点
+    static std::vector<std::vector<int>> detect_topology() {
+
+        std::vector<int> allowed = _allowed_cpus();
+        std::vector<std::vector<int>> nodes;
+
+        DIR *dir = opendir(NODE_SYSFS_DIR);
+        if (dir != NULL) {
+            std::vector<int> node_ids;
+            dirent *ent;
+            while ((ent = readdir(dir)) != NULL) {
+                int id;
+                if (sscanf(ent->d_name, "node%d", &id) == 1) {
+                    node_ids.push_back(id);
+                }
+            }
+            closedir(dir);
+            std::sort(node_ids.begin(), node_ids.end());
+
+            for (int id : node_ids) {
+                std::ifstream in(std::string(NODE_SYSFS_DIR) + "/node" + \
+                    std::to_string(id) + "/cpulist");
+                std::string cpulist;
+                if (!std::getline(in, cpulist)) continue;
+
+                // 只保留当前进程允许使用的CPU（例如被cgroup/taskset限制时）
+                std::vector<int> cpus;
+                for (int cpu : _parse_cpulist(cpulist)) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (nodes.size() <= (size_t)id) nodes.resize(id + 1);
+                nodes[id] = cpus;
+            }
+        }
+
+        // 去掉没有可用CPU的节点（内存节点、被限制的节点）
+        // 注意：去掉之后下标不再等于节点号，因此节点号单独记录
+        _node_ids.clear();
+        std::vector<std::vector<int>> result;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!nodes[i].empty()) {
+                _node_ids.push_back(i);
+                result.push_back(nodes[i]);
+            }
+        }
+
+        if (result.empty()) {
+            _node_ids.assign(1, 0);
+            result.push_back(allowed);
+        }
+        return result;
+    }
+
+    // 根据策略计算第proc_idx个子进程的位置
+    static Placement plan(const std::vector<std::vector<int>> &topology, \
+            PLACEMENT_POLICY policy, int proc_idx, int proc_num) {
+
+        Placement placement;
+        if (policy == PP_NONE || topology.empty()) return placement;
+
+        int node_num = topology.size();
+
+        switch (policy) {
+            case PP_COMPACT: {
+                // 将全部CPU按节点顺序排成一列，每个子进程取连续的一段
+                std::vector<std::pair<int, int>> flat;    // {cpu, node}
+                for (int n = 0; n < node_num; ++n) {
+                    for (int cpu : topology[n]) flat.push_back({cpu, n});
+                }
+                int per_proc = std::max<int>(1, flat.size() / proc_num);
+                int beg = (proc_idx * per_proc) % flat.size();
+                for (int i = 0; i < per_proc; ++i) {
+                    placement.cpus.push_back(flat[(beg + i) % flat.size()].first);
+                }
+                placement.node = flat[beg].second;
+                break;
+            }
+            case PP_SCATTER: {
+                // 子进程轮流落在各个节点上，同一节点上的子进程平分该节点的CPU
+                int n = proc_idx % node_num;
+                int slot = proc_idx / node_num;
+                int procs_on_node = proc_num / node_num + \
+                    (n < proc_num % node_num ? 1 : 0);
+                const std::vector<int> &cpus = topology[n];
+                int per_proc = std::max<int>(1, cpus.size() / procs_on_node);
+                int beg = (slot * per_proc) % cpus.size();
+                for (int i = 0; i < per_proc; ++i) {
+                    placement.cpus.push_back(cpus[(beg + i) % cpus.size()]);
+                }
+                placement.node = n;
+                break;
+            }
+            case PP_NUMA_NODE: {
+                int n = proc_idx % node_num;
+                placement.cpus = topology[n];
+                placement.node = n;
+                break;
+            }
+            default:
+                break;
+        }
+        return placement;
+    }
+
+    // 将当前进程（调用线程，之后创建的线程会继承）绑定到placement上
+    static bool apply_to_process(const Placement &placement, bool numa_local_memory) {
+
+        if (placement.cpus.empty()) return true;
+
+        cpu_set_t set;
+        _fill_cpu_set(placement.cpus, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            std::cout << "sched_setaffinity() failed, errno: " << errno << std::endl;
+            return false;
+        }
+
+        // 子进程之后分配的内存（客户信息表、缓冲区）优先落在本节点
+        // 用PREFERRED而不是BIND：本节点内存不足时允许退回到其他节点
+        if (numa_local_memory && placement.node >= 0) {
+            unsigned long nodemask = 1UL << node_id(placement.node);
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, \
+                    sizeof(nodemask) * 8) != 0) {
+                std::cout << "set_mempolicy() failed, errno: " << errno << std::endl;
+            }
+        }
+        return true;
+    }
+
+    // 将线程绑定到单个CPU
+    static bool apply_to_thread(pthread_t tid, int cpu) {
+
+        cpu_set_t set;
+        _fill_cpu_set(std::vector<int>(1, cpu), &set);
+        return pthread_setaffinity_np(tid, sizeof(set), &set) == 0;
+    }
+
+    // topology下标 -> 系统中的节点号
+    static int node_id(int idx) {
+        return (size_t)idx < _node_ids.size() ? _node_ids[idx] : idx;
+    }
+
+    // 启动时打印放置结果
+    static void report(int proc_idx, pid_t pid, const Placement &placement) {
+
+        std::ostringstream oss;
+        oss << "process " << proc_idx << " (pid " << pid << ") -> ";
+        if (placement.cpus.empty()) {
+            oss << "unbound";
+        }else {
+            oss << "node " << node_id(placement.node) << " cpus [";
+            for (size_t i = 0; i < placement.cpus.size(); ++i) {
+                oss << (i ? "," : "") << placement.cpus[i];
+            }
+            oss << "]";
+        }
+        std::cout << oss.str() << std::endl;
+    }
+
+private:
+    static inline std::vector<int> _node_ids;
+
+    // 当前进程允许运行的CPU
+    static std::vector<int> _allowed_cpus() {
+
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; ++i) {
+                if (CPU_ISSET(i, &set)) cpus.push_back(i);
+            }
+        }
+        if (cpus.empty()) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            for (long i = 0; i < n; ++i) cpus.push_back(i);
+        }
+        return cpus;
+    }
+
+    // 解析形如 "0-3,8-11" 的cpulist
+    static std::vector<int> _parse_cpulist(const std::string &cpulist) {
+
+        std::vector<int> cpus;
+        std::stringstream ss(cpulist);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            int lo, hi;
+            int n = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+            if (n == 1) hi = lo;
+            else if (n != 2) continue;
+            for (int cpu = lo; cpu <= hi; ++cpu) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    static void _fill_cpu_set(const std::vector<int> &cpus, cpu_set_t *set) {
+
+        CPU_ZERO(set);
+        for (int cpu : cpus) CPU_SET(cpu, set);
+    }
+};
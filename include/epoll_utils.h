@@ -17,12 +17,42 @@ public:
 
     static std::pair<epoll_event*, int> wait_for_events();
 
+    // 最多等待timeout_ms毫秒（用于需要定期检查状态的场合，如排空连接）
+    static std::pair<epoll_event*, int> wait_for_events(int timeout_ms) {
+        int len = epoll_wait(_epoll_fd, events, MAX_EVENT_NUMBER, timeout_ms);
+        return {events, len};
+    }
+
     // 创建内核事件表
     static void create();
 
     // 向内核事件表添加fd 及 监听事件
     static void addfd(int fd, bool oneshot = false);
 
+    // 以边缘触发方式注册连接：一次注册读写事件，之后不再修改
+    static void addfd_et(int fd) {
+        epoll_event event;
+        event.data.fd = fd;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    // 以EPOLLONESHOT方式注册fd的ev事件（反向代理的上游连接）
+    static void addfd_oneshot(int fd, int ev) {
+        epoll_event event;
+        event.data.fd = fd;
+        event.events = ev | EPOLLRDHUP | EPOLLONESHOT;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    // 重新注册addfd_oneshot注册过的fd
+    static void rearm_oneshot(int fd, int ev) {
+        epoll_event event;
+        event.data.fd = fd;
+        event.events = ev | EPOLLRDHUP | EPOLLONESHOT;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+
     // 从内核事件表中删除fd
     static void removefd(int fd);
 
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include "server_config.h"
+#include "utils.h"
+
+// 一个被预热（mmap并预读）的文件
+struct File_Entry {
+    char *addr = NULL;      // mmap的起始地址
+    size_t size = 0;        // 文件大小
+    time_t mtime = 0;       // 最后修改时间（用于Last-Modified/ETag）
+    ino_t ino = 0;
+    bool pinned = false;    // 是否已mlock
+
+    // 重新验证的状态（每个子进程各自一份）：文件被替换、截断或修改后，
+    // 该项被丢弃，之后的请求按未缓存的文件处理
+    mutable std::atomic<uint64_t> checked_us{0};    // 上次stat的时刻
+    mutable std::atomic<bool> stale{false};
+};
+
+// 预热结果
+struct Warmup_Report {
+    uint64_t elapsed_us = 0;
+    size_t files_seen = 0;      // 文档根目录下的普通文件数
+    size_t files_mapped = 0;    // 被mmap进缓存的文件数
+    size_t mapped_bytes = 0;
+    size_t resident_bytes = 0;  // 预热完成后实际驻留内存的字节数（mincore）
+    size_t pinned_bytes = 0;    // 被mlock的字节数
+};
+
+/**
+ * desc: 静态文件缓存
+ *      在父进程fork之前由warm_up()一次性填充，之后只读：
+ *      子进程继承全部映射（共享同一份page cache），各线程查找不需要加锁
+ *      缓存项至少每path_cache_ttl_ms验证一次（inode、mtime、大小），变化的项被丢弃，
+ *      其映射保留到进程退出（可能仍有响应在引用）
+ *      被mlock的页由父进程持有锁，子进程虽不继承mlock，但页同样常驻
+ */
+class File_Cache final {
+public:
+    static File_Cache &instance() {
+        static File_Cache cache;
+        return cache;
+    }
+
+    // 查找文件的绝对路径，不在缓存中（或已失效）返回NULL
+    // 距上次验证超过path_cache_ttl_ms时重新stat
+    const File_Entry *find(const std::string &path) const {
+
+        auto iter = _entries.find(path);
+        if (iter == _entries.end()) return NULL;
+
+        const File_Entry &entry = iter->second;
+        if (entry.stale.load(std::memory_order_relaxed)) return NULL;
+
+        uint64_t now = now_us();
+        if (now - entry.checked_us.load(std::memory_order_relaxed) >= _ttl_us) {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !_same_file(entry, st.st_ino, st.st_mtime, st.st_size)) {
+                entry.stale.store(true, std::memory_order_relaxed);
+                return NULL;
+            }
+            entry.checked_us.store(now, std::memory_order_relaxed);
+        }
+        return &entry;
+    }
+
+    // 路径解析已经stat过的文件：直接比较其验证器（解析结果本身每path_cache_ttl_ms刷新一次）
+    const File_Entry *find(const std::string &path, ino_t ino, time_t mtime, off_t size) const {
+
+        auto iter = _entries.find(path);
+        if (iter == _entries.end()) return NULL;
+
+        const File_Entry &entry = iter->second;
+        if (entry.stale.load(std::memory_order_relaxed)) return NULL;
+        if (!_same_file(entry, ino, mtime, size)) {
+            entry.stale.store(true, std::memory_order_relaxed);
+            return NULL;
+        }
+        return &entry;
+    }
+
+    size_t size() const { return _entries.size(); }
+
+    /**
+     * 遍历文档根目录，将不超过warmup_max_file_bytes的文件
+     * 按从小到大的顺序mmap(MAP_POPULATE)进缓存，直到总量达到warmup_budget_bytes
+     * （小文件优先：同样的内存能覆盖更多的请求）
+     */
+    Warmup_Report warm_up(const std::string &root, const ServerConfig &config) {
+
+        Warmup_Report report;
+        uint64_t beg = now_us();
+
+        // 1. 收集候选文件
+        _candidates.clear();
+        _files_seen = 0;
+        _max_file_bytes = config.warmup_max_file_bytes;
+        _ttl_us = (uint64_t)config.path_cache_ttl_ms * 1000;
+        if (nftw(root.c_str(), _visit, 64, FTW_PHYS) != 0) {
+            std::cout << "warm up: walk " << root << " failed, errno: " << errno << std::endl;
+        }
+        report.files_seen = _files_seen;
+
+        std::sort(_candidates.begin(), _candidates.end(), \
+            [](const Candidate &a, const Candidate &b) { return a.size < b.size; });
+
+        // 2. 在预算内映射并预读
+        bool mlock_failed = false;
+        for (const Candidate &cand : _candidates) {
+
+            if (report.mapped_bytes + cand.size > config.warmup_budget_bytes) break;
+            if (cand.size == 0) continue;
+
+            int fd = open(cand.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            void *addr = mmap(NULL, cand.size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED) continue;
+
+            File_Entry &entry = _entries[cand.path];
+            entry.addr = (char *)addr;
+            entry.size = cand.size;
+            entry.mtime = cand.mtime;
+            entry.ino = cand.ino;
+            entry.checked_us = now_us();
+
+            if (config.warmup_mlock && !mlock_failed) {
+                if (mlock(addr, cand.size) == 0) {
+                    entry.pinned = true;
+                    report.pinned_bytes += cand.size;
+                }else {
+                    // 通常是RLIMIT_MEMLOCK不够，之后的文件不再尝试
+                    std::cout << "warm up: mlock() failed, errno: " << errno << std::endl;
+                    mlock_failed = true;
+                }
+            }
+
+            report.resident_bytes += _resident_bytes(entry.addr, entry.size);
+            report.mapped_bytes += cand.size;
+            ++report.files_mapped;
+        }
+        _candidates.clear();
+        _candidates.shrink_to_fit();
+
+        report.elapsed_us = now_us() - beg;
+        std::cout << "warm up " << root << ": " << report.files_mapped << "/" \
+            << report.files_seen << " files, mapped " << report.mapped_bytes \
+            << " bytes, resident " << report.resident_bytes \
+            << " bytes, pinned " << report.pinned_bytes \
+            << " bytes, took " << report.elapsed_us / 1000 << "ms" << std::endl;
+        return report;
+    }
+
+private:
+    File_Cache() {}
+    File_Cache(const File_Cache &) = delete;
+    File_Cache &operator=(const File_Cache &) = delete;
+
+    struct Candidate {
+        std::string path;
+        size_t size;
+        time_t mtime;
+        ino_t ino;
+    };
+
+    std::unordered_map<std::string, File_Entry> _entries;
+    uint64_t _ttl_us = 0;
+
+    // nftw的回调没有用户参数，遍历期间的状态只能放在静态成员中
+    static inline std::vector<Candidate> _candidates;
+    static inline size_t _files_seen = 0;
+    static inline size_t _max_file_bytes = 0;
+
+    static int _visit(const char *path, const struct stat *st, int type, struct FTW *) {
+
+        if (type != FTW_F || !S_ISREG(st->st_mode)) return 0;
+
+        ++_files_seen;
+        if ((size_t)st->st_size <= _max_file_bytes) {
+            _candidates.push_back(Candidate{path, (size_t)st->st_size, st->st_mtime, st->st_ino});
+        }
+        return 0;
+    }
+
+    static bool _same_file(const File_Entry &entry, ino_t ino, time_t mtime, off_t size) {
+        return entry.ino == ino && entry.mtime == mtime && entry.size == (size_t)size;
+    }
+
+    // 统计映射中已经在内存中的字节数
+    static size_t _resident_bytes(char *addr, size_t size) {
+
+        long page = sysconf(_SC_PAGESIZE);
+        size_t pages = (size + page - 1) / page;
+        std::vector<unsigned char> vec(pages);
+        if (mincore(addr, size, vec.data()) != 0) return 0;
+
+        size_t resident = 0;
+        for (size_t i = 0; i < pages; ++i) {
+            if (vec[i] & 1) resident += page;
+        }
+        return std::min(resident, size);
+    }
+};
@@ -1,204 +1,194 @@
 #pragma once
 
-#include <iostream>
 #include <vector>
-#include <algorithm>
+#include <utility>
+#include <functional>
+#include <assert.h>
 #include <sys/types.h>
 
-template<typename DataType, typename Comparator = std::greater<int>>
+/**
+ * desc: 带索引的d叉堆（indexed priority queue）
+ *      - 每个元素由一个整数句柄(handle)标识，例如子进程在进程池中的下标、
+ *        连接的fd、定时器id等，句柄应尽量稠密（位置表按句柄直接寻址）
+ *      - 通过位置表 handle -> 堆中下标，修改优先级/删除都是O(log n)，
+ *        不再需要线性查找
+ *      - comparator(a, b)为true表示a应该在b的上面，默认std::less即小根堆
+ *      - Arity为每个节点的孩子数，默认4叉：树更矮，且同一节点的孩子
+ *        在内存中相邻，向下调整时一次比较的数据大多落在同一个cache line
+ */
+template<typename Priority, typename Comparator = std::less<Priority>, int Arity = 4>
 class Heap {
-    using const_reference = const DataType&;
-public:
-    Heap() { std::cout << "yes" << std::endl; }
-    void insert(DataType _elem) {
-
-        _elem_container.push_back(std::move(_elem));
+    static_assert(Arity >= 2, "heap arity must be at least 2");
 
-        _adjust_bottom_up(_elem_container.size() - 1);
-    }
+    struct Node {
+        Priority prio;
+        int handle;
+    };
+public:
+    using const_reference = const Priority&;
 
-    const_reference top() {
-        return _elem_container.front();
+    explicit Heap(int capacity = 0, Comparator _comparator = Comparator()):
+        comparator(_comparator) {
+        reserve(capacity);
     }
 
-    template<typename Predicate>
-    void modify(const_reference elem, Predicate pred) {
+    // 预分配句柄在[0, capacity)范围内的空间
+    void reserve(int capacity) {
 
-        auto iter = std::find_if(_elem_container.begin(), _elem_container.end(), pred);
-
-        if (iter == _elem_container.end()) return;
-
-        _adjust_top_down(iter - _elem_container.begin());
+        if (capacity > (int)_pos.size()) {
+            _pos.resize(capacity, NPOS);
+        }
+        _nodes.reserve(capacity);
     }
 
-private:
-    std::vector<DataType> _elem_container;
-    Comparator comparator;
-private:
-
-    // 自下而上的调整
-    void _adjust_bottom_up(int idx) {
+    int size() const { return _nodes.size(); }
+    bool empty() const { return _nodes.empty(); }
 
-        int root_idx = idx / 2;
-        while (idx != 0 && comparator(_elem_container[root_idx], _elem_container[idx])) {
-            std::swap(_elem_container[root_idx], _elem_container[idx]);
-            idx = root_idx;
-        }
+    bool contains(int handle) const {
+        return handle >= 0 && handle < (int)_pos.size() && _pos[handle] != NPOS;
     }
 
-    // 自上而下的调整
-    void _adjust_top_down(int idx) {
-
-        int target_idx = -1;
+    // 清空堆
+    void clear() {
 
-        while (idx < _elem_container.size()) {
+        for (const Node &node : _nodes) _pos[node.handle] = NPOS;
+        _nodes.clear();
+    }
 
-            int left_child_idx = (2 * idx < _elem_container.size() ?
-                2 * idx : -1);
-            int right_child_idx = (2 * idx + 1 < _elem_container.size() ?
-                2 * idx + 1 : -1);
+    // 插入一个句柄，若已存在则等同于update
+    void insert(int handle, Priority prio) {
 
-            if (left_child_idx != -1 && \
-                comparator(_elem_container[left_child_idx], _elem_container[idx])) {
+        assert(handle >= 0);
+        if (contains(handle)) {
+            update(handle, std::move(prio));
+            return;
+        }
+        if (handle >= (int)_pos.size()) _pos.resize(handle + 1, NPOS);
 
-                target_idx = left_child_idx;
-            }
+        _nodes.push_back(Node{std::move(prio), handle});
+        _pos[handle] = _nodes.size() - 1;
+        _adjust_bottom_up(_nodes.size() - 1);
+    }
 
-            if (right_child_idx != -1 &&
-                (target_idx == -1 || comparator(_elem_container[right_child_idx], _elem_container[target_idx]))) {
+    // 修改句柄的优先级：根据新旧优先级的关系，只向一个方向调整
+    void update(int handle, Priority prio) {
 
-                target_idx = right_child_idx;
-            }
+        if (!contains(handle)) return;
 
-            if (target_idx == -1) break;
+        int idx = _pos[handle];
+        bool goes_up = comparator(prio, _nodes[idx].prio);
+        _nodes[idx].prio = std::move(prio);
 
-            std::swap(_elem_container[target_idx], _elem_container[idx]);
-            idx = target_idx;
+        if (goes_up) {
+            _adjust_bottom_up(idx);
+        }else {
+            _adjust_top_down(idx);
         }
-
     }
-};
 
-template<typename Comparator>
-class Heap<std::pair<int, int>, Comparator> {
+    // 按句柄删除
+    void erase(int handle) {
 
-    using const_reference = const std::pair<int, int>&;
-private:
-    int _heap_sz = 0;
-public:
-    Heap(Comparator _comparator):comparator(_comparator) { 
-        std::cout << "partial one" << std::endl; 
-    }
-    using DataType = std::pair<int, int>;
-    static const int BEG_IDX = 0;
-public:
+        if (!contains(handle)) return;
 
-    // 清空堆
-    void clear() {
-
-        _heap_sz = 0;
-        _elem_container.clear();
-    }
+        int idx = _pos[handle];
+        int last = _nodes.size() - 1;
+        _pos[handle] = NPOS;
 
-    // 堆排序 - 排序后，堆将被破坏
-    void sort() {
-
-        while (_heap_sz > 0) {
-            std::swap(_elem_container[0], _elem_container[_heap_sz - 1]);
-            --_heap_sz;
-            _adjust_top_down(0);
+        if (idx != last) {
+            _move(last, idx);
+            _nodes.pop_back();
+            // 被换上来的元素可能比原位置的父节点更优，也可能更差
+            if (idx > 0 && comparator(_nodes[idx].prio, _nodes[_parent(idx)].prio)) {
+                _adjust_bottom_up(idx);
+            }else {
+                _adjust_top_down(idx);
+            }
+        }else {
+            _nodes.pop_back();
         }
     }
 
-    void print_heap() {
-        for_each(_elem_container.begin(), _elem_container.end(), [](std::pair<int, int> p) {
-            std::cout << p.second << " ";
-            });
-        std::cout << std::endl;
+    // 堆顶元素的句柄，堆不能为空
+    int top() const {
+        assert(!_nodes.empty());
+        return _nodes.front().handle;
     }
 
-    void insert(DataType _elem) {
-
-        ++_heap_sz;
-        _elem_container.push_back(std::move(_elem));
-
-        _adjust_bottom_up(_elem_container.size() - 1);
+    const_reference top_priority() const {
+        assert(!_nodes.empty());
+        return _nodes.front().prio;
     }
 
-    const_reference top() {
+    // 取出堆顶，返回其句柄
+    int pop() {
 
-        return _elem_container.front();
+        int handle = top();
+        erase(handle);
+        return handle;
     }
 
-    template<typename Predicate>
-    void delete_from_heap(const_reference elem, Predicate pred) {
-
-        auto iter = std::find_if(_elem_container.begin(), _elem_container.end(), pred);
-        if (iter == _elem_container.end()) {
-
-            return;
-        }
-
-        std::swap(*iter, _elem_container[_heap_sz - 1]);
-
-        --_heap_sz;
-
-        _adjust_top_down(iter - _elem_container.begin());
+    // 句柄当前的优先级，句柄必须在堆中
+    const_reference priority(int handle) const {
+        assert(contains(handle));
+        return _nodes[_pos[handle]].prio;
     }
 
-    template<typename Predicate>
-    void modify(const_reference elem, Predicate pred) {
+private:
+    static constexpr int NPOS = -1;
 
-        auto iter = std::find_if(_elem_container.begin(), _elem_container.begin() + _heap_sz, pred);
+    std::vector<Node> _nodes;   // 堆本身：优先级和句柄放在一起，调整时不需要间接寻址
+    std::vector<int> _pos;      // 句柄 -> _nodes中的下标，NPOS表示不在堆中
+    Comparator comparator;
 
-        if (iter == _elem_container.begin() + _heap_sz) return;
+private:
 
-        if (comparator(elem.second, iter->second)) {
+    static int _parent(int idx) { return (idx - 1) / Arity; }
+    static int _first_child(int idx) { return idx * Arity + 1; }
 
-            iter->second = elem.second;
-            _adjust_bottom_up(iter - _elem_container.begin());
-        }
-        else {
-            iter->second = elem.second;
-            _adjust_top_down(iter - _elem_container.begin(), _heap_sz);
-        }
+    // 将from处的节点放到to处，并更新位置表
+    void _move(int from, int to) {
+        _nodes[to] = std::move(_nodes[from]);
+        _pos[_nodes[to].handle] = to;
     }
-private:
-
-    std::vector<DataType> _elem_container;
-    Comparator comparator;
-private:
 
-    // 自下而上的调整
+    // 自下而上的调整：空穴上移，最后一次性放入，减少交换
     void _adjust_bottom_up(int idx) {
 
-        int root_idx = idx / 2;
-        while (idx != BEG_IDX && \
-            comparator(_elem_container[idx].second, _elem_container[root_idx].second)) {
-
-            std::swap(_elem_container[idx], _elem_container[root_idx]);
-            idx = root_idx;
-            root_idx = idx / 2;
+        Node node = std::move(_nodes[idx]);
+        while (idx > 0) {
+            int parent_idx = _parent(idx);
+            if (!comparator(node.prio, _nodes[parent_idx].prio)) break;
+            _move(parent_idx, idx);
+            idx = parent_idx;
         }
+        _nodes[idx] = std::move(node);
+        _pos[_nodes[idx].handle] = idx;
     }
 
-    // 自上而下的调整
-    void _adjust_top_down(int i) {
+    // 自上而下的调整：每层在Arity个孩子中选出最优的一个
+    void _adjust_top_down(int idx) {
 
-        while (i != -1 && i < _heap_sz) {
+        int sz = _nodes.size();
+        Node node = std::move(_nodes[idx]);
 
-            int left_child_idx = i * 2 + 1;
-            int right_child_idx = i * 2 + 2;
-            int target_idx = -1;
+        while (true) {
+            int first = _first_child(idx);
+            if (first >= sz) break;
 
-            if (left_child_idx < _heap_sz && comparator(_elem_container[left_child_idx].second, _elem_container[i].second)) {
-                target_idx = left_child_idx;
-            }
-            if (right_child_idx < _heap_sz && (target_idx == -1 || comparator(_elem_container[right_child_idx].second, _elem_container[target_idx].second))) {
-                target_idx = right_child_idx;
+            int last = first + Arity < sz ? first + Arity : sz;
+            int target_idx = first;
+            for (int child = first + 1; child < last; ++child) {
+                if (comparator(_nodes[child].prio, _nodes[target_idx].prio)) {
+                    target_idx = child;
+                }
             }
 
-            i = (target_idx == -1) ? -1 : (std::swap(_elem_container[target_idx], _elem_container[i]), target_idx);
+            if (!comparator(_nodes[target_idx].prio, node.prio)) break;
+            _move(target_idx, idx);
+            idx = target_idx;
         }
+        _nodes[idx] = std::move(node);
+        _pos[_nodes[idx].handle] = idx;
     }
-};
\ No newline at end of file
+};
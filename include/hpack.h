@@ -0,0 +1,472 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <algorithm>
+
+#define HPACK_ENTRY_OVERHEAD 32         // 动态表中每项的额外开销（RFC 7541 4.1）
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_STATIC_TABLE_SIZE 61
+
+typedef std::pair<std::string, std::string> Header_Field;
+
+// HPACK静态表（RFC 7541 附录A），下标从1开始
+static const char *const HPACK_STATIC_TABLE[HPACK_STATIC_TABLE_SIZE + 1][2] = {
+    {"", ""},
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""}
+};
+
+// Huffman编码表（RFC 7541 附录B）：{码字, 位数}，下标为符号，256为EOS
+struct Hpack_Huffman_Code {
+    uint32_t code;
+    uint8_t bits;
+};
+
+static const Hpack_Huffman_Code HPACK_HUFFMAN_TABLE[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+/**
+ * desc: HPACK的基本编码：整数、字符串（可选Huffman）
+ */
+class Hpack_Util final {
+public:
+
+    // 整数编码（RFC 7541 5.1）：first为第一个字节中前缀之外的高位
+    static void encode_int(std::string &out, uint64_t value, int prefix_bits, uint8_t first) {
+
+        uint64_t max_prefix = (1u << prefix_bits) - 1;
+        if (value < max_prefix) {
+            out.push_back((char)(first | value));
+            return;
+        }
+        out.push_back((char)(first | max_prefix));
+        value -= max_prefix;
+        while (value >= 128) {
+            out.push_back((char)(0x80 | (value & 0x7f)));
+            value >>= 7;
+        }
+        out.push_back((char)value);
+    }
+
+    // 解码整数，成功返回true并前移pos
+    static bool decode_int(const uint8_t *p, size_t len, size_t &pos, int prefix_bits, uint64_t &value) {
+
+        if (pos >= len) return false;
+        uint64_t max_prefix = (1u << prefix_bits) - 1;
+        value = p[pos++] & max_prefix;
+        if (value < max_prefix) return true;
+
+        int shift = 0;
+        while (pos < len) {
+            uint8_t b = p[pos++];
+            if (shift > 56) return false;   // 超出64位
+            value += (uint64_t)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    // Huffman编码后的字节数
+    static size_t huffman_length(const std::string &s) {
+        uint64_t bits = 0;
+        for (unsigned char c : s) bits += HPACK_HUFFMAN_TABLE[c].bits;
+        return (bits + 7) / 8;
+    }
+
+    static void huffman_encode(std::string &out, const std::string &s) {
+
+        uint64_t acc = 0;   // 待输出的位
+        int acc_bits = 0;
+        for (unsigned char c : s) {
+            const Hpack_Huffman_Code &hc = HPACK_HUFFMAN_TABLE[c];
+            acc = (acc << hc.bits) | hc.code;
+            acc_bits += hc.bits;
+            while (acc_bits >= 8) {
+                acc_bits -= 8;
+                out.push_back((char)(acc >> acc_bits));
+            }
+        }
+        // 用EOS的高位（全1）补齐最后一个字节
+        if (acc_bits > 0) {
+            out.push_back((char)((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+        }
+    }
+
+    // 解码Huffman字符串：EOS、超过7位的填充或不是全1的填充都是错误
+    static bool huffman_decode(const uint8_t *p, size_t len, std::string &out) {
+
+        const Huffman_Tree &tree = _tree();
+        int node = 0;
+        int depth = 0;          // 自上一个符号以来读入的位数
+        bool all_ones = true;   // 这些位是否全为1（只有EOS的前缀可以做填充）
+        for (size_t i = 0; i < len; ++i) {
+            for (int b = 7; b >= 0; --b) {
+                int bit = (p[i] >> b) & 1;
+                node = tree.nodes[node].child[bit];
+                if (node < 0) return false;
+                ++depth;
+                all_ones = all_ones && bit;
+
+                int sym = tree.nodes[node].sym;
+                if (sym >= 0) {
+                    if (sym == 256) return false;
+                    out.push_back((char)sym);
+                    node = 0;
+                    depth = 0;
+                    all_ones = true;
+                }
+            }
+        }
+        return depth <= 7 && all_ones;
+    }
+
+    // 写入一个字符串（长度前缀 + 内容），Huffman更短时使用Huffman
+    static void encode_string(std::string &out, const std::string &s) {
+
+        size_t hlen = huffman_length(s);
+        if (hlen < s.size()) {
+            encode_int(out, hlen, 7, 0x80);
+            huffman_encode(out, s);
+        }else {
+            encode_int(out, s.size(), 7, 0);
+            out += s;
+        }
+    }
+
+    static bool decode_string(const uint8_t *p, size_t len, size_t &pos, std::string &out) {
+
+        if (pos >= len) return false;
+        bool huffman = p[pos] & 0x80;
+        uint64_t slen;
+        if (!decode_int(p, len, pos, 7, slen)) return false;
+        if (slen > len - pos) return false;
+
+        out.clear();
+        if (huffman) {
+            if (!huffman_decode(p + pos, slen, out)) return false;
+        }else {
+            out.assign((const char *)p + pos, slen);
+        }
+        pos += slen;
+        return true;
+    }
+
+private:
+
+    // 解码用的二叉树：由编码表在第一次使用时构造
+    struct Huffman_Tree {
+        struct Node {
+            int child[2] = {-1, -1};
+            int sym = -1;
+        };
+        std::vector<Node> nodes;
+
+        Huffman_Tree() {
+            nodes.reserve(513);
+            nodes.emplace_back();
+            for (int sym = 0; sym < 257; ++sym) {
+                const Hpack_Huffman_Code &hc = HPACK_HUFFMAN_TABLE[sym];
+                int node = 0;
+                for (int b = hc.bits - 1; b >= 0; --b) {
+                    int bit = (hc.code >> b) & 1;
+                    if (nodes[node].child[bit] < 0) {
+                        nodes[node].child[bit] = nodes.size();
+                        nodes.emplace_back();
+                    }
+                    node = nodes[node].child[bit];
+                }
+                nodes[node].sym = sym;
+            }
+        }
+    };
+
+    static const Huffman_Tree &_tree() {
+        static const Huffman_Tree tree;
+        return tree;
+    }
+};
+
+/**
+ * desc: HPACK动态表（RFC 7541 2.3.2）
+ *      新项插入在最前面，下标62对应最新的一项；超出容量时从最旧的一项开始淘汰
+ */
+class Hpack_Table {
+public:
+    explicit Hpack_Table(size_t max_size = HPACK_DEFAULT_TABLE_SIZE): _max_size(max_size) {}
+
+    size_t max_size() const { return _max_size; }
+
+    void set_max_size(size_t max_size) {
+        _max_size = max_size;
+        _evict(0);
+    }
+
+    void insert(const std::string &name, const std::string &value) {
+
+        size_t entry = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+        _evict(entry);
+        if (entry > _max_size) return;  // 比整个表还大：清空表，不插入
+        _entries.emplace_front(name, value);
+        _size += entry;
+    }
+
+    // 按HPACK下标取得一项（静态表 + 动态表），越界返回false
+    bool get(uint64_t index, std::string &name, std::string &value) const {
+
+        if (index == 0) return false;
+        if (index <= HPACK_STATIC_TABLE_SIZE) {
+            name = HPACK_STATIC_TABLE[index][0];
+            value = HPACK_STATIC_TABLE[index][1];
+            return true;
+        }
+        index -= HPACK_STATIC_TABLE_SIZE + 1;
+        if (index >= _entries.size()) return false;
+        name = _entries[index].first;
+        value = _entries[index].second;
+        return true;
+    }
+
+    // 查找：完全匹配返回下标并置exact，只有名字匹配返回名字的下标，都没有返回0
+    uint64_t find(const std::string &name, const std::string &value, bool &exact) const {
+
+        uint64_t name_index = 0;
+        exact = false;
+        for (int i = 1; i <= HPACK_STATIC_TABLE_SIZE; ++i) {
+            if (name != HPACK_STATIC_TABLE[i][0]) continue;
+            if (value == HPACK_STATIC_TABLE[i][1]) {
+                exact = true;
+                return i;
+            }
+            if (name_index == 0) name_index = i;
+        }
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            if (_entries[i].first != name) continue;
+            if (_entries[i].second == value) {
+                exact = true;
+                return HPACK_STATIC_TABLE_SIZE + 1 + i;
+            }
+            if (name_index == 0) name_index = HPACK_STATIC_TABLE_SIZE + 1 + i;
+        }
+        return name_index;
+    }
+
+private:
+    std::deque<Header_Field> _entries;
+    size_t _size = 0;
+    size_t _max_size;
+
+    // 淘汰旧项，直到能再放入incoming字节
+    void _evict(size_t incoming) {
+        while (!_entries.empty() && _size + incoming > _max_size) {
+            const Header_Field &last = _entries.back();
+            _size -= last.first.size() + last.second.size() + HPACK_ENTRY_OVERHEAD;
+            _entries.pop_back();
+        }
+    }
+};
+
+/**
+ * desc: HPACK解码器：一个连接上对端发来的全部首部块共用一个
+ */
+class Hpack_Decoder {
+public:
+    // settings_max：本端SETTINGS_HEADER_TABLE_SIZE，对端的表大小更新不能超过它
+    explicit Hpack_Decoder(size_t settings_max = HPACK_DEFAULT_TABLE_SIZE, \
+            size_t max_list_size = 64 << 10): \
+        _table(settings_max), _settings_max(settings_max), _max_list_size(max_list_size) {}
+
+    // 解码一个完整的首部块，格式错误（COMPRESSION_ERROR）返回false
+    bool decode(const uint8_t *p, size_t len, std::vector<Header_Field> &headers) {
+
+        size_t pos = 0;
+        size_t list_size = 0;
+        bool field_seen = false;
+        std::string name, value;
+
+        while (pos < len) {
+            uint8_t b = p[pos];
+
+            if (b & 0x80) {
+                // 6.1 已索引
+                uint64_t index;
+                if (!Hpack_Util::decode_int(p, len, pos, 7, index)) return false;
+                if (!_table.get(index, name, value)) return false;
+            }else if ((b & 0xe0) == 0x20) {
+                // 6.3 动态表大小更新：只能出现在首部块的开头
+                uint64_t size;
+                if (field_seen || !Hpack_Util::decode_int(p, len, pos, 5, size)) return false;
+                if (size > _settings_max) return false;
+                _table.set_max_size(size);
+                continue;
+            }else {
+                // 6.2 字面量：带索引(01)、不索引(0000)、永不索引(0001)
+                bool incremental = (b & 0xc0) == 0x40;
+                uint64_t index;
+                if (!Hpack_Util::decode_int(p, len, pos, incremental ? 6 : 4, index)) return false;
+                if (index == 0) {
+                    if (!Hpack_Util::decode_string(p, len, pos, name)) return false;
+                }else {
+                    std::string unused;
+                    if (!_table.get(index, name, unused)) return false;
+                }
+                if (!Hpack_Util::decode_string(p, len, pos, value)) return false;
+                if (incremental) _table.insert(name, value);
+            }
+
+            field_seen = true;
+            list_size += name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+            if (list_size > _max_list_size) return false;
+            headers.emplace_back(name, value);
+        }
+        return true;
+    }
+
+private:
+    Hpack_Table _table;
+    size_t _settings_max;
+    size_t _max_list_size;
+};
+
+/**
+ * desc: HPACK编码器：一个连接上本端发出的全部首部块共用一个
+ *      完全匹配的项用下标；其他首部以带索引的字面量写入并加入动态表，
+ *      每个响应都不同的首部（日期、长度、校验值）不加入动态表，以免挤掉可复用的项
+ */
+class Hpack_Encoder {
+public:
+    // 对端SETTINGS_HEADER_TABLE_SIZE变化时调用，下一个首部块开头发出表大小更新
+    void set_peer_max_size(size_t size) {
+        size_t target = std::min<size_t>(size, HPACK_DEFAULT_TABLE_SIZE);
+        if (target != _table.max_size()) {
+            _pending_size_update = true;
+            _min_size_seen = std::min(_min_size_seen, target);
+            _table.set_max_size(target);
+        }
+    }
+
+    void encode(const std::vector<Header_Field> &headers, std::string &out) {
+
+        if (_pending_size_update) {
+            // 期间缩小过就先发最小值，使对端淘汰的项与本端一致
+            if (_min_size_seen < _table.max_size()) {
+                Hpack_Util::encode_int(out, _min_size_seen, 5, 0x20);
+            }
+            Hpack_Util::encode_int(out, _table.max_size(), 5, 0x20);
+            _pending_size_update = false;
+            _min_size_seen = SIZE_MAX;
+        }
+
+        for (const Header_Field &h : headers) {
+            bool exact = false;
+            uint64_t index = _table.find(h.first, h.second, exact);
+            if (exact) {
+                Hpack_Util::encode_int(out, index, 7, 0x80);
+                continue;
+            }
+
+            if (_volatile(h.first)) {
+                Hpack_Util::encode_int(out, index, 4, 0x00);    // 不索引
+            }else {
+                Hpack_Util::encode_int(out, index, 6, 0x40);    // 带索引
+                _table.insert(h.first, h.second);
+            }
+            if (index == 0) Hpack_Util::encode_string(out, h.first);
+            Hpack_Util::encode_string(out, h.second);
+        }
+    }
+
+private:
+    Hpack_Table _table;
+    bool _pending_size_update = false;
+    size_t _min_size_seen = SIZE_MAX;
+
+    static bool _volatile(const std::string &name) {
+        return name == "date" || name == "content-length" || name == "etag" || \
+            name == "last-modified" || name == "age" || name == "set-cookie";
+    }
+};
@@ -0,0 +1,964 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include "hpack.h"
+#include "http_request_parser.h"
+#include "http_response_sender.h"
+#include "write_policy.h"
+#include "load_table.h"
+#include "tls.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER_LEN 9
+#define H2_DEFAULT_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_DEFAULT_FRAME_SIZE 16384     // 本端不修改SETTINGS_MAX_FRAME_SIZE，收到的帧不超过它
+#define H2_MAX_FRAME_SIZE 16777215
+#define H2_OUT_HIGH_WATER (64 << 10)    // 输出缓冲超过该值时不再生成DATA帧，先写出（优先级只在这之内生效）
+#define H2_WEIGHT_SCALE 256             // 加权调度：发送n字节后虚拟时间增加 n * 256 / weight
+
+// 帧类型（RFC 7540 6）
+enum H2_FRAME_TYPE {
+    H2F_DATA = 0,
+    H2F_HEADERS,
+    H2F_PRIORITY,
+    H2F_RST_STREAM,
+    H2F_SETTINGS,
+    H2F_PUSH_PROMISE,
+    H2F_PING,
+    H2F_GOAWAY,
+    H2F_WINDOW_UPDATE,
+    H2F_CONTINUATION
+};
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+// 错误码（RFC 7540 7）
+enum H2_ERROR {
+    H2E_NO_ERROR = 0,
+    H2E_PROTOCOL_ERROR,
+    H2E_INTERNAL_ERROR,
+    H2E_FLOW_CONTROL_ERROR,
+    H2E_SETTINGS_TIMEOUT,
+    H2E_STREAM_CLOSED,
+    H2E_FRAME_SIZE_ERROR,
+    H2E_REFUSED_STREAM,
+    H2E_CANCEL,
+    H2E_COMPRESSION_ERROR,
+    H2E_CONNECT_ERROR,
+    H2E_ENHANCE_YOUR_CALM,
+    H2E_INADEQUATE_SECURITY,
+    H2E_HTTP_1_1_REQUIRED
+};
+
+// SETTINGS参数（RFC 7540 6.5.2）
+enum H2_SETTING {
+    H2S_HEADER_TABLE_SIZE = 1,
+    H2S_ENABLE_PUSH,
+    H2S_MAX_CONCURRENT_STREAMS,
+    H2S_INITIAL_WINDOW_SIZE,
+    H2S_MAX_FRAME_SIZE,
+    H2S_MAX_HEADER_LIST_SIZE
+};
+
+// 本端的HTTP/2参数，由ServerConfig得到
+struct H2_Settings {
+    uint32_t max_concurrent_streams = 128;
+    uint32_t initial_window_size = 1 << 20;     // 本端的接收窗口（每个流，连接同样大小）
+    uint32_t max_header_list_size = 64 << 10;
+    size_t max_request_body = 1 << 20;
+};
+
+enum H2_STREAM_STATE {
+    H2SS_OPEN = 0,
+    H2SS_HALF_CLOSED_REMOTE,    // 请求已收完，等待/正在发送响应
+    H2SS_CLOSED
+};
+
+// 一个流：一个请求和它的响应
+struct H2_Stream {
+    H2_Stream(uint32_t stream_id, const Http_Response_Sender &proto): id(stream_id), hrs(proto) {}
+
+    uint32_t id;
+    H2_STREAM_STATE state = H2SS_OPEN;
+
+    // 请求
+    std::vector<Header_Field> headers;
+    std::string body;
+    bool request_ready = false;     // 请求已收完，等待生成响应
+    bool parsed = false;            // hrp已经解析过（h2c升级时的第一个请求）
+    PARSE_STAGE parse_state = PS_PARSE_FAIL;
+    Http_Request_Parser hrp;
+    Http_Response_Sender hrs;
+
+    // 流量控制
+    int64_t send_window = H2_DEFAULT_WINDOW;
+    int64_t recv_window = H2_DEFAULT_WINDOW;
+
+    // 优先级（RFC 7540 5.3）
+    uint32_t parent = 0;
+    int weight = 16;
+    uint64_t vtime = 0;             // 加权公平调度的虚拟时间
+
+    // 响应体：引用hrs中的数据（mmap的文件或字符串），流关闭时释放
+    bool responded = false;
+    const char *resp_body = NULL;
+    size_t resp_body_len = 0;
+    size_t resp_body_sent = 0;
+};
+
+/**
+ * desc: 一个HTTP/2连接（明文h2c：prior knowledge或HTTP/1.1 Upgrade）
+ *      - 只处理帧和流的状态，不涉及IO：工作线程把读到的数据交给on_recv，
+ *        取出收完的请求生成响应后交回submit_response，再把schedule生成的帧写出
+ *      - 请求转成HTTP/1.1报文交给Http_Request_Parser，响应由Http_Response_Sender
+ *        生成后转成HEADERS/DATA帧：静态文件的处理与HTTP/1.1完全相同
+ *      - 流量控制：发送受连接和流两级窗口限制；接收窗口用掉一半时补充
+ *      - 调度：有数据可发的流中，父流（依赖的流）优先，同级按权重做加权公平调度
+ *        （虚拟时间最小者先发，每帧之后虚拟时间增加 发送字节 * 256 / 权重）
+ *      - 同一连接同时只有一个任务，类内不加锁
+ */
+class H2_Session {
+public:
+    H2_Session(const H2_Settings &settings, const Http_Response_Sender &proto): \
+        _settings(settings), _proto(proto), \
+        _decoder(HPACK_DEFAULT_TABLE_SIZE, settings.max_header_list_size), \
+        _conn_recv_window(settings.initial_window_size) {}
+
+    ~H2_Session() {
+        for (auto &kv : _streams) kv.second->hrs.clear_data();
+    }
+
+    // 数据是否以连接序言开头（len不足时只比较已有的部分）
+    static bool is_preface(const char *p, size_t len) {
+        return memcmp(p, H2_PREFACE, std::min<size_t>(len, H2_PREFACE_LEN)) == 0;
+    }
+
+    // 以prior knowledge方式开始：发送本端的SETTINGS，等待客户端的序言
+    void start() {
+        _queue_server_preface();
+    }
+
+    /**
+     * 以HTTP/1.1 Upgrade: h2c方式开始：hrp为已解析的升级请求，成为流1（已半关闭）
+     * settings_b64为HTTP2-Settings首部（base64url编码的SETTINGS帧负载），无效返回false
+     */
+    bool upgrade(const Http_Request_Parser &hrp, const std::string &settings_b64) {
+
+        std::string payload;
+        if (!_base64url_decode(settings_b64, payload) || payload.size() % 6 != 0) return false;
+
+        _out += "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        _queue_server_preface();
+        if (_apply_settings((const uint8_t *)payload.data(), payload.size()) != H2E_NO_ERROR) {
+            return false;
+        }
+
+        H2_Stream *st = _new_stream(1);
+        st->hrp = hrp;
+        st->parsed = true;
+        st->parse_state = PS_OK;
+        st->state = H2SS_HALF_CLOSED_REMOTE;
+        st->request_ready = true;
+        _last_stream_id = 1;
+        return true;
+    }
+
+    /**
+     * 处理收到的数据（序言和帧），可以是任意的片段
+     * 返回false表示连接出错：GOAWAY已排队，写出后关闭连接
+     */
+    bool on_recv(const char *p, size_t len) {
+
+        if (_fatal) return false;
+        _in.append(p, len);
+
+        if (!_preface_received) {
+            size_t n = std::min<size_t>(_in.size(), H2_PREFACE_LEN);
+            if (memcmp(_in.data(), H2_PREFACE, n) != 0) {
+                _connection_error(H2E_PROTOCOL_ERROR);
+                return false;
+            }
+            if (n < H2_PREFACE_LEN) return true;
+            _in_pos = H2_PREFACE_LEN;
+            _preface_received = true;
+        }
+
+        while (!_fatal && _in.size() - _in_pos >= H2_FRAME_HEADER_LEN) {
+
+            const uint8_t *h = (const uint8_t *)_in.data() + _in_pos;
+            uint32_t flen = (h[0] << 16) | (h[1] << 8) | h[2];
+            uint8_t type = h[3], flags = h[4];
+            uint32_t sid = _read32(h + 5) & 0x7fffffff;
+
+            if (flen > H2_DEFAULT_FRAME_SIZE) {
+                _connection_error(H2E_FRAME_SIZE_ERROR);
+                break;
+            }
+            if (_in.size() - _in_pos < H2_FRAME_HEADER_LEN + flen) break;
+
+            _on_frame(type, flags, sid, h + H2_FRAME_HEADER_LEN, flen);
+            _in_pos += H2_FRAME_HEADER_LEN + flen;
+        }
+
+        // 已处理的部分从缓冲区中删除
+        if (_in_pos == _in.size()) {
+            _in.clear();
+            _in_pos = 0;
+        }else if (_in_pos > H2_DEFAULT_FRAME_SIZE) {
+            _in.erase(0, _in_pos);
+            _in_pos = 0;
+        }
+        return !_fatal;
+    }
+
+    // 取出一个已收完、还没有响应的请求（请求已交给流的hrp解析），没有返回NULL
+    H2_Stream *next_request() {
+
+        for (auto &kv : _streams) {
+            H2_Stream *st = kv.second.get();
+            if (!st->request_ready || st->responded) continue;
+            st->request_ready = false;
+            if (!st->parsed) _parse_request(st);
+            return st;
+        }
+        return NULL;
+    }
+
+    // 流的hrs已生成响应：转成HEADERS帧，响应体由schedule按优先级和窗口发送
+    void submit_response(H2_Stream *st) {
+
+        st->responded = true;
+        const std::string &status_line = st->hrs.status_line();
+        std::string status = status_line.size() >= 12 ? status_line.substr(9, 3) : "500";
+
+        std::vector<Header_Field> headers;
+        headers.emplace_back(":status", status);
+        _convert_header_lines(st->hrs.header_lines(), headers);
+
+        // HEAD、1xx/204/304没有响应体
+        bool no_body = st->hrp.method() == "HEAD" || status[0] == '1' || \
+            status == "204" || status == "304" || st->hrs.get_response_body_len() == 0;
+        if (!no_body) {
+            st->resp_body = st->hrs.body_data();
+            st->resp_body_len = st->hrs.get_response_body_len();
+            st->vtime = _vtime_base;
+        }
+
+        std::string block;
+        _encoder.encode(headers, block);
+        _queue_header_block(st->id, block, no_body);
+        if (no_body) _close_stream(st->id);
+    }
+
+    // 按优先级和流量控制窗口生成DATA帧，直到输出缓冲达到高水位
+    void schedule() {
+
+        while (_out.size() - _out_sent < H2_OUT_HIGH_WATER && _conn_send_window > 0) {
+
+            H2_Stream *st = _pick_stream();
+            if (st == NULL) break;
+
+            size_t n = std::min<size_t>(st->resp_body_len - st->resp_body_sent, _peer_max_frame_size);
+            n = std::min<size_t>(n, std::min(_conn_send_window, st->send_window));
+            bool end = st->resp_body_sent + n == st->resp_body_len;
+
+            _frame_header(n, H2F_DATA, end ? H2_FLAG_END_STREAM : 0, st->id);
+            _out.append(st->resp_body + st->resp_body_sent, n);
+            st->resp_body_sent += n;
+            st->send_window -= n;
+            _conn_send_window -= n;
+
+            _vtime_base = st->vtime;
+            st->vtime += (n + 1) * H2_WEIGHT_SCALE / st->weight;
+            if (end) _close_stream(st->id);
+        }
+    }
+
+    // 写出输出缓冲（tls为NULL表示明文连接）
+    IO_STATUS flush(Tls_Conn *tls, int fd, ChildLoad *load) {
+
+        while (_out_sent < _out.size()) {
+            if (load) load->send_calls.fetch_add(1, std::memory_order_relaxed);
+            ssize_t n = Tls_Util::send(tls, fd, _out.data() + _out_sent, _out.size() - _out_sent);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno == EINTR) continue;
+                return IOS_CLOSE;
+            }
+            _out_sent += n;
+        }
+
+        if (_out_sent == _out.size()) {
+            _out.clear();
+            _out_sent = 0;
+            return IOS_DONE;
+        }
+        if (_out_sent > H2_OUT_HIGH_WATER) {
+            _out.erase(0, _out_sent);
+            _out_sent = 0;
+        }
+        return IOS_AGAIN;
+    }
+
+    // 是否有数据等待写出（包括窗口允许发送的响应体）
+    bool want_write() {
+        return _out_sent < _out.size() || (_conn_send_window > 0 && _pick_stream() != NULL);
+    }
+
+    // 停止接受新的流（进程排空时），已有的流处理完后连接结束
+    void goaway(H2_ERROR code = H2E_NO_ERROR) {
+
+        if (_goaway_sent) return;
+        _goaway_sent = true;
+        _frame_header(8, H2F_GOAWAY, 0, 0);
+        _put32(_last_stream_id);
+        _put32(code);
+    }
+
+    // 连接可以关闭了：出错，或双方之一已GOAWAY且流都已结束，并且输出已写完
+    bool finished() const {
+        if (_out_sent < _out.size()) return false;
+        return _fatal || ((_goaway_sent || _goaway_received) && _streams.empty());
+    }
+
+    // 没有进行中的流，也没有待写出的数据
+    bool idle() const {
+        return _streams.empty() && _out_sent == _out.size();
+    }
+
+private:
+    H2_Settings _settings;
+    Http_Response_Sender _proto;        // 新流的hrs从它拷贝（带服务器支持的content-type）
+    Hpack_Decoder _decoder;
+    Hpack_Encoder _encoder;
+    std::map<uint32_t, std::unique_ptr<H2_Stream>> _streams;
+
+    std::string _in;
+    size_t _in_pos = 0;
+    std::string _out;
+    size_t _out_sent = 0;
+
+    bool _preface_received = false;
+    bool _settings_received = false;
+    bool _fatal = false;
+    bool _goaway_sent = false;
+    bool _goaway_received = false;
+    uint32_t _last_stream_id = 0;
+
+    // 正在接收的首部块（HEADERS + CONTINUATION）
+    uint32_t _continuation_stream = 0;
+    bool _continuation_end_stream = false;
+    std::string _header_block;
+
+    // 对端的参数
+    uint32_t _peer_max_frame_size = H2_DEFAULT_FRAME_SIZE;
+    int64_t _peer_initial_window = H2_DEFAULT_WINDOW;
+    int64_t _conn_send_window = H2_DEFAULT_WINDOW;
+    int64_t _conn_recv_window;
+    uint64_t _vtime_base = 0;
+
+    static uint32_t _read32(const uint8_t *p) {
+        return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    void _put32(uint32_t v) {
+        _out.push_back((char)(v >> 24));
+        _out.push_back((char)(v >> 16));
+        _out.push_back((char)(v >> 8));
+        _out.push_back((char)v);
+    }
+
+    void _frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+        _out.push_back((char)(len >> 16));
+        _out.push_back((char)(len >> 8));
+        _out.push_back((char)len);
+        _out.push_back((char)type);
+        _out.push_back((char)flags);
+        _put32(sid & 0x7fffffff);
+    }
+
+    void _queue_server_preface() {
+
+        _frame_header(18, H2F_SETTINGS, 0, 0);
+        _out.push_back(0); _out.push_back(H2S_MAX_CONCURRENT_STREAMS);
+        _put32(_settings.max_concurrent_streams);
+        _out.push_back(0); _out.push_back(H2S_INITIAL_WINDOW_SIZE);
+        _put32(_settings.initial_window_size);
+        _out.push_back(0); _out.push_back(H2S_MAX_HEADER_LIST_SIZE);
+        _put32(_settings.max_header_list_size);
+
+        // 连接的接收窗口不受SETTINGS影响，需要单独扩大
+        if (_settings.initial_window_size > H2_DEFAULT_WINDOW) {
+            _window_update(0, _settings.initial_window_size - H2_DEFAULT_WINDOW);
+        }
+    }
+
+    void _window_update(uint32_t sid, uint32_t increment) {
+        _frame_header(4, H2F_WINDOW_UPDATE, 0, sid);
+        _put32(increment);
+    }
+
+    void _rst_stream(uint32_t sid, H2_ERROR code) {
+        _frame_header(4, H2F_RST_STREAM, 0, sid);
+        _put32(code);
+        _close_stream(sid);
+    }
+
+    void _connection_error(H2_ERROR code) {
+        goaway(code);
+        _fatal = true;
+    }
+
+    H2_Stream *_find(uint32_t sid) {
+        auto iter = _streams.find(sid);
+        return iter == _streams.end() ? NULL : iter->second.get();
+    }
+
+    H2_Stream *_new_stream(uint32_t sid) {
+        H2_Stream *st = new H2_Stream(sid, _proto);
+        st->send_window = _peer_initial_window;
+        st->recv_window = _settings.initial_window_size;
+        _streams[sid].reset(st);
+        return st;
+    }
+
+    void _close_stream(uint32_t sid) {
+        auto iter = _streams.find(sid);
+        if (iter == _streams.end()) return;
+        iter->second->hrs.clear_data();     // 释放响应体（mmap的文件）
+        _streams.erase(iter);
+    }
+
+// 帧的处理
+
+    void _on_frame(uint8_t type, uint8_t flags, uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        // 首部块必须连续：中间不能插入其他帧
+        if (_continuation_stream != 0 && (type != H2F_CONTINUATION || sid != _continuation_stream)) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        // 客户端序言之后的第一个帧必须是SETTINGS
+        if (!_settings_received && type != H2F_SETTINGS) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+
+        switch (type) {
+            case H2F_DATA: _on_data(flags, sid, p, len); break;
+            case H2F_HEADERS: _on_headers(flags, sid, p, len); break;
+            case H2F_PRIORITY: _on_priority(sid, p, len); break;
+            case H2F_RST_STREAM: _on_rst_stream(sid, len); break;
+            case H2F_SETTINGS: _on_settings(flags, sid, p, len); break;
+            case H2F_PUSH_PROMISE: _connection_error(H2E_PROTOCOL_ERROR); break;   // 客户端不能推送
+            case H2F_PING: _on_ping(flags, sid, p, len); break;
+            case H2F_GOAWAY: _on_goaway(sid, len); break;
+            case H2F_WINDOW_UPDATE: _on_window_update(sid, p, len); break;
+            case H2F_CONTINUATION: _on_continuation(flags, sid, p, len); break;
+            default: break;     // 未知类型的帧忽略
+        }
+    }
+
+    // 去掉填充，返回false表示填充长度错误
+    bool _strip_padding(uint8_t flags, const uint8_t *&p, uint32_t &len) {
+        if (!(flags & H2_FLAG_PADDED)) return true;
+        if (len < 1 || p[0] >= len) return false;
+        uint8_t pad = p[0];
+        p += 1;
+        len -= 1 + pad;
+        return true;
+    }
+
+    void _on_data(uint8_t flags, uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (sid == 0) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+
+        // 整个帧（含填充）都计入流量控制
+        _conn_recv_window -= len;
+        if (_conn_recv_window < 0) {
+            _connection_error(H2E_FLOW_CONTROL_ERROR);
+            return;
+        }
+        if (_conn_recv_window < (int64_t)_settings.initial_window_size / 2) {
+            _window_update(0, _settings.initial_window_size - _conn_recv_window);
+            _conn_recv_window = _settings.initial_window_size;
+        }
+
+        uint32_t frame_len = len;
+        if (!_strip_padding(flags, p, len)) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+
+        H2_Stream *st = _find(sid);
+        if (st == NULL || st->state != H2SS_OPEN) {
+            if (sid > _last_stream_id) _connection_error(H2E_PROTOCOL_ERROR);    // 空闲的流
+            else _rst_stream(sid, H2E_STREAM_CLOSED);
+            return;
+        }
+
+        st->recv_window -= frame_len;
+        if (st->recv_window < 0) {
+            _rst_stream(sid, H2E_FLOW_CONTROL_ERROR);
+            return;
+        }
+        if (st->body.size() + len > _settings.max_request_body) {
+            _rst_stream(sid, H2E_REFUSED_STREAM);
+            return;
+        }
+        st->body.append((const char *)p, len);
+
+        if (flags & H2_FLAG_END_STREAM) {
+            st->state = H2SS_HALF_CLOSED_REMOTE;
+            st->request_ready = true;
+        }else if (st->recv_window < (int64_t)_settings.initial_window_size / 2) {
+            _window_update(sid, _settings.initial_window_size - st->recv_window);
+            st->recv_window = _settings.initial_window_size;
+        }
+    }
+
+    void _on_headers(uint8_t flags, uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (sid == 0 || (sid & 1) == 0) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (!_strip_padding(flags, p, len)) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+
+        uint32_t parent = 0;
+        int weight = 16;
+        if (flags & H2_FLAG_PRIORITY) {
+            if (len < 5) {
+                _connection_error(H2E_FRAME_SIZE_ERROR);
+                return;
+            }
+            parent = _read32(p) & 0x7fffffff;
+            weight = p[4] + 1;
+            p += 5;
+            len -= 5;
+        }
+
+        H2_Stream *st = _find(sid);
+        if (st == NULL) {
+            if (sid <= _last_stream_id) {
+                // 已关闭的流上不能再有HEADERS
+                _connection_error(H2E_STREAM_CLOSED);
+                return;
+            }
+            _last_stream_id = sid;
+            if (!_goaway_sent) {
+                st = _new_stream(sid);
+                st->parent = parent == sid ? 0 : parent;
+                st->weight = weight;
+            }
+        }else if (st->state != H2SS_OPEN || !(flags & H2_FLAG_END_STREAM)) {
+            // 已有的流上只能是带END_STREAM的trailer
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+
+        _header_block.assign((const char *)p, len);
+        _continuation_end_stream = flags & H2_FLAG_END_STREAM;
+        if (flags & H2_FLAG_END_HEADERS) {
+            _on_header_block(sid);
+        }else {
+            _continuation_stream = sid;
+        }
+    }
+
+    void _on_continuation(uint8_t flags, uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (_continuation_stream == 0 || sid != _continuation_stream) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (_header_block.size() + len > _settings.max_header_list_size * 2) {
+            _connection_error(H2E_ENHANCE_YOUR_CALM);
+            return;
+        }
+        _header_block.append((const char *)p, len);
+        if (flags & H2_FLAG_END_HEADERS) {
+            _continuation_stream = 0;
+            _on_header_block(sid);
+        }
+    }
+
+    // 一个完整的首部块：即使流已被拒绝也必须解码，保持HPACK动态表一致
+    void _on_header_block(uint32_t sid) {
+
+        std::vector<Header_Field> headers;
+        bool ok = _decoder.decode((const uint8_t *)_header_block.data(), _header_block.size(), headers);
+        _header_block.clear();
+        if (!ok) {
+            _connection_error(H2E_COMPRESSION_ERROR);
+            return;
+        }
+
+        H2_Stream *st = _find(sid);
+        if (st == NULL) return;     // GOAWAY之后的新流：忽略
+
+        bool trailers = !st->headers.empty();
+        if (!trailers) {
+            if (!_valid_request_headers(headers)) {
+                _rst_stream(sid, H2E_PROTOCOL_ERROR);
+                return;
+            }
+            size_t open = 0;
+            for (auto &kv : _streams) if (!kv.second->responded) ++open;
+            if (open > _settings.max_concurrent_streams) {
+                _rst_stream(sid, H2E_REFUSED_STREAM);
+                return;
+            }
+            st->headers.swap(headers);
+        }
+
+        if (_continuation_end_stream) {
+            st->state = H2SS_HALF_CLOSED_REMOTE;
+            st->request_ready = true;
+        }
+    }
+
+    // 伪首部：:method/:scheme/:path必须有且只有一个，且在普通首部之前；首部名必须是小写
+    static bool _valid_request_headers(const std::vector<Header_Field> &headers) {
+
+        int method = 0, scheme = 0, path = 0;
+        bool regular_seen = false;
+        for (const Header_Field &h : headers) {
+            if (!h.first.empty() && h.first[0] == ':') {
+                if (regular_seen) return false;
+                if (h.first == ":method") ++method;
+                else if (h.first == ":scheme") ++scheme;
+                else if (h.first == ":path") { ++path; if (h.second.empty()) return false; }
+                else if (h.first != ":authority") return false;
+                continue;
+            }
+            regular_seen = true;
+            for (char c : h.first) {
+                if (c >= 'A' && c <= 'Z') return false;
+            }
+            if (h.first == "connection" || h.first == "keep-alive" || h.first == "proxy-connection" || \
+                    h.first == "transfer-encoding" || h.first == "upgrade") {
+                return false;
+            }
+            if (h.first == "te" && h.second != "trailers") return false;
+        }
+        return method == 1 && scheme == 1 && path == 1;
+    }
+
+    void _on_priority(uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (sid == 0) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (len != 5) {
+            _rst_stream(sid, H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+        uint32_t parent = _read32(p) & 0x7fffffff;
+        if (parent == sid) {
+            _rst_stream(sid, H2E_PROTOCOL_ERROR);
+            return;
+        }
+        H2_Stream *st = _find(sid);
+        if (st == NULL) return;     // 空闲/已关闭的流：不保留优先级信息
+        st->parent = parent;
+        st->weight = p[4] + 1;
+    }
+
+    void _on_rst_stream(uint32_t sid, uint32_t len) {
+
+        if (sid == 0 || sid > _last_stream_id) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (len != 4) {
+            _connection_error(H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+        _close_stream(sid);
+    }
+
+    void _on_settings(uint8_t flags, uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (sid != 0) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (flags & H2_FLAG_ACK) {
+            if (len != 0) _connection_error(H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (len % 6 != 0) {
+            _connection_error(H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+
+        _settings_received = true;
+        H2_ERROR err = _apply_settings(p, len);
+        if (err != H2E_NO_ERROR) {
+            _connection_error(err);
+            return;
+        }
+        _frame_header(0, H2F_SETTINGS, H2_FLAG_ACK, 0);
+    }
+
+    H2_ERROR _apply_settings(const uint8_t *p, size_t len) {
+
+        for (size_t i = 0; i + 6 <= len; i += 6) {
+            uint16_t id = (p[i] << 8) | p[i + 1];
+            uint32_t value = _read32(p + i + 2);
+            switch (id) {
+                case H2S_HEADER_TABLE_SIZE:
+                    _encoder.set_peer_max_size(value);
+                    break;
+                case H2S_ENABLE_PUSH:
+                    if (value > 1) return H2E_PROTOCOL_ERROR;
+                    break;
+                case H2S_INITIAL_WINDOW_SIZE: {
+                    if (value > H2_MAX_WINDOW) return H2E_FLOW_CONTROL_ERROR;
+                    // 已有流的发送窗口按差值调整（可以变为负数）
+                    int64_t delta = (int64_t)value - _peer_initial_window;
+                    for (auto &kv : _streams) {
+                        kv.second->send_window += delta;
+                        if (kv.second->send_window > H2_MAX_WINDOW) return H2E_FLOW_CONTROL_ERROR;
+                    }
+                    _peer_initial_window = value;
+                    break;
+                }
+                case H2S_MAX_FRAME_SIZE:
+                    if (value < H2_DEFAULT_FRAME_SIZE || value > H2_MAX_FRAME_SIZE) return H2E_PROTOCOL_ERROR;
+                    _peer_max_frame_size = value;
+                    break;
+                default:
+                    break;  // 本端不推送，不需要MAX_CONCURRENT_STREAMS；未知参数忽略
+            }
+        }
+        return H2E_NO_ERROR;
+    }
+
+    void _on_ping(uint8_t flags, uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (sid != 0) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (len != 8) {
+            _connection_error(H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (flags & H2_FLAG_ACK) return;
+        _frame_header(8, H2F_PING, H2_FLAG_ACK, 0);
+        _out.append((const char *)p, 8);
+    }
+
+    void _on_goaway(uint32_t sid, uint32_t len) {
+
+        if (sid != 0) {
+            _connection_error(H2E_PROTOCOL_ERROR);
+            return;
+        }
+        if (len < 8) {
+            _connection_error(H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+        _goaway_received = true;    // 客户端不再发起新的流，已有的流照常完成
+    }
+
+    void _on_window_update(uint32_t sid, const uint8_t *p, uint32_t len) {
+
+        if (len != 4) {
+            _connection_error(H2E_FRAME_SIZE_ERROR);
+            return;
+        }
+        uint32_t increment = _read32(p) & 0x7fffffff;
+
+        if (sid == 0) {
+            if (increment == 0) {
+                _connection_error(H2E_PROTOCOL_ERROR);
+                return;
+            }
+            _conn_send_window += increment;
+            if (_conn_send_window > H2_MAX_WINDOW) _connection_error(H2E_FLOW_CONTROL_ERROR);
+            return;
+        }
+
+        H2_Stream *st = _find(sid);
+        if (st == NULL) {
+            if (sid > _last_stream_id) _connection_error(H2E_PROTOCOL_ERROR);
+            return;     // 已关闭的流：忽略
+        }
+        if (increment == 0) {
+            _rst_stream(sid, H2E_PROTOCOL_ERROR);
+            return;
+        }
+        st->send_window += increment;
+        if (st->send_window > H2_MAX_WINDOW) _rst_stream(sid, H2E_FLOW_CONTROL_ERROR);
+    }
+
+// 请求与响应的转换
+
+    // h2的首部名是小写，转成HTTP/1.1的习惯写法（Accept-Encoding），解析器按这种写法查找
+    static std::string _canonical_name(const std::string &name) {
+        std::string out = name;
+        bool upper = true;
+        for (char &c : out) {
+            if (upper && c >= 'a' && c <= 'z') c -= 'a' - 'A';
+            upper = c == '-';
+        }
+        return out;
+    }
+
+    // 把流的请求转成HTTP/1.1报文交给hrp解析
+    void _parse_request(H2_Stream *st) {
+
+        std::string method, path, authority, cookie;
+        std::string lines;
+        bool has_length = false;
+        for (const Header_Field &h : st->headers) {
+            if (h.first == ":method") method = h.second;
+            else if (h.first == ":path") path = h.second;
+            else if (h.first == ":authority") authority = h.second;
+            else if (h.first[0] == ':') continue;
+            else if (h.first == "cookie") {
+                // 拆开的cookie合并成一行（RFC 7540 8.1.2.5）
+                cookie += (cookie.empty() ? "" : "; ") + h.second;
+            }else {
+                if (h.first == "host" && !authority.empty()) continue;
+                if (h.first == "content-length") has_length = true;
+                lines += _canonical_name(h.first) + ": " + h.second + "\r\n";
+            }
+        }
+
+        std::string req = method + " " + path + " HTTP/1.1\r\n";
+        if (!authority.empty()) req += "Host: " + authority + "\r\n";
+        req += lines;
+        if (!cookie.empty()) req += "Cookie: " + cookie + "\r\n";
+        if (!st->body.empty() && !has_length) {
+            req += "Content-Length: " + std::to_string(st->body.size()) + "\r\n";
+        }
+        req += "Connection: keep-alive\r\n\r\n";
+
+        // 和HTTP/1.1相同：parser只解析首部，已经收完的请求体直接交给它
+        st->parse_state = st->hrp.parse(&req[0], req.size());
+        if (st->parse_state == PS_BODY) st->parse_state = PS_OK;
+        if (st->parse_state == PS_OK) st->hrp.set_body(std::move(st->body));
+        st->parsed = true;
+        st->headers.clear();
+        st->headers.shrink_to_fit();
+        st->body.clear();
+        st->body.shrink_to_fit();
+    }
+
+    // HTTP/1.1的首部行转成h2首部：名字小写，去掉逐跳首部
+    static void _convert_header_lines(const std::string &lines, std::vector<Header_Field> &headers) {
+
+        size_t pos = 0;
+        while (pos < lines.size()) {
+            size_t end = lines.find("\r\n", pos);
+            if (end == std::string::npos) end = lines.size();
+            if (end == pos) break;      // 空行：首部结束
+
+            size_t colon = lines.find(':', pos);
+            if (colon != std::string::npos && colon < end) {
+                std::string name = lines.substr(pos, colon - pos);
+                for (char &c : name) c = tolower((unsigned char)c);
+                size_t vbeg = lines.find_first_not_of(" \t", colon + 1);
+                std::string value = vbeg == std::string::npos || vbeg >= end ? "" : lines.substr(vbeg, end - vbeg);
+
+                if (name != "connection" && name != "keep-alive" && name != "proxy-connection" && \
+                        name != "transfer-encoding" && name != "upgrade") {
+                    headers.emplace_back(name, value);
+                }
+            }
+            pos = end + 2;
+        }
+    }
+
+    // 首部块超过对端的帧大小上限时拆成HEADERS + CONTINUATION
+    void _queue_header_block(uint32_t sid, const std::string &block, bool end_stream) {
+
+        size_t pos = 0;
+        bool first = true;
+        do {
+            size_t n = std::min<size_t>(block.size() - pos, _peer_max_frame_size);
+            bool last = pos + n == block.size();
+            uint8_t flags = last ? H2_FLAG_END_HEADERS : 0;
+            if (first && end_stream) flags |= H2_FLAG_END_STREAM;
+            _frame_header(n, first ? H2F_HEADERS : H2F_CONTINUATION, flags, sid);
+            _out.append(block, pos, n);
+            pos += n;
+            first = false;
+        } while (pos < block.size());
+    }
+
+// 调度
+
+    // 流是否有响应体可以发送（窗口允许）
+    static bool _sendable(const H2_Stream *st) {
+        return st->resp_body != NULL && st->resp_body_sent < st->resp_body_len && st->send_window > 0;
+    }
+
+    // 选出下一个发送DATA的流：依赖的流还有数据可发时先等它，其余按虚拟时间
+    H2_Stream *_pick_stream() {
+
+        H2_Stream *best = NULL;
+        for (auto &kv : _streams) {
+            H2_Stream *st = kv.second.get();
+            if (!_sendable(st)) continue;
+            if (st->parent != 0) {
+                H2_Stream *parent = _find(st->parent);
+                if (parent != NULL && _sendable(parent)) continue;
+            }
+            if (best == NULL || st->vtime < best->vtime) best = st;
+        }
+        return best;
+    }
+
+    // HTTP2-Settings首部：base64url，没有填充
+    static bool _base64url_decode(const std::string &in, std::string &out) {
+
+        uint32_t acc = 0;
+        int bits = 0;
+        for (char c : in) {
+            int v;
+            if (c >= 'A' && c <= 'Z') v = c - 'A';
+            else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+            else if (c >= '0' && c <= '9') v = c - '0' + 52;
+            else if (c == '-' || c == '+') v = 62;
+            else if (c == '_' || c == '/') v = 63;
+            else if (c == '=') break;
+            else return false;
+            acc = (acc << 6) | v;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                out.push_back((char)(acc >> bits));
+            }
+        }
+        return true;
+    }
+};
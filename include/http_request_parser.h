@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <iostream>
 #include <string>
 #include <unordered_map>
@@ -43,6 +44,8 @@ private:
     std::string req_http_version;
     std::unordered_map<std::string, std::string> key_val;
     std::string req_body;
+    int req_body_fd = -1;           // 转存到临时文件的请求体（此时req_body为空）
+    uint64_t req_body_size = 0;
 
     PARSE_STAGE cur_woking_stage;
     PARSE_LINE_STATE cur_line_parse_state;
@@ -70,6 +73,52 @@ public:
     // desc: parse request body
     PARSE_STAGE parse_req_body();
 
+    // 一个请求处理完成后，为同一连接上的下一个请求清空状态
+    void reset() {
+        cur_check_idx = 0;
+        req_buffer_end_idx = 0;
+        req_buffer_to_parse.clear();
+        req_method.clear();
+        req_url.clear();
+        req_http_version.clear();
+        key_val.clear();
+        req_body.clear();
+        req_body_fd = -1;
+        req_body_size = 0;
+        cur_woking_stage = PS_HEADER;
+    }
+
+    // 解析完成后请求的各部分（反向代理转发请求时使用）
+    const std::string &method() const { return req_method; }
+    const std::string &url() const { return req_url; }
+    const std::string &version() const { return req_http_version; }
+    const std::unordered_map<std::string, std::string> &headers() const { return key_val; }
+    const std::string &body() const { return req_body; }
+
+    // 流式接收的请求体（没有转存到文件时）在接收完成后交给parser
+    void set_body(std::string &&body) {
+        req_body = std::move(body);
+    }
+
+    // 转存到临时文件的请求体：fd由连接的Request_Body持有，在本次请求结束（响应发送完）之前有效
+    void set_body_file(int fd, uint64_t size) {
+        req_body_fd = fd;
+        req_body_size = size;
+    }
+
+    // 请求体在临时文件中时为其fd（用pread读取，从偏移0开始），否则为-1
+    int body_fd() const { return req_body_fd; }
+
+    // 请求体的长度（不论在内存中还是在临时文件中）
+    uint64_t body_size() const { return req_body_fd >= 0 ? req_body_size : req_body.size(); }
+
+    bool has_body() const { return body_size() > 0; }
+
+    // 是否已经收到了一个请求的部分数据
+    bool has_partial_request() const {
+        return !req_buffer_to_parse.empty() || !req_method.empty();
+    }
+
     // 是否长连接
     inline bool is_keep_alive() {
 
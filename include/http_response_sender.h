@@ -16,9 +16,13 @@
 #include <memory>
 #include <array>
 #include "utils.h"
+#include "file_cache.h"
+#include "path_resolver.h"
+#include "conditional.h"
 #include <algorithm>
 #include <vector>
 #include <numeric>
+#include <sys/uio.h>
 
 using namespace HTTP_UTILS;
 
@@ -115,16 +119,16 @@ private:
 // cur working stage:
     RESPONSE_STAGE cur_working_stage;
     
-// server support content-type;
-    std::vector<std::string> support_content_type;
+// server support content-type;（由全部连接共享，不拷贝）
+    const std::vector<std::string> &support_content_type;
     
-// general fields
-    std::vector<GENERAL_FIELDS> _general_fields = {
+// general fields（只读，全部实例共享）
+    static inline const std::vector<GENERAL_FIELDS> _general_fields = {
         GF_DATE, GF_SERVER, GF_LAST_MODIFIED, GF_ETAG, GF_CACHE_CONTROL
     };
 
 // check fields
-    std::vector<CHECK_FIELDS> _check_fields = {
+    static inline const std::vector<CHECK_FIELDS> _check_fields = {
         CF_CONNECTION, CF_CONTENT_TYPE, CF_CONTENT_LENGTH, \
         CF_CONTENT_ENCODING, CF_CONTENT_LANGUAGE, \
         CF_CONTENT_LOCATION, CF_TRANSFER_ENCODING
@@ -133,6 +137,18 @@ private:
 /*客户请求的目标文件被mmap到内存中的起始位置*/
     char *__file_address;
 
+    // 响应体是否直接使用mmap的文件（200时不再拷贝到resp_body）
+    bool __body_from_file = false;
+
+    // 响应体来自预热的文件缓存（映射归缓存所有，不能munmap）
+    const File_Entry *__cached_file = NULL;
+
+    // Path_Resolver解析到的文件（来自解析缓存，不再拼接路径）
+    std::shared_ptr<const Resolved_Path> __resolved;
+
+    // 进程正在排空：无论请求是否要求长连接，都回复Connection: close
+    bool __force_close = false;
+
     // 目标文件的状态。通过它我们可以判断文件是否存在、
     // 是否为目录、是否可读，并获取文件大小等信息
     struct stat __file_stat;
@@ -146,16 +162,54 @@ public:
 
     }
 
-    // 整个响应报文，用于给线程向客户端发送响应报文
-    const char * get_response_data() {
-        std::string resp_data = resp_header + resp_lines + resp_body;
-        
-        return resp_data.c_str();
+    // 整个响应报文按 状态行/首部/响应体 分段给出，由线程用writev一次发送
+    // 不再拼接成一个字符串：避免拷贝响应体，也避免返回临时对象的指针
+    int get_response_iovec(iovec iov[3]) {
+
+        int cnt = 0;
+        if (!resp_header.empty()) {
+            iov[cnt].iov_base = (void *)resp_header.data();
+            iov[cnt++].iov_len = resp_header.size();
+        }
+        if (!resp_lines.empty()) {
+            iov[cnt].iov_base = (void *)resp_lines.data();
+            iov[cnt++].iov_len = resp_lines.size();
+        }
+        if (get_response_body_len() > 0) {
+            iov[cnt].iov_base = __cached_file ? (void *)__cached_file->addr : \
+                __body_from_file ? (void *)__file_address : (void *)resp_body.data();
+            iov[cnt++].iov_len = get_response_body_len();
+        }
+        return cnt;
+    }
+
+    // 响应体的长度
+    int get_response_body_len() {
+        if (__cached_file) return __cached_file->size;
+        return __body_from_file ? __file_stat.st_size : resp_body.size();
+    }
+
+    // 响应体是否是mmap的文件（文件页不会被我们改写，可以零拷贝发送）
+    bool is_body_from_file() {
+        return __cached_file != NULL || __body_from_file;
+    }
+
+    // 分段取出响应（HTTP/2把状态行和首部转成HEADERS帧，响应体分成DATA帧）
+    const std::string &status_line() const { return resp_header; }
+    const std::string &header_lines() const { return resp_lines; }
+    const char *body_data() const {
+        return __cached_file ? __cached_file->addr : \
+            __body_from_file ? __file_address : resp_body.data();
+    }
+
+    // 响应的状态码（访问日志）
+    int status_code() const {
+        return http_code;
     }
 
     // 整个响应报文的长度
     int get_response_data_len() {
-        return resp_header.size() + resp_lines.size() + resp_body.size();
+        return resp_header.size() + resp_lines.size() + get_response_body_len();
     }
 
     // 清空数据
@@ -168,15 +222,141 @@ public:
         resp_header.shrink_to_fit();
         resp_lines.shrink_to_fit();
         resp_body.shrink_to_fit();
+
+        __file_ummap();
+        __body_from_file = false;
+        __cached_file = NULL;
+        __resolved.reset();
+        __force_close = false;
+    }
+
+    // 本次响应之后关闭连接（在response()之前调用）
+    void set_connection_close() {
+        __force_close = true;
+    }
+
+    bool connection_close() const {
+        return __force_close;
+    }
+
+    // 请求的文件已由Path_Resolver解析（在response()之前调用）
+    void set_resolved_path(const std::shared_ptr<const Resolved_Path> &path) {
+        __resolved = path;
     }
 
     // 生成响应报文，根据请求报文
     void response(Http_Request_Parser &http_request_parser);
 
+    // 不读取任何文件，直接生成一个没有响应体的错误响应（如限流时的429）
+    // retry_after_s > 0 时带上Retry-After
+    void response_error(Http_Request_Parser &http_request_parser, \
+            HTTP_UTILS::HTTPCODE code, int retry_after_s = 0) {
+
+        http_code = code;
+        const std::string &version = http_request_parser.req_http_version;
+        resp_header = (version.empty() ? std::string("HTTP/1.1") : version) + " " + \
+            HTTP_UTILS::http_header_response[code] + "\r\n";
+
+        resp_lines += "Content-Length: 0\r\n";
+        if (retry_after_s > 0) {
+            resp_lines += "Retry-After: " + std::to_string(retry_after_s) + "\r\n";
+        }
+        __set_connection(http_request_parser.is_keep_alive());
+        resp_lines += "\r\n";
+    }
+
+    // 条件请求的验证器与文件一致：只有首部的304，不读取文件，也不加载not_modified.html
+    // 验证器首部在路径解析时已经生成
+    void response_not_modified(Http_Request_Parser &http_request_parser, const Resolved_Path &path) {
+
+        static const std::string status_line = "HTTP/1.1 " + \
+            HTTP_UTILS::http_header_response[HTTP_UTILS::NOT_MODIFIED] + "\r\n";
+
+        http_code = HTTP_UTILS::NOT_MODIFIED;
+        const std::string &version = http_request_parser.req_http_version;
+        if (version.empty() || version == "HTTP/1.1") {
+            resp_header = status_line;
+        }else {
+            resp_header = version + " " + HTTP_UTILS::http_header_response[HTTP_UTILS::NOT_MODIFIED] + "\r\n";
+        }
+
+        resp_lines.reserve(128 + path.validator_lines.size());
+        resp_lines += "Date: ";
+        resp_lines += Conditional_Util::date_now();
+        resp_lines += "\r\n";
+        resp_lines += path.validator_lines;
+        _set_cache_control();
+        __set_connection(http_request_parser.is_keep_alive());
+        resp_lines += "\r\n";
+    }
+
+    /**
+     * 已解析的文件（GET/HEAD，在set_resolved_path之后调用）：200响应完全由解析结果生成
+     *  ETag/Last-Modified与304共用validator_lines，客户端拿到的验证器一定能再验证成功；
+     *  Content-Type是解析时按扩展名查到的类型，不再扫描support_content_type
+     * 文件在解析之后被删除时回复404
+     */
+    void response_file(Http_Request_Parser &http_request_parser) {
+
+        static const std::string status_line = "HTTP/1.1 " + \
+            HTTP_UTILS::http_header_response[HTTP_UTILS::OK] + "\r\n";
+
+        // HEAD不读取文件，长度用解析时的大小
+        off_t length = __resolved->size;
+        if (http_request_parser.req_method != "HEAD" && length > 0) {
+            _set_body_resolved();
+            if (!is_body_from_file()) {
+                response_error(http_request_parser, HTTP_UTILS::NOT_FOUND);
+                return;
+            }
+            length = get_response_body_len();
+        }
+
+        http_code = HTTP_UTILS::OK;
+        const std::string &version = http_request_parser.req_http_version;
+        if (version.empty() || version == "HTTP/1.1") {
+            resp_header = status_line;
+        }else {
+            resp_header = version + " " + HTTP_UTILS::http_header_response[HTTP_UTILS::OK] + "\r\n";
+        }
+
+        resp_lines.reserve(192 + __resolved->validator_lines.size());
+        resp_lines += "Date: ";
+        resp_lines += Conditional_Util::date_now();
+        resp_lines += "\r\n";
+        resp_lines += __resolved->validator_lines;
+        _set_cache_control();
+        resp_lines += "Content-Type: ";
+        resp_lines += __resolved->content_type;
+        resp_lines += "\r\nContent-Length: ";
+        resp_lines += std::to_string(length);
+        resp_lines += "\r\n";
+        __set_connection(http_request_parser.is_keep_alive());
+        resp_lines += "\r\n";
+    }
+
+    // 由程序生成响应体（路由的处理器使用），HEAD请求不带响应体
+    // extra_lines是附加的首部，每行以\r\n结尾
+    void response_content(Http_Request_Parser &http_request_parser, HTTP_UTILS::HTTPCODE code, \
+            const std::string &content_type, std::string body, const std::string &extra_lines = "") {
+
+        http_code = code;
+        const std::string &version = http_request_parser.req_http_version;
+        resp_header = (version.empty() ? std::string("HTTP/1.1") : version) + " " + \
+            HTTP_UTILS::http_header_response[code] + "\r\n";
+
+        if (!content_type.empty()) resp_lines += "Content-Type: " + content_type + "\r\n";
+        resp_lines += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        resp_lines += extra_lines;
+        __set_connection(http_request_parser.is_keep_alive());
+        resp_lines += "\r\n";
+        if (http_request_parser.req_method != "HEAD") resp_body = std::move(body);
+    }
+
     // 根据HTTP CODE，生成相应的header
     RESPONSE_STAGE response_header(Http_Request_Parser &http_request_parser) {
 
-        resp_header += http_request_parser.req_http_version + " " + HTTP_UTILS::http_header_response[http_code];
+        resp_header += http_request_parser.req_http_version + " " + HTTP_UTILS::http_header_response[http_code] + "\r\n";
 
         return RS_OK;
     }
@@ -284,14 +464,35 @@ private:
         resp_body.assign(__file_address);
     }
 
+    // 已解析的文件：缓存的绝对路径查文件缓存，否则以根目录fd为起点打开
+    void _set_body_resolved() {
+
+        __cached_file = File_Cache::instance().find(__resolved->abs, __resolved->ino, \
+            __resolved->mtime, __resolved->size);
+        if (__cached_file) return;
+
+        __file_address = Path_Resolver::instance().map(*__resolved, &__file_stat);
+        __body_from_file = (__file_address != NULL);
+    }
+
     // 200 ok
     void _set_body_ok(Http_Request_Parser &http_request_parser) {
         
+        if (__resolved) {
+            _set_body_resolved();
+            return;
+        }
+
         // file: with successful status ： OK
         const std::string &file_pos = _get_file_pos(http_request_parser);
+
+        // 预热过的文件直接使用缓存中的映射，不需要open/mmap
+        __cached_file = File_Cache::instance().find(file_pos);
+        if (__cached_file) return;
+
         __file_address = _get_file(file_pos);
-        // finally: get resp_body
-        resp_body.assign(__file_address);
+        // finally: 响应体直接引用mmap的文件，发送时与首部一起writev，不再拷贝
+        __body_from_file = (__file_address != NULL);
     }
 
     // get file by mmap
@@ -406,7 +607,7 @@ private:
     void __set_connection(bool linger) {
 
         resp_lines += std::string("Connection: ") + \
-            (linger ? "keep-alive": "close") + "\r\n";
+            (linger && !__force_close ? "keep-alive": "close") + "\r\n";
     }
 
     // 这里只需将服务器端支持的content-type全部填写进去即可，
@@ -68,6 +68,14 @@ namespace HTTP_UTILS {
         // 客户端accpet的类型，服务器端不支持
         Not_ACCEPTABLE = 406,
 
+        // 413 Payload Too Large
+        // 请求体超过服务器允许的大小，服务器不再读取剩余的请求体并关闭连接
+        PAYLOAD_TOO_LARGE = 413,
+
+        // 429 Too Many Requests
+        // 客户端在给定时间内发送了太多请求（限流），可以用Retry-After告诉客户端何时重试
+        TOO_MANY_REQUESTS = 429,
+
         // 500（Internal Server Error）
         // 通常是代码出错，后台Bug。
         // 一般的Web服务器通常会给出抛出异常的调用堆栈。 然而多数服务器即使在生产环境也会打出调用堆栈，这显然是不安全的。
@@ -80,6 +88,14 @@ namespace HTTP_UTILS {
         // （通过代理服务器访问资源时，代理服务器向浏览器返回）
         BAD_GATEWAY = 502,
 
+        // 503 Service Unavailable
+        // 服务器暂时过载，通常带Retry-After告诉客户端稍后重试
+        SERVICE_UNAVAILABLE = 503,
+
+        // 504 Gateway Timeout
+        // 作为网关或者代理工作的服务器没有在规定时间内收到上游服务器的响应
+        GATEWAY_TIMEOUT = 504,
+
         // 505 HTTP Version Not Supported
         HTTP_VERSION_NOT_SUPPORTED = 505
     };
@@ -92,8 +108,12 @@ namespace HTTP_UTILS {
                 {NOT_FOUND, "404 Not Found"},
                 {METHOD_NOT_ALLOWED, "405 Method Not Allowed"},
                 {Not_ACCEPTABLE, "406 Not Acceptable"},
+                {PAYLOAD_TOO_LARGE, "413 Payload Too Large"},
+                {TOO_MANY_REQUESTS, "429 Too Many Requests"},
                 {INTERNAL_SERVER_ERROR, "Internal Server Error"},
-                {BAD_GATEWAY, "504 Gateway Timeout"},
+                {BAD_GATEWAY, "502 Bad Gateway"},
+                {GATEWAY_TIMEOUT, "504 Gateway Timeout"},
+                {SERVICE_UNAVAILABLE, "503 Service Unavailable"},
                 {HTTP_VERSION_NOT_SUPPORTED, "HTTP Version Not Supported"}
         };
 } 
\ No newline at end of file
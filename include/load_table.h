@@ -0,0 +1,151 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <iostream>
+#include <sstream>
+
+/**
+ * desc: 一个子进程的实时负载
+ *      位于父子进程共享的内存中，子进程用原子操作更新，父进程直接读取
+ *      每项独占一个cache line，避免不同子进程之间的伪共享
+ */
+struct alignas(64) ChildLoad {
+    std::atomic<int> active_conns{0};       // 当前连接数
+    std::atomic<int> inflight_requests{0};  // 正在被工作线程处理的任务数
+    std::atomic<int> queue_depth{0};        // 任务容器中排队的任务数
+    std::atomic<uint32_t> latency_ewma_us{0};   // 任务从入队到处理完成耗时的滑动平均
+    std::atomic<uint64_t> accepted_total{0};    // 累计accept的连接数
+    std::atomic<uint64_t> shed_total{0};        // 过载时直接回复503的请求数
+    std::atomic<int> draining{0};           // 子进程正在排空，父进程不应再分配新连接
+    std::atomic<uint64_t> log_dropped{0};   // 日志缓冲区满时丢弃的记录数
+
+    // 连接的内存：空闲连接只占用连接表的一项（TLS连接还有SSL对象），
+    // 正在处理的请求另外占用一个请求对象；请求体和协程帧在连接空闲时归还
+    std::atomic<uint32_t> idle_conn_bytes{0};   // 每个空闲连接的字节数（TLS连接含实测的SSL对象）
+    std::atomic<uint32_t> proxy_conn_bytes{0};  // 代理过请求的连接另外占用的字节数（到连接关闭为止）
+    std::atomic<uint32_t> request_bytes{0};     // 每个请求对象的字节数（不含其中字符串的堆内存）
+    std::atomic<int> live_requests{0};          // 当前取出的请求对象数
+
+    // 线程池的伸缩决策，由管理线程写入
+    std::atomic<int> live_threads{0};           // 当前工作线程数
+    std::atomic<uint64_t> thread_grows{0};      // 扩容次数
+    std::atomic<uint64_t> thread_shrinks{0};    // 缩容次数
+    std::atomic<uint32_t> queue_sojourn_us{0};  // 最近一个决策周期内的最大排队时间
+
+    // 系统调用计数，用于比较EPOLLONESHOT与EPOLLET两种模式的开销
+    std::atomic<uint64_t> epoll_wait_calls{0};
+    std::atomic<uint64_t> epoll_ctl_calls{0};
+    std::atomic<uint64_t> recv_calls{0};
+    std::atomic<uint64_t> send_calls{0};
+
+    // 放置决策使用的负载：先比较连接数，再比较排队任务数
+    std::pair<int, int> score() const {
+        return {active_conns.load(std::memory_order_relaxed), \
+            queue_depth.load(std::memory_order_relaxed)};
+    }
+
+    void record_latency(uint32_t us) {
+        // ewma = 7/8 * ewma + 1/8 * us，并发时偶尔丢失一次更新无所谓
+        uint32_t ewma = latency_ewma_us.load(std::memory_order_relaxed);
+        latency_ewma_us.store(ewma - (ewma >> 3) + (us >> 3), std::memory_order_relaxed);
+    }
+
+    void reset() {
+        active_conns = 0;
+        inflight_requests = 0;
+        queue_depth = 0;
+        latency_ewma_us = 0;
+        draining = 0;
+        live_requests = 0;
+        live_threads = 0;
+        queue_sojourn_us = 0;
+    }
+};
+
+// 跨进程共享要求原子变量不依赖锁（锁无法跨进程）
+static_assert(std::atomic<int>::is_always_lock_free, "ChildLoad needs lock-free int");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ChildLoad needs lock-free uint64_t");
+
+/**
+ * desc: 全部子进程的负载表
+ *      在fork之前由父进程通过 mmap(MAP_SHARED | MAP_ANONYMOUS) 创建，
+ *      取代子进程每次连接增减都通过管道通知父进程的做法
+ */
+class Load_Table {
+public:
+    Load_Table(): _slots(NULL), _slot_num(0) {}
+
+    // 创建共享内存，必须在fork之前调用
+    bool create(int slot_num) {
+
+        void *addr = mmap(NULL, sizeof(ChildLoad) * slot_num, \
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::cout << "mmap() load table failed, errno: " << errno << std::endl;
+            return false;
+        }
+
+        _slots = (ChildLoad *)addr;
+        _slot_num = slot_num;
+        for (int i = 0; i < slot_num; ++i) {
+            new (&_slots[i]) ChildLoad();
+        }
+        return true;
+    }
+
+    ~Load_Table() {
+        if (_slots) {
+            munmap(_slots, sizeof(ChildLoad) * _slot_num);
+        }
+    }
+
+    ChildLoad &operator[](int idx) {
+        assert(0 <= idx && idx < _slot_num);
+        return _slots[idx];
+    }
+
+    int size() const { return _slot_num; }
+
+    // 各子进程负载的快照，用于打印/状态页面
+    std::string report() const {
+
+        std::ostringstream oss;
+        for (int i = 0; i < _slot_num; ++i) {
+            const ChildLoad &load = _slots[i];
+            oss << "process " << i \
+                << " conns " << load.active_conns.load(std::memory_order_relaxed) \
+                << " inflight " << load.inflight_requests.load(std::memory_order_relaxed) \
+                << " queued " << load.queue_depth.load(std::memory_order_relaxed) \
+                << " latency_ewma_us " << load.latency_ewma_us.load(std::memory_order_relaxed) \
+                << " accepted " << load.accepted_total.load(std::memory_order_relaxed) \
+                << " shed " << load.shed_total.load(std::memory_order_relaxed) \
+                << " log_dropped " << load.log_dropped.load(std::memory_order_relaxed) \
+                << " idle_conn_bytes " << load.idle_conn_bytes.load(std::memory_order_relaxed) \
+                << " proxy_conn_bytes " << load.proxy_conn_bytes.load(std::memory_order_relaxed) \
+                << " request_bytes " << load.request_bytes.load(std::memory_order_relaxed) \
+                << " live_requests " << load.live_requests.load(std::memory_order_relaxed) \
+                << (load.draining.load(std::memory_order_relaxed) ? " draining" : "") \
+                << " threads " << load.live_threads.load(std::memory_order_relaxed) \
+                << " thread_grows " << load.thread_grows.load(std::memory_order_relaxed) \
+                << " thread_shrinks " << load.thread_shrinks.load(std::memory_order_relaxed) \
+                << " sojourn_us " << load.queue_sojourn_us.load(std::memory_order_relaxed) \
+                << " epoll_wait " << load.epoll_wait_calls.load(std::memory_order_relaxed) \
+                << " epoll_ctl " << load.epoll_ctl_calls.load(std::memory_order_relaxed) \
+                << " recv " << load.recv_calls.load(std::memory_order_relaxed) \
+                << " send " << load.send_calls.load(std::memory_order_relaxed) \
+                << "\n";
+        }
+        return oss.str();
+    }
+
+private:
+    Load_Table(const Load_Table &) = delete;
+    Load_Table &operator=(const Load_Table &) = delete;
+
+    ChildLoad *_slots;
+    int _slot_num;
+};
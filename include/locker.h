@@ -4,13 +4,17 @@
 #include <pthread.h>
 #include <exception>
 #include <assert.h>
+#include <time.h>
+#include <errno.h>
 
 class Sem {
 private:
     sem_t _sem;
 public:
     Sem() {
-        assert(sem_init(&_sem, 0, 0) != 0);
+        int ret = sem_init(&_sem, 0, 0);
+        assert(ret == 0);
+        (void)ret;
     }
     ~Sem() {
         sem_destroy(&_sem);
@@ -18,6 +22,21 @@ public:
     bool wait() {
         return sem_wait(&_sem) == 0;
     }
+    // 最多等待timeout_ms毫秒，超时返回false
+    bool timed_wait(int timeout_ms) {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeout_ms / 1000;
+        ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        while (sem_timedwait(&_sem, &ts) != 0) {
+            if (errno != EINTR) return false;
+        }
+        return true;
+    }
     bool post() {
         return sem_post(&_sem) == 0;
     }
@@ -28,7 +47,9 @@ private:
     pthread_mutex_t _mutex;
 public:
     Locker() {
-        assert(pthread_mutex_init(&_mutex, NULL) == 0);
+        int ret = pthread_mutex_init(&_mutex, NULL);
+        assert(ret == 0);
+        (void)ret;
     }
     ~Locker() {
         pthread_mutex_destroy(&_mutex);
@@ -39,4 +60,36 @@ public:
     bool unlock() {
         return pthread_mutex_unlock(&_mutex) == 0;
     }
-};
\ No newline at end of file
+};
+// 位于共享内存中、跨进程使用的互斥锁（必须在fork之前于共享内存中构造）
+// 持有锁的进程崩溃时，下一个加锁者接管锁（EOWNERDEAD），不会永久阻塞
+class Shared_Locker {
+private:
+    pthread_mutex_t _mutex;
+public:
+    Shared_Locker() {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        int ret = pthread_mutex_init(&_mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        assert(ret == 0);
+        (void)ret;
+    }
+    ~Shared_Locker() {
+        pthread_mutex_destroy(&_mutex);
+    }
+    bool lock() {
+        int ret = pthread_mutex_lock(&_mutex);
+        if (ret == EOWNERDEAD) {
+            // 被保护的数据可能只更新了一半，由使用者自行容错
+            pthread_mutex_consistent(&_mutex);
+            ret = 0;
+        }
+        return ret == 0;
+    }
+    bool unlock() {
+        return pthread_mutex_unlock(&_mutex) == 0;
+    }
+};
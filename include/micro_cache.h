@@ -0,0 +1,554 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <new>
+#include <iostream>
+#include <sstream>
+#include "server_config.h"
+#include "locker.h"
+#include "utils.h"
+
+#define MICROCACHE_WAYS 8               // 组相联：一个键只能放在所属组的8个槽中
+#define MICROCACHE_SKETCH_DEPTH 4       // 频率估计（count-min）的行数
+#define MICROCACHE_SKETCH_MAX 15        // 每个计数器4位
+#define MICROCACHE_SAMPLE_FACTOR 10     // 累计这么多倍槽数的访问后计数器减半（老化）
+#define MICROCACHE_PASS_MS 10000        // 不可缓存的响应：这段时间内同一URL直接回源，不再排队等待
+#define MICROCACHE_WAIT_POLL_MS 5       // 等待其他请求回源时，重新查询缓存的周期
+
+// 查询缓存的结果
+enum CACHE_LOOKUP {
+    CL_BYPASS = 0,  // 不使用缓存：直接回源（没有可用的槽、新键的频率不够替换已有项，或已知不可缓存）
+    CL_HIT,         // 新鲜的响应
+    CL_STALE,       // 已过期但在stale-while-revalidate期内，另一个请求正在回源更新
+    CL_FILL,        // 缓存中没有：调用者回源并commit/abandon，同一URL的其他请求等待它
+    CL_REFRESH,     // 已过期：调用者回源更新，其他请求继续使用旧响应
+    CL_WAIT         // 另一个请求正在回源，稍后再查
+};
+
+// 回源填充/更新时持有的槽
+struct Cache_Handle {
+    int slot = -1;
+    uint64_t token = 0;     // 回源锁的持有者：锁超时被其他请求接管后，旧持有者不能再写入
+};
+
+// 微缓存的统计数据（与缓存一起位于共享内存中）
+struct MicroCacheMetrics {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> stale_hits{0};        // 使用了过期的响应（有请求正在更新）
+    std::atomic<uint64_t> fills{0};             // 未命中，回源填充
+    std::atomic<uint64_t> refreshes{0};         // 过期，回源更新
+    std::atomic<uint64_t> waits{0};             // 等待其他请求回源的次数
+    std::atomic<uint64_t> bypasses{0};
+    std::atomic<uint64_t> stores{0};            // 写入缓存的响应数
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> admission_rejects{0}; // TinyLFU：新键的频率不高于被替换项，不替换
+    std::atomic<uint64_t> sketch_additions{0};  // 本轮老化以来的访问数
+    std::atomic<uint64_t> next_token{1};
+};
+
+/**
+ * desc: 代理响应的微缓存
+ *      - 位于fork之前创建的共享内存中，全部子进程共用；定长的槽，每个槽最多
+ *        microcache_entry_bytes字节（URL + 响应头 + 响应体）
+ *      - 组相联：每组MICROCACHE_WAYS个槽，各有一把跨进程的锁，查询/写入时在锁内拷贝
+ *      - 淘汰：组内空槽、已彻底过期的槽优先，否则选最久未访问的槽；
+ *        替换有效的项之前用TinyLFU判断：新键的访问频率（count-min，4位计数器，
+ *        定期减半）高于被替换项才替换，使偶发的URL冲不掉热门的响应
+ *      - 合并回源：未命中时第一个请求拿到回源锁，同一URL的其他请求等待它写入；
+ *        过期后在stale-while-revalidate期内，一个请求回源更新，其他请求使用旧响应
+ *      - 回源锁有超时：持有者出错或崩溃后，等待者接管
+ */
+class Micro_Cache {
+public:
+    Micro_Cache() {}
+
+    ~Micro_Cache() {
+        if (_mem) {
+            munmap(_mem, _mem_size);
+        }
+    }
+
+    // 创建共享的缓存，必须在fork之前调用
+    bool create(const ServerConfig &config) {
+
+        if (!config.microcache) return true;
+
+        _entry_bytes = config.microcache_entry_bytes;
+        _stale_ms = config.microcache_stale_ms;
+        _lock_timeout_us = config.microcache_lock_timeout_ms * 1000ULL;
+        _stride = (sizeof(Slot) + _entry_bytes + 63) & ~(size_t)63;
+
+        // 先按总大小估算组数，再扣除锁和计数器占用的空间
+        size_t set_bytes = _stride * MICROCACHE_WAYS + sizeof(Shared_Locker);
+        _set_num = config.microcache_bytes / set_bytes;
+        while (_set_num > 0) {
+            _sketch_width = 1024;
+            while (_sketch_width < _set_num * MICROCACHE_WAYS * 8) _sketch_width <<= 1;
+            if (_layout_bytes() <= config.microcache_bytes) break;
+            --_set_num;
+        }
+        if (_set_num == 0) {
+            std::cout << "microcache: " << config.microcache_bytes << " bytes cannot hold one set of " \
+                << MICROCACHE_WAYS << " entries" << std::endl;
+            return false;
+        }
+
+        _mem_size = _layout_bytes();
+        void *addr = mmap(NULL, _mem_size, PROT_READ | PROT_WRITE, \
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::cout << "mmap() microcache failed, errno: " << errno << std::endl;
+            return false;
+        }
+
+        // 匿名映射已清零：槽的状态为SS_EMPTY，计数器为0
+        _mem = addr;
+        char *p = (char *)addr;
+        _metrics = new (p) MicroCacheMetrics();
+        p += _align(sizeof(MicroCacheMetrics));
+        _locks = (Shared_Locker *)p;
+        for (size_t i = 0; i < _set_num; ++i) new (&_locks[i]) Shared_Locker();
+        p += _align(sizeof(Shared_Locker) * _set_num);
+        _sketch = (std::atomic<uint8_t> *)p;
+        p += _align(_sketch_width * MICROCACHE_SKETCH_DEPTH);
+        _slots = p;
+
+        std::cout << "microcache: " << _set_num * MICROCACHE_WAYS << " entries of " \
+            << _entry_bytes << " bytes" << std::endl;
+        return true;
+    }
+
+    bool enabled() const {
+        return _mem != NULL;
+    }
+
+    size_t entry_bytes() const {
+        return _entry_bytes;
+    }
+
+    /**
+     * 查询key（Host + URL）
+     * CL_HIT/CL_STALE：header为缓存的状态行和首部（不含结尾的空行），body为响应体，age_s为已缓存的秒数
+     * CL_FILL/CL_REFRESH：handle为调用者持有的回源锁，回源结束后必须commit或abandon
+     */
+    CACHE_LOOKUP lookup(const std::string &key, Cache_Handle *handle, \
+            std::string *header, std::string *body, uint32_t *age_s) {
+
+        uint64_t hash = _hash(key);
+        _record_access(hash);
+
+        if (key.size() > _entry_bytes) {
+            _metrics->bypasses.fetch_add(1, std::memory_order_relaxed);
+            return CL_BYPASS;
+        }
+
+        size_t set = hash % _set_num;
+        uint64_t now = now_us();
+        CACHE_LOOKUP result = CL_BYPASS;
+
+        _locks[set].lock();
+        Slot *slot = _find(set, hash, key);
+        if (slot != NULL) {
+            result = _lookup_slot(slot, now, handle, header, body, age_s);
+        }else {
+            slot = _claim(set, hash, key, now);
+            if (slot != NULL) {
+                _lock_for_fill(slot, now, handle);
+                result = CL_FILL;
+            }
+        }
+        if (slot != NULL) handle->slot = _index_of(slot);
+        _locks[set].unlock();
+
+        switch (result) {
+            case CL_HIT: _metrics->hits.fetch_add(1, std::memory_order_relaxed); break;
+            case CL_STALE: _metrics->stale_hits.fetch_add(1, std::memory_order_relaxed); break;
+            case CL_FILL: _metrics->fills.fetch_add(1, std::memory_order_relaxed); break;
+            case CL_REFRESH: _metrics->refreshes.fetch_add(1, std::memory_order_relaxed); break;
+            case CL_WAIT: _metrics->waits.fetch_add(1, std::memory_order_relaxed); break;
+            case CL_BYPASS: _metrics->bypasses.fetch_add(1, std::memory_order_relaxed); break;
+        }
+        return result;
+    }
+
+    // 写入回源得到的响应；超出槽大小时按不可缓存处理
+    void commit(const Cache_Handle &handle, const std::string &header, const std::string &body, \
+            uint64_t ttl_ms, uint64_t stale_ms) {
+
+        size_t set = handle.slot / MICROCACHE_WAYS;
+        uint64_t now = now_us();
+
+        _locks[set].lock();
+        Slot *slot = _slot(handle.slot);
+        if (slot->token == handle.token && slot->state != SS_EMPTY) {
+
+            if (slot->key_len + header.size() + body.size() > _entry_bytes) {
+                _release_lock(slot, now, true);     // 太大，之后直接回源
+            }else {
+                memcpy(slot->data + slot->key_len, header.data(), header.size());
+                memcpy(slot->data + slot->key_len + header.size(), body.data(), body.size());
+                slot->header_len = header.size();
+                slot->body_len = body.size();
+                slot->state = SS_READY;
+                slot->stored_us = now;
+                slot->expires_us = now + ttl_ms * 1000;
+                slot->stale_until_us = slot->expires_us + stale_ms * 1000;
+                slot->lock_until_us = 0;
+                slot->token = 0;
+                _metrics->stores.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        _locks[set].unlock();
+    }
+
+    // 放弃回源锁；uncacheable为true表示响应不可缓存，之后一段时间同一URL直接回源
+    void abandon(const Cache_Handle &handle, bool uncacheable) {
+
+        size_t set = handle.slot / MICROCACHE_WAYS;
+        _locks[set].lock();
+        Slot *slot = _slot(handle.slot);
+        if (slot->token == handle.token && slot->state != SS_EMPTY) {
+            _release_lock(slot, now_us(), uncacheable);
+        }
+        _locks[set].unlock();
+    }
+
+    // 没有stale-while-revalidate时使用的过期后宽限
+    uint64_t default_stale_ms() const {
+        return _stale_ms;
+    }
+
+    /**
+     * 根据上游的响应头判断是否可以缓存
+     * head为状态行和首部（不含结尾的空行），可缓存时返回true并给出有效期
+     * stale_ms为响应的stale-while-revalidate，没有时为-1
+     */
+    static bool cache_policy(int status, const std::string &head, int64_t *ttl_ms, int64_t *stale_ms) {
+
+        if (status != 200 && status != 203 && status != 301 && status != 404) return false;
+
+        int64_t max_age = -1, s_maxage = -1;
+        *stale_ms = -1;
+        time_t expires = -1, date = -1;
+
+        size_t pos = head.find("\r\n");
+        while (pos != std::string::npos && pos + 2 < head.size()) {
+            pos += 2;
+            size_t next = head.find("\r\n", pos);
+            std::string line = head.substr(pos, next == std::string::npos ? std::string::npos : next - pos);
+            pos = next;
+
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string name = line.substr(0, colon);
+            size_t vbeg = line.find_first_not_of(" \t", colon + 1);
+            std::string value = vbeg == std::string::npos ? "" : line.substr(vbeg);
+
+            if (strcasecmp(name.c_str(), "Cache-Control") == 0) {
+                if (strcasestr(value.c_str(), "no-store") || strcasestr(value.c_str(), "no-cache") || \
+                        strcasestr(value.c_str(), "private")) {
+                    return false;
+                }
+                _directive(value, "s-maxage=", &s_maxage);
+                _directive(value, "max-age=", &max_age);
+                _directive(value, "stale-while-revalidate=", stale_ms);
+            }else if (strcasecmp(name.c_str(), "Expires") == 0) {
+                expires = _parse_http_date(value);
+                if (expires == -1) expires = 0;     // 无效的日期视为已过期
+            }else if (strcasecmp(name.c_str(), "Date") == 0) {
+                date = _parse_http_date(value);
+            }else if (strcasecmp(name.c_str(), "Set-Cookie") == 0 || \
+                    strcasecmp(name.c_str(), "Vary") == 0) {
+                return false;   // 因人而异的响应
+            }
+        }
+
+        // s-maxage优先于max-age，max-age优先于Expires
+        if (s_maxage >= 0) {
+            *ttl_ms = s_maxage * 1000;
+        }else if (max_age >= 0) {
+            *ttl_ms = max_age * 1000;
+        }else if (expires >= 0) {
+            *ttl_ms = ((int64_t)expires - (date >= 0 ? date : time(NULL))) * 1000;
+        }else {
+            return false;
+        }
+        if (*stale_ms > 0) *stale_ms *= 1000;
+        return *ttl_ms > 0;
+    }
+
+    const MicroCacheMetrics *metrics() const {
+        return _metrics;
+    }
+
+    std::string report() const {
+
+        std::ostringstream oss;
+        if (!enabled()) return "microcache disabled\n";
+        oss << "microcache hits " << _metrics->hits.load(std::memory_order_relaxed) \
+            << " stale " << _metrics->stale_hits.load(std::memory_order_relaxed) \
+            << " fills " << _metrics->fills.load(std::memory_order_relaxed) \
+            << " refreshes " << _metrics->refreshes.load(std::memory_order_relaxed) \
+            << " waits " << _metrics->waits.load(std::memory_order_relaxed) \
+            << " bypasses " << _metrics->bypasses.load(std::memory_order_relaxed) \
+            << " stores " << _metrics->stores.load(std::memory_order_relaxed) \
+            << " evictions " << _metrics->evictions.load(std::memory_order_relaxed) \
+            << " admission_rejects " << _metrics->admission_rejects.load(std::memory_order_relaxed) \
+            << "\n";
+        return oss.str();
+    }
+
+private:
+    Micro_Cache(const Micro_Cache &) = delete;
+    Micro_Cache &operator=(const Micro_Cache &) = delete;
+
+    enum SLOT_STATE {
+        SS_EMPTY = 0,
+        SS_FILLING,     // 已占用，第一个请求正在回源
+        SS_READY,       // 有响应
+        SS_PASS         // 响应不可缓存，expires_us之前直接回源
+    };
+
+    // 槽头，之后是数据：URL + 响应头 + 响应体；只在所属组的锁内访问
+    struct Slot {
+        uint64_t hash;
+        uint32_t state;
+        uint32_t key_len;
+        uint32_t header_len;
+        uint32_t body_len;
+        uint64_t stored_us;
+        uint64_t expires_us;
+        uint64_t stale_until_us;
+        uint64_t lock_until_us;     // 回源锁的期限，0表示没有请求在回源
+        uint64_t token;
+        uint64_t last_access_us;
+        char data[];
+    };
+
+    void *_mem = NULL;
+    size_t _mem_size = 0;
+    MicroCacheMetrics *_metrics = NULL;
+    Shared_Locker *_locks = NULL;
+    std::atomic<uint8_t> *_sketch = NULL;
+    char *_slots = NULL;
+
+    size_t _entry_bytes = 0;
+    size_t _stride = 0;
+    size_t _set_num = 0;
+    size_t _sketch_width = 0;
+    uint64_t _stale_ms = 0;
+    uint64_t _lock_timeout_us = 0;
+
+    static size_t _align(size_t n) {
+        return (n + 63) & ~(size_t)63;
+    }
+
+    size_t _layout_bytes() const {
+        return _align(sizeof(MicroCacheMetrics)) + _align(sizeof(Shared_Locker) * _set_num) + \
+            _align(_sketch_width * MICROCACHE_SKETCH_DEPTH) + _stride * MICROCACHE_WAYS * _set_num;
+    }
+
+    Slot *_slot(size_t idx) const {
+        return (Slot *)(_slots + idx * _stride);
+    }
+
+    int _index_of(const Slot *slot) const {
+        return ((const char *)slot - _slots) / _stride;
+    }
+
+    // FNV-1a后再混合一次：同一前缀的URL也能均匀分布
+    static uint64_t _hash(const std::string &key) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h | 1;   // 0表示空槽
+    }
+
+    Slot *_find(size_t set, uint64_t hash, const std::string &key) const {
+
+        for (int i = 0; i < MICROCACHE_WAYS; ++i) {
+            Slot *slot = _slot(set * MICROCACHE_WAYS + i);
+            if (slot->state != SS_EMPTY && slot->hash == hash && slot->key_len == key.size() && \
+                    memcmp(slot->data, key.data(), key.size()) == 0) {
+                return slot;
+            }
+        }
+        return NULL;
+    }
+
+    CACHE_LOOKUP _lookup_slot(Slot *slot, uint64_t now, Cache_Handle *handle, \
+            std::string *header, std::string *body, uint32_t *age_s) {
+
+        slot->last_access_us = now;
+        switch (slot->state) {
+            case SS_PASS:
+                if (now < slot->expires_us) return CL_BYPASS;
+                _lock_for_fill(slot, now, handle);
+                return CL_FILL;
+
+            case SS_FILLING:
+                if (now < slot->lock_until_us) return CL_WAIT;
+                _lock_for_fill(slot, now, handle);     // 持有者超时：接管
+                return CL_FILL;
+
+            case SS_READY:
+                if (now < slot->expires_us) {
+                    _copy_out(slot, now, header, body, age_s);
+                    return CL_HIT;
+                }
+                if (now < slot->stale_until_us) {
+                    if (now < slot->lock_until_us) {
+                        _copy_out(slot, now, header, body, age_s);
+                        return CL_STALE;
+                    }
+                    slot->lock_until_us = now + _lock_timeout_us;
+                    slot->token = _metrics->next_token.fetch_add(1, std::memory_order_relaxed);
+                    handle->token = slot->token;
+                    return CL_REFRESH;
+                }
+                _lock_for_fill(slot, now, handle);     // 过期太久：和未命中一样
+                return CL_FILL;
+
+            default:
+                return CL_BYPASS;
+        }
+    }
+
+    void _lock_for_fill(Slot *slot, uint64_t now, Cache_Handle *handle) {
+        slot->state = SS_FILLING;
+        slot->header_len = slot->body_len = 0;
+        slot->lock_until_us = now + _lock_timeout_us;
+        slot->token = _metrics->next_token.fetch_add(1, std::memory_order_relaxed);
+        handle->token = slot->token;
+    }
+
+    void _release_lock(Slot *slot, uint64_t now, bool uncacheable) {
+
+        if (uncacheable) {
+            slot->state = SS_PASS;
+            slot->header_len = slot->body_len = 0;
+            slot->expires_us = now + MICROCACHE_PASS_MS * 1000ULL;
+        }else if (slot->state == SS_FILLING) {
+            slot->state = SS_EMPTY;
+            slot->hash = 0;
+        }
+        slot->lock_until_us = 0;
+        slot->token = 0;
+    }
+
+    void _copy_out(const Slot *slot, uint64_t now, std::string *header, std::string *body, uint32_t *age_s) {
+        header->assign(slot->data + slot->key_len, slot->header_len);
+        body->assign(slot->data + slot->key_len + slot->header_len, slot->body_len);
+        *age_s = (now - slot->stored_us) / 1000000;
+    }
+
+    // 为新键选择一个槽，没有可用的槽或新键不被接纳时返回NULL
+    Slot *_claim(size_t set, uint64_t hash, const std::string &key, uint64_t now) {
+
+        Slot *victim = NULL;
+        bool victim_live = true;
+        for (int i = 0; i < MICROCACHE_WAYS; ++i) {
+            Slot *slot = _slot(set * MICROCACHE_WAYS + i);
+
+            // 空槽、彻底过期的响应、超时的回源锁可以直接使用
+            bool dead = slot->state == SS_EMPTY || \
+                (slot->state == SS_READY && now >= slot->stale_until_us && now >= slot->lock_until_us) || \
+                (slot->state == SS_FILLING && now >= slot->lock_until_us) || \
+                (slot->state == SS_PASS && now >= slot->expires_us);
+            if (dead) {
+                victim = slot;
+                victim_live = false;
+                break;
+            }
+
+            // 正在回源的槽不能替换
+            if (now < slot->lock_until_us) continue;
+            if (victim == NULL || slot->last_access_us < victim->last_access_us) {
+                victim = slot;
+            }
+        }
+        if (victim == NULL) return NULL;
+
+        if (victim_live) {
+            if (_frequency(hash) <= _frequency(victim->hash)) {
+                _metrics->admission_rejects.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+            _metrics->evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        victim->hash = hash;
+        victim->key_len = key.size();
+        memcpy(victim->data, key.data(), key.size());
+        victim->last_access_us = now;
+        return victim;
+    }
+
+// 访问频率的估计（count-min sketch），计数器的更新不加锁，偶尔丢失一次计数无妨
+
+    size_t _sketch_index(uint64_t hash, int row) const {
+        uint64_t h = hash + (uint64_t)row * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 29;
+        return row * _sketch_width + (h & (_sketch_width - 1));
+    }
+
+    void _record_access(uint64_t hash) {
+
+        for (int row = 0; row < MICROCACHE_SKETCH_DEPTH; ++row) {
+            std::atomic<uint8_t> &c = _sketch[_sketch_index(hash, row)];
+            uint8_t v = c.load(std::memory_order_relaxed);
+            if (v < MICROCACHE_SKETCH_MAX) c.store(v + 1, std::memory_order_relaxed);
+        }
+
+        // 老化：累计的访问数达到槽数的若干倍后全部减半，使过去的热点逐渐让位
+        uint64_t limit = _set_num * MICROCACHE_WAYS * MICROCACHE_SAMPLE_FACTOR;
+        if (_metrics->sketch_additions.fetch_add(1, std::memory_order_relaxed) + 1 == limit) {
+            for (size_t i = 0; i < _sketch_width * MICROCACHE_SKETCH_DEPTH; ++i) {
+                uint8_t v = _sketch[i].load(std::memory_order_relaxed);
+                if (v) _sketch[i].store(v >> 1, std::memory_order_relaxed);
+            }
+            _metrics->sketch_additions.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint8_t _frequency(uint64_t hash) const {
+        uint8_t freq = MICROCACHE_SKETCH_MAX;
+        for (int row = 0; row < MICROCACHE_SKETCH_DEPTH; ++row) {
+            freq = std::min<uint8_t>(freq, _sketch[_sketch_index(hash, row)].load(std::memory_order_relaxed));
+        }
+        return freq;
+    }
+
+// 解析响应头
+
+    // 取出Cache-Control中name=N的秒数
+    static void _directive(const std::string &value, const char *name, int64_t *out) {
+        const char *p = strcasestr(value.c_str(), name);
+        if (p == NULL) return;
+        *out = strtoll(p + strlen(name), NULL, 10);
+    }
+
+    // HTTP日期（IMF-fixdate）："Sun, 06 Nov 1994 08:49:37 GMT"，无效返回-1
+    static time_t _parse_http_date(const std::string &value) {
+        tm t;
+        memset(&t, 0, sizeof(t));
+        const char *end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S", &t);
+        if (end == NULL) return -1;
+        return timegm(&t);
+    }
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <array>
+#include <string>
+
+#define MIME_SLOTS 256          // 完美哈希的槽数（2的幂）
+#define MIME_EXT_MAX 12         // 扩展名的最大长度
+#define MIME_DEFAULT "application/octet-stream"
+
+struct Mime_Entry {
+    const char *ext;    // 小写，不含'.'
+    const char *type;
+};
+
+// 常见的扩展名，编译时生成完美哈希表
+static constexpr Mime_Entry MIME_TYPES[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"xml", "application/xml"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"csv", "text/csv; charset=utf-8"},
+    {"md", "text/markdown; charset=utf-8"},
+    {"yaml", "application/yaml"},
+    {"yml", "application/yaml"},
+    {"rss", "application/rss+xml"},
+    {"atom", "application/atom+xml"},
+    {"webmanifest", "application/manifest+json"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"apng", "image/apng"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"ico", "image/x-icon"},
+    {"bmp", "image/bmp"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"ogv", "video/ogg"},
+    {"ogg", "audio/ogg"},
+    {"mp3", "audio/mpeg"},
+    {"wav", "audio/wav"},
+    {"m4a", "audio/mp4"},
+    {"flac", "audio/flac"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"tar", "application/x-tar"},
+    {"wasm", "application/wasm"},
+};
+
+static constexpr size_t MIME_COUNT = sizeof(MIME_TYPES) / sizeof(MIME_TYPES[0]);
+static_assert(MIME_COUNT < 0xff, "MIME table too large for uint8_t slots");
+
+// 编译时构造扩展名的完美哈希
+class Mime_Perfect_Hash final {
+public:
+    static constexpr char lower(char c) {
+        return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    static constexpr uint32_t hash(const char *s, size_t len, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (uint8_t)lower(s[i]);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    static constexpr size_t length(const char *s) {
+        size_t n = 0;
+        while (s[n]) ++n;
+        return n;
+    }
+
+    // 第一个使全部扩展名落在不同槽中的种子
+    static constexpr uint32_t find_seed() {
+        for (uint32_t seed = 1; ; ++seed) {
+            bool used[MIME_SLOTS] = {};
+            bool ok = true;
+            for (size_t i = 0; i < MIME_COUNT && ok; ++i) {
+                uint32_t slot = hash(MIME_TYPES[i].ext, length(MIME_TYPES[i].ext), seed) & (MIME_SLOTS - 1);
+                ok = !used[slot];
+                used[slot] = true;
+            }
+            if (ok) return seed;
+        }
+    }
+
+    static constexpr std::array<uint8_t, MIME_SLOTS> build_slots(uint32_t seed) {
+        std::array<uint8_t, MIME_SLOTS> slots{};
+        for (size_t i = 0; i < MIME_SLOTS; ++i) slots[i] = 0xff;
+        for (size_t i = 0; i < MIME_COUNT; ++i) {
+            slots[hash(MIME_TYPES[i].ext, length(MIME_TYPES[i].ext), seed) & (MIME_SLOTS - 1)] = i;
+        }
+        return slots;
+    }
+};
+
+// desc: 扩展名 -> MIME类型，Accept首部的协商
+//      扩展名表在编译时找到一个没有冲突的种子（FNV-1a），查找只需一次哈希和一次比较；
+//      文件的类型在路径解析时确定一次，随解析结果缓存
+//      Accept按RFC 9110 12.5.1：取最具体的匹配（type/subtype > type/* > */*）的q值，
+//      不分配内存
+class Mime_Util final {
+public:
+    // 扩展名（不含'.'，不区分大小写）对应的类型，没有时返回NULL
+    static const char *lookup(const char *ext, size_t len) {
+
+        if (len == 0 || len > MIME_EXT_MAX) return NULL;
+        uint8_t idx = SLOTS[Mime_Perfect_Hash::hash(ext, len, SEED) & (MIME_SLOTS - 1)];
+        if (idx == 0xff) return NULL;
+
+        const Mime_Entry &entry = MIME_TYPES[idx];
+        if (strlen(entry.ext) != len) return NULL;
+        for (size_t i = 0; i < len; ++i) {
+            if (Mime_Perfect_Hash::lower(ext[i]) != entry.ext[i]) return NULL;
+        }
+        return entry.type;
+    }
+
+    // 路径最后一段的扩展名对应的类型，未知时为application/octet-stream
+    static const char *for_path(const std::string &path) {
+
+        size_t slash = path.rfind('/');
+        size_t dot = path.rfind('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return MIME_DEFAULT;
+        const char *type = lookup(path.c_str() + dot + 1, path.size() - dot - 1);
+        return type ? type : MIME_DEFAULT;
+    }
+
+    /**
+     * Accept首部对type（可以带参数，如"; charset=utf-8"）的q值，单位为千分之一：
+     *  0表示不可接受；没有匹配的媒体范围也是0
+     *  accept为空时返回1000
+     */
+    static int accept_quality(const char *accept, const char *type) {
+
+        if (accept == NULL || *accept == '\0') return 1000;
+
+        size_t type_len = strcspn(type, ";");
+        while (type_len > 0 && type[type_len - 1] == ' ') --type_len;
+        const char *slash = (const char *)memchr(type, '/', type_len);
+        size_t major_len = slash ? slash - type : type_len;
+
+        int best_specificity = 0;
+        int best_q = 0;
+        const char *p = accept;
+        while (*p) {
+            // 一个媒体范围："type/subtype *( OWS ; OWS param )"
+            while (*p == ' ' || *p == '\t' || *p == ',') ++p;
+            if (*p == '\0') break;
+            const char *range = p;
+            while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') ++p;
+            size_t range_len = p - range;
+
+            int q = 1000;
+            while (*p && *p != ',') {
+                if (*p == ';') {
+                    ++p;
+                    while (*p == ' ' || *p == '\t') ++p;
+                    if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') q = _parse_q(p + 2);
+                    continue;
+                }
+                ++p;
+            }
+
+            int specificity = 0;
+            if (range_len == 3 && memcmp(range, "*/*", 3) == 0) {
+                specificity = 1;
+            }else if (range_len == major_len + 2 && strncasecmp(range, type, major_len) == 0 && \
+                    range[major_len] == '/' && range[major_len + 1] == '*') {
+                specificity = 2;
+            }else if (range_len == type_len && strncasecmp(range, type, type_len) == 0) {
+                specificity = 3;
+            }
+            if (specificity > best_specificity) {
+                best_specificity = specificity;
+                best_q = q;
+            }
+        }
+        return best_q;
+    }
+
+private:
+    // "0.5" -> 500，格式错误按1000
+    static int _parse_q(const char *p) {
+        if (*p == '1') return 1000;
+        if (*p != '0') return 1000;
+        int q = 0, scale = 100;
+        if (*++p == '.') {
+            while (*++p >= '0' && *p <= '9' && scale > 0) {
+                q += (*p - '0') * scale;
+                scale /= 10;
+            }
+        }
+        return q;
+    }
+
+    static constexpr uint32_t SEED = Mime_Perfect_Hash::find_seed();
+    static constexpr std::array<uint8_t, MIME_SLOTS> SLOTS = Mime_Perfect_Hash::build_slots(SEED);
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include "locker.h"
+#include "server_config.h"
+#include "utils.h"
+#include "conditional.h"
+#include "mime.h"
+
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#define PATH_CACHE_SHARDS 16
+
+// URL解析的结果
+enum RESOLVE_STATUS {
+    RP_FILE = 0,        // 根目录下的普通文件
+    RP_NOT_FOUND,       // 不存在（负缓存）
+    RP_FORBIDDEN,       // 试图访问根目录之外（..越界或符号链接指向外部）
+    RP_BAD,             // 百分号编码错误或含有NUL
+    RP_OTHER            // 目录、没有权限等，交给原有流程处理
+};
+
+// 一个URL解析后的结果，进入缓存后只读
+struct Resolved_Path {
+    RESOLVE_STATUS status = RP_OTHER;
+    std::string rel;        // 相对于根目录的路径（openat使用）
+    std::string abs;        // 绝对路径（文件缓存的键）
+    off_t size = 0;
+    time_t mtime = 0;
+    ino_t ino = 0;
+
+    // 文件的验证器（RP_FILE）：ETag为"mtime-size"（十六进制），
+    // validator_lines是304响应中的ETag/Last-Modified首部，解析时生成一次
+    std::string etag;
+    std::string validator_lines;
+
+    // 按扩展名确定的Content-Type（RP_FILE），指向Mime_Util的静态表
+    const char *content_type = MIME_DEFAULT;
+};
+
+/**
+ * desc: 静态文件的路径解析
+ *      URL先百分号解码，再去掉"."、".."和重复的'/'，越过根目录的请求直接拒绝；
+ *      文件以根目录fd为起点用openat2(RESOLVE_BENEATH)打开，符号链接也不能指向根目录之外
+ *      （内核不支持openat2时退回openat，此时只依靠规范化）
+ *      根目录在fork之前打开，子进程继承；解析结果按URL的路径部分（不含查询串和片段）
+ *      缓存在每个子进程中，包括不存在的结果，有效期path_cache_ttl_ms，命中时不访问文件系统
+ *      （文件在有效期内被修改时，缓存的验证器最多滞后这么久）
+ */
+class Path_Resolver final {
+public:
+    static Path_Resolver &instance() {
+        static Path_Resolver resolver;
+        return resolver;
+    }
+
+    // 打开根目录，失败时不启用（请求按原有方式拼接路径）
+    bool open_root(const std::string &root, const ServerConfig &config) {
+
+        _root_fd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (_root_fd < 0) return false;
+        _root = root;
+        _shard_capacity = config.path_cache_entries / PATH_CACHE_SHARDS;
+        _ttl_us = (uint64_t)config.path_cache_ttl_ms * 1000;
+        return true;
+    }
+
+    bool enabled() const {
+        return _root_fd >= 0;
+    }
+
+    // 解析URL，结果可能来自缓存
+    std::shared_ptr<const Resolved_Path> resolve(const std::string &url) {
+
+        // 查询串不参与解析：?v=1、?v=2这类不同的URL共用一项，不会挤掉其他缓存
+        size_t query = url.find_first_of("?#");
+        if (query != std::string::npos) return resolve(url.substr(0, query));
+
+        uint64_t now = now_us();
+        size_t hash = std::hash<std::string>()(url);
+        Shard &shard = _shards[hash % PATH_CACHE_SHARDS];
+
+        if (_shard_capacity > 0) {
+            shard.locker.lock();
+            auto it = shard.entries.find(url);
+            if (it != shard.entries.end() && it->second.expire_us > now) {
+                std::shared_ptr<const Resolved_Path> hit = it->second.path;
+                shard.locker.unlock();
+                return hit;
+            }
+            shard.locker.unlock();
+        }
+
+        std::shared_ptr<Resolved_Path> path = std::make_shared<Resolved_Path>();
+        _resolve(url, path.get());
+        if (_shard_capacity == 0) return path;
+
+        // 分片满时随便淘汰一项：过期的项同样会被覆盖
+        shard.locker.lock();
+        if (shard.entries.size() >= _shard_capacity && shard.entries.count(url) == 0) {
+            shard.entries.erase(shard.entries.begin());
+        }
+        shard.entries[url] = Cache_Slot{path, now + _ttl_us};
+        shard.locker.unlock();
+        return path;
+    }
+
+    // 打开并mmap解析到的文件，st得到文件的状态；失败（或空文件）返回NULL
+    char *map(const Resolved_Path &path, struct stat *st) const {
+
+        int fd = _open_beneath(path.rel.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return NULL;
+
+        char *addr = NULL;
+        if (fstat(fd, st) == 0 && S_ISREG(st->st_mode) && st->st_size > 0) {
+            void *p = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) addr = (char *)p;
+        }
+        close(fd);
+        return addr;
+    }
+
+    // URL的路径部分解码并规范化为相对路径，失败时返回RP_BAD/RP_FORBIDDEN
+    static RESOLVE_STATUS normalize(const std::string &url, std::string *rel, bool *trailing_slash) {
+
+        size_t end = url.find_first_of("?#");
+        if (end == std::string::npos) end = url.size();
+
+        std::string segment;
+        std::vector<size_t> starts;     // rel中每一段的起始位置，".."时回退
+        rel->clear();
+        *trailing_slash = false;
+        for (size_t i = 0; i <= end; ++i) {
+            char c = i < end ? url[i] : '/';
+            if (c == '%' && i < end) {
+                int hi = i + 2 < end ? _hex(url[i + 1]) : -1;
+                int lo = i + 2 < end ? _hex(url[i + 2]) : -1;
+                if (hi < 0 || lo < 0) return RP_BAD;
+                c = (char)(hi << 4 | lo);
+                if (c == '\0') return RP_BAD;
+                i += 2;
+                if (c == '/') return RP_BAD;    // 编码的'/'不作为分隔符，也不允许出现在文件名中
+                segment += c;
+                continue;
+            }
+            if (c != '/') {
+                segment += c;
+                continue;
+            }
+
+            *trailing_slash = segment.empty();
+            if (segment.empty() || segment == ".") {
+                segment.clear();
+                continue;
+            }
+            if (segment == "..") {
+                if (starts.empty()) return RP_FORBIDDEN;
+                rel->resize(starts.back() == 0 ? 0 : starts.back() - 1);
+                starts.pop_back();
+                segment.clear();
+                *trailing_slash = true;
+                continue;
+            }
+            if (!rel->empty()) *rel += '/';
+            starts.push_back(rel->size());
+            *rel += segment;
+            segment.clear();
+        }
+        return RP_FILE;
+    }
+
+private:
+    struct Cache_Slot {
+        std::shared_ptr<const Resolved_Path> path;
+        uint64_t expire_us;
+    };
+
+    struct Shard {
+        Locker locker;
+        std::unordered_map<std::string, Cache_Slot> entries;
+    };
+
+    int _root_fd = -1;
+    std::string _root;
+    size_t _shard_capacity = 0;
+    uint64_t _ttl_us = 0;
+    Shard _shards[PATH_CACHE_SHARDS];
+
+    Path_Resolver() {}
+
+    static int _hex(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // 以根目录为起点打开，路径（包括符号链接）不能离开根目录
+    int _open_beneath(const char *rel, int flags) const {
+
+        if (*rel == '\0') rel = ".";
+#ifdef SYS_openat2
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd = syscall(SYS_openat2, _root_fd, rel, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) return fd;
+#endif
+        return openat(_root_fd, rel, flags);
+    }
+
+    void _resolve(const std::string &url, Resolved_Path *path) const {
+
+        bool trailing_slash = false;
+        path->status = normalize(url, &path->rel, &trailing_slash);
+        if (path->status != RP_FILE) return;
+
+        path->abs = path->rel.empty() ? _root : _root + "/" + path->rel;
+
+        int fd = _open_beneath(path->rel.c_str(), O_PATH | O_CLOEXEC);
+        if (fd < 0) {
+            path->status = errno == ENOENT || errno == ENOTDIR ? RP_NOT_FOUND : \
+                errno == EXDEV || errno == ELOOP ? RP_FORBIDDEN : RP_OTHER;
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && !trailing_slash) {
+            path->size = st.st_size;
+            path->mtime = st.st_mtime;
+            path->ino = st.st_ino;
+
+            char buf[64];
+            snprintf(buf, sizeof(buf), "\"%lx-%lx\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+            path->etag = buf;
+            path->content_type = Mime_Util::for_path(path->rel);
+            Conditional_Util::format_http_date(st.st_mtime, buf);
+            path->validator_lines = "ETag: " + path->etag + "\r\nLast-Modified: " + buf + "\r\n";
+        }else {
+            path->status = RP_OTHER;
+        }
+        close(fd);
+    }
+};
@@ -22,10 +22,32 @@
 
 #include "worker.h"
 #include "heap.h"
+#include "server_config.h"
+#include "cpu_affinity.h"
+#include "load_table.h"
+#include "write_policy.h"
+#include "file_cache.h"
+#include "upgrade.h"
+#include "rate_limiter.h"
+#include "reverse_proxy.h"
+#include "access_log.h"
+#include "router.h"
 
 using namespace std;
 
 #define MAX_CLIENT_NUM 4096
+#define RESERVE_FD_PATH "/dev/null"
+#define DRAIN_POLL_MS 100       // 排空连接期间检查状态的周期
+#define ACCEPT_PAUSE_POLL_MS 10     // 暂停accept期间父进程检查子进程负载的周期
+#define TLS_ROTATE_POLL_MS 1000     // 父进程检查票据密钥是否需要轮换的周期
+#define SHED_DISCARD_MAX 16         // 回复503之前最多丢弃的读缓冲次数
+#define DRAIN_KILL_GRACE_MS 2000    // 子进程超过排空期限这么久仍未退出，父进程SIGKILL
+
+// 子进程的退出状态：父进程据此区分正常退场和崩溃（被信号杀死或其他退出码）
+#define CHILD_EXIT_DRAINED 0        // 排空完成：全部请求处理完、连接关闭后退出
+#define CHILD_EXIT_DRAIN_TIMEOUT 3  // 排空超时：剩余连接被强制关闭
+#define CHILD_EXIT_STOPPED 4        // 收到SIGINT，立即停止
+#define CHILD_EXIT_LOOP_ERROR 5     // 事件循环出错（如epoll_wait失败）
 
 
 template<typename ClientData_t>
@@ -44,19 +66,24 @@ public:
         _pid = rhs._pid;
         _pipefd[0] = rhs._pipefd[0];
         _pipefd[1] = rhs._pipefd[1];
-        _serverd_user_count = rhs._serverd_user_count;
     }
     Process &operator=(const Process &rhs) {
         _pid = rhs._pid;
         _pipefd[0] = rhs._pipefd[0];
         _pipefd[1] = rhs._pipefd[1];
-        _serverd_user_count = rhs._serverd_user_count;
+        return *this;
     }
 private:
 
     pid_t _pid;     // pid
-    int _pipefd[2];  // IPC: using pipe to communicate with parent Process
-    int _serverd_user_count = 0;        // user playload
+    int _pipefd[2];  // IPC: 父进程通过它通知子进程accept
+    // 子进程的负载（服务人数等）不再通过管道上报，见 Load_Table
+};
+
+// 一次accept得到的新连接
+struct Accepted_Conn {
+    int fd;
+    sockaddr_in addr;
 };
 
 /**
@@ -66,20 +93,60 @@ template<typename ClientData_t>
 class ProcessPool {
 private:
     ProcessPool(int listenfd, work_routine_t work_routine, \
-            int process_number = 8): \
+            int process_number = 8, const ServerConfig &config = ServerConfig()): \
         _listen_fd(listenfd), _process_num(process_number), \
-        _process_idx(-1), _thread_pool(work_routine, &thread_task_container) {
+        _process_idx(-1), _config(config), \
+        _thread_pool(work_routine, &thread_task_container, config) {
+
+        // 每个NUMA节点一个子进程：子进程数量由拓扑决定
+        std::vector<std::vector<int>> topology = Cpu_Affinity::detect_topology();
+        if (_config.placement == PP_NUMA_NODE) {
+            _process_num = std::min<int>(topology.size(), (int)MAX_PROCESS_NUM);
+        }
 
         // check valid input
         assert(0 < _process_num && _process_num <= MAX_PROCESS_NUM);
         process_pool.assign(_process_num, Process());
 
+        // 预热文档根目录：在fork之前完成，子进程继承全部映射；
+        // 此时listenfd还没有加入父进程的内核事件表，不会有请求进来
+        if (_config.warmup) {
+            File_Cache::instance().warm_up(server_root, _config);
+        }
+
+        // 根目录同样在fork之前打开，子进程都以它为起点打开文件
+        if (!Path_Resolver::instance().open_root(server_root, _config)) {
+            cout << "path resolver: cannot open " << server_root << ", paths are not normalized" << endl;
+        }
+
+        // 路由在fork之前冻结：之后只读，子进程的各线程查找不需要加锁
+        Router::instance().freeze();
+
+        // 负载表必须在fork之前创建，父子进程才能共享同一块内存
+        bool load_table_ok = _load_table.create(_process_num);
+        assert(load_table_ok);
+        (void)load_table_ok;
+
+        // 限流表同样在fork之前创建：每个IP的限额由全部子进程共同执行
+        _rate_limiter.create(_config);
+
+        // 上游的健康状态同样在fork之前创建，由父进程的健康检查线程更新
+        _reverse_proxy.create(_config);
+
+        // TLS的证书只加载一次，票据密钥放在共享内存中：会话可以在任意子进程恢复
+        // 证书无效时不能退回明文服务
+        if (!_tls_context.create(_config)) {
+            cout << "tls: configuration invalid, exit" << endl;
+            exit(1);
+        }
+
         // 创建process_number个进程
         for (int i = 0; i < _process_num; ++i) {
             
             // create pipe between child process with father process
-            assert(socketpair(PF_UNIX, SOCK_STREAM, 0, \
-                process_pool[i]._pipefd));
+            int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, process_pool[i]._pipefd);
+            assert(ret == 0);
+            (void)ret;
 
             // fork one process
             process_pool[i]._pid = fork();
@@ -89,7 +156,7 @@ private:
             if (process_pool[i]._pid > 0) {    
 
                 // 将子进程所在pool的下标加入到进程调度堆中（比加pid好）
-                _process_heap.insert({i, process_pool[i]._serverd_user_count});
+                _process_heap.insert(i, _load_table[i].score());
 
                 // 关闭和子进程通信管道的一端，因为不使用
                 close(process_pool[i]._pipefd[1]);  // father close write 
@@ -100,18 +167,26 @@ private:
             // 以下只有子进程执行
             close(process_pool[i]._pipefd[0]);      // child close read
             _process_idx = i;   // to identify father or child   
-            _serverd_user_count = 0; 
+
+            // 在分配客户信息表之前完成绑定，使其内存落在本节点
+            _placement = Cpu_Affinity::plan(topology, _config.placement, \
+                i, _process_num);
+            Cpu_Affinity::apply_to_process(_placement, _config.numa_local_memory);
+            Cpu_Affinity::report(i, getpid(), _placement);
+            if (_config.pin_threads) {
+                _thread_pool.set_cpus(_placement.cpus);
+            }
 
             break;
         }
     }
 public:
     // 进程池的静态方法，通过这里创建单例线程池
-    static ProcessPool create(int listenfd, sig_hander handler, \
-            work_routine_t work_routine, int process_number = 8) {
+    static ProcessPool &create(int listenfd, work_routine_t work_routine, \
+            int process_number = 8, const ServerConfig &config = ServerConfig()) {
         if (!Instance) {
-            Instance = new ProcessPool(listenfd, handler, work_routine, \
-                process_number);
+            Instance = new ProcessPool(listenfd, work_routine, \
+                process_number, config);
         }
         return *Instance;
     }
@@ -131,7 +206,10 @@ public:
 
     // 为每个进程统一事件源 (信号源)
     static void setup_sig_pipe() {
-        assert(socketpair(PF_UNIX, SOCK_STREAM, 0, _sig_pipefd) != -1);
+        // 调用不能写在assert里：定义了NDEBUG时会被整个去掉，信号就不会被处理
+        int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, _sig_pipefd);
+        assert(ret != -1);
+        (void)ret;
         Epoll_Util::addfd(_sig_pipefd[0]);
     }
 
@@ -140,6 +218,7 @@ public:
         addsig(SIGCHLD, handler);
         addsig(SIGTERM, handler);
         addsig(SIGINT, handler);
+        addsig(SIGQUIT, handler);
         addsig(SIGPIPE, SIG_IGN);
     }
 
@@ -151,7 +230,10 @@ public:
             run_father();
         }else {                     // 子进程的工作内容
 
-            run_child();   
+            run_child();
+
+            // 子进程不返回调用者：用退出码告诉父进程是如何结束的
+            exit(_child_exit_status);
         }
     }
 
@@ -161,7 +243,54 @@ public:
         // 进程开始工作前的准备工作
         init();
 
-        _thread_pool.create();  // 在进入子进程以后，创建thread_num个线程
+        // 任务容器的排队统计、工作线程的在途/耗时统计都写到本进程的负载项中
+        ChildLoad &load = _load_table[_process_idx];
+        thread_task_container.set_load_slot(&load);
+        thread_task_container.set_io_budget(_config.edge_io_budget);
+        thread_task_container.set_overload_limits(_config.queue_max, \
+            _config.codel_target_us, _config.codel_interval_us);
+        if (_rate_limiter.enabled()) {
+            thread_task_container.set_rate_limiter(&_rate_limiter);
+        }
+        if (_reverse_proxy.enabled()) {
+            _reverse_proxy.init_child();
+            thread_task_container.set_reverse_proxy(&_reverse_proxy);
+        }
+        if (!Router::instance().empty()) {
+            thread_task_container.set_router(&Router::instance());
+        }
+        if (_config.http2 && !_config.edge_triggered) {
+            _h2_settings.max_concurrent_streams = _config.h2_max_concurrent_streams;
+            _h2_settings.initial_window_size = _config.h2_initial_window_size;
+            _h2_settings.max_header_list_size = _config.h2_max_header_list_size;
+            _h2_settings.max_request_body = _config.h2_max_request_body;
+            thread_task_container.set_http2(&_h2_settings);
+        }
+        if (!_config.websocket_paths.empty() && !_config.edge_triggered) {
+            _ws_settings.paths = _config.websocket_paths;
+            _ws_settings.max_message = _config.websocket_max_message;
+            _ws_settings.send_high_water = _config.websocket_send_high_water;
+            _ws_settings.handler = &_ws_echo;
+            thread_task_container.set_websocket(&_ws_settings);
+        }
+        thread_task_container.set_coroutines(CO_SUPPORTED && _config.coroutine_handler && \
+            !_config.edge_triggered);
+        Body_Settings body_settings;
+        body_settings.max_bytes = _config.request_body_max_bytes;
+        body_settings.memory_bytes = _config.request_body_memory_bytes;
+        body_settings.temp_dir = _config.request_body_temp_dir;
+        thread_task_container.set_request_body(body_settings);
+        Write_Policy::configure(_config);
+
+        // 日志线程先于工作线程启动，最后停止：工作线程退出前写的记录都能写出
+        if (!Access_Log::start(_config, &load)) {
+            exit(1);
+        }
+
+        // 空闲TLS连接的大小按进程的堆统计实测，要在工作线程分配内存之前
+        size_t tls_conn_bytes = _tls_context.measure_idle_conn_bytes();
+
+        _thread_pool.create();  // 在进入子进程以后，创建thread_min个线程，之后弹性伸缩
 
         // 和父进程之间的管道 - 父进程通过管道，来告诉子进程可以accept
         // 因为通过socketpair生成，所以任何一端，可读可写
@@ -171,16 +300,40 @@ public:
 
         // 客户信息表 
         // - 下标为clientfd 
-        // - 用于存储每个客户读缓冲区/HTTP_Parser/HTTP_Sender
+        // - 只存储连接本身，读缓冲区/HTTP_Parser/HTTP_Sender在处理请求时才取得
         vector<ClientData_t> client_data(MAX_CLIENT_NUM);
+        ClientData_t::track_memory(load, tls_conn_bytes);
+
+        // listenfd在子进程中设为非阻塞：批量accept直到EAGAIN
+        setnonblocking(_listen_fd);
+
+        // 预留一个fd：fd耗尽(EMFILE)时临时释放它来accept并立即关闭连接，
+        // 否则listenfd一直可读，父子进程会空转
+        _reserve_fd = open(RESERVE_FD_PATH, O_RDONLY | O_CLOEXEC);
+        vector<Accepted_Conn> new_conns;
+        vector<int> expired_proxy_fds;
+        new_conns.reserve(_config.accept_batch);
+
+        // 过载时回复的503：预先生成，reactor不解析请求直接写出
+        _shed_response = "HTTP/1.1 " + \
+            HTTP_UTILS::http_header_response[HTTP_UTILS::SERVICE_UNAVAILABLE] + "\r\n" + \
+            "Content-Length: 0\r\n" + \
+            "Retry-After: " + std::to_string(_config.shed_retry_after_s) + "\r\n" + \
+            "Connection: close\r\n\r\n";
 
         // 子进程开始工作
         while (is_working) {
 
-            // 开始监听事件
-            auto ret = Epoll_Util::wait_for_events();
+            // 开始监听事件（排空期间需要定期检查是否还有连接，
+            // 启用代理时需要定期检查超时、唤醒等待缓存的请求：代理请求由工作线程开始，
+            // 可能不产生任何事件（复用的上游连接上一次就发出了请求），不能等到有请求才限时）
+            auto ret = _draining ? Epoll_Util::wait_for_events(DRAIN_POLL_MS) : \
+                _reverse_proxy.enabled() ? \
+                    Epoll_Util::wait_for_events(_reverse_proxy.sweep_interval_ms()) : \
+                Epoll_Util::wait_for_events();
             epoll_event *events = ret.first;
             int len = ret.second;
+            load.epoll_wait_calls.fetch_add(1, std::memory_order_relaxed);
             
             // check return val status
             if (len < 0 && errno != EINTR) {    
@@ -196,27 +349,73 @@ public:
                 if (sockfd == pipefd && (events[i].events & EPOLLIN)) {
                    // 1. 父进程告诉子进程listenfd有新的连接, 子进程直接accept
 
-                    bool have_new_conn = false;
-                    int ret = recv(pipefd, &have_new_conn, sizeof(have_new_conn), 0);
-                    if (ret <= 0 || !have_new_conn) {
+                    // 父进程可能连续通知了多次，一次全部读出，只accept一轮
+                    bool have_new_conn[64] = {false};
+                    int ret = recv(pipefd, have_new_conn, sizeof(have_new_conn), 0);
+                    if (ret <= 0) {
                         // 这里本应该更细节的处理一下
                         continue;
-                    }else { 
-                        // has new connection
-                        int client_fd;
-                        if (_try_accept_client_connection(&client_fd)) {
-                            // 进行新连接用户数据的添加
-                            
-                            // 1. 将client_fd添加到内核事件表中
-                            Epoll_Util::addfd(client_fd, true);
-
-                            // 2. 更新客户表对应项
-                            client_data[client_fd]._clientfd = client_fd;
-
-                            // 3. 告诉父进程，该子进程服务人数 + 1
-                            int conn_info[2] = {_process_idx, 1};
-                            send(pipefd, conn_info, sizeof(conn_info), 0);
+                    }
+
+                    // has new connection: 一次唤醒最多accept accept_batch个连接
+                    // 且不超过连接数的高水位（父进程的选择和本进程的连接数之间有延迟）
+                    int budget = _config.accept_batch;
+                    if (_config.conn_high_watermark > 0) {
+                        budget = std::min(budget, \
+                            _config.conn_high_watermark - load.active_conns.load());
+                    }
+                    new_conns.clear();
+                    if (budget > 0) {
+                        _accept_client_connections(new_conns, budget);
+                    }
+
+                    // 进行新连接用户数据的添加，一轮处理完全部新连接
+                    int accepted = 0;
+                    for (const Accepted_Conn &conn : new_conns) {
+
+                        // 客户表以fd为下标，超出范围的连接无法服务
+                        if (conn.fd >= MAX_CLIENT_NUM) {
+                            close(conn.fd);
+                            continue;
+                        }
+
+                        // 来源IP/前缀新建连接过快：直接关闭，不占用客户表和工作线程
+                        uint32_t peer_ip = conn.addr.sin_addr.s_addr;
+                        if (!_rate_limiter.allow_connection(peer_ip)) {
+                            close(conn.fd);
+                            continue;
+                        }
+
+                        // TLS连接的握手由工作线程在EPOLLIN/EPOLLOUT上推进
+                        Tls_Conn *tls = NULL;
+                        if (_tls_context.enabled() && (tls = _tls_context.accept(conn.fd)) == NULL) {
+                            close(conn.fd);
+                            continue;
+                        }
+
+                        // 1. 更新客户表对应项（该fd上一个连接的状态可能还在）
+                        ClientData_t &client = client_data[conn.fd];
+                        client._tls = tls;
+                        client._clientfd = conn.fd;
+                        client._peer_ip = peer_ip;
+                        client._readable = false;
+                        client._writable = false;
+                        client._scheduled = false;
+                        Write_Policy::on_accept(conn.fd, client._write_state);
+
+                        // 2. 将client_fd添加到内核事件表中
+                        if (_config.edge_triggered) {
+                            Epoll_Util::addfd_et(conn.fd);
+                        }else {
+                            Epoll_Util::addfd(conn.fd, true);
                         }
+                        ++accepted;
+                    }
+
+                    // 3. 该子进程服务人数 + accepted（父进程直接读共享负载表）
+                    if (accepted > 0) {
+                        load.active_conns += accepted;
+                        load.accepted_total += accepted;
                     }
                 }else if (sockfd == _sig_pipefd[0] && (events[i].events & EPOLLIN)) {
                     // 2. 处理信号
@@ -237,14 +436,16 @@ public:
                                 }
                                 break;
                             }
-                            case SIGTERM: case SIGINT:  
-                                // 该子进程结束工作
-
-                                // 服务人数置0，并停止工作
+                            case SIGINT:
+                                // 立即停止：放弃排队的任务
                                 // 父进程会收到SIGCHILD信号
-                                _serverd_user_count = 0;
+                                _child_exit_status = CHILD_EXIT_STOPPED;
                                 is_working = false;
                                 break;
+                            case SIGTERM: case SIGQUIT:
+                                // 平滑退出/旧一代进程退场：停止accept，排空已有连接后退出
+                                _begin_drain(pipefd, load);
+                                break;
                             default:    
                                 // other signal will not be processed.
                                 break;
@@ -254,7 +455,51 @@ public:
                     // 3. 处理客户请求，根据用户到来的请求，
                     //      将其封装为任务，添加到任务容器中去
 
+                    // 上游连接的事件：转成所属客户连接的任务
+                    int owner = _reverse_proxy.owner_of(sockfd);
+                    if (owner >= 0) {
+                        _dispatch_proxy_event(events[i].events | PROXY_EVENT_UPSTREAM, \
+                            client_data[owner]);
+                        continue;
+                    }
+
+                    if (_config.edge_triggered) {
+                        _dispatch_edge_triggered(events[i], client_data[sockfd], load);
+                        continue;
+                    }
+
+                    // 已关闭的连接（例如同一批事件中先处理了它的关闭）残留的事件
+                    if (sockfd >= MAX_CLIENT_NUM || client_data[sockfd]._clientfd != sockfd) {
+                        continue;
+                    }
+
+                    // 代理请求进行中的客户连接
+                    if (client_data[sockfd]._proxying()) {
+                        if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR) && \
+                                !client_data[sockfd]._scheduled.load()) {
+                            _close_client(client_data[sockfd], load);
+                        }else {
+                            _dispatch_proxy_event(events[i].events, client_data[sockfd]);
+                        }
+                        continue;
+                    }
+
+                    // HTTP/2和WebSocket连接：读写都交给同一个任务，需要关闭时注册的是EPOLLOUT
+                    if (client_data[sockfd]._h2.load() || client_data[sockfd]._ws.load()) {
+                        ClientData_t &client = client_data[sockfd];
+                        if ((events[i].events & EPOLLOUT) && client._should_close) {
+                            _close_client(client, load);
+                            continue;
+                        }
+                        epoll_event event;
+                        event.events = events[i].events & (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+                        client._scheduled.store(true);
+                        thread_task_container.add(event, sockfd, &client);
+                        continue;
+                    }
+
                     epoll_event event;
+                    event.events = 0;
                     if (events[i].events & EPOLLIN) {
 
                         event.events |= EPOLLIN;
@@ -263,11 +508,8 @@ public:
                         if (client_data[sockfd]._should_close) {
 
                             // 出现异常：当前用户需要关闭
-                            close(sockfd);
-
-                            // 告诉父进程，当前子进程服务人数 - 1
-                            int conn_info[2] = {_process_idx, -1};
-                            send(pipefd, conn_info, sizeof(conn_info), 0);
+                            // 当前子进程服务人数 - 1
+                            _close_client(client_data[sockfd], load);
                             continue;
                         }
 
@@ -275,19 +517,46 @@ public:
                     }else if (events[i].events & EPOLLRDHUP) {
 
                         // 客户端发起断开连接
-                        close(sockfd);
-
-                        // 告诉父进程，当前子进程服务人数 - 1
-                        int conn_info[2] = {_process_idx, -1};
-                        send(pipefd, conn_info, sizeof(conn_info), 0);
+                        // 当前子进程服务人数 - 1
+                        _close_client(client_data[sockfd], load);
                         continue;
                     }
                     
                     // 通过互斥的方式向任务容器中添加数据
-                    thread_task_container.add(event, sockfd, &client_data[sockfd]);
+                    // 空闲连接上的新请求在过载时被拒绝，直接回复503
+                    ClientData_t &client = client_data[sockfd];
+                    bool sheddable = (event.events & EPOLLIN) && _is_idle_client(client);
+                    client._scheduled.store(true);
+                    if (!thread_task_container.add(event, sockfd, &client, sheddable)) {
+                        client._scheduled.store(false);
+                        _shed_request(client, load);
+                    }
+                }
+            }
+
+            // 代理请求超时：交给工作线程回复504或关闭连接
+            if (_reverse_proxy.active_sessions() > 0) {
+                _sweep_proxy_timeouts(client_data, expired_proxy_fds);
+            }
+
+            // 排空：关闭空闲的长连接，全部连接关闭后退出，超过期限则放弃剩余连接
+            if (_draining && is_working) {
+                _close_idle_clients(client_data, load);
+                if (load.active_conns.load() <= 0) {
+                    _child_exit_status = CHILD_EXIT_DRAINED;
+                    is_working = false;
+                }else if (now_us() >= _drain_deadline_us) {
+                    cout << "process " << _process_idx << " drain deadline exceeded, " \
+                        << load.active_conns.load() << " connections dropped" << endl;
+                    _child_exit_status = CHILD_EXIT_DRAIN_TIMEOUT;
+                    is_working = false;
                 }
             }
         }
+
+        // 停止并join全部工作线程（线程优先响应退出请求，不再处理排队的任务）
+        _thread_pool.stop();
+        Access_Log::stop();
     }
 
     // 父进程真正的工作逻辑
@@ -296,14 +565,8 @@ public:
         // 进程工作前的准备工作
         init();
 
-        // 和父进程之间的管道 - 父进程通过管道，来告诉子进程可以accept
-        // 子进程也可以将消息通过这里告诉父进程
-        // 将每个进程的管道加入到内核事件表中
-        for (int i = 0; i < _process_num; ++i) {
-            if (process_pool[i]._pid != -1) {
-                Epoll_Util::addfd(process_pool[i]._pipefd[0]);
-            }
-        }
+        // 和子进程之间的管道只用于通知子进程accept，父进程不需要监听：
+        // 子进程的负载直接从共享负载表中读取
 
         // 父进程的工作逻辑
         // 1. 监听listenfd
@@ -313,11 +576,24 @@ public:
         // 监听listenfd
         Epoll_Util::addfd(_listen_fd);
 
+        // 热升级的控制socket：新master连接它来接管listenfd
+        if (!_config.upgrade_socket_path.empty()) {
+            _control_fd = Upgrade_Util::listen_control(_config.upgrade_socket_path);
+            if (_control_fd >= 0) Epoll_Util::addfd(_control_fd);
+        }
+
+        // 上游的主动健康检查
+        _reverse_proxy.start_health_checker();
+
         // 父进程开始工作
         while (is_working) {
 
-            // 开始监听事件
-            auto ret = Epoll_Util::wait_for_events();
+            // 开始监听事件（退场期间需要定期检查子进程是否超时，
+            // 暂停accept期间需要定期检查是否可以恢复，启用TLS时需要定期轮换票据密钥）
+            auto ret = _retiring ? Epoll_Util::wait_for_events(DRAIN_POLL_MS) : \
+                _accept_paused ? Epoll_Util::wait_for_events(ACCEPT_PAUSE_POLL_MS) : \
+                _tls_context.rotates_keys() ? Epoll_Util::wait_for_events(TLS_ROTATE_POLL_MS) : \
+                Epoll_Util::wait_for_events();
             epoll_event *events = ret.first;
             int len = ret.second;
 
@@ -343,26 +619,12 @@ public:
                     // 根据策略，选择当前工作负载最小的子进程
                     _choose_min_load_child_process();
 
-                }else if (_check_if_pipefd(sockfd) && (events[i].events & EPOLLIN)) {
-                    // 2. 处理子进程给父进程发送的消息
-                    // （目前我只发送用户人数改变消息）也可以发送其他消息
-
-                    int conn_info[2];   // 其中包含子进程在进程池中的idx与用户增减信息
-                    int ret = recv(pipefd, conn_info, sizeof(conn_info), 0);
-                    if (ret <= 0) {
-                        // 接收管道信息出现问题，则处理下一个epoll_event
-                        continue;   
-                    } 
-
-                    // 更新子进程当前服务的客户数量
-                    process_pool[conn_info[0]]._serverd_user_count += \ 
-                            conn_info[1];
-                    
-                    // 更新_process_heap中的顺序
-                    int idx = conn_info[0];
-                    int user_count = process_pool[conn_info[0]]._serverd_user_count;
-                    _refresh_process_heap(idx, user_count);
-                    
+                }else if (sockfd == _control_fd && (events[i].events & EPOLLIN)) {
+                    // 新master请求接管listenfd：交出之后本代进程退场
+                    if (Upgrade_Util::serve_handoff(_control_fd, _listen_fd)) {
+                        cout << "listen socket handed over, draining child processes" << endl;
+                        _retire(SIGQUIT, true);
+                    }
                 }else if (sockfd == _sig_pipefd[0] && (events[i].events & EPOLLIN)) {
 
                     char signals[1024];
@@ -378,19 +640,52 @@ public:
                             case SIGCHLD:
                                 // 子进程结束
                                 __withdraw_child_process();
+
+                                // 退场中的父进程在全部子进程退出后结束
+                                if (_retiring && _live_children() == 0) {
+                                    cout << "all child processes drained, exit" << endl;
+                                    is_working = false;
+                                }
                                 break;
-                            case SIGINT: case SIGTERM:
-                                // 我觉得这里需要将子进程全部关闭
-                                // 书中也是这样做的
+                            case SIGINT:
+                                // 立即结束：将子进程全部关闭
                                 cout << "kill all child process" << endl;
                                 is_working = false;
-                                _kill_child_process();
+                                _kill_child_process(-1, SIGINT);
+                                break;
+                            case SIGTERM: case SIGQUIT:
+                                // 平滑退出：停止accept，等待子进程排空
+                                if (!_retiring) {
+                                    cout << "draining child processes" << endl;
+                                    _retire(SIGTERM, false);
+                                }
                                 break;
                         }
                     }
                 }
             }
+
+            // 票据密钥只由父进程轮换（子进程只读）
+            _tls_context.rotate_keys();
+
+            // 有子进程的连接数降到低水位以下：恢复accept
+            if (_accept_paused && !_retiring) {
+                _try_resume_accept();
+            }
+
+            // 超过排空期限仍未退出的子进程（例如卡在某个请求上）直接杀死
+            if (_retiring && is_working && \
+                    now_us() >= _drain_deadline_us + DRAIN_KILL_GRACE_MS * 1000ULL) {
+                _kill_child_process(-1, SIGKILL);
+            }
         }
+
+        _reverse_proxy.stop_health_checker();
+        cout << _reverse_proxy.report();
+        if (_rate_limiter.enabled()) cout << _rate_limiter.report();
+
+        // 负载表（包括系统调用计数）：平滑退出时子进程都已结束，是最终的计数
+        cout << _load_table.report() << flush;
     }
 
 private:    // 全部子进程都会有一份下列的拷贝，不管是否是静态
@@ -401,24 +696,29 @@ private:    // 全部子进程都会有一份下列的拷贝，不管是否是
     int _process_num;                   // 进程池中的进程数量
     vector<Process> process_pool;
     int _process_idx;                   // 区分子进程和父进程的一个标志
+    ServerConfig _config;               // 服务器配置，fork之后只读
+    Placement _placement;               // 子进程所在的CPU/NUMA节点
     static int _sig_pipefd[2];          // 每个进程内实现统一信号事件源的管道
-    ThreadPool<ClientData_t> _thread_pool;            // 每个进程都有自己的线程池
     ThreadPoolTaskContainer<ClientData_t> thread_task_container;  // 每个进程都有自己的一个任务容器
-    Heap<std::pair<int, int>> _process_heap;  // 给主进程使用，虽然每个进程都会有一份，但其他进程不使用 
+    ThreadPool<ClientData_t> _thread_pool;            // 每个进程都有自己的线程池（需在任务容器之后析构前停止）
+    Heap<std::pair<int, int>> _process_heap{MAX_PROCESS_NUM};  // 给主进程使用（句柄为子进程下标，优先级为负载），其他进程不使用 
+    Load_Table _load_table;             // 父子进程共享的负载表，每个子进程一项
+    Rate_Limiter _rate_limiter;         // 父子进程共享的按IP限流表
+    Reverse_Proxy _reverse_proxy;       // 反向代理（上游状态父子进程共享）
+    Tls_Context _tls_context;           // TLS（证书和票据密钥在fork之前准备）
+    H2_Settings _h2_settings;           // 子进程：HTTP/2的参数（由_config得到）
+    Ws_Settings _ws_settings;           // 子进程：WebSocket的参数
+    Ws_Echo_Handler _ws_echo;           // 子进程：WebSocket消息的处理器
+    int _reserve_fd = -1;               // 子进程为EMFILE预留的fd
+    int _control_fd = -1;               // 父进程：热升级的控制socket
+    bool _retiring = false;             // 父进程：listenfd已交给新master，等待子进程排空
+    bool _draining = false;             // 子进程：已停止accept，正在排空连接
+    uint64_t _drain_deadline_us = 0;    // 排空的截止时间（子进程：强制关闭；父进程：SIGKILL）
+    int _child_exit_status = CHILD_EXIT_LOOP_ERROR; // 子进程的退出码：只有正常结束的路径才改写
+    bool _accept_paused = false;        // 父进程：全部子进程超过高水位，暂停监听listenfd
+    std::string _shed_response;         // 子进程：过载时回复的503
 private:
 
-    // 检查sockfd是不是和子进程通信的管道fd
-    bool _check_if_pipefd(int sockfd) {
-        for (int i = 0; i < _process_num; ++i) {
-            if (process_pool[i]._pid != -1 && \
-                process_pool[i]._pipefd[0] == sockfd) {
-                
-                return true;
-            }   
-        }
-        return false;
-    }
-
     // 信号处理函数
     static void handler(int sig) {
         int old_errno = errno;
@@ -426,57 +726,268 @@ private:
         errno = old_errno;
     }
 
-    // 子进程尝试接受客户连接请求
-    bool _try_accept_client_connection(int *p_client_fd) {
-        
-        sockaddr_in client_addr;
-        socklen_t client_addr_sz;
-        int client_fd = accept(_listen_fd, \
-            (sockaddr *)&client_addr, &client_addr_sz);
+    // 子进程尝试接受客户连接请求：循环accept直到EAGAIN或达到budget
+    // 新连接直接是非阻塞、close-on-exec的，返回本轮accept到的连接数
+    int _accept_client_connections(vector<Accepted_Conn> &conns, int budget) {
+
+        int n = 0;
+        while (n < budget) {
+
+            Accepted_Conn conn;
+            socklen_t client_addr_sz = sizeof(conn.addr);
+            conn.fd = accept4(_listen_fd, (sockaddr *)&conn.addr, \
+                &client_addr_sz, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (conn.fd >= 0) {
+                conns.push_back(conn);
+                ++n;
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;      // 已经没有等待的连接
+            }else if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+                continue;   // 这个连接出了问题，继续下一个
+            }else if (errno == EMFILE || errno == ENFILE) {
+                // fd耗尽：用预留的fd接下这个连接并立即关闭，
+                // 让客户端尽快收到断开，而不是留在队列里让listenfd一直可读
+                _shed_connection_with_reserve_fd();
+                break;
+            }else {
+                Access_Log::error("accept4() failed", errno);
+                break;
+            }
+        }
+        return n;
+    }
+
+    void _shed_connection_with_reserve_fd() {
+
+        if (_reserve_fd < 0) return;
+
+        close(_reserve_fd);
+        int fd = accept(_listen_fd, NULL, NULL);
+        if (fd >= 0) close(fd);
+        _reserve_fd = open(RESERVE_FD_PATH, O_RDONLY | O_CLOEXEC);
+
+        Access_Log::error("out of fds, connection dropped, process", EMFILE, _process_idx);
+    }
+
+    // 边缘触发模式：只记录就绪状态，连接上没有任务时才生成一个任务
+    // 连接的读写、关闭都由工作线程完成
+    void _dispatch_edge_triggered(const epoll_event &ev, ClientData_t &client, ChildLoad &load) {
+
+        // 对端关闭/出错也当作可读：工作线程recv得到0或错误后关闭连接
+        if (ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            client._readable.store(true);
+        }
+        if (ev.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            client._writable.store(true);
+        }
+
+        if (!client._scheduled.exchange(true)) {
+            epoll_event event;
+            event.events = EPOLLET;
+
+            // 空闲连接上到来的新请求在过载时被拒绝
+            bool sheddable = client._readable.load() && \
+                _is_idle_client(client);
+            if (!thread_task_container.add(event, ev.data.fd, &client, sheddable)) {
+                _shed_request(client, load);
+            }
+        }
+    }
+
+    // 连接上没有正在处理的请求，也没有待发送的响应（只在reactor线程中、连接未被调度时调用）
+    static bool _is_idle_client(ClientData_t &client) {
+        return (!client.has_request() || (client._read_buf_end_idx == 0 && \
+                !client.hrp().has_partial_request() && client.hrs().get_response_data_len() == 0)) && \
+            !client._proxying() && \
+            (client._h2.load() == NULL || client._h2.load()->idle()) && \
+            (client._ws.load() == NULL || client._ws.load()->idle());
+    }
+
+    // 代理请求进行中的连接：同一连接同时最多只有一个任务
+    // 已有任务时丢弃事件：该任务结束前总会重新尝试读写并注册事件
+    void _dispatch_proxy_event(uint32_t events, ClientData_t &client) {
+
+        if (client._scheduled.exchange(true)) return;
+
+        epoll_event event;
+        event.events = events;
+        thread_task_container.add(event, client._clientfd, &client);
+    }
+
+    // 为到期的代理请求生成任务：超时的回复504，等待微缓存的重新查询缓存
+    void _sweep_proxy_timeouts(vector<ClientData_t> &client_data, vector<int> &expired) {
+
+        expired.clear();
+        _reverse_proxy.collect_expired(now_us(), &expired);
+        for (int fd : expired) {
+            // 收集之后该请求可能已经结束、连接已经关闭
+            ClientData_t &client = client_data[fd];
+            if (client._clientfd != fd || !client._proxying()) continue;
+            _dispatch_proxy_event(PROXY_EVENT_TIMEOUT, client);
+        }
+    }
 
-        if (client_fd < 0) {
+    // 过载：不解析请求，丢弃已收到的数据后直接写出预先生成的503并关闭连接
+    // 先读空接收缓冲区：带着未读数据close会发送RST，客户端可能收不到503
+    void _shed_request(ClientData_t &client, ChildLoad &load) {
 
-            cout << "In Child Process accept() system call failed, errno: " 
-                << errno << endl;
-            return false;
+        int fd = client._clientfd;
+        char discard[4096];
+        for (int i = 0; i < SHED_DISCARD_MAX; ++i) {
+            if (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) <= 0) break;
+        }
+        if (client._tls == NULL || client._tls->established) {
+            Tls_Util::send(client._tls, fd, _shed_response.data(), _shed_response.size());
         }
 
-        *p_client_fd = client_fd;
-        return true;
+        load.shed_total.fetch_add(1, std::memory_order_relaxed);
+        _close_client(client, load);
     }
 
-    // 跟新小根堆
-    void _refresh_process_heap(int idx, int user_count) {
+    // 用共享负载表中的最新数据更新小根堆，只有负载变化的子进程才需要调整
+    void _refresh_process_heap() {
+
+        for (int i = 0; i < _process_num; ++i) {
+            if (!_process_heap.contains(i)) continue;
 
-        std::pair<int, int> pval = {idx, user_count};
+            // 正在排空的子进程不再接收新连接
+            if (_load_table[i].draining.load(std::memory_order_relaxed)) {
+                _process_heap.erase(i);
+                continue;
+            }
 
-        _process_heap.modify(pval, [&pval](const std::pair<int, int> &p) -> bool {
-            return pval.first == p.first;
-        });
+            std::pair<int, int> score = _load_table[i].score();
+            if (score != _process_heap.priority(i)) {
+                _process_heap.update(i, score);
+            }
+        }
     }
 
     // 选择最小负载子进程工作：通过小根堆
     void _choose_min_load_child_process() {
 
+        _refresh_process_heap();
+        if (_process_heap.empty()) return;    // 没有存活的子进程
+
+        // 负载最小的子进程也达到了高水位：暂停accept，连接留在内核的监听队列中
+        if (_config.conn_high_watermark > 0 && \
+                _process_heap.top_priority().first >= _config.conn_high_watermark) {
+            cout << "all child processes reached " << _config.conn_high_watermark \
+                << " connections, pause accept" << endl;
+            Epoll_Util::removefd(_listen_fd);
+            _accept_paused = true;
+            return;
+        }
+
         bool has_new_conn = true;
-        std::pair<int, int> _min_load_process = _process_heap.top();
-        int _min_load_process_pid_idx = _min_load_process.first;
+        int _min_load_process_pid_idx = _process_heap.top();
 
+        // 不阻塞：子进程刚进入排空时可能已不再读取管道
         send(process_pool[_min_load_process_pid_idx]._pipefd[0], \
-            &has_new_conn, sizeof(has_new_conn), 0);
+            &has_new_conn, sizeof(has_new_conn), MSG_DONTWAIT);
+    }
+
+    void _try_resume_accept() {
+
+        _refresh_process_heap();
+        if (_process_heap.empty()) return;
+
+        if (_process_heap.top_priority().first < _config.conn_low_watermark) {
+            cout << "resume accept" << endl;
+            Epoll_Util::addfd(_listen_fd);
+            _accept_paused = false;
+        }
+    }
+
+    // 父进程：停止accept，通知子进程排空，全部子进程退出后父进程结束
+    // handed_over: listenfd已交给新一代master，控制socket文件属于新master，不能删除
+    void _retire(int sig, bool handed_over) {
+
+        Epoll_Util::removefd(_listen_fd);
+        if (_control_fd >= 0) {
+            Epoll_Util::removefd(_control_fd);
+            close(_control_fd);
+            if (!handed_over) unlink(_config.upgrade_socket_path.c_str());
+            _control_fd = -1;
+        }
+        _retiring = true;
+        _drain_deadline_us = now_us() + _config.drain_deadline_ms * 1000ULL;
+
+        _kill_child_process(-1, sig);
+        if (_live_children() == 0) is_working = false;
+    }
+
+    int _live_children() const {
+
+        int n = 0;
+        for (int i = 0; i < _process_num; ++i) {
+            if (process_pool[i]._pid != -1) ++n;
+        }
+        return n;
+    }
+
+    // 子进程：停止accept并进入排空状态
+    // 之后的响应都带Connection: close，空闲连接由reactor关闭
+    void _begin_drain(int pipefd, ChildLoad &load) {
+
+        if (_draining) return;
+        _draining = true;
+        _drain_deadline_us = now_us() + _config.drain_deadline_ms * 1000ULL;
+        load.draining = 1;
+        Epoll_Util::removefd(pipefd);
+        thread_task_container.set_draining();
     }
 
-    // 给子进程发送SIGTERM信号
-    void _kill_child_process(int c_pid = -1) {
+    // 子进程：关闭一个连接
+    void _close_client(ClientData_t &client, ChildLoad &load) {
+
+        _reverse_proxy.abort(client);
+        delete client._proxy.exchange(NULL);
+        delete client._h2.exchange(NULL);
+        delete client._ws.exchange(NULL);
+        client._co.destroy();
+        Tls_Util::shutdown(client._tls);
+        delete client._tls;
+        client._tls = NULL;
+        close(client._clientfd);
+        client._clientfd = -1;
+        client._read_buf_end_idx = 0;
+        client._send_buf_end_idx = 0;
+        client._head_match = 0;
+        client._head_bytes = 0;
+        if (client._body) client._body->reset();
+        client._should_close = false;
+        client.release_request();
+        --load.active_conns;
+    }
+
+    // 子进程：关闭没有请求在处理的连接（排空时使用）
+    // 只在reactor线程中调用：未被调度的连接此时不会被任何工作线程访问
+    void _close_idle_clients(vector<ClientData_t> &client_data, ChildLoad &load) {
+
+        for (ClientData_t &client : client_data) {
+            if (client._clientfd == -1 || client._scheduled.load()) continue;
+            if (!_is_idle_client(client)) continue;
+            if (Ws_Session *ws = client._ws.load()) ws->going_away(client._tls, client._clientfd);
+            _close_client(client, load);
+        }
+    }
+
+    // 给子进程发送信号（默认SIGTERM：平滑退出）
+    void _kill_child_process(int c_pid = -1, int sig = SIGTERM) {
         if (c_pid != -1) {
             
-            kill(c_pid, SIGTERM);
+            kill(c_pid, sig);
         }else {
             for (int i = 0; i < _process_num; ++i) {
 
                 if (process_pool[i]._pid != -1) {
 
-                    kill(process_pool[i]._pid, SIGTERM);
+                    kill(process_pool[i]._pid, sig);
                 }
             }
 
@@ -496,17 +1007,45 @@ private:
 
                 if (process_pool[i]._pid == c_pid) {
 
+                    _report_child_exit(i, c_pid, c_stat_loc);
                     process_pool[i]._pid = -1;
-                    process_pool[i]._serverd_user_count = 0;
+                    _load_table[i].reset();
                     close(process_pool[i]._pipefd[0]);
 
                     // 从_process_heap中删除该元素
-                    std::pair<int, int> pval = {i, 0};
-                    _process_heap.delete_from_heap(pval, [&pval](const std::pair<int, int> &p) {
-                            return p.first == pval.first;
-                    })
+                    _process_heap.erase(i);
                 }
             }
         }
     }
+
+    // 根据退出状态区分子进程是正常退场还是崩溃
+    void _report_child_exit(int idx, pid_t pid, int stat) {
+
+        cout << "child process " << idx << " (pid " << pid << ") ";
+        if (WIFEXITED(stat)) {
+            switch (WEXITSTATUS(stat)) {
+                case CHILD_EXIT_DRAINED:
+                    cout << "drained and exited" << endl;
+                    return;
+                case CHILD_EXIT_DRAIN_TIMEOUT:
+                    cout << "exited after drain deadline, connections dropped" << endl;
+                    return;
+                case CHILD_EXIT_STOPPED:
+                    cout << "stopped" << endl;
+                    return;
+                case CHILD_EXIT_LOOP_ERROR:
+                    cout << "left its event loop on an error" << endl;
+                    return;
+                default:
+                    cout << "crashed, exit code " << WEXITSTATUS(stat) << endl;
+                    return;
+            }
+        }
+        if (WIFSIGNALED(stat)) {
+            cout << "crashed, killed by signal " << WTERMSIG(stat) << endl;
+            return;
+        }
+        cout << "exited, status " << stat << endl;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <iostream>
+#include <sstream>
+#include "server_config.h"
+
+#define RATE_PROBE_LIMIT 8      // 开放寻址最多探测的槽数
+#define RATE_KEY_HOST 1ULL      // 键的类型：单个IP
+#define RATE_KEY_PREFIX 2ULL    // 键的类型：IP前缀
+
+// 限流的统计数据（与限流表一起位于共享内存中）
+// 只统计拒绝/淘汰这类少见的事件：放行路径上不写任何共享计数器
+struct RateLimiterMetrics {
+    std::atomic<uint64_t> conns_rejected{0};    // 在accept时被关闭的连接数
+    std::atomic<uint64_t> reqs_rejected{0};     // 被回复429的请求数
+    std::atomic<uint64_t> evictions{0};         // 淘汰空闲项的次数
+    std::atomic<uint64_t> table_full{0};        // 找不到可用槽而直接放行的次数
+    std::atomic<int> occupied{0};               // 已占用的槽数
+};
+
+/**
+ * desc: 按来源IP/IP前缀的令牌桶限流
+ *      - 每个键有两个令牌桶：新建连接/秒、请求/秒
+ *      - 表为开放寻址的定长数组，位于fork之前创建的共享内存中，
+ *        所有子进程的reactor和工作线程共用，每个IP的限额是整个服务器的限额
+ *      - 无锁：键用CAS占槽，令牌桶是一个64位字 [上次补充时刻ms:32][毫令牌数:32]，用CAS更新
+ *      - 近似淘汰：探测范围内没有空槽时，替换其中空闲最久且超过rate_idle_evict_ms的项；
+ *        替换与旧键的并发更新之间没有同步，最坏情况下某个IP多得到或少得到一个桶的令牌
+ *      - 找不到槽时放行（fail open）：限流表满不应导致拒绝正常用户
+ */
+class Rate_Limiter {
+public:
+    Rate_Limiter() {}
+
+    ~Rate_Limiter() {
+        if (_mem) {
+            munmap(_mem, _mem_size);
+        }
+    }
+
+    // 创建共享的限流表，必须在fork之前调用；配置中各速率都为0时不创建
+    bool create(const ServerConfig &config) {
+
+        _conn_rate = config.conn_rate_per_ip;
+        _conn_burst = _burst_mtokens(config.conn_burst_per_ip);
+        _req_rate = config.req_rate_per_ip;
+        _req_burst = _burst_mtokens(config.req_burst_per_ip);
+        _prefix_conn_rate = config.conn_rate_per_prefix;
+        _prefix_conn_burst = _burst_mtokens(config.conn_burst_per_prefix);
+        _prefix_req_rate = config.req_rate_per_prefix;
+        _prefix_req_burst = _burst_mtokens(config.req_burst_per_prefix);
+        _prefix_mask = config.rate_prefix_len <= 0 ? 0 : \
+            htonl(0xffffffffu << (32 - std::min(config.rate_prefix_len, 32)));
+        _prefix_len = config.rate_prefix_len;
+        _idle_evict_ms = config.rate_idle_evict_ms;
+
+        _enabled = _conn_rate > 0 || _req_rate > 0 || \
+            _prefix_conn_rate > 0 || _prefix_req_rate > 0;
+        if (!_enabled) return true;
+
+        size_t slot_num = 1;
+        while (slot_num < (size_t)config.rate_table_slots) slot_num <<= 1;
+
+        _mem_size = sizeof(RateLimiterMetrics) + sizeof(Slot) * slot_num;
+        void *addr = mmap(NULL, _mem_size, PROT_READ | PROT_WRITE, \
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::cout << "mmap() rate limit table failed, errno: " << errno << std::endl;
+            _enabled = false;
+            return false;
+        }
+
+        // 匿名映射已清零：键为0表示空槽，桶为0表示满桶
+        _mem = addr;
+        _metrics = new (addr) RateLimiterMetrics();
+        _slots = (Slot *)((char *)addr + sizeof(RateLimiterMetrics));
+        _mask = slot_num - 1;
+        return true;
+    }
+
+    bool enabled() const {
+        return _enabled;
+    }
+
+    // 新连接是否放行（ip为网络字节序），不放行时应直接关闭连接
+    bool allow_connection(uint32_t ip) {
+
+        if (!_enabled) return true;
+
+        uint32_t now = _now_ms();
+        bool ok = _allow(_host_key(ip), now, &Slot::conn_bucket, _conn_rate, _conn_burst) && \
+            _allow(_prefix_key(ip), now, &Slot::conn_bucket, _prefix_conn_rate, _prefix_conn_burst);
+        if (!ok) _metrics->conns_rejected.fetch_add(1, std::memory_order_relaxed);
+        return ok;
+    }
+
+    // 一个完整请求是否放行，不放行时回复429
+    bool allow_request(uint32_t ip) {
+
+        if (!_enabled) return true;
+
+        uint32_t now = _now_ms();
+        bool ok = _allow(_host_key(ip), now, &Slot::req_bucket, _req_rate, _req_burst) && \
+            _allow(_prefix_key(ip), now, &Slot::req_bucket, _prefix_req_rate, _prefix_req_burst);
+        if (!ok) _metrics->reqs_rejected.fetch_add(1, std::memory_order_relaxed);
+        return ok;
+    }
+
+    const RateLimiterMetrics *metrics() const {
+        return _metrics;
+    }
+
+    std::string report() const {
+
+        std::ostringstream oss;
+        if (!_enabled) return "rate limit disabled\n";
+        oss << "rate limit table " << _metrics->occupied.load(std::memory_order_relaxed) \
+            << "/" << _mask + 1 << " slots" \
+            << " conns_rejected " << _metrics->conns_rejected.load(std::memory_order_relaxed) \
+            << " reqs_rejected " << _metrics->reqs_rejected.load(std::memory_order_relaxed) \
+            << " evictions " << _metrics->evictions.load(std::memory_order_relaxed) \
+            << " table_full " << _metrics->table_full.load(std::memory_order_relaxed) \
+            << "\n";
+        return oss.str();
+    }
+
+private:
+    Rate_Limiter(const Rate_Limiter &) = delete;
+    Rate_Limiter &operator=(const Rate_Limiter &) = delete;
+
+    // 一个槽32字节，一个cache line两个槽
+    struct Slot {
+        std::atomic<uint64_t> key;
+        std::atomic<uint64_t> conn_bucket;
+        std::atomic<uint64_t> req_bucket;
+        std::atomic<uint32_t> last_ms;      // 最近一次访问的时刻，用于淘汰
+        uint32_t _pad;
+    };
+
+    bool _enabled = false;
+    void *_mem = NULL;
+    size_t _mem_size = 0;
+    RateLimiterMetrics *_metrics = NULL;
+    Slot *_slots = NULL;
+    size_t _mask = 0;
+
+    // 速率：令牌/秒，即每毫秒补充的毫令牌数；容量：毫令牌数
+    uint32_t _conn_rate = 0, _conn_burst = 0;
+    uint32_t _req_rate = 0, _req_burst = 0;
+    uint32_t _prefix_conn_rate = 0, _prefix_conn_burst = 0;
+    uint32_t _prefix_req_rate = 0, _prefix_req_burst = 0;
+    uint32_t _prefix_mask = 0;
+    int _prefix_len = 0;
+    uint32_t _idle_evict_ms = 0;
+
+    static uint32_t _burst_mtokens(int burst) {
+        // 毫令牌数放在32位中：容量上限约400万个令牌
+        if (burst < 1) burst = 1;
+        return (uint32_t)std::min<uint64_t>((uint64_t)burst * 1000, 0xffffffffu);
+    }
+
+    // 粗粒度时钟：vDSO直接读，几纳秒，精度（几毫秒）对限流足够
+    static uint32_t _now_ms() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    }
+
+    static uint64_t _host_key(uint32_t ip) {
+        return (RATE_KEY_HOST << 62) | ip;
+    }
+
+    uint64_t _prefix_key(uint32_t ip) const {
+        return (RATE_KEY_PREFIX << 62) | ((uint64_t)_prefix_len << 32) | (ip & _prefix_mask);
+    }
+
+    static size_t _hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return (size_t)key;
+    }
+
+    bool _allow(uint64_t key, uint32_t now, std::atomic<uint64_t> Slot::*bucket, \
+            uint32_t rate, uint32_t burst) {
+
+        if (rate == 0) return true;
+
+        Slot *slot = _find_or_insert(key, now);
+        if (slot == NULL) return true;
+
+        if (slot->last_ms.load(std::memory_order_relaxed) != now) {
+            slot->last_ms.store(now, std::memory_order_relaxed);
+        }
+        return _take(slot->*bucket, now, rate, burst);
+    }
+
+    // 从令牌桶中取一个令牌；桶为0表示新建的满桶
+    static bool _take(std::atomic<uint64_t> &bucket, uint32_t now, uint32_t rate, uint32_t burst) {
+
+        uint64_t cur = bucket.load(std::memory_order_relaxed);
+        while (true) {
+
+            uint32_t tokens = burst;
+            if (cur != 0) {
+                uint32_t last = (uint32_t)(cur >> 32);
+                int32_t elapsed = (int32_t)(now - last);    // 其他线程可能刚写入更新的时刻
+                uint64_t refill = elapsed > 0 ? (uint64_t)elapsed * rate : 0;
+                tokens = (uint32_t)std::min<uint64_t>(burst, (uint32_t)cur + refill);
+            }
+            if (tokens < 1000) return false;    // 拒绝时不写：不产生cache line争用
+
+            uint64_t next = ((uint64_t)now << 32) | (tokens - 1000);
+            if (bucket.compare_exchange_weak(cur, next, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    Slot *_find_or_insert(uint64_t key, uint32_t now) {
+
+        size_t idx = _hash(key);
+        Slot *victim = NULL;
+        uint32_t victim_idle = 0;
+
+        for (int i = 0; i < RATE_PROBE_LIMIT; ++i) {
+
+            Slot &slot = _slots[(idx + i) & _mask];
+            uint64_t cur = slot.key.load(std::memory_order_acquire);
+            if (cur == key) return &slot;
+
+            if (cur == 0) {
+                if (slot.key.compare_exchange_strong(cur, key, std::memory_order_acq_rel)) {
+                    _metrics->occupied.fetch_add(1, std::memory_order_relaxed);
+                    return &slot;
+                }
+                if (cur == key) return &slot;   // 另一个线程刚插入了同一个键
+                continue;
+            }
+
+            uint32_t idle = now - slot.last_ms.load(std::memory_order_relaxed);
+            if (idle >= _idle_evict_ms && idle > victim_idle) {
+                victim = &slot;
+                victim_idle = idle;
+            }
+        }
+
+        // 探测范围内没有空槽：替换空闲最久的项
+        if (victim != NULL) {
+            uint64_t old_key = victim->key.load(std::memory_order_relaxed);
+            if (old_key != key && \
+                    victim->key.compare_exchange_strong(old_key, key, std::memory_order_acq_rel)) {
+                victim->conn_bucket.store(0, std::memory_order_relaxed);
+                victim->req_bucket.store(0, std::memory_order_relaxed);
+                victim->last_ms.store(now, std::memory_order_relaxed);
+                _metrics->evictions.fetch_add(1, std::memory_order_relaxed);
+                return victim;
+            }
+        }
+
+        _metrics->table_full.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+};
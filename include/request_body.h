@@ -0,0 +1,249 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "chunked.h"
+#include "http_request_parser.h"
+#include "router.h"
+
+// 接收请求体的一次结果
+enum BODY_STATE {
+    BS_MORE = 0,        // 还没有接收完
+    BS_DONE,            // 请求体已接收完
+    BS_TOO_LARGE,       // 超过请求体上限（413）
+    BS_BAD,             // 分块格式错误（400）
+    BS_ERROR            // 处理器出错，如临时文件写入失败（500）
+};
+
+// 请求体的参数（由ServerConfig得到）
+struct Body_Settings {
+    uint64_t max_bytes = 1 << 30;
+    size_t memory_bytes = 64 << 10;
+    std::string temp_dir = "/tmp";
+};
+
+/**
+ * desc: 请求体的存放：先放在内存中，超过memory_bytes后转存到临时文件
+ *      临时文件用O_TMPFILE创建（不支持时mkstemp后立即unlink），关闭后自动删除，
+ *      这样几百MB的上传也只占用固定的内存
+ */
+class Body_Spool final {
+public:
+    ~Body_Spool() {
+        reset();
+    }
+
+    void start(const Body_Settings &settings) {
+        _settings = &settings;
+    }
+
+    // 按到达顺序追加请求体的一段（已去掉分块格式），写临时文件失败时返回false
+    bool on_data(const char *data, size_t len) {
+
+        _size += len;
+        if (_fd < 0 && _memory.size() + len <= _settings->memory_bytes) {
+            _memory.append(data, len);
+            return true;
+        }
+        if (_fd < 0) {
+            if (!_open_temp()) return false;
+            if (!_write_all(_memory.data(), _memory.size())) return false;
+            _release_memory();
+        }
+        return _write_all(data, len);
+    }
+
+    bool spilled() const { return _fd >= 0; }
+    int fd() const { return _fd; }
+    uint64_t size() const { return _size; }
+    std::string &memory() { return _memory; }
+
+    // 一个请求结束：删除临时文件，释放内存
+    void reset() {
+        if (_fd >= 0) close(_fd);
+        _fd = -1;
+        _size = 0;
+        _release_memory();
+    }
+
+private:
+    const Body_Settings *_settings = NULL;
+    std::string _memory;
+    int _fd = -1;
+    uint64_t _size = 0;
+
+    void _release_memory() {
+        _memory.clear();
+        _memory.shrink_to_fit();
+    }
+
+    bool _open_temp() {
+
+        _fd = open(_settings->temp_dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (_fd >= 0) return true;
+
+        std::string path = _settings->temp_dir + "/body.XXXXXX";
+        _fd = mkostemp(&path[0], O_CLOEXEC);
+        if (_fd < 0) return false;
+        unlink(path.c_str());
+        return true;
+    }
+
+    bool _write_all(const char *data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(_fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+};
+
+// 请求体交给谁
+enum BODY_SINK {
+    BK_SPOOL = 0,       // 存放在内存/临时文件中，完成后交给parser
+    BK_STREAM,          // 逐段交给路由的处理器，不存放
+    BK_DISCARD          // 没有人读取（静态文件、405等），只跟踪边界
+};
+
+/**
+ * desc: 流式接收一个请求的请求体
+ *      首部之后读到的数据逐段交给feed：按Content-Length或chunked找到请求体的边界，
+ *      块数据交给接收者，超过上限时立即停止；请求体之后的数据属于下一个请求，不消耗
+ *      接收者在首部完整时确定：流式的路由处理器、存放（Body_Spool），或者丢弃
+ *      在连接第一次收到带请求体的请求时创建，之后随ClientData复用
+ */
+class Request_Body {
+public:
+    // 开始接收一个请求体：chunked为false时长度为length（调用者已检查不超过上限）
+    // 默认存放，start之后可以用stream_to/discard改变接收者
+    void start(bool chunked, uint64_t length, const Body_Settings &settings) {
+        _active = true;
+        _chunked = chunked;
+        _remaining = length;
+        _received = 0;
+        _max_bytes = settings.max_bytes;
+        _sink = BK_SPOOL;
+        _chunks.reset();
+        _spool.start(settings);
+    }
+
+    // 块数据逐段交给handler->on_body_chunk；hrp和params在请求结束前保持有效
+    void stream_to(Route_Handler *handler, Http_Request_Parser &hrp, const Route_Params &params) {
+        _sink = BK_STREAM;
+        _handler = handler;
+        _hrp = &hrp;
+        _params = params;
+    }
+
+    void discard() {
+        _sink = BK_DISCARD;
+    }
+
+    // 处理n个字节，*consumed为属于请求体的字节数
+    BODY_STATE feed(const char *p, size_t n, size_t *consumed) {
+
+        size_t i = 0;
+        BODY_STATE state = BS_MORE;
+        if (!_chunked) {
+            size_t take = std::min<uint64_t>(_remaining, n);
+            if (take > 0 && !_deliver(p, take)) state = BS_ERROR;
+            _remaining -= take;
+            i = take;
+            if (state == BS_MORE && _remaining == 0) state = BS_DONE;
+        }else {
+            while (i < n && state == BS_MORE) {
+                if (_chunks.state == Chunk_Tracker::CT_DATA) {
+                    size_t take = std::min<uint64_t>(_chunks.size, n - i);
+                    if (!_deliver(p + i, take)) state = BS_ERROR;
+                    i += _chunks.feed(p + i, take);
+                    continue;
+                }
+
+                // 分块的格式：逐字节交给Chunk_Tracker，进入新的块时检查上限
+                i += _chunks.feed(p + i, 1);
+                if (_chunks.state == Chunk_Tracker::CT_DATA && _received + _chunks.size > _max_bytes) {
+                    state = BS_TOO_LARGE;
+                }else if (_chunks.bad()) {
+                    state = BS_BAD;
+                }else if (_chunks.done()) {
+                    state = BS_DONE;
+                }
+            }
+        }
+
+        *consumed = i;
+        if (state != BS_MORE) _active = false;
+        _complete = state == BS_DONE;
+        return state;
+    }
+
+    // 请求体接收完成：交给parser，在内存中的直接移交，转存的交出临时文件的fd
+    // （fd仍由本对象持有，reset时关闭）；流式接收和丢弃的请求体为空
+    void finish(Http_Request_Parser &hrp) {
+        if (_sink != BK_SPOOL) return;
+        if (_spool.spilled()) {
+            hrp.set_body_file(_spool.fd(), _spool.size());
+        }else {
+            hrp.set_body(std::move(_spool.memory()));
+        }
+    }
+
+    bool active() const { return _active; }
+    bool spilled() const { return _spool.spilled(); }
+    uint64_t received() const { return _received; }
+
+    // 一个请求结束（响应已发送或连接关闭）：流式接收的处理器在这里释放这个请求的状态
+    void reset() {
+        if (_sink == BK_STREAM) {
+            _handler->on_body_end(*_hrp, _complete);
+            _handler = NULL;
+            _hrp = NULL;
+        }
+        _sink = BK_SPOOL;
+        _complete = false;
+        _active = false;
+        _remaining = 0;
+        _received = 0;
+        _chunks.reset();
+        _spool.reset();
+    }
+
+private:
+    bool _active = false;
+    bool _chunked = false;
+    uint64_t _remaining = 0;    // Content-Length：剩余的字节数
+    uint64_t _received = 0;
+    uint64_t _max_bytes = 0;
+    Chunk_Tracker _chunks;
+    Body_Spool _spool;
+
+    BODY_SINK _sink = BK_SPOOL;
+    bool _complete = false;     // 请求体已全部收到
+    Route_Handler *_handler = NULL;
+    Http_Request_Parser *_hrp = NULL;
+    Route_Params _params;
+
+    bool _deliver(const char *p, size_t n) {
+        _received += n;
+        switch (_sink) {
+            case BK_STREAM:
+                return _handler->on_body_chunk(*_hrp, _params, p, n);
+            case BK_DISCARD:
+                return true;
+            default:
+                return _spool.on_data(p, n);
+        }
+    }
+};
@@ -0,0 +1,1248 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <iostream>
+#include <sstream>
+#include "server_config.h"
+#include "http_request_parser.h"
+#include "http_response_sender.h"
+#include "epoll_utils.h"
+#include "write_policy.h"
+#include "micro_cache.h"
+#include "load_table.h"
+#include "locker.h"
+#include "utils.h"
+#include "chunked.h"
+
+#define PROXY_BUF_SZ 16384          // 转发响应体的缓冲区：每个连接最多缓存这么多数据
+#define PROXY_HEADER_MAX 16384      // 上游响应头的最大长度（不超过PROXY_BUF_SZ：读到的响应体部分要放进buf）
+#define PROXY_SWEEP_MS 100          // 有代理请求时reactor检查超时的周期
+#define PROXY_MAX_FD 65536          // 上游连接fd的上限（fd到所属客户连接的映射表大小）
+
+// 响应头连同之后已经读到的响应体一起拷进buf，读响应头时最多读到PROXY_HEADER_MAX
+static_assert(PROXY_HEADER_MAX <= PROXY_BUF_SZ, "buffered header bytes must fit in Proxy_Session::buf");
+
+// 任务事件中的自定义标记，只出现在任务中，不注册到epoll（不与EPOLL*的位冲突）
+#define PROXY_EVENT_UPSTREAM (1u << 20)     // 事件来自上游连接
+#define PROXY_EVENT_TIMEOUT (1u << 21)      // reactor发现代理请求超时
+
+// 代理请求所处的阶段
+enum PROXY_STAGE {
+    PXS_IDLE = 0,
+    PXS_CONNECT,        // 正在连接上游
+    PXS_SEND_REQUEST,   // 正在向上游发送请求
+    PXS_READ_HEADER,    // 正在读取上游的响应头
+    PXS_STREAM,         // 正在把响应转发给客户端
+    PXS_WAIT_CACHE      // 等待另一个请求回源后写入微缓存
+};
+
+// 上游响应体的边界
+enum BODY_FRAMING {
+    BF_NONE = 0,    // 没有响应体（HEAD、204、304）
+    BF_LENGTH,      // Content-Length
+    BF_CHUNKED,     // Transfer-Encoding: chunked
+    BF_CLOSE        // 以上游关闭连接为结束（此时也不能与客户端保持连接）
+};
+
+// 代理请求的一次处理结果，由工作线程据此处理客户连接
+enum PROXY_RESULT {
+    PXR_PENDING = 0,    // 已注册了等待的事件，工作线程不再处理该连接
+    PXR_RESPOND,        // 已在hrs中生成了错误响应（502/504），按普通响应发送
+    PXR_DONE,           // 响应已全部转发
+    PXR_CLOSE           // 转发中途出错，只能关闭客户连接
+};
+
+/**
+ * desc: 一个客户连接上正在进行的代理请求
+ *      在连接第一次被代理时创建，之后随客户表项复用
+ *      除active/deadline_us/list_pos外，只由当前持有该连接任务的工作线程访问
+ */
+struct Proxy_Session {
+    std::atomic<bool> active{false};        // reactor据此判断超时、关闭时是否需要清理
+    std::atomic<uint64_t> deadline_us{0};
+    int clientfd = -1;
+    size_t list_pos = 0;            // 在进行中的代理请求列表中的位置（受列表的锁保护）
+
+    PROXY_STAGE stage = PXS_IDLE;
+    int route = -1;
+    int upstream = -1;              // 上游下标，-1表示未占用上游
+    int upstream_fd = -1;
+    bool registered = false;        // upstream_fd是否已注册到epoll
+    bool reused = false;            // 上游连接来自空闲连接池（可能已被上游关闭）
+    bool retried = false;
+    bool idempotent = false;        // 请求可以在另一个连接上重试
+    bool head_request = false;
+    bool client_keep_alive = false;
+    bool upstream_keep_alive = false;
+    bool broken = false;            // 上游的响应体格式错误，转发完已有数据后关闭两端
+    int status = 0;                 // 转发给客户端的响应的状态码（访问日志）
+    uint64_t bytes_out = 0;         // 已转发给客户端的字节数
+
+    std::string request;            // 转发给上游的请求（请求体转存在临时文件中时只有首部）
+    size_t request_sent = 0;
+    int body_fd = -1;               // 转存在临时文件中的请求体（由Request_Body持有），用sendfile发送
+    uint64_t body_size = 0;
+    off_t body_sent = 0;
+    std::string header_in;          // 上游的响应头
+    std::string header_out;         // 转发给客户端的响应头（命中缓存时是整个响应）
+    size_t header_out_sent = 0;
+    size_t header_core_len = 0;     // header_out中状态行和上游首部的长度（不含本服务器添加的首部）
+
+    // 微缓存
+    std::string cache_key;          // Host + URL，为空表示该请求不使用缓存
+    const char *cache_status = NULL;    // X-Cache-Status
+    bool cache_fill = false;        // 持有回源锁，响应需要写入缓存
+    Cache_Handle cache_handle;
+    int64_t cache_ttl_ms = 0;
+    int64_t cache_stale_ms = 0;
+    std::string cache_body;
+
+    BODY_FRAMING framing = BF_NONE;
+    uint64_t body_remaining = 0;
+    bool body_done = false;
+    Chunk_Tracker chunks;
+
+    char buf[PROXY_BUF_SZ];         // 上游 -> 客户端，写不出去时不再读上游（背压）
+    size_t buf_len = 0;
+    size_t buf_sent = 0;
+
+    // 开始一个新的代理请求（上游连接相关的状态由释放连接时清理）
+    void reset() {
+        stage = PXS_IDLE;
+        route = -1;
+        reused = retried = idempotent = head_request = false;
+        client_keep_alive = upstream_keep_alive = broken = false;
+        status = 0;
+        bytes_out = 0;
+        request.clear();
+        request_sent = 0;
+        body_fd = -1;
+        body_size = 0;
+        body_sent = 0;
+        cache_key.clear();
+        cache_status = NULL;
+        cache_fill = false;
+        _reset_response();
+    }
+
+    // 清空上游响应的状态（换一个上游连接重试时也需要）
+    void _reset_response() {
+        header_in.clear();
+        header_out.clear();
+        header_out_sent = 0;
+        header_core_len = 0;
+        cache_body.clear();
+        framing = BF_NONE;
+        body_remaining = 0;
+        body_done = false;
+        chunks.reset();
+        buf_len = buf_sent = 0;
+    }
+};
+
+// 一个上游服务器的状态，位于父子进程共享的内存中
+struct alignas(64) Upstream_State {
+    std::atomic<int> active{0};             // 正在使用该上游的请求数（最少连接）
+    std::atomic<int> healthy{1};            // 主动健康检查的结果
+    std::atomic<int> fails{0};              // 连续失败次数（被动检查）
+    std::atomic<uint64_t> down_until_us{0}; // 被动检查摘除该上游的截止时刻
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> failures{0};
+};
+
+/**
+ * desc: 反向代理
+ *      - 路由：按URL前缀（最长匹配）选择一组上游，组内轮询或最少连接
+ *      - 上游连接是非阻塞的，和客户连接注册在子进程的同一个epoll中（EPOLLONESHOT），
+ *        上游连接的事件由reactor转成所属客户连接的任务，同一连接同时最多只有一个任务
+ *      - 每个工作线程有自己的空闲长连接池，用完的上游连接放回当前线程的池中
+ *      - 响应体边读边转发，每个连接最多缓存PROXY_BUF_SZ字节：
+ *        客户端写不动时不再读上游，由TCP流控把压力传回上游
+ *      - 健康检查：父进程的线程周期性地主动检查；工作线程连续失败proxy_max_fails次
+ *        则在proxy_fail_timeout_ms内不再选择该上游。状态位于共享内存中
+ */
+class Reverse_Proxy {
+public:
+    Reverse_Proxy() {}
+
+    ~Reverse_Proxy() {
+        stop_health_checker();
+        if (_states) {
+            munmap(_states, sizeof(Upstream_State) * _upstreams.size());
+        }
+    }
+
+    // 解析路由和上游地址，创建共享的上游状态，必须在fork之前调用
+    bool create(const ServerConfig &config) {
+
+        _connect_timeout_ms = config.proxy_connect_timeout_ms;
+        _read_timeout_ms = config.proxy_read_timeout_ms;
+        _idle_conns = config.proxy_idle_conns;
+        _max_fails = config.proxy_max_fails;
+        _fail_timeout_ms = config.proxy_fail_timeout_ms;
+        _health_interval_ms = config.proxy_health_interval_ms;
+        _health_path = config.proxy_health_path;
+
+        for (const Proxy_Route_Config &rc : config.proxy_routes) {
+
+            Route route;
+            route.prefix = rc.prefix;
+            route.balance = rc.balance;
+            route.strip_prefix = rc.strip_prefix;
+            for (const std::string &name : rc.upstreams) {
+                int idx = _add_upstream(name);
+                if (idx >= 0) route.upstreams.push_back(idx);
+            }
+            if (route.prefix.empty() || route.upstreams.empty()) {
+                std::cout << "proxy route " << rc.prefix << " ignored: no usable upstream" << std::endl;
+                continue;
+            }
+            _routes.push_back(route);
+        }
+        if (_routes.empty()) return true;
+
+        if (config.edge_triggered) {
+            std::cout << "reverse proxy needs EPOLLONESHOT mode, proxy routes ignored" << std::endl;
+            _routes.clear();
+            return false;
+        }
+
+        void *addr = mmap(NULL, sizeof(Upstream_State) * _upstreams.size(), \
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::cout << "mmap() upstream table failed, errno: " << errno << std::endl;
+            _routes.clear();
+            return false;
+        }
+        _states = (Upstream_State *)addr;
+        for (size_t i = 0; i < _upstreams.size(); ++i) {
+            new (&_states[i]) Upstream_State();
+        }
+        _rr.reset(new std::atomic<uint32_t>[_routes.size()]());
+
+        // 微缓存同样位于共享内存中
+        _cache.create(config);
+        return true;
+    }
+
+    bool enabled() const {
+        return !_routes.empty();
+    }
+
+    // 子进程开始工作前调用：上游fd到所属客户连接的映射只在本进程内有效
+    void init_child() {
+        if (!enabled()) return;
+        _owner.reset(new std::atomic<int>[PROXY_MAX_FD]);
+        for (int i = 0; i < PROXY_MAX_FD; ++i) _owner[i].store(-1, std::memory_order_relaxed);
+    }
+
+    // fd是上游连接时返回所属客户连接的fd，否则返回-1
+    int owner_of(int fd) const {
+        if (!_owner || fd < 0 || fd >= PROXY_MAX_FD) return -1;
+        return _owner[fd].load(std::memory_order_acquire);
+    }
+
+    // 本进程中正在进行的代理请求数（为0时reactor不需要扫描超时）
+    int active_sessions() const {
+        return _active_sessions.load(std::memory_order_relaxed);
+    }
+
+    // 到期（超时，或等待缓存的请求该重新查询了）的代理请求的客户fd，
+    // reactor只检查进行中的请求，而不是整个客户表
+    void collect_expired(uint64_t now, std::vector<int> *fds) {
+        _list_locker.lock();
+        for (Proxy_Session *s : _active_list) {
+            if (now >= s->deadline_us.load()) fds->push_back(s->clientfd);
+        }
+        _list_locker.unlock();
+    }
+
+    // reactor检查代理请求的周期：有请求在等待缓存时需要更频繁地唤醒它们
+    int sweep_interval_ms() const {
+        return _waiting_sessions.load(std::memory_order_relaxed) > 0 ? \
+            MICROCACHE_WAIT_POLL_MS : PROXY_SWEEP_MS;
+    }
+
+    // 返回url匹配的路由下标（最长前缀），没有则返回-1
+    int match(const std::string &url) const {
+
+        int best = -1;
+        size_t best_len = 0;
+        for (size_t i = 0; i < _routes.size(); ++i) {
+            const std::string &prefix = _routes[i].prefix;
+            if (prefix.size() > best_len && url.compare(0, prefix.size(), prefix) == 0) {
+                best = i;
+                best_len = prefix.size();
+            }
+        }
+        return best;
+    }
+
+    /**
+     * 工作线程解析出一个匹配路由的请求后调用：选择上游并开始转发
+     * 调用时该连接的任务由当前线程持有
+     */
+    template<typename ClientData_t>
+    PROXY_RESULT start(ClientData_t *client, int clientfd, bool draining, ChildLoad *load) {
+
+        Proxy_Session *s = client->_proxy.load(std::memory_order_relaxed);
+        if (s == NULL) {
+            s = new Proxy_Session();
+            client->_proxy.store(s, std::memory_order_release);
+        }
+
+        Http_Request_Parser &hrp = client->hrp();
+        s->reset();
+        s->route = match(hrp.url());
+        s->client_keep_alive = hrp.is_keep_alive() && !draining;
+        s->head_request = hrp.method() == "HEAD";
+        s->idempotent = hrp.method() == "GET" || s->head_request || \
+            hrp.method() == "PUT" || hrp.method() == "DELETE" || hrp.method() == "OPTIONS";
+        _build_request(s, hrp, client->_peer_ip);
+
+        ++_active_sessions;
+        s->clientfd = clientfd;
+        s->active.store(true);
+        _list_locker.lock();
+        s->list_pos = _active_list.size();
+        _active_list.push_back(s);
+        _list_locker.unlock();
+
+        // 只有GET使用缓存；带Authorization的请求的响应因人而异
+        if (_cache.enabled() && hrp.method() == "GET" && !_has_header(hrp, "Authorization")) {
+            s->cache_key = _header_value(hrp, "Host") + hrp.url();
+            return _cache_start(client, clientfd, s, load);
+        }
+        return _connect_and_send(client, clientfd, s, load);
+    }
+
+    // 代理请求进行中，该连接的任务（客户端可写、上游事件、超时）都由这里处理
+    template<typename ClientData_t>
+    PROXY_RESULT on_event(ClientData_t *client, int clientfd, uint32_t events, ChildLoad *load) {
+
+        Proxy_Session *s = client->_proxy.load(std::memory_order_relaxed);
+        // reactor判断超时之后，该连接的上一个任务可能刚刚更新了超时时刻
+        // 等待缓存的请求由reactor定期唤醒，不是超时
+        if ((events & PROXY_EVENT_TIMEOUT) && s->stage != PXS_WAIT_CACHE && \
+                now_us() >= s->deadline_us.load()) {
+            if (s->upstream >= 0) _record_failure(s->upstream);
+            return _fail(client, s, HTTP_UTILS::GATEWAY_TIMEOUT);
+        }
+        return _advance(client, clientfd, s, load);
+    }
+
+    // reactor关闭客户连接时调用（此时没有任务持有该连接，上游连接也没有注册事件）
+    template<typename ClientData_t>
+    void abort(ClientData_t &client) {
+
+        Proxy_Session *s = client._proxy.load(std::memory_order_relaxed);
+        if (s == NULL || !s->active.load()) return;
+        _close_upstream(s);
+        _end_session(s);
+    }
+
+    // 父进程：启动主动健康检查线程
+    void start_health_checker() {
+
+        if (!enabled() || _health_interval_ms <= 0 || _health_running) return;
+        _health_stop = false;
+        if (pthread_create(&_health_thread, NULL, _health_routine, this) == 0) {
+            _health_running = true;
+        }
+    }
+
+    void stop_health_checker() {
+
+        if (!_health_running) return;
+        _health_stop = true;
+        _health_sem.post();
+        pthread_join(_health_thread, NULL);
+        _health_running = false;
+    }
+
+    // 各上游状态的快照
+    std::string report() const {
+
+        std::ostringstream oss;
+        uint64_t now = now_us();
+        for (size_t i = 0; i < _upstreams.size() && _states; ++i) {
+            const Upstream_State &st = _states[i];
+            oss << "upstream " << _upstreams[i].name \
+                << (st.healthy.load() ? " up" : " down") \
+                << (now < st.down_until_us.load() ? " (failing)" : "") \
+                << " active " << st.active.load() \
+                << " requests " << st.requests.load() \
+                << " failures " << st.failures.load() << "\n";
+        }
+        if (_cache.enabled()) oss << _cache.report();
+        return oss.str();
+    }
+
+private:
+    Reverse_Proxy(const Reverse_Proxy &) = delete;
+    Reverse_Proxy &operator=(const Reverse_Proxy &) = delete;
+
+    struct Upstream {
+        std::string name;       // "host:port"，也用作缺省的Host
+        sockaddr_in addr;
+    };
+
+    struct Route {
+        std::string prefix;
+        BALANCE_POLICY balance;
+        bool strip_prefix;
+        std::vector<int> upstreams;
+    };
+
+    // 每个工作线程的空闲上游连接，线程退出时关闭
+    struct Idle_Pool {
+        std::vector<std::vector<int>> conns;    // 下标为上游
+        ~Idle_Pool() {
+            for (auto &list : conns) {
+                for (int fd : list) close(fd);
+            }
+        }
+    };
+
+    std::vector<Upstream> _upstreams;
+    std::vector<Route> _routes;
+    Upstream_State *_states = NULL;
+    std::unique_ptr<std::atomic<uint32_t>[]> _rr;   // 每条路由的轮询位置（各子进程独立）
+    std::unique_ptr<std::atomic<int>[]> _owner;     // 上游fd -> 客户fd
+    std::atomic<int> _active_sessions{0};
+    std::atomic<int> _waiting_sessions{0};          // 等待缓存的请求数
+    Locker _list_locker;
+    std::vector<Proxy_Session *> _active_list;      // 本进程中进行中的代理请求
+    Micro_Cache _cache;
+
+    int _connect_timeout_ms = 1000;
+    int _read_timeout_ms = 30000;
+    int _idle_conns = 8;
+    int _max_fails = 3;
+    int _fail_timeout_ms = 10000;
+    int _health_interval_ms = 0;
+    std::string _health_path;
+
+    pthread_t _health_thread;
+    bool _health_running = false;
+    std::atomic<bool> _health_stop{false};
+    Sem _health_sem;
+
+    static Idle_Pool &_idle_pool() {
+        thread_local Idle_Pool pool;
+        return pool;
+    }
+
+    int _add_upstream(const std::string &name) {
+
+        for (size_t i = 0; i < _upstreams.size(); ++i) {
+            if (_upstreams[i].name == name) return i;
+        }
+
+        size_t colon = name.rfind(':');
+        if (colon == std::string::npos) {
+            std::cout << "proxy upstream " << name << " should be host:port" << std::endl;
+            return -1;
+        }
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *res = NULL;
+        if (getaddrinfo(name.substr(0, colon).c_str(), name.c_str() + colon + 1, &hints, &res) != 0 || !res) {
+            std::cout << "proxy upstream " << name << " cannot be resolved" << std::endl;
+            return -1;
+        }
+
+        Upstream up;
+        up.name = name;
+        memcpy(&up.addr, res->ai_addr, sizeof(up.addr));
+        freeaddrinfo(res);
+        _upstreams.push_back(up);
+        return _upstreams.size() - 1;
+    }
+
+// 选择上游
+
+    bool _available(int idx, uint64_t now) const {
+        const Upstream_State &st = _states[idx];
+        return st.healthy.load(std::memory_order_relaxed) && \
+            now >= st.down_until_us.load(std::memory_order_relaxed);
+    }
+
+    int _pick(int route_idx) {
+
+        const Route &route = _routes[route_idx];
+        uint64_t now = now_us();
+        int n = route.upstreams.size();
+
+        if (route.balance == BP_LEAST_CONN) {
+            int best = -1, best_active = 0;
+            for (int idx : route.upstreams) {
+                if (!_available(idx, now)) continue;
+                int active = _states[idx].active.load(std::memory_order_relaxed);
+                if (best == -1 || active < best_active) {
+                    best = idx;
+                    best_active = active;
+                }
+            }
+            return best;
+        }
+
+        uint32_t start = _rr[route_idx].fetch_add(1, std::memory_order_relaxed);
+        for (int k = 0; k < n; ++k) {
+            int idx = route.upstreams[(start + k) % n];
+            if (_available(idx, now)) return idx;
+        }
+        return -1;
+    }
+
+    void _record_failure(int idx) {
+        Upstream_State &st = _states[idx];
+        st.failures.fetch_add(1, std::memory_order_relaxed);
+        if (st.fails.fetch_add(1) + 1 >= _max_fails) {
+            st.down_until_us.store(now_us() + _fail_timeout_ms * 1000ULL);
+            st.fails.store(0);
+        }
+    }
+
+    void _record_success(int idx) {
+        Upstream_State &st = _states[idx];
+        if (st.fails.load(std::memory_order_relaxed) != 0) st.fails.store(0);
+    }
+
+// 构造转发的请求
+
+    static bool _is_hop_by_hop(const std::string &name) {
+        static const char *names[] = {
+            "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", \
+            "Upgrade", "Transfer-Encoding", "Content-Length"
+        };
+        for (const char *n : names) {
+            if (strcasecmp(name.c_str(), n) == 0) return true;
+        }
+        return false;
+    }
+
+    void _build_request(Proxy_Session *s, const Http_Request_Parser &hrp, uint32_t peer_ip) {
+
+        const Route &route = _routes[s->route];
+        std::string path = hrp.url();
+        if (route.strip_prefix) {
+            path.erase(0, route.prefix.size());
+            if (path.empty() || path[0] != '/') path.insert(0, "/");
+        }
+
+        std::string &req = s->request;
+        req.reserve(512 + hrp.body().size());
+        req += hrp.method() + " " + path + " HTTP/1.1\r\n";
+
+        bool has_host = false;
+        std::string forwarded_for;
+        for (const auto &kv : hrp.headers()) {
+            if (_is_hop_by_hop(kv.first)) continue;
+            // 请求体已经完整收到再转发，上游不需要再回复100 Continue
+            if (strcasecmp(kv.first.c_str(), "Expect") == 0) continue;
+            if (strcasecmp(kv.first.c_str(), "X-Forwarded-For") == 0) {
+                forwarded_for = kv.second;
+                continue;
+            }
+            if (strcasecmp(kv.first.c_str(), "Host") == 0) has_host = true;
+            req += kv.first + ": " + kv.second + "\r\n";
+        }
+        if (!has_host) {
+            req += "Host: " + _upstreams[route.upstreams[0]].name + "\r\n";
+        }
+
+        char ip[INET_ADDRSTRLEN] = "";
+        inet_ntop(AF_INET, &peer_ip, ip, sizeof(ip));
+        req += "X-Forwarded-For: " + (forwarded_for.empty() ? \
+            std::string(ip) : forwarded_for + ", " + ip) + "\r\n";
+
+        if (hrp.has_body()) {
+            req += "Content-Length: " + std::to_string(hrp.body_size()) + "\r\n";
+        }
+        req += "Connection: keep-alive\r\n\r\n";
+        req += hrp.body();
+        if (hrp.body_fd() >= 0) {
+            s->body_fd = hrp.body_fd();
+            s->body_size = hrp.body_size();
+        }
+    }
+
+// 上游连接
+
+    // 从当前线程的空闲连接池中取一个仍然可用的连接
+    int _pool_get(int idx) {
+
+        Idle_Pool &pool = _idle_pool();
+        if ((size_t)idx >= pool.conns.size()) return -1;
+
+        std::vector<int> &list = pool.conns[idx];
+        while (!list.empty()) {
+            int fd = list.back();
+            list.pop_back();
+
+            // 空闲连接上不应有数据：可读说明上游已关闭（或出错）
+            char c;
+            if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && \
+                    (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return fd;
+            }
+            close(fd);
+        }
+        return -1;
+    }
+
+    bool _pool_put(int idx, int fd) {
+
+        Idle_Pool &pool = _idle_pool();
+        if (pool.conns.size() < _upstreams.size()) pool.conns.resize(_upstreams.size());
+
+        std::vector<int> &list = pool.conns[idx];
+        if ((int)list.size() >= _idle_conns) return false;
+        list.push_back(fd);
+        return true;
+    }
+
+    // 选择上游、取得连接并开始发送请求
+    template<typename ClientData_t>
+    PROXY_RESULT _connect_and_send(ClientData_t *client, int clientfd, Proxy_Session *s, ChildLoad *load) {
+
+        int idx = _pick(s->route);
+        if (idx < 0) {
+            return _fail(client, s, HTTP_UTILS::BAD_GATEWAY);   // 没有可用的上游
+        }
+        s->upstream = idx;
+        _states[idx].active.fetch_add(1, std::memory_order_relaxed);
+        _states[idx].requests.fetch_add(1, std::memory_order_relaxed);
+
+        int fd = _pool_get(idx);
+        if (fd >= 0) {
+            s->reused = true;
+            s->stage = PXS_SEND_REQUEST;
+        }else {
+            s->reused = false;
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) return _fail(client, s, HTTP_UTILS::BAD_GATEWAY);
+
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            const sockaddr_in &addr = _upstreams[idx].addr;
+            if (connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0) {
+                s->stage = PXS_SEND_REQUEST;
+            }else if (errno == EINPROGRESS) {
+                s->stage = PXS_CONNECT;
+            }else {
+                close(fd);
+                _record_failure(idx);
+                return _fail(client, s, HTTP_UTILS::BAD_GATEWAY);
+            }
+        }
+
+        if (fd >= PROXY_MAX_FD) {
+            close(fd);
+            return _fail(client, s, HTTP_UTILS::BAD_GATEWAY);
+        }
+
+        s->upstream_fd = fd;
+        s->registered = false;
+        s->request_sent = 0;
+        s->body_sent = 0;
+        _owner[fd].store(clientfd, std::memory_order_release);
+
+        if (s->stage == PXS_CONNECT) {
+            return _arm_upstream(client, s, EPOLLOUT);
+        }
+        return _advance(client, clientfd, s, load);
+    }
+
+    // 上游出错：空闲池中的连接可能已被上游关闭，幂等请求换一个新连接重试一次
+    template<typename ClientData_t>
+    PROXY_RESULT _upstream_error(ClientData_t *client, int clientfd, Proxy_Session *s, ChildLoad *load) {
+
+        bool stale = s->reused && !s->retried && s->idempotent && \
+            s->stage != PXS_STREAM && s->header_in.empty();
+        if (stale) {
+            s->retried = true;
+            _close_upstream(s);
+            s->_reset_response();
+            return _connect_and_send(client, clientfd, s, load);
+        }
+
+        if (s->upstream >= 0) _record_failure(s->upstream);
+        return _fail(client, s, HTTP_UTILS::BAD_GATEWAY);
+    }
+
+    // 放弃代理请求：还没有向客户端发送响应时回复错误码，否则只能关闭客户连接
+    template<typename ClientData_t>
+    PROXY_RESULT _fail(ClientData_t *client, Proxy_Session *s, HTTP_UTILS::HTTPCODE code) {
+
+        bool started = s->stage == PXS_STREAM;
+        _close_upstream(s);
+        _end_session(s);
+        if (started) return PXR_CLOSE;
+
+        client->hrs().clear_data();
+        client->hrs().response_error(client->hrp(), code);
+        return PXR_RESPOND;
+    }
+
+    void _end_session(Proxy_Session *s) {
+        if (s->stage == PXS_WAIT_CACHE) --_waiting_sessions;
+        if (s->cache_fill) {
+            // 没有得到完整的响应：让等待的请求自己回源
+            _cache.abandon(s->cache_handle, false);
+            s->cache_fill = false;
+        }
+        s->stage = PXS_IDLE;
+        s->active.store(false);
+        --_active_sessions;
+
+        // 从进行中的列表删除：用最后一项填补位置
+        _list_locker.lock();
+        Proxy_Session *last = _active_list.back();
+        _active_list[s->list_pos] = last;
+        last->list_pos = s->list_pos;
+        _active_list.pop_back();
+        _list_locker.unlock();
+    }
+
+    void _close_upstream(Proxy_Session *s) {
+
+        if (s->upstream_fd >= 0) {
+            _owner[s->upstream_fd].store(-1, std::memory_order_release);
+            close(s->upstream_fd);      // 同时从epoll中删除
+            s->upstream_fd = -1;
+        }
+        if (s->upstream >= 0) {
+            _states[s->upstream].active.fetch_sub(1, std::memory_order_relaxed);
+            s->upstream = -1;
+        }
+    }
+
+    // 响应完整转发后，可以保持的上游连接放回当前线程的连接池
+    void _release_upstream(Proxy_Session *s) {
+
+        if (!s->upstream_keep_alive || s->upstream_fd < 0) {
+            _close_upstream(s);
+            return;
+        }
+        int fd = s->upstream_fd;
+        if (s->registered) Epoll_Util::removefd(fd);
+        _owner[fd].store(-1, std::memory_order_release);
+        if (!_pool_put(s->upstream, fd)) close(fd);
+
+        _states[s->upstream].active.fetch_sub(1, std::memory_order_relaxed);
+        s->upstream_fd = -1;
+        s->upstream = -1;
+    }
+
+// 等待事件：先释放调度权（并更新超时时刻），再注册事件，之后不能再访问该连接
+
+    template<typename ClientData_t>
+    PROXY_RESULT _arm_upstream(ClientData_t *client, Proxy_Session *s, int ev) {
+
+        int timeout_ms = s->stage == PXS_CONNECT ? _connect_timeout_ms : _read_timeout_ms;
+        s->deadline_us.store(now_us() + timeout_ms * 1000ULL);
+
+        int fd = s->upstream_fd;
+        bool registered = s->registered;
+        s->registered = true;
+        client->_scheduled.store(false);
+        if (registered) {
+            Epoll_Util::rearm_oneshot(fd, ev);
+        }else {
+            Epoll_Util::addfd_oneshot(fd, ev);
+        }
+        return PXR_PENDING;
+    }
+
+    template<typename ClientData_t>
+    PROXY_RESULT _arm_client(ClientData_t *client, int clientfd, Proxy_Session *s, ChildLoad *load) {
+
+        s->deadline_us.store(now_us() + _read_timeout_ms * 1000ULL);
+        client->_scheduled.store(false);
+        if (load) load->epoll_ctl_calls.fetch_add(1, std::memory_order_relaxed);
+        Epoll_Util::modifyfd(clientfd, EPOLLOUT);
+        return PXR_PENDING;
+    }
+
+// 状态机
+
+    template<typename ClientData_t>
+    PROXY_RESULT _advance(ClientData_t *client, int clientfd, Proxy_Session *s, ChildLoad *load) {
+
+        while (true) {
+            switch (s->stage) {
+
+                case PXS_CONNECT: {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(s->upstream_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if (err != 0) return _upstream_error(client, clientfd, s, load);
+                    s->stage = PXS_SEND_REQUEST;
+                    break;
+                }
+
+                case PXS_SEND_REQUEST: {
+                    while (s->request_sent < s->request.size()) {
+                        ssize_t n = send(s->upstream_fd, s->request.data() + s->request_sent, \
+                            s->request.size() - s->request_sent, MSG_NOSIGNAL);
+                        if (n < 0) {
+                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                return _arm_upstream(client, s, EPOLLOUT);
+                            }
+                            if (errno == EINTR) continue;
+                            return _upstream_error(client, clientfd, s, load);
+                        }
+                        s->request_sent += n;
+                    }
+                    // 转存的请求体：从临时文件直接发送，不经过用户态
+                    while ((uint64_t)s->body_sent < s->body_size) {
+                        ssize_t n = sendfile(s->upstream_fd, s->body_fd, &s->body_sent, \
+                            s->body_size - s->body_sent);
+                        if (n < 0) {
+                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                return _arm_upstream(client, s, EPOLLOUT);
+                            }
+                            if (errno == EINTR) continue;
+                            return _upstream_error(client, clientfd, s, load);
+                        }
+                        if (n == 0) return _upstream_error(client, clientfd, s, load);
+                    }
+                    s->stage = PXS_READ_HEADER;
+                    break;
+                }
+
+                case PXS_READ_HEADER: {
+                    // 先在已收到的数据中找完整的响应头：1xx之后的最终响应可能在同一个报文段中
+                    size_t end = s->header_in.find("\r\n\r\n");
+                    if (end == std::string::npos) {
+                        if (s->header_in.size() >= PROXY_HEADER_MAX) {
+                            return _upstream_error(client, clientfd, s, load);
+                        }
+                        ssize_t n = recv(s->upstream_fd, s->buf, PROXY_HEADER_MAX - s->header_in.size(), 0);
+                        if (n < 0) {
+                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                return _arm_upstream(client, s, EPOLLIN);
+                            }
+                            if (errno == EINTR) break;
+                            return _upstream_error(client, clientfd, s, load);
+                        }
+                        if (n == 0) return _upstream_error(client, clientfd, s, load);
+
+                        s->header_in.append(s->buf, n);
+                        break;
+                    }
+
+                    // 响应头之后已经读到的部分是响应体
+                    std::string head = s->header_in.substr(0, end);
+                    std::string rest = s->header_in.substr(end + 4);
+                    int status = _parse_response_header(s, head);
+                    if (status < 0) return _upstream_error(client, clientfd, s, load);
+                    if (status >= 100 && status < 200) {
+                        s->header_in = rest;    // 跳过1xx中间响应，重新查找下一个响应头
+                        s->header_out.clear();
+                        break;
+                    }
+
+                    s->status = status;
+                    _record_success(s->upstream);
+                    _cache_on_header(s, status, head);
+                    _close_header_out(s);
+                    memcpy(s->buf, rest.data(), rest.size());
+                    s->buf_len = rest.size();
+                    s->buf_sent = 0;
+                    _consume_body(s);
+                    s->stage = PXS_STREAM;
+                    break;
+                }
+
+                case PXS_STREAM: {
+                    IO_STATUS status = _flush_to_client(client->_tls, clientfd, s, load);
+                    if (status == IOS_AGAIN) return _arm_client(client, clientfd, s, load);
+                    if (status == IOS_CLOSE || (s->broken && s->buf_sent == s->buf_len)) {
+                        s->upstream_keep_alive = false;
+                        _close_upstream(s);
+                        _end_session(s);
+                        return PXR_CLOSE;
+                    }
+
+                    if (s->body_done) {
+                        _cache_commit(s);
+                        _release_upstream(s);
+                        _end_session(s);
+                        return PXR_DONE;
+                    }
+
+                    // 缓冲区已全部写给客户端，继续读上游
+                    ssize_t n = recv(s->upstream_fd, s->buf, PROXY_BUF_SZ, 0);
+                    if (n < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            return _arm_upstream(client, s, EPOLLIN);
+                        }
+                        if (errno == EINTR) break;
+                    }
+                    if (n <= 0) {
+                        if (n == 0 && s->framing == BF_CLOSE) {
+                            // 上游关闭连接即响应结束
+                            s->body_done = true;
+                            s->upstream_keep_alive = false;
+                            break;
+                        }
+                        // 响应体不完整：客户端无法得知，只能关闭连接
+                        if (s->upstream >= 0) _record_failure(s->upstream);
+                        _close_upstream(s);
+                        _end_session(s);
+                        return PXR_CLOSE;
+                    }
+
+                    s->buf_len = n;
+                    s->buf_sent = 0;
+                    _consume_body(s);
+                    break;
+                }
+
+                case PXS_WAIT_CACHE:
+                    // reactor定期唤醒：重新查询缓存
+                    --_waiting_sessions;
+                    s->stage = PXS_IDLE;
+                    return _cache_start(client, clientfd, s, load);
+
+                default:
+                    return PXR_CLOSE;
+            }
+        }
+    }
+
+    // 把待发送的响应头和缓冲区写给客户端
+    static IO_STATUS _flush_to_client(Tls_Conn *tls, int clientfd, Proxy_Session *s, ChildLoad *load) {
+
+        while (s->header_out_sent < s->header_out.size() || s->buf_sent < s->buf_len) {
+
+            iovec iov[2];
+            int cnt = 0;
+            if (s->header_out_sent < s->header_out.size()) {
+                iov[cnt].iov_base = (void *)(s->header_out.data() + s->header_out_sent);
+                iov[cnt++].iov_len = s->header_out.size() - s->header_out_sent;
+            }
+            if (s->buf_sent < s->buf_len) {
+                iov[cnt].iov_base = s->buf + s->buf_sent;
+                iov[cnt++].iov_len = s->buf_len - s->buf_sent;
+            }
+
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+
+            if (load) load->send_calls.fetch_add(1, std::memory_order_relaxed);
+            ssize_t n = Tls_Util::sendmsg(tls, clientfd, &msg, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return IOS_AGAIN;
+                if (errno == EINTR) continue;
+                return IOS_CLOSE;
+            }
+
+            s->bytes_out += n;
+            size_t header_left = s->header_out.size() - s->header_out_sent;
+            size_t from_header = std::min<size_t>(n, header_left);
+            s->header_out_sent += from_header;
+            s->buf_sent += n - from_header;
+        }
+        return IOS_DONE;
+    }
+
+    // 缓冲区中新读到的是响应体：按响应体的边界截断，判断响应是否结束
+    void _consume_body(Proxy_Session *s) {
+
+        switch (s->framing) {
+            case BF_NONE:
+                if (s->buf_len > 0) s->upstream_keep_alive = false;  // 多余的数据
+                s->buf_len = 0;
+                s->body_done = true;
+                break;
+            case BF_LENGTH: {
+                uint64_t take = std::min<uint64_t>(s->body_remaining, s->buf_len);
+                if (take < s->buf_len) s->upstream_keep_alive = false;
+                s->buf_len = take;
+                s->body_remaining -= take;
+                s->body_done = s->body_remaining == 0;
+                break;
+            }
+            case BF_CHUNKED: {
+                size_t used = s->chunks.feed(s->buf, s->buf_len);
+                if (s->chunks.bad()) {
+                    s->broken = true;
+                    s->upstream_keep_alive = false;
+                }else if (s->chunks.done()) {
+                    if (used < s->buf_len) s->upstream_keep_alive = false;
+                    s->body_done = true;
+                }
+                s->buf_len = used;
+                break;
+            }
+            case BF_CLOSE:
+                break;
+        }
+
+        // 需要写入缓存的响应：同时保留一份响应体，超过缓存项的大小则放弃
+        if (s->cache_fill && s->buf_len > 0) {
+            size_t limit = _cache.entry_bytes() - std::min(_cache.entry_bytes(), \
+                s->cache_key.size() + s->header_core_len);
+            if (s->cache_body.size() + s->buf_len > limit) {
+                _cache.abandon(s->cache_handle, true);
+                s->cache_fill = false;
+                s->cache_body.clear();
+            }else {
+                s->cache_body.append(s->buf, s->buf_len);
+            }
+        }
+    }
+
+    /**
+     * 解析上游的响应头，生成转发给客户端的响应头
+     * 返回状态码，格式错误返回-1
+     */
+    static int _parse_response_header(Proxy_Session *s, const std::string &head) {
+
+        size_t line_end = head.find("\r\n");
+        std::string status_line = head.substr(0, line_end);
+        if (status_line.compare(0, 5, "HTTP/") != 0 || status_line.size() < 12) return -1;
+
+        int status = atoi(status_line.c_str() + 9);
+        if (status < 100 || status > 999) return -1;
+
+        // HTTP/1.1默认保持连接，HTTP/1.0默认关闭
+        s->upstream_keep_alive = status_line.compare(0, 8, "HTTP/1.0") != 0;
+        bool chunked = false, has_length = false;
+        uint64_t length = 0;
+        std::string forwarded;
+
+        size_t pos = line_end == std::string::npos ? head.size() : line_end + 2;
+        while (pos < head.size()) {
+            size_t next = head.find("\r\n", pos);
+            if (next == std::string::npos) next = head.size();
+            std::string line = head.substr(pos, next - pos);
+            pos = next + 2;
+
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string name = line.substr(0, colon);
+            size_t vbeg = line.find_first_not_of(" \t", colon + 1);
+            std::string value = vbeg == std::string::npos ? "" : line.substr(vbeg);
+
+            if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+                has_length = true;
+                length = strtoull(value.c_str(), NULL, 10);
+            }else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+                chunked = strcasestr(value.c_str(), "chunked") != NULL;
+            }else if (strcasecmp(name.c_str(), "Connection") == 0) {
+                if (strcasestr(value.c_str(), "close")) s->upstream_keep_alive = false;
+                else if (strcasestr(value.c_str(), "keep-alive")) s->upstream_keep_alive = true;
+                continue;
+            }else if (strcasecmp(name.c_str(), "Keep-Alive") == 0 || \
+                    strcasecmp(name.c_str(), "Proxy-Connection") == 0) {
+                continue;
+            }
+            forwarded += line + "\r\n";
+        }
+
+        if (status < 200) return status;
+
+        if (s->head_request || status == 204 || status == 304) {
+            s->framing = BF_NONE;
+        }else if (chunked) {
+            s->framing = BF_CHUNKED;
+        }else if (has_length) {
+            s->framing = BF_LENGTH;
+            s->body_remaining = length;
+        }else {
+            // 没有长度信息：以上游关闭为结束，客户端也只能以关闭连接得知结束
+            s->framing = BF_CLOSE;
+            s->upstream_keep_alive = false;
+            s->client_keep_alive = false;
+        }
+        s->body_done = s->framing == BF_NONE || (s->framing == BF_LENGTH && length == 0);
+
+        // 本服务器的首部（缓存状态、Connection）由_close_header_out添加
+        s->header_out = status_line + "\r\n" + forwarded;
+        s->header_core_len = s->header_out.size();
+        s->header_out_sent = 0;
+        return status;
+    }
+
+    // 在上游的首部之后添加本服务器的首部，并结束响应头
+    static void _close_header_out(Proxy_Session *s) {
+        if (s->cache_status) {
+            s->header_out += std::string("X-Cache-Status: ") + s->cache_status + "\r\n";
+        }
+        s->header_out += std::string("Connection: ") + \
+            (s->client_keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+    }
+
+// 微缓存
+
+    static bool _has_header(const Http_Request_Parser &hrp, const char *name) {
+        for (const auto &kv : hrp.headers()) {
+            if (strcasecmp(kv.first.c_str(), name) == 0) return true;
+        }
+        return false;
+    }
+
+    static std::string _header_value(const Http_Request_Parser &hrp, const char *name) {
+        for (const auto &kv : hrp.headers()) {
+            if (strcasecmp(kv.first.c_str(), name) == 0) return kv.second;
+        }
+        return "";
+    }
+
+    // 查询缓存：命中则直接回复，未命中则回源（或等待正在回源的请求）
+    template<typename ClientData_t>
+    PROXY_RESULT _cache_start(ClientData_t *client, int clientfd, Proxy_Session *s, ChildLoad *load) {
+
+        std::string header;
+        uint32_t age_s = 0;
+        CACHE_LOOKUP result = _cache.lookup(s->cache_key, &s->cache_handle, &header, &s->cache_body, &age_s);
+
+        switch (result) {
+            case CL_HIT: case CL_STALE:
+                // 整个响应放在header_out中，不经过上游
+                s->cache_status = result == CL_HIT ? "HIT" : "UPDATING";
+                s->header_out = header;
+                s->status = atoi(header.c_str() + 9);
+                s->header_out += "Age: " + std::to_string(age_s) + "\r\n";
+                _close_header_out(s);
+                s->header_out += s->cache_body;
+                s->cache_body.clear();
+                s->header_out_sent = 0;
+                s->buf_len = s->buf_sent = 0;
+                s->body_done = true;
+                s->upstream_keep_alive = false;
+                s->stage = PXS_STREAM;
+                return _advance(client, clientfd, s, load);
+
+            case CL_WAIT:
+                // 同一URL正在回源：暂停，由reactor在MICROCACHE_WAIT_POLL_MS后唤醒
+                s->stage = PXS_WAIT_CACHE;
+                ++_waiting_sessions;
+                s->deadline_us.store(now_us() + MICROCACHE_WAIT_POLL_MS * 1000ULL);
+                client->_scheduled.store(false);
+                return PXR_PENDING;
+
+            case CL_FILL: case CL_REFRESH:
+                s->cache_fill = true;
+                s->cache_status = result == CL_FILL ? "MISS" : "EXPIRED";
+                return _connect_and_send(client, clientfd, s, load);
+
+            default:
+                s->cache_status = "BYPASS";
+                return _connect_and_send(client, clientfd, s, load);
+        }
+    }
+
+    // 收到上游的响应头：不可缓存则立即放弃回源锁，等待的请求各自回源
+    void _cache_on_header(Proxy_Session *s, int status, const std::string &head) {
+
+        if (!s->cache_fill) return;
+
+        int64_t ttl_ms = 0, stale_ms = -1;
+        bool cacheable = s->framing != BF_CLOSE && \
+            Micro_Cache::cache_policy(status, head, &ttl_ms, &stale_ms);
+        if (!cacheable) {
+            _cache.abandon(s->cache_handle, true);
+            s->cache_fill = false;
+            return;
+        }
+        s->cache_ttl_ms = ttl_ms;
+        s->cache_stale_ms = stale_ms >= 0 ? stale_ms : _cache.default_stale_ms();
+        s->cache_body.clear();
+    }
+
+    // 响应完整：写入缓存
+    void _cache_commit(Proxy_Session *s) {
+
+        if (!s->cache_fill) return;
+        _cache.commit(s->cache_handle, s->header_out.substr(0, s->header_core_len), \
+            s->cache_body, s->cache_ttl_ms, s->cache_stale_ms);
+        s->cache_fill = false;
+        s->cache_body.clear();
+    }
+
+// 主动健康检查（父进程中的线程）
+
+    static void *_health_routine(void *args) {
+
+        Reverse_Proxy *proxy = (Reverse_Proxy *)args;
+        while (!proxy->_health_stop) {
+
+            for (size_t i = 0; i < proxy->_upstreams.size() && !proxy->_health_stop; ++i) {
+                bool ok = proxy->_probe(proxy->_upstreams[i]);
+                int was = proxy->_states[i].healthy.exchange(ok ? 1 : 0);
+                if (was != (ok ? 1 : 0)) {
+                    std::cout << "upstream " << proxy->_upstreams[i].name \
+                        << (ok ? " is up" : " is down") << std::endl;
+                }
+            }
+            proxy->_health_sem.timed_wait(proxy->_health_interval_ms);
+        }
+        return NULL;
+    }
+
+    // 连接上游（配置了路径时再发送一个GET），在connect超时之内完成
+    bool _probe(const Upstream &up) {
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+
+        bool ok = false;
+        int ret = connect(fd, (const sockaddr *)&up.addr, sizeof(up.addr));
+        if (ret == 0 || (errno == EINPROGRESS && _poll(fd, POLLOUT))) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            ok = err == 0;
+        }
+
+        if (ok && !_health_path.empty()) {
+            std::string req = "GET " + _health_path + " HTTP/1.1\r\nHost: " + up.name + \
+                "\r\nConnection: close\r\n\r\n";
+            char resp[64] = {0};
+            ok = send(fd, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size() && \
+                _poll(fd, POLLIN) && recv(fd, resp, sizeof(resp) - 1, 0) >= 12 && \
+                strncmp(resp, "HTTP/1.", 7) == 0 && resp[9] >= '2' && resp[9] <= '3';
+        }
+        close(fd);
+        return ok;
+    }
+
+    bool _poll(int fd, short ev) {
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = ev;
+        pfd.revents = 0;
+        return poll(&pfd, 1, _connect_timeout_ms) == 1 && (pfd.revents & ev);
+    }
+};
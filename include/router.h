@@ -0,0 +1,377 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "http_request_parser.h"
+#include "http_response_sender.h"
+
+#define ROUTE_MAX_PARAMS 8      // 一条路由最多的参数（含通配符）个数
+
+// 路由按方法分派；RM_ANY是不限方法的处理器
+enum ROUTE_METHOD {
+    RM_GET = 0,
+    RM_HEAD,
+    RM_POST,
+    RM_PUT,
+    RM_DELETE,
+    RM_PATCH,
+    RM_OPTIONS,
+    RM_ANY,
+    RM_COUNT
+};
+
+// 查找的结果
+enum ROUTE_RESULT {
+    RR_NONE = 0,            // 没有匹配的路由：按静态文件处理
+    RR_FOUND,
+    RR_METHOD_NOT_ALLOWED   // 路径匹配但没有该方法的处理器（405）
+};
+
+/**
+ * desc: 路由参数（:name匹配的一段路径，*name匹配的剩余路径）
+ *      只引用URL和路由表中的字节，不拷贝；在处理器返回之前有效
+ *      参数值是URL中的原样，没有做百分号解码
+ */
+struct Route_Params {
+    struct Item {
+        const char *name;
+        const char *value;
+        uint16_t name_len;
+        uint32_t value_len;
+    };
+
+    Item items[ROUTE_MAX_PARAMS];
+    int count = 0;
+
+    // 按名字查找参数，不存在时返回false
+    bool get(const char *name, const char **value, size_t *len) const {
+        size_t n = strlen(name);
+        for (int i = 0; i < count; ++i) {
+            if (items[i].name_len == n && memcmp(items[i].name, name, n) == 0) {
+                *value = items[i].value;
+                *len = items[i].value_len;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string value(const char *name) const {
+        const char *v = NULL;
+        size_t len = 0;
+        return get(name, &v, &len) ? std::string(v, len) : std::string();
+    }
+};
+
+/**
+ * desc: 路由的处理器
+ *      由多个工作线程同时调用，必须是线程安全的；
+ *      用hrs.response_content（或response_error）生成响应
+ *      请求体默认完整收到之后才调用handle：
+ *      超过request_body_memory_bytes的请求体转存在临时文件中，hrp.body()为空：
+ *      reads_spooled_body返回true的处理器从hrp.body_fd()读取，其他处理器收不到这样的请求（413）
+ *      streams_body返回true的处理器边收边处理：请求体不存放，每段块数据到达时调用on_body_chunk，
+ *      全部收到后调用handle（hrp.body()为空），请求结束时（包括中途出错、连接关闭）调用on_body_end；
+ *      HTTP/2的请求体由会话收在内存中，handle之前一次交给on_body_chunk
+ *      同一个请求的回调在同一个连接上依次进行，一个连接同时只有一个请求，可以用&hrp区分请求
+ */
+class Route_Handler {
+public:
+    virtual ~Route_Handler() {}
+
+    virtual void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, \
+        const Route_Params &params) = 0;
+
+    virtual bool reads_spooled_body() const {
+        return false;
+    }
+
+    virtual bool streams_body() const {
+        return false;
+    }
+
+    // 一段请求体（已去掉分块格式），返回false时回复500并关闭连接
+    virtual bool on_body_chunk(Http_Request_Parser &hrp, const Route_Params &params, \
+            const char *data, size_t len) {
+        return true;
+    }
+
+    // complete为false表示请求体没有收完（格式错误、超过上限、连接关闭）
+    virtual void on_body_end(Http_Request_Parser &hrp, bool complete) {
+    }
+};
+
+// desc: URL路由
+//      启动时（ProcessPool::create之前）用add注册路由：
+//          /health             静态路径
+//          /api/users/:id      :id匹配一段（不含'/'）
+//          /static/*path       *path匹配剩余的全部路径，只能在最后
+//      create在fork之前调用freeze：构造用的基数树（radix tree）被压平成一个只读的
+//      节点数组，子节点连续存放，标签集中在一个字符串里，各线程查找不需要加锁
+//      查找不分配内存；优先级：静态 > 参数 > 通配符，后面的段不匹配时回溯到下一种；
+//      一个节点在一次查找中最多访问一次（到达它时的路径位置是确定的），时间上限是节点数，
+//      没有回溯时与路径长度成正比
+class Router final {
+public:
+    static Router &instance() {
+        static Router router;
+        return router;
+    }
+
+    // 注册路由，method为"*"时不限方法；路由表已冻结、模式不合法或重复注册时返回false
+    bool add(const std::string &method, const std::string &pattern, Route_Handler *handler) {
+
+        int m = method == "*" ? RM_ANY : method_index(method.data(), method.size());
+        if (_frozen || m < 0 || handler == NULL || pattern.empty() || pattern[0] != '/') return false;
+        if (!_root) _root.reset(new Build_Node());
+
+        Build_Node *node = _root.get();
+        size_t i = 0;
+        int params = 0;
+        while (i < pattern.size()) {
+            char c = pattern[i];
+            if ((c == ':' || c == '*') && pattern[i - 1] == '/') {
+                size_t end = pattern.find('/', i);
+                if (end == std::string::npos) end = pattern.size();
+                std::string name = pattern.substr(i + 1, end - i - 1);
+                if (name.empty() || ++params > ROUTE_MAX_PARAMS) return false;
+                if (c == '*' && end != pattern.size()) return false;
+
+                // 同一位置的参数必须同名
+                std::unique_ptr<Build_Node> &child = c == ':' ? node->param : node->wildcard;
+                if (!child) {
+                    child.reset(new Build_Node());
+                    child->label = name;
+                }else if (child->label != name) {
+                    return false;
+                }
+                node = child.get();
+                i = end;
+                continue;
+            }
+
+            size_t end = i;
+            while (end < pattern.size() && !((pattern[end] == ':' || pattern[end] == '*') && \
+                    pattern[end - 1] == '/')) {
+                ++end;
+            }
+            node = _insert_static(node, pattern.substr(i, end - i));
+            i = end;
+        }
+
+        if (node->handlers[m] != NULL) return false;
+        node->handlers[m] = handler;
+        return true;
+    }
+
+    // 压平成只读数组，之后不能再注册
+    void freeze() {
+
+        if (_frozen) return;
+        _frozen = true;
+        if (!_root) return;
+
+        _nodes.clear();
+        _labels.clear();
+        _slots.clear();
+        _nodes.push_back(Route_Node());
+        _flatten(_root.get(), 0);
+        _root.reset();
+    }
+
+    bool empty() const {
+        return _nodes.empty();
+    }
+
+    // 查找请求的处理器（url中的查询串被忽略）
+    ROUTE_RESULT match(const std::string &method, const std::string &url, \
+            Route_Handler **handler, Route_Params *params) const {
+
+        if (_nodes.empty()) return RR_NONE;
+
+        size_t len = url.find('?');
+        if (len == std::string::npos) len = url.size();
+        params->count = 0;
+        const Route_Node *node = _lookup(0, url.data(), url.data() + len, params);
+        if (node == NULL) return RR_NONE;
+
+        Route_Handler *const *slot = &_slots[node->slot * RM_COUNT];
+        int m = method_index(method.data(), method.size());
+        *handler = m >= 0 && slot[m] ? slot[m] : slot[RM_ANY];
+        if (*handler == NULL && m == RM_HEAD) *handler = slot[RM_GET];
+        return *handler ? RR_FOUND : RR_METHOD_NOT_ALLOWED;
+    }
+
+    // 405时的Allow首部的值（有GET处理器时也列出HEAD，与match一致）
+    std::string allow(const std::string &url) const {
+
+        Route_Params params;
+        size_t len = std::min(url.find('?'), url.size());
+        const Route_Node *node = _lookup(0, url.data(), url.data() + len, &params);
+        if (node == NULL) return std::string();
+
+        std::string value;
+        Route_Handler *const *slot = &_slots[node->slot * RM_COUNT];
+        for (int m = 0; m < RM_ANY; ++m) {
+            if (slot[m] == NULL && !(m == RM_HEAD && slot[RM_GET] != NULL)) continue;
+            if (!value.empty()) value += ", ";
+            value += METHOD_NAMES[m];
+        }
+        return value;
+    }
+
+    static int method_index(const char *method, size_t len) {
+        for (int m = 0; m < RM_ANY; ++m) {
+            if (strlen(METHOD_NAMES[m]) == len && memcmp(METHOD_NAMES[m], method, len) == 0) return m;
+        }
+        return -1;
+    }
+
+private:
+    static constexpr const char *METHOD_NAMES[RM_ANY] = {
+        "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS"
+    };
+
+    // 构造用的树：静态子节点按标签压缩，参数和通配符是单独的子节点（标签为参数名）
+    struct Build_Node {
+        std::string label;
+        std::vector<std::unique_ptr<Build_Node>> children;
+        std::unique_ptr<Build_Node> param;
+        std::unique_ptr<Build_Node> wildcard;
+        Route_Handler *handlers[RM_COUNT] = {};
+    };
+
+    // 冻结后的节点：静态子节点在_nodes中连续存放，按标签首字节区分
+    struct Route_Node {
+        uint32_t label_off = 0;     // 标签（参数节点为参数名）在_labels中的位置
+        uint16_t label_len = 0;
+        uint16_t child_count = 0;
+        uint32_t first_child = 0;
+        int32_t param = -1;         // 参数子节点
+        int32_t wildcard = -1;      // 通配符子节点
+        int32_t slot = -1;          // 处理器在_slots中的位置（乘RM_COUNT），-1表示不是路由的终点
+    };
+
+    bool _frozen = false;
+    std::unique_ptr<Build_Node> _root;
+    std::vector<Route_Node> _nodes;
+    std::string _labels;
+    std::vector<Route_Handler *> _slots;
+
+    Router() {}
+
+    // 在node下插入一段静态路径，必要时分裂已有的边，返回路径终点的节点
+    static Build_Node *_insert_static(Build_Node *node, std::string s) {
+
+        while (!s.empty()) {
+            std::unique_ptr<Build_Node> *edge = NULL;
+            for (auto &child : node->children) {
+                if (child->label[0] == s[0]) {
+                    edge = &child;
+                    break;
+                }
+            }
+            if (edge == NULL) {
+                node->children.emplace_back(new Build_Node());
+                node->children.back()->label = s;
+                return node->children.back().get();
+            }
+
+            std::string &label = (*edge)->label;
+            size_t k = 0;
+            while (k < label.size() && k < s.size() && label[k] == s[k]) ++k;
+            if (k < label.size()) {
+                std::unique_ptr<Build_Node> mid(new Build_Node());
+                mid->label = label.substr(0, k);
+                label.erase(0, k);
+                mid->children.push_back(std::move(*edge));
+                *edge = std::move(mid);
+            }
+            node = edge->get();
+            s.erase(0, k);
+        }
+        return node;
+    }
+
+    // 把src写到_nodes[idx]，子节点（静态的连续）追加到数组末尾
+    void _flatten(Build_Node *src, size_t idx) {
+
+        _nodes[idx].label_off = _labels.size();
+        _nodes[idx].label_len = src->label.size();
+        _labels += src->label;
+
+        bool terminal = false;
+        for (int m = 0; m < RM_COUNT; ++m) terminal |= src->handlers[m] != NULL;
+        if (terminal) {
+            _nodes[idx].slot = _slots.size() / RM_COUNT;
+            _slots.insert(_slots.end(), src->handlers, src->handlers + RM_COUNT);
+        }
+
+        size_t first = _nodes.size();
+        _nodes[idx].first_child = first;
+        _nodes[idx].child_count = src->children.size();
+        _nodes.resize(first + src->children.size());
+        if (src->param) {
+            _nodes[idx].param = _nodes.size();
+            _nodes.push_back(Route_Node());
+        }
+        if (src->wildcard) {
+            _nodes[idx].wildcard = _nodes.size();
+            _nodes.push_back(Route_Node());
+        }
+
+        // 注意：_nodes在递归中会扩容，只能通过下标访问
+        for (size_t i = 0; i < src->children.size(); ++i) _flatten(src->children[i].get(), first + i);
+        if (src->param) _flatten(src->param.get(), _nodes[idx].param);
+        if (src->wildcard) _flatten(src->wildcard.get(), _nodes[idx].wildcard);
+    }
+
+    // node的标签已经匹配，从p开始匹配剩余的路径；返回路由的终点节点
+    const Route_Node *_lookup(uint32_t idx, const char *p, const char *end, Route_Params *params) const {
+
+        const Route_Node &node = _nodes[idx];
+        if (p == end && node.slot >= 0) return &node;
+
+        // 1. 静态子节点：首字节不同，最多一个候选
+        if (p < end) {
+            for (uint32_t i = node.first_child; i < node.first_child + node.child_count; ++i) {
+                const Route_Node &child = _nodes[i];
+                const char *label = _labels.data() + child.label_off;
+                if (label[0] != *p) continue;
+                if ((size_t)(end - p) >= child.label_len && memcmp(label, p, child.label_len) == 0) {
+                    const Route_Node *found = _lookup(i, p + child.label_len, end, params);
+                    if (found) return found;
+                }
+                break;
+            }
+        }
+
+        // 2. 参数：匹配到下一个'/'，不能为空
+        if (node.param >= 0 && p < end && *p != '/' && params->count < ROUTE_MAX_PARAMS) {
+            const char *q = p;
+            while (q < end && *q != '/') ++q;
+            _push_param(node.param, p, q, params);
+            const Route_Node *found = _lookup(node.param, q, end, params);
+            if (found) return found;
+            --params->count;
+        }
+
+        // 3. 通配符：匹配剩余的全部（可以为空）
+        if (node.wildcard >= 0 && _nodes[node.wildcard].slot >= 0 && params->count < ROUTE_MAX_PARAMS) {
+            _push_param(node.wildcard, p, end, params);
+            return &_nodes[node.wildcard];
+        }
+        return NULL;
+    }
+
+    void _push_param(int32_t idx, const char *value, const char *value_end, Route_Params *params) const {
+        Route_Params::Item &item = params->items[params->count++];
+        item.name = _labels.data() + _nodes[idx].label_off;
+        item.name_len = _nodes[idx].label_len;
+        item.value = value;
+        item.value_len = value_end - value;
+    }
+};
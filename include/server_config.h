@@ -0,0 +1,144 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// 子进程/线程在CPU和NUMA节点上的放置策略
+enum PLACEMENT_POLICY {
+    PP_NONE = 0,    // 不设置亲和性，完全交给内核调度（原有行为）
+    PP_COMPACT,     // 紧凑：按节点顺序依次占满CPU，相邻子进程尽量落在同一节点
+    PP_SCATTER,     // 分散：子进程轮流分布到各个NUMA节点
+    PP_NUMA_NODE    // 每个NUMA节点一个子进程，子进程绑定整个节点
+};
+
+// 反向代理选择上游服务器的策略
+enum BALANCE_POLICY {
+    BP_ROUND_ROBIN = 0, // 轮询
+    BP_LEAST_CONN       // 当前请求数最少的上游（跨子进程统计）
+};
+
+// 一条反向代理路由：URL以prefix开头的请求转发给一组上游服务器
+struct Proxy_Route_Config {
+    std::string prefix;                 // 如 "/api/"，多条路由匹配时取最长的前缀
+    std::vector<std::string> upstreams; // "host:port"，启动时解析为IPv4地址
+    BALANCE_POLICY balance = BP_ROUND_ROBIN;
+    bool strip_prefix = false;          // 转发时去掉路径中的前缀
+};
+
+/**
+ * desc: 服务器配置
+ *      由父进程在创建进程池之前填写一次，fork之后各进程只读
+ */
+struct ServerConfig {
+// 进程/线程放置
+    PLACEMENT_POLICY placement = PP_NONE;
+    bool pin_threads = true;        // 是否将线程绑定到所属进程CPU集合中的某个CPU
+    bool numa_local_memory = true;  // 子进程的内存优先从本节点分配
+
+// 每个子进程的线程池（弹性伸缩）
+    int thread_min = 4;                 // 线程数下限，启动时创建这么多
+    int thread_max = 32;                // 线程数上限
+    int queue_target_us = 5000;         // 任务排队时间超过该值则扩容
+    int thread_idle_cooldown_ms = 10000;// 有线程持续空闲这么久则缩容一个
+    int thread_adjust_interval_ms = 100;// 伸缩决策的周期
+
+// 连接接收
+    int accept_batch = 64;              // 子进程每次被唤醒最多accept的连接数
+
+// 连接的事件模式
+    bool edge_triggered = false;        // true: EPOLLET，连接只注册一次；false: EPOLLONESHOT
+    int edge_io_budget = 16;            // EPOLLET下每次调度最多的recv/send次数（公平性）
+    bool coroutine_handler = false;     // EPOLLONESHOT下用C++20协程处理HTTP/1.1连接（编译器不支持协程时不生效）
+
+// 写路径
+    bool tcp_nodelay = true;            // 响应合并为一次writev发出，不需要Nagle等待
+    int cork_min_bytes = 16384;         // 文件响应体不小于此值时用TCP_CORK凑满报文段，0表示不用
+    int zerocopy_min_bytes = 0;         // 文件响应体不小于此值时用MSG_ZEROCOPY发送，0表示关闭
+
+// 请求体：按Content-Length或chunked流式接收，不受读缓冲区大小的限制
+    uint64_t request_body_max_bytes = 1 << 30;  // 请求体上限，超过则回复413并关闭连接
+    size_t request_body_memory_bytes = 64 << 10;// 超过该大小的请求体转存到临时文件（流式接收的路由和静态文件不存放请求体）
+    std::string request_body_temp_dir = "/tmp"; // 临时文件所在的目录
+
+// 启动预热：在开始监听之前将文档根目录下的文件读入内存
+    bool warmup = false;
+    size_t warmup_max_file_bytes = 1 << 20;     // 超过该大小的文件不预热
+    size_t warmup_budget_bytes = 256 << 20;     // 预热文件的总大小上限
+    bool warmup_mlock = false;                  // 是否mlock预热的文件（受RLIMIT_MEMLOCK限制）
+
+// 静态文件的路径解析：每个子进程按URL缓存解析结果（包括不存在的文件）
+    size_t path_cache_entries = 4096;   // 缓存的URL数，0表示不缓存
+    int path_cache_ttl_ms = 1000;       // 缓存项的有效期：文件的增删最多延迟这么久生效
+
+// 按来源IP限流（令牌桶，跨子进程共享），速率为0表示不限制
+// 新建连接超限时在accept后直接关闭，请求超限时回复429
+    int conn_rate_per_ip = 0;           // 每个IP每秒新建连接数
+    int conn_burst_per_ip = 20;
+    int req_rate_per_ip = 0;            // 每个IP每秒请求数
+    int req_burst_per_ip = 100;
+    int rate_prefix_len = 24;           // 按前缀聚合的长度（IPv4）
+    int conn_rate_per_prefix = 0;       // 每个前缀每秒新建连接数
+    int conn_burst_per_prefix = 200;
+    int req_rate_per_prefix = 0;        // 每个前缀每秒请求数
+    int req_burst_per_prefix = 1000;
+    int rate_table_slots = 65536;       // 限流表槽数（向上取2的幂）
+    int rate_idle_evict_ms = 60000;     // 空闲超过该时间的项可以被新键替换
+
+// 过载保护
+    int queue_max = 4096;               // 任务队列上限，队列满时新请求直接回复503
+    int codel_target_us = 5000;         // 排队时间持续超过该值则开始丢弃新请求（CoDel）
+    int codel_interval_us = 100000;     // CoDel的观察窗口
+    int shed_retry_after_s = 1;         // 503响应中的Retry-After
+    int conn_high_watermark = 3584;     // 全部子进程的连接数都达到该值时父进程暂停accept（不超过MAX_CLIENT_NUM）
+    int conn_low_watermark = 3072;      // 有子进程的连接数降到该值以下时恢复accept
+
+// 反向代理（只支持EPOLLONESHOT模式，edge_triggered为true时不生效）
+    std::vector<Proxy_Route_Config> proxy_routes;
+    int proxy_connect_timeout_ms = 1000;    // 连接上游的超时
+    int proxy_read_timeout_ms = 30000;      // 等待上游数据/客户端可写的超时
+    int proxy_idle_conns = 8;               // 每个线程对每个上游最多保留的空闲长连接数
+    int proxy_max_fails = 3;                // 连续失败这么多次后暂时摘除该上游
+    int proxy_fail_timeout_ms = 10000;      // 被摘除的上游多久之后重新尝试
+    int proxy_health_interval_ms = 2000;    // 父进程主动健康检查的周期，0表示只做被动检查
+    std::string proxy_health_path;          // 健康检查GET的路径（2xx/3xx为健康），为空则只检查能否连接
+
+// 代理响应的微缓存（跨子进程共享），按Cache-Control/Expires决定是否缓存及有效期
+    bool microcache = false;
+    size_t microcache_bytes = 64 << 20;     // 共享内存的总大小
+    size_t microcache_entry_bytes = 64 << 10;   // 每项的大小上限（URL + 响应头 + 响应体）
+    int microcache_stale_ms = 10000;        // 响应没有stale-while-revalidate时，过期后仍可使用旧响应的时长
+    int microcache_lock_timeout_ms = 5000;  // 回源的请求超过该时间没有结果，其他请求不再等待它
+
+// HTTP/2（明文连接：prior knowledge或Upgrade: h2c；TLS连接：ALPN协商h2），只支持EPOLLONESHOT模式
+    bool http2 = false;
+    int h2_max_concurrent_streams = 128;    // 每个连接同时进行的流数上限
+    int h2_initial_window_size = 1 << 20;   // 本端的接收窗口（流和连接）
+    int h2_max_header_list_size = 64 << 10; // 请求首部（解压后）的大小上限
+    size_t h2_max_request_body = 1 << 20;   // 请求体上限，超过则重置该流
+
+// WebSocket（只支持EPOLLONESHOT模式）：URL以其中某个前缀开头的Upgrade: websocket请求升级，
+// 消息交给内置的回显处理器
+    std::vector<std::string> websocket_paths;
+    size_t websocket_max_message = 1 << 20;     // 消息（所有分片合计）的大小上限，超过则以1009关闭
+    size_t websocket_send_high_water = 1 << 20; // 发送队列超过该值时暂停读取该连接
+
+// TLS（只支持EPOLLONESHOT模式），证书链和私钥为PEM文件，证书为空表示不启用
+    std::string tls_cert_file;
+    std::string tls_key_file;
+    bool tls_ktls = true;               // 尝试内核TLS：响应（包括mmap的文件）直接sendmsg，由内核加密
+    int tls_session_timeout_s = 7200;   // 会话票据的有效期
+    int tls_ticket_rotate_s = 3600;     // 票据密钥的轮换周期，0表示不轮换
+
+// 访问日志/错误日志：工作线程写入各自的环形缓冲区，后台线程批量写文件，缓冲区满时丢弃
+    std::string access_log_path;            // 为空表示不记录访问日志
+    std::string error_log_path;             // 为空表示写到标准输出
+    int log_flush_interval_ms = 50;         // 后台线程写文件的周期
+    size_t log_rotate_bytes = 64 << 20;     // 日志文件超过该大小时轮转，0表示不轮转
+    int log_rotate_keep = 5;                // 保留的旧文件数（path.1 ~ path.N）
+
+// 平滑退出：收到SIGTERM/SIGQUIT后停止accept，处理完已有请求再退出
+    int drain_deadline_ms = 30000;      // 排空的最长时间，超时后强制关闭剩余连接
+
+// 热升级：新master通过该Unix域socket从旧master接管监听socket，为空表示不启用
+    std::string upgrade_socket_path;
+};
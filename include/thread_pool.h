@@ -6,45 +6,193 @@
 #include <pthread.h>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <memory.h>
 #include "thread_task.h"
+#include "cpu_affinity.h"
+#include "server_config.h"
+#include "locker.h"
+#include "utils.h"
+#include "access_log.h"
 
 using work_routine_t = void *(*)(void *);
 
+/**
+ * desc: 弹性线程池
+ *      线程数在[thread_min, thread_max]之间变化：
+ *      - 任务排队时间超过queue_target_us时扩容
+ *        （例如线程阻塞在mmap文件的缺页上，队列就会积压）
+ *      - 有线程持续空闲超过thread_idle_cooldown_ms时缩容
+ *      决策由一个单独的管理线程周期性完成；全部线程都是joinable的
+ *      线程数、扩容/缩容次数和排队时间写到任务容器所属的负载项（ChildLoad）中，
+ *      父进程从负载表中读取
+ */
 template<typename ClientData_t>
 class ThreadPool {
 public:
-    ThreadPool(work_routine_t work_routine, ThreadPoolTaskContainer<ClientData_t> *p_thread_task_container, int thread_num = 8): \
-        _work_routine(work_routine), _thread_num(thread_num), \
-        _p_thread_task_container(p_thread_task_container) {
+    ThreadPool(work_routine_t work_routine, ThreadPoolTaskContainer<ClientData_t> *p_thread_task_container, \
+            const ServerConfig &config = ServerConfig()): \
+        _work_routine(work_routine), _p_thread_task_container(p_thread_task_container), \
+        _thread_min(config.thread_min), _thread_max(config.thread_max), \
+        _queue_target_us(config.queue_target_us), \
+        _idle_cooldown_us((uint64_t)config.thread_idle_cooldown_ms * 1000), \
+        _adjust_interval_ms(config.thread_adjust_interval_ms) {
         
-        assert(thread_num > 0);
+        assert(_thread_min > 0 && _thread_min <= _thread_max);
 
         assert(work_routine != NULL);
+    }
 
-        _threads.assign(_thread_num, -1);
-        assert(!_threads.empty());
+    // 线程绑定的CPU集合：第i个线程绑定到cpus[i % cpus.size()]
+    // 为空则不绑定（继承所在进程的亲和性）
+    void set_cpus(const std::vector<int> &cpus) {
+        _cpus = cpus;
     }
+
     void create() {
 
-        // 创建_thread_num个线程
-        for (int i = 0; i < _thread_num; ++i) {
+        // 先创建thread_min个线程，之后由管理线程伸缩
+        for (int i = 0; i < _thread_min; ++i) {
+            _spawn_thread();
+        }
+
+        // 管理线程创建失败时线程数固定为thread_min
+        int err = pthread_create(&_manager, NULL, _manage_routine, this);
+        if (err != 0) {
+            std::cout << "pthread_create() manager failed, error: " << err << std::endl;
+            return;
+        }
+        _manager_running = true;
+    }
 
-            std::cout << "creating the " << i + 1 << " thread" << std::endl;
+    // 停止全部线程并等待其退出
+    // 已在队列中的任务处理完之前，线程不会看到退出请求之后的任务
+    void stop() {
 
-            // 写任务类，其中函数为静态，存储任务的数据类型为双向链表
-            assert(pthread_create(&_threads[i], NULL, _work_routine, _p_thread_task_container) == 0);
+        if (_manager_running) {
+            _stop = true;
+            _stop_sem.post();
+            pthread_join(_manager, NULL);
+            _manager_running = false;
+        }
 
-            // 设置为分离线程
-            assert(pthread_detach(_threads[i]) != 0);
+        _p_thread_task_container->request_exit(_threads.size());
+        for (pthread_t tid : _threads) {
+            pthread_join(tid, NULL);
         }
+        _p_thread_task_container->take_exited_threads();
+        _threads.clear();
+        _publish_live_threads();
     }
+
     ~ThreadPool() {
+        stop();
         _work_routine = NULL;
     }
 private:
-    int _thread_num;
-    std::vector<pthread_t> _threads;
+    std::vector<pthread_t> _threads;    // 存活的线程（只由管理线程修改）
+    std::vector<int> _cpus;
     work_routine_t _work_routine;
     ThreadPoolTaskContainer<ClientData_t> *_p_thread_task_container;
-};
\ No newline at end of file
+
+    int _thread_min;
+    int _thread_max;
+    uint64_t _queue_target_us;
+    uint64_t _idle_cooldown_us;
+    int _adjust_interval_ms;
+
+    pthread_t _manager;
+    bool _manager_running = false;
+    std::atomic<bool> _stop{false};
+    Sem _stop_sem;
+    int _next_cpu = 0;
+
+private:
+
+    bool _spawn_thread() {
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, _work_routine, _p_thread_task_container) != 0) {
+            std::cout << "pthread_create() failed, errno: " << errno << std::endl;
+            return false;
+        }
+
+        if (!_cpus.empty()) {
+            Cpu_Affinity::apply_to_thread(tid, _cpus[_next_cpu++ % _cpus.size()]);
+        }
+
+        _threads.push_back(tid);
+        _publish_live_threads();
+        return true;
+    }
+
+    // 没有负载项（不在子进程中）时不统计
+    ChildLoad *_load() const {
+        return _p_thread_task_container->load_slot();
+    }
+
+    void _publish_live_threads() {
+        if (ChildLoad *load = _load()) {
+            load->live_threads.store(_threads.size(), std::memory_order_relaxed);
+        }
+    }
+
+    // join已经退出的线程，并从存活列表中删除
+    void _reap_exited_threads() {
+
+        for (pthread_t tid : _p_thread_task_container->take_exited_threads()) {
+            pthread_join(tid, NULL);
+            auto iter = std::find_if(_threads.begin(), _threads.end(), \
+                [tid](pthread_t t) { return pthread_equal(t, tid); });
+            if (iter != _threads.end()) _threads.erase(iter);
+        }
+        _publish_live_threads();
+    }
+
+    // 管理线程：周期性地根据排队时间和空闲线程数伸缩线程池
+    static void *_manage_routine(void *args) {
+
+        ThreadPool *pool = (ThreadPool *)args;
+        uint64_t idle_since = 0;    // 开始持续有空闲线程的时刻，0表示当前无空闲
+
+        while (!pool->_stop) {
+
+            pool->_stop_sem.timed_wait(pool->_adjust_interval_ms);
+            if (pool->_stop) break;
+
+            pool->_reap_exited_threads();
+
+            ThreadPoolTaskContainer<ClientData_t> *container = pool->_p_thread_task_container;
+            uint64_t sojourn = std::max(container->head_sojourn_us(), \
+                container->take_max_sojourn_us());
+            ChildLoad *load = pool->_load();
+            if (load) load->queue_sojourn_us.store(std::min<uint64_t>(sojourn, UINT32_MAX), std::memory_order_relaxed);
+
+            int live = pool->_threads.size();
+            uint64_t now = now_us();
+
+            if (sojourn > pool->_queue_target_us && live < pool->_thread_max) {
+                // 排队超时：扩容一个线程，下个周期再看效果
+                if (pool->_spawn_thread()) {
+                    if (load) load->thread_grows.fetch_add(1, std::memory_order_relaxed);
+                    Access_Log::info("thread pool grow to", live + 1);
+                }
+                idle_since = 0;
+            }else if (container->idle_threads() > 0 && live > pool->_thread_min) {
+                // 有空闲线程：持续空闲超过冷却时间才缩容，避免抖动
+                if (idle_since == 0) {
+                    idle_since = now;
+                }else if (now - idle_since >= pool->_idle_cooldown_us) {
+                    container->request_exit(1);
+                    if (load) load->thread_shrinks.fetch_add(1, std::memory_order_relaxed);
+                    Access_Log::info("thread pool shrink to", live - 1);
+                    idle_since = now;
+                }
+            }else {
+                idle_since = 0;
+            }
+        }
+        return NULL;
+    }
+};
@@ -6,26 +6,38 @@
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <vector>
+#include <algorithm>
 #include <memory.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
 #include "locker.h"
+#include "utils.h"
+#include "load_table.h"
+#include "rate_limiter.h"
+#include "request_body.h"
+
+class Reverse_Proxy;
+class Router;
+struct H2_Settings;
+struct Ws_Settings;
 
 
 template<typename ClientData_t>
 struct ThreadPoolTask {
     
     // constructor
-    ThreadPoolTask(epoll_event event, int clientfd = -1, \
-            ClientData_t *p = NULL): \
-        _event(event), _clientfd(clientfd), p_client_data(p)  {
+    ThreadPoolTask(epoll_event event = epoll_event(), int clientfd = -1, \
+            ClientData_t *p = NULL, bool sheddable = false): \
+        _event(event), _clientfd(clientfd), p_client_data(p), \
+        _enqueue_us(now_us()), _sheddable(sheddable) {
 
         }
 
     // copy constructor
-    ThreadPoolTask(const ThreadPoolTask& rhs) {
-        _event = rhs._event;
-        _clientfd = rhs._clientfd;
-        p_client_data = new ClientData_t(*rhs.p_client_data);
-    }
+    // 任务只是客户表中某一项的引用，拷贝时共享同一份客户数据
+    ThreadPoolTask(const ThreadPoolTask& rhs) = default;
+    ThreadPoolTask &operator=(const ThreadPoolTask& rhs) = default;
 
     // destructor
     ~ThreadPoolTask() {
@@ -36,10 +48,24 @@ struct ThreadPoolTask {
     int _clientfd;      // 服务的客户fd
     // 对指向vector中的元素来说, 使用指针是非常危险的，如果vector扩容的话
     ClientData_t *p_client_data;  
+    uint64_t _enqueue_us;   // 入队时刻，用于计算任务的排队时间
+    bool _sheddable;        // 是否是空闲连接上的新请求
 };
 
 /**
  * 线程安全的任务容器
+ *      除了任务本身，还统计任务的排队时间和空闲线程数，供线程池伸缩使用
+ *
+ *      过载保护：新请求的任务是"可丢弃"的，以下情况入队失败，由reactor直接回复503
+ *      - 队列长度达到queue_max
+ *      - CoDel：出队时发现排队时间持续interval都超过target，判定为过载；
+ *        过载时新请求预计的排队时间超过target就拒绝，否则超过interval才拒绝，
+ *        直到出队的排队时间回到target以下
+ *        预计的排队时间取队首已排队的时间和"排队的新请求数 * 积压时新请求的平均出队间隔"中较大的：
+ *        同一批epoll事件中到达的请求看到的队首都是刚入队的，只看队首会整批接纳；
+ *        其他任务（发送剩余的响应、关闭连接等）很快，不计入间隔，否则会拉低估计
+ *        （被拒绝的客户端不会像TCP那样降速，经典CoDel按sqrt加快的丢弃速率跟不上持续的过载）
+ *      已经在处理中的连接（如响应没发完）的任务不会被丢弃，队列上限对它们不生效
  */
 template<typename ClientData_t>
 class ThreadPoolTaskContainer {
@@ -47,18 +73,45 @@ private:
 
     std::list<ThreadPoolTask<ClientData_t>> task_queue;
 public:
-    void add(epoll_event event, int clientfd, ClientData_t *p_client_data) {
+    // sheddable: 该任务是一个新请求，过载时可以拒绝；被拒绝时返回false
+    bool add(epoll_event event, int clientfd, ClientData_t *p_client_data, \
+            bool sheddable = false) {
 
         _locker.lock();
 
-        task_queue.push_back(ThreadPoolTask(event, clientfd, p_client_data));
+        if (sheddable && _should_shed(now_us())) {
+            _locker.unlock();
+            return false;
+        }
+
+        task_queue.push_back(ThreadPoolTask<ClientData_t>(event, clientfd, p_client_data, sheddable));
+        if (sheddable) ++_queued_requests;
 
         _locker.unlock();
+        if (_load) ++_load->queue_depth;
         _sem.post();
+        return true;
     }
-    bool try_remove(ThreadPoolTask<ClientData_t> &task) {
 
+    /**
+     * should_exit: 若不为NULL，当线程池要求本线程退出时被置为true
+     *              此时返回false，线程应结束工作函数
+     */
+    bool try_remove(ThreadPoolTask<ClientData_t> &task, bool *should_exit = NULL) {
+
+        ++_idle_threads;
         _sem.wait();
+        --_idle_threads;
+
+        // 优先处理退出请求：每个请求对应一次post，由恰好一个线程消费
+        int tokens = _exit_tokens.load();
+        while (tokens > 0) {
+            if (_exit_tokens.compare_exchange_weak(tokens, tokens - 1)) {
+                if (should_exit) *should_exit = true;
+                return false;
+            }
+        }
+
         _locker.lock();
 
         if (task_queue.empty()) {
@@ -66,15 +119,261 @@ public:
             return false;
         }
 
-        // 需要为ThreadPoolTask类写拷贝构造
         task = task_queue.front();
         task_queue.pop_front();
 
+        uint64_t now = now_us();
+        uint64_t sojourn = now - task._enqueue_us;
+        _codel_on_dequeue(sojourn, now);
+        if (task._sheddable) _update_drain_interval(now);
+
         _locker.unlock();
+        if (_load) --_load->queue_depth;
+
+        _record_sojourn(sojourn);
 
         return true;
     }
+
+    // 要求n个线程退出（线程池缩容/关闭时使用）
+    void request_exit(int n) {
+
+        _exit_tokens += n;
+        for (int i = 0; i < n; ++i) _sem.post();
+    }
+
+    // 工作线程退出前调用，登记自己以便线程池join
+    void on_thread_exit() {
+
+        _locker.lock();
+        _exited_threads.push_back(pthread_self());
+        _locker.unlock();
+    }
+
+    // 取出已经退出、等待join的线程
+    std::vector<pthread_t> take_exited_threads() {
+
+        _locker.lock();
+        std::vector<pthread_t> exited;
+        exited.swap(_exited_threads);
+        _locker.unlock();
+        return exited;
+    }
+
+    // 当前队首任务已经排队的时间（微秒）
+    uint64_t head_sojourn_us() {
+
+        uint64_t sojourn = 0;
+        _locker.lock();
+        if (!task_queue.empty()) {
+            sojourn = now_us() - task_queue.front()._enqueue_us;
+        }
+        _locker.unlock();
+        return sojourn;
+    }
+
+    // 自上次调用以来，出队任务的最大排队时间（微秒），读取后清零
+    uint64_t take_max_sojourn_us() {
+        return _max_sojourn_us.exchange(0);
+    }
+
+    // 排队时间的指数滑动平均（微秒）
+    uint64_t sojourn_ewma_us() const {
+        return _sojourn_ewma_us.load(std::memory_order_relaxed);
+    }
+
+    // 本进程在共享负载表中的一项，队列深度等统计会同步到这里
+    void set_load_slot(ChildLoad *load) {
+        _load = load;
+    }
+
+    ChildLoad *load_slot() const {
+        return _load;
+    }
+
+    // 边缘触发模式下，一个任务最多连续调用recv/send的次数，用完则重新排队
+    void set_io_budget(int budget) {
+        _io_budget = budget;
+    }
+
+    int io_budget() const {
+        return _io_budget;
+    }
+
+    // 过载保护的参数，见类的说明
+    void set_overload_limits(int queue_max, int target_us, int interval_us) {
+        _queue_max = queue_max;
+        _codel_target_us = target_us;
+        _codel_interval_us = interval_us;
+    }
+
+    // 按来源IP的请求限流，为NULL表示不限流
+    void set_rate_limiter(Rate_Limiter *limiter) {
+        _rate_limiter = limiter;
+    }
+
+    Rate_Limiter *rate_limiter() const {
+        return _rate_limiter;
+    }
+
+    // 反向代理，为NULL表示没有配置代理路由
+    void set_reverse_proxy(Reverse_Proxy *proxy) {
+        _reverse_proxy = proxy;
+    }
+
+    Reverse_Proxy *reverse_proxy() const {
+        return _reverse_proxy;
+    }
+
+    // 程序注册的路由（已冻结），为NULL表示没有注册路由
+    void set_router(const Router *router) {
+        _router = router;
+    }
+
+    const Router *router() const {
+        return _router;
+    }
+
+    // 明文HTTP/2的参数，为NULL表示不支持h2c
+    void set_http2(const H2_Settings *settings) {
+        _http2 = settings;
+    }
+
+    const H2_Settings *http2() const {
+        return _http2;
+    }
+
+    // WebSocket的参数，为NULL表示不支持升级
+    void set_websocket(const Ws_Settings *settings) {
+        _websocket = settings;
+    }
+
+    const Ws_Settings *websocket() const {
+        return _websocket;
+    }
+
+    // HTTP/1.1连接是否由协程处理（见Worker::_serve_http1）
+    void set_coroutines(bool on) {
+        _coroutines = on;
+    }
+
+    bool coroutines() const {
+        return _coroutines;
+    }
+
+    // 请求体的参数
+    void set_request_body(const Body_Settings &settings) {
+        _request_body = settings;
+    }
+
+    const Body_Settings &request_body() const {
+        return _request_body;
+    }
+
+    // 进程进入排空状态：之后的响应都不再保持连接
+    void set_draining() {
+        _draining.store(true);
+    }
+
+    bool draining() const {
+        return _draining.load(std::memory_order_relaxed);
+    }
+
+    // 正在等待任务的线程数
+    int idle_threads() const {
+        return _idle_threads.load(std::memory_order_relaxed);
+    }
+
 private:
     Sem _sem;
     Locker _locker;
+
+    std::atomic<int> _exit_tokens{0};
+    std::atomic<int> _idle_threads{0};
+    std::atomic<uint64_t> _max_sojourn_us{0};
+    std::atomic<uint64_t> _sojourn_ewma_us{0};
+    std::vector<pthread_t> _exited_threads;
+    ChildLoad *_load = NULL;
+    int _io_budget = 16;
+    Rate_Limiter *_rate_limiter = NULL;
+    Reverse_Proxy *_reverse_proxy = NULL;
+    const Router *_router = NULL;
+    const H2_Settings *_http2 = NULL;
+    const Ws_Settings *_websocket = NULL;
+    bool _coroutines = false;
+    Body_Settings _request_body;
+    std::atomic<bool> _draining{false};
+
+    // CoDel状态，由_locker保护
+    size_t _queue_max = 4096;
+    uint64_t _codel_target_us = 5000;
+    uint64_t _codel_interval_us = 100000;
+    uint64_t _first_above_us = 0;   // 排队时间超过target之后，观察窗口的结束时刻
+    bool _overloaded = false;       // 排队时间是否已持续超过target
+    uint64_t _last_shed_us = 0;     // 最近一次因排队时间拒绝请求的时刻
+    size_t _queued_requests = 0;    // 队列中新请求的任务数
+    uint64_t _drain_us = 0;         // 积压时相邻两个新请求出队的平均间隔（EWMA，1/8）
+    uint64_t _last_dequeue_us = 0;  // 上一个新请求出队的时刻，之后队列中没有新请求时为0
+
+    // 出队时根据排队时间更新CoDel状态
+    void _codel_on_dequeue(uint64_t sojourn, uint64_t now) {
+
+        if (_codel_target_us == 0) return;
+
+        // 过载状态下排队时间被拒绝控制在target以下，不能据此判断过载已经结束：
+        // 还要一个interval内都没有拒绝过请求
+        if (sojourn < _codel_target_us) {
+            _first_above_us = 0;
+            if (now - _last_shed_us > _codel_interval_us) _overloaded = false;
+            return;
+        }
+
+        if (_first_above_us == 0) {
+            _first_above_us = now + _codel_interval_us;
+        }else if (now >= _first_above_us) {
+            _overloaded = true;
+        }
+    }
+
+    // 新请求出队时更新积压时的出队间隔：只统计上一个出队后仍有新请求排队的间隔，空闲的时间不计入
+    void _update_drain_interval(uint64_t now) {
+
+        --_queued_requests;
+        if (_last_dequeue_us != 0) {
+            uint64_t sample = now - _last_dequeue_us;
+            _drain_us = _drain_us == 0 ? sample : (_drain_us * 7 + sample) / 8;
+        }
+        _last_dequeue_us = _queued_requests == 0 ? 0 : now;
+    }
+
+    // 入队前判断是否应拒绝一个新请求
+    bool _should_shed(uint64_t now) {
+
+        if (task_queue.size() >= _queue_max) return true;
+
+        if (task_queue.empty() || _codel_target_us == 0) return false;
+
+        // 新请求至少要等队首的任务处理完，队首的排队时间是它排队时间的下界；
+        // 排队的新请求都要在它之前处理完，按出队间隔估计的等待时间是另一个下界
+        uint64_t wait = now - task_queue.front()._enqueue_us;
+        wait = std::max(wait, _queued_requests * _drain_us);
+        if (wait <= (_overloaded ? _codel_target_us : _codel_interval_us)) {
+            return false;
+        }
+        _last_shed_us = now;
+        return true;
+    }
+
+    void _record_sojourn(uint64_t sojourn) {
+
+        uint64_t cur = _max_sojourn_us.load(std::memory_order_relaxed);
+        while (sojourn > cur && \
+            !_max_sojourn_us.compare_exchange_weak(cur, sojourn)) {
+        }
+
+        // ewma = 7/8 * ewma + 1/8 * sojourn，偶尔丢失一次更新无所谓
+        uint64_t ewma = _sojourn_ewma_us.load(std::memory_order_relaxed);
+        _sojourn_ewma_us.store(ewma - (ewma >> 3) + (sojourn >> 3), \
+            std::memory_order_relaxed);
+    }
 };
\ No newline at end of file
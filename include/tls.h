@@ -0,0 +1,413 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+#include "server_config.h"
+#include "utils.h"
+
+#define TLS_TICKET_NAME_LEN 16
+#define TLS_KEY_READ_RETRIES 64     // seqlock读的重试上限，超过时放弃票据（做完整握手）
+
+// 一个TLS连接（EPOLLONESHOT下同一时刻只有一个线程访问）
+struct Tls_Conn {
+    explicit Tls_Conn(SSL *s): ssl(s) {}
+    ~Tls_Conn() { SSL_free(ssl); }
+
+    SSL *ssl;
+    bool established = false;   // 握手已完成
+    bool ktls_send = false;     // 发送方向已交给内核TLS：可以直接sendmsg明文
+    bool alpn_h2 = false;       // ALPN协商为HTTP/2
+};
+
+// 会话票据的密钥：名字用于解密时找到对应的密钥
+struct Tls_Ticket_Key {
+    unsigned char name[TLS_TICKET_NAME_LEN];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+};
+
+// 父子进程共享的票据密钥（fork之前mmap）：当前密钥加密，当前/上一个密钥都可以解密
+// 只有父进程写（seq为奇数时正在更新），子进程按seqlock读
+struct Tls_Ticket_Keys {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> rotate_at_us{0};
+    Tls_Ticket_Key current;
+    Tls_Ticket_Key previous;
+};
+
+/**
+ * desc: TLS终止
+ *      - SSL_CTX在fork之前创建（证书、私钥只加载一次），子进程继承
+ *      - 握手是非阻塞的：SSL_do_handshake返回WANT_READ/WANT_WRITE时由调用者
+ *        重新注册EPOLLIN/EPOLLOUT，握手和请求处理都在同一个EPOLLONESHOT状态机里
+ *      - 会话恢复：无状态票据，密钥放在共享内存中，一个子进程签发的票据
+ *        可以被任何子进程（包括之后fork的）接受；服务端会话缓存关闭；
+ *        密钥只由父进程轮换：子进程在更新中途崩溃不会让seq停在奇数，
+ *        读者的重试也有上限（读不到一致的密钥时不签发/不接受票据，做完整握手）
+ *      - 内核TLS（SSL_OP_ENABLE_KTLS）：发送方向卸载到内核后，响应（包括mmap的
+ *        文件）直接用sendmsg写明文，由内核加密，写路径和明文连接完全相同；
+ *        不可用时（内核/算法不支持）退回SSL_write
+ */
+class Tls_Context {
+public:
+    Tls_Context() = default;
+    Tls_Context(const Tls_Context &) = delete;
+    Tls_Context &operator=(const Tls_Context &) = delete;
+
+    ~Tls_Context() {
+        if (_ctx) SSL_CTX_free(_ctx);
+        if (_keys) munmap(_keys, sizeof(Tls_Ticket_Keys));
+    }
+
+    // 父进程在fork之前调用；没有配置证书时不启用，证书/私钥无效返回false
+    bool create(const ServerConfig &config) {
+
+        if (config.tls_cert_file.empty()) return true;
+        if (config.edge_triggered) {
+            std::cout << "tls: only supported with EPOLLONESHOT, disabled" << std::endl;
+            return true;
+        }
+
+        _ctx = SSL_CTX_new(TLS_server_method());
+        if (_ctx == NULL) return false;
+
+        SSL_CTX_set_min_proto_version(_ctx, TLS1_2_VERSION);
+        uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+        if (config.tls_ktls) options |= SSL_OP_ENABLE_KTLS;
+        SSL_CTX_set_options(_ctx, options);
+        SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | \
+            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+        if (SSL_CTX_use_certificate_chain_file(_ctx, config.tls_cert_file.c_str()) != 1 || \
+                SSL_CTX_use_PrivateKey_file(_ctx, config.tls_key_file.c_str(), SSL_FILETYPE_PEM) != 1 || \
+                SSL_CTX_check_private_key(_ctx) != 1) {
+            std::cout << "tls: cannot load certificate/key: " << _last_error() << std::endl;
+            SSL_CTX_free(_ctx);
+            _ctx = NULL;
+            return false;
+        }
+
+        // 票据密钥在共享内存中：会话可以在任意子进程恢复
+        void *addr = mmap(NULL, sizeof(Tls_Ticket_Keys), PROT_READ | PROT_WRITE, \
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::cout << "mmap() tls ticket keys failed, errno: " << errno << std::endl;
+            SSL_CTX_free(_ctx);
+            _ctx = NULL;
+            return false;
+        }
+        _keys = new (addr) Tls_Ticket_Keys();
+        _rotate_us = (uint64_t)config.tls_ticket_rotate_s * 1000000ULL;
+        _generate_key(_keys->current);
+        _keys->previous = _keys->current;
+        _keys->rotate_at_us.store(now_us() + _rotate_us);
+
+        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_timeout(_ctx, config.tls_session_timeout_s);
+        SSL_CTX_set_num_tickets(_ctx, 1);
+        SSL_CTX_set_app_data(_ctx, this);
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(_ctx, _ticket_key_cb);
+
+        _offer_h2 = config.http2;
+        SSL_CTX_set_alpn_select_cb(_ctx, _alpn_select_cb, this);
+        return true;
+    }
+
+    bool enabled() const {
+        return _ctx != NULL;
+    }
+
+    // 新连接：创建SSL对象，握手由工作线程进行
+    Tls_Conn *accept(int fd) {
+        SSL *ssl = SSL_new(_ctx);
+        if (ssl == NULL) return NULL;
+        SSL_set_fd(ssl, fd);
+        SSL_set_accept_state(ssl);
+        return new Tls_Conn(ssl);
+    }
+
+    // 父进程是否需要定期调用rotate_keys
+    bool rotates_keys() const {
+        return _ctx != NULL && _rotate_us > 0;
+    }
+
+    // 父进程调用：到了轮换时间（或force）时生成新密钥，旧的当前密钥降为上一个
+    void rotate_keys(bool force = false) {
+
+        if (!rotates_keys() || (!force && now_us() < _keys->rotate_at_us.load(std::memory_order_relaxed))) return;
+
+        uint64_t seq = _keys->seq.load(std::memory_order_relaxed);
+        _keys->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _keys->previous = _keys->current;
+        _generate_key(_keys->current);
+        _keys->rotate_at_us.store(now_us() + _rotate_us, std::memory_order_relaxed);
+        _keys->seq.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * 一个空闲TLS连接（握手完成、没有数据在途）占用的堆内存：Tls_Conn和SSL对象
+     * 在socketpair上和一个临时客户端完成握手，服务端读一次（和空闲连接一样释放读缓冲区），
+     * 再看删除服务端的Tls_Conn归还了多少字节
+     * 按整个进程的堆（mallinfo2）统计，其他线程同时分配内存时不准：子进程在工作线程处理请求之前调用；
+     * 替换了malloc的分配器（如ASan）不计入时只得到sizeof(Tls_Conn)
+     */
+    size_t measure_idle_conn_bytes() {
+
+        if (_ctx == NULL) return 0;
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) return sizeof(Tls_Conn);
+
+        size_t bytes = sizeof(Tls_Conn);
+        SSL_CTX *client_ctx = SSL_CTX_new(TLS_client_method());
+        SSL *client = client_ctx ? SSL_new(client_ctx) : NULL;
+        Tls_Conn *server = accept(sv[0]);
+        if (client != NULL && server != NULL) {
+            SSL_set_fd(client, sv[1]);
+            SSL_set_connect_state(client);
+            bool client_done = false, server_done = false;
+            for (int i = 0; i < 32 && !(client_done && server_done); ++i) {
+                if (!client_done) client_done = SSL_do_handshake(client) == 1;
+                if (!server_done) server_done = SSL_do_handshake(server->ssl) == 1;
+            }
+            if (client_done && server_done) {
+                char c;
+                SSL_read(server->ssl, &c, 1);
+                size_t before = _heap_in_use();
+                delete server;
+                server = NULL;
+                size_t after = _heap_in_use();
+                if (before > after) bytes = before - after;
+            }
+        }
+        delete server;
+        SSL_free(client);
+        SSL_CTX_free(client_ctx);
+        close(sv[0]);
+        close(sv[1]);
+        ERR_clear_error();
+        return bytes;
+    }
+
+private:
+    SSL_CTX *_ctx = NULL;
+    Tls_Ticket_Keys *_keys = NULL;
+    uint64_t _rotate_us = 0;
+    bool _offer_h2 = false;
+
+    static std::string _last_error() {
+        char buf[256];
+        ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+        return buf;
+    }
+
+    static size_t _heap_in_use() {
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    }
+
+    static void _generate_key(Tls_Ticket_Key &key) {
+        RAND_bytes(key.name, sizeof(key.name));
+        RAND_bytes(key.aes_key, sizeof(key.aes_key));
+        RAND_bytes(key.hmac_key, sizeof(key.hmac_key));
+    }
+
+    // seqlock读：拷贝出一致的两个密钥；重试TLS_KEY_READ_RETRIES次仍不一致时返回false
+    bool _read_keys(Tls_Ticket_Key &current, Tls_Ticket_Key &previous) const {
+        for (int i = 0; i < TLS_KEY_READ_RETRIES; ++i) {
+            uint64_t seq = _keys->seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                sched_yield();
+                continue;
+            }
+            current = _keys->current;
+            previous = _keys->previous;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_keys->seq.load(std::memory_order_relaxed) == seq) return true;
+        }
+        return false;
+    }
+
+    /**
+     * 票据的加解密密钥（RFC 5077的格式由OpenSSL完成）
+     * enc=1：用当前密钥签发；enc=0：按名字找密钥，用上一个密钥解开的票据要求续签（返回2）
+     * 读不到密钥时返回0：加密时不签发票据，解密时做完整握手
+     */
+    static int _ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv, \
+            EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc) {
+
+        Tls_Context *self = (Tls_Context *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+        Tls_Ticket_Key current, previous;
+        if (!self->_read_keys(current, previous)) return 0;
+
+        const Tls_Ticket_Key *key = &current;
+        int ret = 1;
+        if (enc) {
+            if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) return -1;
+            memcpy(name, current.name, TLS_TICKET_NAME_LEN);
+        }else if (memcmp(name, current.name, TLS_TICKET_NAME_LEN) == 0) {
+            key = &current;
+        }else if (memcmp(name, previous.name, TLS_TICKET_NAME_LEN) == 0) {
+            key = &previous;
+            ret = 2;
+        }else {
+            return 0;   // 未知（已过期）的密钥：做完整握手
+        }
+
+        OSSL_PARAM params[2];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, \
+            (void *)key->hmac_key, sizeof(key->hmac_key));
+        params[1] = OSSL_PARAM_construct_end();
+        OSSL_PARAM digest[2];
+        digest[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0);
+        digest[1] = OSSL_PARAM_construct_end();
+        if (EVP_MAC_CTX_set_params(mac_ctx, digest) != 1 || \
+                EVP_MAC_CTX_set_params(mac_ctx, params) != 1) {
+            return -1;
+        }
+
+        int ok = enc ? EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) : \
+            EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv);
+        return ok == 1 ? ret : -1;
+    }
+
+    // ALPN：启用HTTP/2时优先h2，否则http/1.1；客户端没有可接受的协议时不协商
+    static int _alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen, \
+            const unsigned char *in, unsigned int inlen, void *arg) {
+
+        (void)ssl;
+        Tls_Context *self = (Tls_Context *)arg;
+        static const unsigned char h2[] = "\x02h2\x08http/1.1";
+        static const unsigned char http11[] = "\x08http/1.1";
+
+        const unsigned char *server = self->_offer_h2 ? h2 : http11;
+        unsigned int server_len = self->_offer_h2 ? sizeof(h2) - 1 : sizeof(http11) - 1;
+        unsigned char *selected = NULL;
+        if (SSL_select_next_proto(&selected, outlen, server, server_len, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        *out = selected;
+        return SSL_TLSEXT_ERR_OK;
+    }
+};
+
+/**
+ * desc: 连接上的读写：tls为NULL时就是recv/send/sendmsg；
+ *      TLS连接的返回值和errno与对应的系统调用一致（EAGAIN表示需要等待），
+ *      调用者不需要区分明文和加密连接
+ */
+class Tls_Util final {
+public:
+    /**
+     * 非阻塞握手，返回true表示完成
+     * 需要等待时返回false并在*want中给出EPOLLIN/EPOLLOUT
+     * 失败（对端不是TLS、证书被拒绝等）时*want为0
+     */
+    static bool handshake(Tls_Conn *tls, int *want) {
+
+        ERR_clear_error();
+        int ret = SSL_do_handshake(tls->ssl);
+        if (ret == 1) {
+            tls->established = true;
+            tls->ktls_send = BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+
+            const unsigned char *proto = NULL;
+            unsigned int len = 0;
+            SSL_get0_alpn_selected(tls->ssl, &proto, &len);
+            tls->alpn_h2 = len == 2 && memcmp(proto, "h2", 2) == 0;
+            *want = 0;
+            return true;
+        }
+
+        switch (SSL_get_error(tls->ssl, ret)) {
+            case SSL_ERROR_WANT_READ: *want = EPOLLIN; break;
+            case SSL_ERROR_WANT_WRITE: *want = EPOLLOUT; break;
+            default: *want = 0; break;
+        }
+        return false;
+    }
+
+    static ssize_t recv(Tls_Conn *tls, int fd, void *buf, size_t len) {
+
+        if (tls == NULL) return ::recv(fd, buf, len, 0);
+
+        ERR_clear_error();
+        size_t n = 0;
+        int ret = SSL_read_ex(tls->ssl, buf, len, &n);
+        if (ret == 1) return n;
+        return _fail(tls, ret);
+    }
+
+    static ssize_t send(Tls_Conn *tls, int fd, const void *buf, size_t len) {
+
+        if (tls == NULL || tls->ktls_send) return ::send(fd, buf, len, MSG_NOSIGNAL);
+
+        ERR_clear_error();
+        size_t n = 0;
+        int ret = SSL_write_ex(tls->ssl, buf, len, &n);
+        if (ret == 1) return n;
+        return _fail(tls, ret);
+    }
+
+    // 没有内核TLS时每段iov一次SSL_write（每次最多一个记录），遇到EAGAIN时返回已写出的字节数
+    static ssize_t sendmsg(Tls_Conn *tls, int fd, const msghdr *msg, int flags) {
+
+        if (tls == NULL || tls->ktls_send) return ::sendmsg(fd, msg, flags);
+
+        ssize_t total = 0;
+        for (size_t i = 0; i < msg->msg_iovlen; ++i) {
+            const char *p = (const char *)msg->msg_iov[i].iov_base;
+            size_t len = msg->msg_iov[i].iov_len;
+            while (len > 0) {
+                ssize_t n = send(tls, fd, p, len);
+                if (n < 0) return total > 0 ? total : -1;
+                p += n;
+                len -= n;
+                total += n;
+            }
+        }
+        return total;
+    }
+
+    // 关闭前尽量发出close_notify（非阻塞，不等待对端的回应）
+    static void shutdown(Tls_Conn *tls) {
+        if (tls == NULL || !tls->established) return;
+        ERR_clear_error();
+        SSL_shutdown(tls->ssl);
+    }
+
+private:
+    static ssize_t _fail(Tls_Conn *tls, int ret) {
+
+        switch (SSL_get_error(tls->ssl, ret)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+            case SSL_ERROR_ZERO_RETURN:
+                return 0;   // close_notify：和FIN一样处理
+            case SSL_ERROR_SYSCALL:
+                if (errno == 0) errno = ECONNRESET;
+                return -1;
+            default:
+                errno = EPROTO;
+                return -1;
+        }
+    }
+};
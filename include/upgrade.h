@@ -0,0 +1,170 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <iostream>
+
+#define UPGRADE_REQUEST 'U'     // 新master请求接管监听socket
+#define UPGRADE_TIMEOUT_MS 1000 // 控制连接上收发的超时
+
+/**
+ * desc: 热升级时在新旧master之间传递监听socket
+ *      旧master在控制socket（Unix域）上等待；新master启动时连接它，
+ *      通过SCM_RIGHTS拿到同一个监听socket，之后旧一代停止accept并排空连接。
+ *      两代进程共享同一个内核监听队列，切换期间不会出现没有监听者的窗口
+ */
+class Upgrade_Util final {
+public:
+
+    // 新master调用：从旧master处继承监听socket，没有旧master时返回-1
+    static int inherit_listen_fd(const std::string &path) {
+
+        int sock = _connect(path);
+        if (sock < 0) return -1;
+
+        char req = UPGRADE_REQUEST;
+        int listen_fd = -1;
+        if (send(sock, &req, 1, MSG_NOSIGNAL) == 1) {
+            listen_fd = recv_fd(sock);
+        }
+        close(sock);
+
+        if (listen_fd >= 0) {
+            std::cout << "inherited listen socket " << listen_fd << " from " << path << std::endl;
+        }
+        return listen_fd;
+    }
+
+    // 旧master调用：创建控制socket，返回监听它的fd
+    // 同一路径上旧的socket文件（上一代master留下的）会被替换
+    static int listen_control(const std::string &path) {
+
+        sockaddr_un addr;
+        if (!_fill_addr(path, &addr)) return -1;
+
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock < 0) return -1;
+
+        unlink(path.c_str());
+        mode_t old_mask = umask(077);   // 只有同一用户可以接管监听socket
+        int ret = bind(sock, (sockaddr *)&addr, sizeof(addr));
+        umask(old_mask);
+
+        if (ret != 0 || listen(sock, 4) != 0) {
+            std::cout << "upgrade control socket " << path << " failed, errno: " << errno << std::endl;
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // 旧master调用：控制socket可读时，处理一个接管请求
+    // 成功把listen_fd交给新master返回true
+    static bool serve_handoff(int control_fd, int listen_fd) {
+
+        int sock = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) return false;
+
+        _set_timeout(sock);
+        char req = 0;
+        bool ok = recv(sock, &req, 1, 0) == 1 && req == UPGRADE_REQUEST && \
+            send_fd(sock, listen_fd);
+        close(sock);
+        return ok;
+    }
+
+    // 通过Unix域socket发送一个fd
+    static bool send_fd(int sock, int fd) {
+
+        char byte = 0;
+        iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+    }
+
+    // 接收一个fd，失败返回-1
+    static int recv_fd(int sock) {
+
+        char byte;
+        iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        char control[CMSG_SPACE(sizeof(int))];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        if (cm == NULL || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+            return -1;
+        }
+        int fd;
+        memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+        return fd;
+    }
+
+private:
+
+    static bool _fill_addr(const std::string &path, sockaddr_un *addr) {
+
+        memset(addr, 0, sizeof(*addr));
+        addr->sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr->sun_path)) return false;
+        memcpy(addr->sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    static int _connect(const std::string &path) {
+
+        sockaddr_un addr;
+        if (!_fill_addr(path, &addr)) return -1;
+
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return -1;
+        if (connect(sock, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(sock);    // 没有旧master在运行
+            return -1;
+        }
+        _set_timeout(sock);
+        return sock;
+    }
+
+    static void _set_timeout(int sock) {
+
+        timeval tv;
+        tv.tv_sec = UPGRADE_TIMEOUT_MS / 1000;
+        tv.tv_usec = (UPGRADE_TIMEOUT_MS % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+};
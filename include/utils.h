@@ -10,6 +10,8 @@
 #include <string>
 #include <stdlib.h>
 #include <memory>
+#include <stdint.h>
+#include <time.h>
 
 using sig_hander = void (*) (int);
 
@@ -20,3 +22,11 @@ extern void addsig(int sig, sig_hander handler, bool restart = true);
 
 // 用于执行在命令行执行命令，并将命令执行的结果返回到程序
 extern std::string _exec_command(const char *cmd);
+
+
+// 单调时钟，单位：微秒（用于计算排队时间、超时等，不受系统时间调整影响）
+inline uint64_t now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "write_policy.h"
+#include "load_table.h"
+#include "tls.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_MAX_CONTROL_PAYLOAD 125
+#define WS_RECV_CHUNK 16384         // 每次recv的大小（栈上的缓冲区）
+#define WS_COALESCE_BYTES 16384     // 小帧追加到发送队列末尾的块中，不超过该大小
+#define WS_OUT_IOV_MAX 16           // 一次sendmsg最多的块数
+
+// 帧的操作码（RFC 6455 5.2）
+enum WS_OPCODE {
+    WSO_CONTINUATION = 0x0,
+    WSO_TEXT = 0x1,
+    WSO_BINARY = 0x2,
+    WSO_CLOSE = 0x8,
+    WSO_PING = 0x9,
+    WSO_PONG = 0xA
+};
+
+// 关闭码（RFC 6455 7.4.1）
+enum WS_CLOSE_CODE {
+    WSC_NORMAL = 1000,
+    WSC_GOING_AWAY = 1001,
+    WSC_PROTOCOL_ERROR = 1002,
+    WSC_INVALID_PAYLOAD = 1007,
+    WSC_TOO_BIG = 1009
+};
+
+class Ws_Session;
+
+// 收到一个完整消息时的回调（在工作线程中调用，回复用session.send）
+class Ws_Handler {
+public:
+    virtual ~Ws_Handler() {}
+    virtual void on_message(Ws_Session &session, bool text, const char *data, size_t len) = 0;
+};
+
+// WebSocket的参数，由ServerConfig得到
+struct Ws_Settings {
+    std::vector<std::string> paths;         // URL前缀
+    size_t max_message = 1 << 20;           // 消息（所有分片合计）的大小上限
+    size_t send_high_water = 1 << 20;       // 发送队列超过该值时暂停读取（背压）
+    Ws_Handler *handler = NULL;
+};
+
+class Ws_Util final {
+public:
+    // Sec-WebSocket-Accept：base64(SHA1(key + GUID))
+    static std::string accept_key(const std::string &key) {
+        std::string src = key + WS_GUID;
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1((const unsigned char *)src.data(), src.size(), digest);
+        unsigned char out[32];
+        int n = EVP_EncodeBlock(out, digest, SHA_DIGEST_LENGTH);
+        return std::string((const char *)out, n);
+    }
+
+    // Sec-WebSocket-Key必须是16字节随机数的base64
+    static bool valid_key(const std::string &key) {
+        if (key.size() != 24 || key.compare(22, 2, "==") != 0) return false;
+        unsigned char out[24];
+        return EVP_DecodeBlock(out, (const unsigned char *)key.data(), key.size()) == 18;
+    }
+
+    /**
+     * 就地去掉掩码：掩码按4字节循环，按16/32字节一组异或
+     * SSE2（x86-64上总是可用）/AVX2（编译时开启时）处理整组，剩下的按8字节和单字节处理
+     */
+    static void unmask(char *p, size_t len, const uint8_t mask[4]) {
+
+        uint32_t m32;
+        memcpy(&m32, mask, 4);
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        __m256i m256 = _mm256_set1_epi32((int)m32);
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+            _mm256_storeu_si256((__m256i *)(p + i), _mm256_xor_si256(v, m256));
+        }
+#endif
+#if defined(__SSE2__)
+        __m128i m128 = _mm_set1_epi32((int)m32);
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            _mm_storeu_si128((__m128i *)(p + i), _mm_xor_si128(v, m128));
+        }
+#endif
+        uint64_t m64 = ((uint64_t)m32 << 32) | m32;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t v;
+            memcpy(&v, p + i, 8);
+            v ^= m64;
+            memcpy(p + i, &v, 8);
+        }
+        for (; i < len; ++i) p[i] ^= mask[i & 3];
+    }
+
+    // 文本消息必须是合法的UTF-8（拒绝过长编码、代理对和超出U+10FFFF的码点）
+    static bool valid_utf8(const char *data, size_t len) {
+
+        const unsigned char *p = (const unsigned char *)data;
+        size_t i = 0;
+        while (i < len) {
+            // ASCII快速路径：8字节一组
+            if (i + 8 <= len) {
+                uint64_t v;
+                memcpy(&v, p + i, 8);
+                if ((v & 0x8080808080808080ULL) == 0) {
+                    i += 8;
+                    continue;
+                }
+            }
+
+            unsigned char c = p[i];
+            if (c < 0x80) {
+                ++i;
+                continue;
+            }
+
+            int n;
+            unsigned char lo = 0x80, hi = 0xBF;
+            if (c >= 0xC2 && c <= 0xDF) n = 1;
+            else if (c == 0xE0) { n = 2; lo = 0xA0; }
+            else if (c == 0xED) { n = 2; hi = 0x9F; }
+            else if (c >= 0xE1 && c <= 0xEF) n = 2;
+            else if (c == 0xF0) { n = 3; lo = 0x90; }
+            else if (c == 0xF4) { n = 3; hi = 0x8F; }
+            else if (c >= 0xF1 && c <= 0xF3) n = 3;
+            else return false;
+
+            if (i + n >= len) return false;
+            if (p[i + 1] < lo || p[i + 1] > hi) return false;
+            for (int k = 2; k <= n; ++k) {
+                if ((p[i + k] & 0xC0) != 0x80) return false;
+            }
+            i += n + 1;
+        }
+        return true;
+    }
+
+    // 服务器发出的帧不加掩码
+    static void frame_header(std::string &out, WS_OPCODE op, size_t len) {
+        out.push_back((char)(0x80 | op));
+        if (len < 126) {
+            out.push_back((char)len);
+        }else if (len <= 0xFFFF) {
+            out.push_back((char)126);
+            out.push_back((char)(len >> 8));
+            out.push_back((char)len);
+        }else {
+            out.push_back((char)127);
+            for (int shift = 56; shift >= 0; shift -= 8) out.push_back((char)(len >> shift));
+        }
+    }
+};
+
+/**
+ * desc: 一个WebSocket连接（RFC 6455）
+ *      - 不占用线程：和HTTP/2一样在EPOLLONESHOT上处理，每次事件读到EAGAIN
+ *        （或用完预算），解析出的消息交给Ws_Handler，再写出发送队列
+ *      - 完整在读缓冲中的帧直接在recv的缓冲区里去掩码并交付，不拷贝；
+ *        只有跨recv的帧和分片消息才缓存
+ *      - 发送队列超过高水位时暂停读取，由TCP窗口对客户端形成背压
+ *      - 空闲时不持有任何缓冲区，只有对象本身（约一百多字节）
+ *      - 同一连接同时只有一个任务，类内不加锁
+ */
+class Ws_Session {
+public:
+    explicit Ws_Session(const Ws_Settings &settings): _settings(&settings) {}
+
+    // 握手成功：101响应放在发送队列的最前面
+    void start(const std::string &client_key) {
+        _queue_raw("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+            "Connection: Upgrade\r\nSec-WebSocket-Accept: " + Ws_Util::accept_key(client_key) + "\r\n\r\n");
+    }
+
+    /**
+     * 处理收到的数据（p会被就地去掩码），返回false表示连接正在关闭，不再需要读取
+     */
+    bool on_recv(char *p, size_t len) {
+
+        if (_closing) return false;
+
+        if (_in.empty()) {
+            size_t used = _parse(p, len);
+            if (!_closing && used < len) _in.assign(p + used, len - used);
+        }else {
+            _in.append(p, len);
+            size_t used = _parse(&_in[0], _in.size());
+            _in.erase(0, used);
+        }
+        if (_in.empty() || _closing) std::string().swap(_in);   // 释放缓冲区
+        return !_closing;
+    }
+
+    // 发送一个消息（文本/二进制）或控制帧
+    void send(WS_OPCODE op, const char *data, size_t len) {
+
+        if (_closing) return;
+        std::string *chunk = NULL;
+        if (_out.size() > _out_head && _out.back().size() + len + 10 <= WS_COALESCE_BYTES) {
+            chunk = &_out.back();
+        }else {
+            _out.emplace_back();
+            chunk = &_out.back();
+            chunk->reserve(std::min<size_t>(len + 10, WS_COALESCE_BYTES));
+        }
+        size_t before = chunk->size();
+        Ws_Util::frame_header(*chunk, op, len);
+        chunk->append(data, len);
+        _out_bytes += chunk->size() - before;
+    }
+
+    // 发送Close帧，之后不再读取和发送，队列写完后关闭连接
+    void close(uint16_t code) {
+        if (_closing) return;
+        char payload[2] = {(char)(code >> 8), (char)code};
+        send(WSO_CLOSE, payload, 2);
+        _closing = true;
+    }
+
+    // 写出发送队列
+    IO_STATUS flush(Tls_Conn *tls, int fd, ChildLoad *load) {
+
+        while (_out_bytes > 0) {
+
+            iovec iov[WS_OUT_IOV_MAX];
+            int cnt = 0;
+            for (size_t i = _out_head; i < _out.size() && cnt < WS_OUT_IOV_MAX; ++i) {
+                size_t skip = i == _out_head ? _head_sent : 0;
+                iov[cnt].iov_base = (void *)(_out[i].data() + skip);
+                iov[cnt++].iov_len = _out[i].size() - skip;
+            }
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+
+            if (load) load->send_calls.fetch_add(1, std::memory_order_relaxed);
+            ssize_t n = Tls_Util::sendmsg(tls, fd, &msg, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return IOS_AGAIN;
+                if (errno == EINTR) continue;
+                return IOS_CLOSE;
+            }
+
+            _out_bytes -= n;
+            size_t left = n;
+            while (left > 0) {
+                size_t rest = _out[_out_head].size() - _head_sent;
+                if (left < rest) {
+                    _head_sent += left;
+                    break;
+                }
+                left -= rest;
+                std::string().swap(_out[_out_head++]);
+                _head_sent = 0;
+            }
+        }
+
+        std::vector<std::string>().swap(_out);  // 写完后释放队列
+        _out_head = 0;
+        _head_sent = 0;
+        return IOS_DONE;
+    }
+
+    // 进程排空时由reactor调用：尽量发出Close(1001)，不等待
+    void going_away(Tls_Conn *tls, int fd) {
+        if (_closing || _out_bytes > 0) return;
+        std::string frame;
+        char payload[2] = {(char)(WSC_GOING_AWAY >> 8), (char)(WSC_GOING_AWAY & 0xFF)};
+        Ws_Util::frame_header(frame, WSO_CLOSE, 2);
+        frame.append(payload, 2);
+        Tls_Util::send(tls, fd, frame.data(), frame.size());
+        _closing = true;
+    }
+
+    bool want_read() const { return !_closing && _out_bytes < _settings->send_high_water; }
+    bool want_write() const { return _out_bytes > 0; }
+    bool finished() const { return _closing && _out_bytes == 0; }
+    bool idle() const { return _out_bytes == 0 && _in.empty() && !_in_fragment; }
+
+private:
+    const Ws_Settings *_settings;
+    std::string _in;                    // 不完整的帧
+    std::string _message;               // 未完成的分片消息
+    bool _in_fragment = false;
+    bool _message_text = false;
+    bool _closing = false;
+
+    std::vector<std::string> _out;      // 发送队列：_out_head之前的块已写完
+    size_t _out_head = 0;
+    size_t _head_sent = 0;              // 队首块已写出的字节数
+    size_t _out_bytes = 0;
+
+    void _queue_raw(const std::string &data) {
+        _out.push_back(data);
+        _out_bytes += data.size();
+    }
+
+    // 解析连续的帧，返回消耗的字节数（停在不完整的帧或关闭处）
+    size_t _parse(char *p, size_t len) {
+
+        size_t pos = 0;
+        while (!_closing && len - pos >= 2) {
+
+            uint8_t b0 = p[pos], b1 = p[pos + 1];
+            bool fin = b0 & 0x80;
+            int op = b0 & 0x0F;
+            uint64_t plen = b1 & 0x7F;
+            size_t hdr = 2;
+
+            if (plen == 126) {
+                if (len - pos < 4) break;
+                plen = ((uint8_t)p[pos + 2] << 8) | (uint8_t)p[pos + 3];
+                hdr = 4;
+            }else if (plen == 127) {
+                if (len - pos < 10) break;
+                plen = 0;
+                for (int k = 0; k < 8; ++k) plen = (plen << 8) | (uint8_t)p[pos + 2 + k];
+                hdr = 10;
+                // 64位长度的最高位必须为0（RFC 6455 5.2）
+                if (plen >> 63) {
+                    close(WSC_PROTOCOL_ERROR);
+                    break;
+                }
+            }
+
+            // 客户端的帧必须加掩码；没有协商扩展，RSV必须为0
+            if (!(b1 & 0x80) || (b0 & 0x70)) {
+                close(WSC_PROTOCOL_ERROR);
+                break;
+            }
+            bool control = op >= WSO_CLOSE;
+            if (control ? (op > WSO_PONG || !fin || plen > WS_MAX_CONTROL_PAYLOAD) : op > WSO_BINARY) {
+                close(WSC_PROTOCOL_ERROR);
+                break;
+            }
+            // 在缓存帧之前检查大小：超大的帧不等它收完（用减法比较，避免溢出）
+            if (!control && (_message.size() > _settings->max_message || \
+                    plen > _settings->max_message - _message.size())) {
+                close(WSC_TOO_BIG);
+                break;
+            }
+
+            hdr += 4;
+            if (len - pos < hdr || plen > len - pos - hdr) break;
+
+            uint8_t mask[4];
+            memcpy(mask, p + pos + hdr - 4, 4);
+            char *payload = p + pos + hdr;
+            Ws_Util::unmask(payload, plen, mask);
+            _on_frame((WS_OPCODE)op, fin, payload, plen);
+            pos += hdr + plen;
+        }
+        return pos;
+    }
+
+    void _on_frame(WS_OPCODE op, bool fin, const char *payload, size_t len) {
+
+        switch (op) {
+            case WSO_TEXT:
+            case WSO_BINARY:
+                if (_in_fragment) {
+                    close(WSC_PROTOCOL_ERROR);
+                    return;
+                }
+                if (fin) {
+                    _deliver(op == WSO_TEXT, payload, len);     // 不分片：直接交付，不拷贝
+                }else {
+                    _in_fragment = true;
+                    _message_text = op == WSO_TEXT;
+                    _message.assign(payload, len);
+                }
+                break;
+            case WSO_CONTINUATION:
+                if (!_in_fragment) {
+                    close(WSC_PROTOCOL_ERROR);
+                    return;
+                }
+                _message.append(payload, len);
+                if (fin) {
+                    _in_fragment = false;
+                    _deliver(_message_text, _message.data(), _message.size());
+                    std::string().swap(_message);
+                }
+                break;
+            case WSO_PING:
+                send(WSO_PONG, payload, len);
+                break;
+            case WSO_PONG:
+                break;
+            case WSO_CLOSE:
+                _on_close(payload, len);
+                break;
+        }
+    }
+
+    void _deliver(bool text, const char *data, size_t len) {
+        if (text && !Ws_Util::valid_utf8(data, len)) {
+            close(WSC_INVALID_PAYLOAD);
+            return;
+        }
+        if (_settings->handler) _settings->handler->on_message(*this, text, data, len);
+    }
+
+    // 对端发起关闭：回复相同的关闭码（没有关闭码时回复1000）
+    void _on_close(const char *payload, size_t len) {
+
+        if (len == 0) {
+            close(WSC_NORMAL);
+            return;
+        }
+        if (len == 1) {
+            close(WSC_PROTOCOL_ERROR);
+            return;
+        }
+        uint16_t code = ((uint8_t)payload[0] << 8) | (uint8_t)payload[1];
+        bool valid = ((code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || \
+            (code >= 3000 && code <= 4999));
+        if (!valid) {
+            close(WSC_PROTOCOL_ERROR);
+        }else if (!Ws_Util::valid_utf8(payload + 2, len - 2)) {
+            close(WSC_INVALID_PAYLOAD);
+        }else {
+            close(code);
+        }
+    }
+};
+
+// 内置的处理器：把消息原样发回
+class Ws_Echo_Handler : public Ws_Handler {
+public:
+    void on_message(Ws_Session &session, bool text, const char *data, size_t len) override {
+        session.send(text ? WSO_TEXT : WSO_BINARY, data, len);
+    }
+};
@@ -10,9 +10,32 @@
 #include "http_request_parser.h"
 #include "http_response_sender.h"
 #include <memory.h>
+#include <limits.h>
 #include "epoll_utils.h"
+#include "load_table.h"
+#include "write_policy.h"
+#include "utils.h"
+#include "reverse_proxy.h"
+#include "http2.h"
+#include "websocket.h"
+#include "coroutine.h"
+#include "access_log.h"
+#include "router.h"
+#include "client_data.h"
 
 #define MAX_READ_NUM 1024
+#define REQUEST_HEAD_MAX (16 << 10)     // 请求行和首部的长度上限，超过则回复400
+
+// 解析请求的结果
+enum REQUEST_STATE {
+    RQS_INCOMPLETE = 0,     // 还没有读到完整的请求
+    RQS_RESPONSE,           // 已生成响应
+    RQS_PROXY,              // 请求匹配代理路由，由反向代理处理
+    RQS_H2,                 // 连接已切换到HTTP/2（Upgrade: h2c）
+    RQS_WS,                 // 连接已切换到WebSocket
+    RQS_IDLE,               // 保持连接，等待下一个请求（协程处理的连接，协程结束以归还协程帧）
+    RQS_CLOSE               // 连接应关闭（协程处理的连接结束时）
+};
 
 // 提供给线程池的工作函数
 /*
@@ -21,26 +44,60 @@
                 在获取之后，才能进行下一步的动作，根据event类型，
                 从sockfd中读，或者是写响应。
                 在读取到响应之后，通过 http_request_parse类进行处理。
-*/ 
+*/
 //    关于数据的保存、修改、细节非常关键
 
+// 统计一个任务的处理：构造时在途任务数+1，析构时-1并记录任务从入队到完成的耗时
+struct Task_Load_Guard {
+    Task_Load_Guard(ChildLoad *load, uint64_t enqueue_us): _load(load), _enqueue_us(enqueue_us) {
+        if (_load) ++_load->inflight_requests;
+    }
+    ~Task_Load_Guard() {
+        if (_load) {
+            --_load->inflight_requests;
+            _load->record_latency(now_us() - _enqueue_us);
+        }
+    }
+    ChildLoad *_load;
+    uint64_t _enqueue_us;
+};
+
 /**
  * the work routine for thread
+ *
+ * 支持两种连接模式（由任务的事件类型区分）：
+ *  - EPOLLONESHOT（水平触发）：每处理完一个事件，通过modifyfd重新注册
+ *  - EPOLLET（边缘触发）：连接只注册一次，reactor只负责在ClientData上记录
+ *    可读/可写，同一连接同时最多只有一个任务；工作线程读写到EAGAIN为止，
+ *    稳态下不再调用epoll_ctl
  */
 template<typename ClientData_t>
 class Worker {
 public:
     static void* work(void *args) {
-        
+
         ThreadPoolTaskContainer<ClientData_t> *task_container = \
             (ThreadPoolTaskContainer<ClientData_t> *)args;
+        ChildLoad *load = task_container->load_slot();
 
         // 线程的工作就是不断的尝试从任务容器中取下任务
+        // 直到线程池要求本线程退出（缩容或关闭）
         while (true) {
 
             ThreadPoolTask<ClientData_t> task;
 
-            if (!task_container->try_remove(task)) { // 没有成功获取任务
+            bool should_exit = false;
+            if (!task_container->try_remove(task, &should_exit)) { // 没有成功获取任务
+                if (should_exit) break;
+                continue;
+            }
+
+            Task_Load_Guard load_guard(load, task._enqueue_us);
+            ClientData_t *client = task.p_client_data;
+
+            if (task._event.events & EPOLLET) {
+                // 边缘触发模式：读写由连接上记录的就绪状态驱动
+                _serve_edge_triggered(task_container, task);
                 continue;
             }
 
@@ -48,138 +105,973 @@ public:
             //      因为要使用EPOLLONESHOT，只有当前线程是其服务者，
             //      在处理未完成之前，clientfd的EPOLLIN不会再次触发
 
-            if (task._event & EPOLLIN) {
-                // 线程读取客户端数据
-                int read_bytes = -1;
-                while (true) {
-                    read_bytes = recv(task._clientfd, \
-                        task.p_client_data->_readbuf + task.p_client_data->_read_buf_end_idx, \
-                            MAX_READ_NUM - 1, 0);
-                    if (read_bytes == -1) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            // 本次EPOLLIN数据已经读完
-                            break;
-                        }else {
-                            // 说明出问题了
-                            // 解决方式：为FD注册写事件为FD注册写事件，让主线程关闭连接
-                            // 主线程查看EPOLLOUT事件时，先查看该fd的_should_close标记
-                            task.p_client_data->_should_close = true;
-                            Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
-                        }
-                    }else if (read_bytes == 0) {
-
-                        // 说明客户端断开了连接，发送了FIN报文
-                        // 方式：为FD注册写事件为FD注册写事件，
-                        // 让主线程响应EPOLLOUT事件，从而关闭连接
-                        task.p_client_data->_should_close = true;
-                        Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
-                        break;
-                    }else {
-                        
-                        // 成功读到数据
-                        task.p_client_data->_read_buf_end_idx += read_bytes;
-                        
-                        // 数据量超过了buffer数组的长度，认为此次连接有误
-                        if (task.p_client_data->_read_buf_end_idx > task.p_client_data->READ_BUF_SZ) {
-                            // 解决方式：为FD注册写事件，让主线程关闭连接
-                            task.p_client_data->_should_close = true;
-                            Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
-                            break;
-                        }
+            // TLS握手未完成：握手完成后请求可能已经随握手到达，接着按可读处理
+            if (client->_tls && !client->_tls->established) {
+                if (!_tls_handshake(client, task._clientfd, task_container)) continue;
+                task._event.events = EPOLLIN;
+            }
+
+            // 代理请求进行中：客户端可写、上游连接的事件、超时都交给反向代理
+            if (client->_proxying()) {
+                Reverse_Proxy *proxy = task_container->reverse_proxy();
+                PROXY_RESULT result = proxy->on_event(client, task._clientfd, task._event.events, load);
+                _handle_proxy_result(client, task._clientfd, result, task_container);
+                continue;
+            }
+
+            // HTTP/2连接：帧的读写都在_serve_h2中完成
+            if (client->_h2.load()) {
+                _serve_h2(task_container, client, task._clientfd, task._event.events);
+                continue;
+            }
+
+            // WebSocket连接：同样不占用线程，每次事件处理完就重新注册
+            if (client->_ws.load()) {
+                _serve_ws(task_container, client, task._clientfd, task._event.events);
+                continue;
+            }
+
+#if CO_SUPPORTED
+            // 协程处理的连接：新请求到来时创建协程，之后的事件都交给挂起的协程
+            if (client->_co.active() || (task_container->coroutines() && (task._event.events & EPOLLIN))) {
+                _serve_coroutine(task_container, client, task._clientfd);
+                continue;
+            }
+#endif
+
+            if (task._event.events & EPOLLIN) {
+                // 线程读取客户端数据，直到本次EPOLLIN的数据读完
+                IO_STATUS status = _recv_request(client, task._clientfd, INT_MAX, load);
+
+                // 以HTTP/2序言开始的连接（prior knowledge）：
+                //  序言还没收全时继续等待；读缓冲区满或对端关闭时交给_serve_h2继续处理
+                if (task_container->http2() && client->_tls == NULL && !client->hrp().has_partial_request() && \
+                        client->_read_buf_end_idx > 0 && \
+                        H2_Session::is_preface(client->_readbuf, client->_read_buf_end_idx)) {
+                    if (client->_read_buf_end_idx < H2_PREFACE_LEN && status != IOS_CLOSE) {
+                        _rearm(client, task._clientfd, EPOLLIN, load);
+                        continue;
                     }
+                    _start_h2_prior_knowledge(client, task_container);
+                    _serve_h2(task_container, client, task._clientfd, \
+                        status == IOS_AGAIN ? 0 : (uint32_t)EPOLLIN);
+                    continue;
+                }
+
+                // 出错或客户端断开（FIN）：
+                // 解决方式：为FD注册写事件，让主线程关闭连接
+                // 主线程查看EPOLLOUT事件时，先查看该fd的_should_close标记
+                if (status == IOS_CLOSE) {
+                    client->_should_close = true;
+                    _rearm(client, task._clientfd, EPOLLOUT, load);
+                    continue;
+                }
+
+                REQUEST_STATE rqs = _parse_request(client, task_container);
+
+                // 读缓冲区满（如较大的请求体）：解析之后接着读
+                while (rqs == RQS_INCOMPLETE && status == IOS_BUDGET) {
+                    status = _recv_request(client, task._clientfd, INT_MAX, load);
+                    if (status == IOS_CLOSE) break;
+                    rqs = _parse_request(client, task_container);
                 }
-                
-                // 若should_close，则线程本次处理task已完成
-                // 尝试获取下一个task
-                if (task.p_client_data->_should_close) {
+                if (status == IOS_CLOSE && rqs == RQS_INCOMPLETE) {
+                    client->_should_close = true;
+                    _rearm(client, task._clientfd, EPOLLOUT, load);
                     continue;
                 }
+                _dispatch_request(task_container, client, task._clientfd, rqs);
+            }else if (task._event.events & EPOLLOUT) {
+                // 线程给客户端发送数据
+                // 可能无法一次性将数据全部发送到TCP发送缓冲区
+                IO_STATUS status = _send_response(client, task._clientfd, INT_MAX, load);
+
+                if (status == IOS_AGAIN) {
+                    // 说明TCP发送缓冲区没有空间了，
+                    // 需要等待下一次TCP发送缓冲区有足够空间
+                    // 即EPOLLOUT触发，但可能是由其他线程接着干了
+                    client->_should_close = false;
+                    _rearm(client, task._clientfd, EPOLLOUT, load);
+                }else if (status == IOS_CLOSE) {
+                    // 数据发送出了问题，书中是断开连接
+                    client->_should_close = true;
+                    _rearm(client, task._clientfd, EPOLLOUT, load);
+                }else {
+                    // 说明一个响应报文的数据已全部发送完成
+                    // 根据请求报文中的Connection字段，
+                    //      告诉主线程是断开连接还是继续连接
+                    // 若持续连接，则继续clientfd的EPOLLIN事件
+                    // 若断开连接，则修改为EPOLLOUT事件，并设置should_close标志
+                    if (_finish_response(client, task_container->draining())) {
+                        // 已经收到的下一个请求（pipelining）直接处理，否则等待EPOLLIN
+                        _dispatch_request(task_container, client, task._clientfd, \
+                            _parse_request(client, task_container));
+                    }else {
+                        client->_should_close = true;
+                        _rearm(client, task._clientfd, EPOLLOUT, load);
+                    }
+                }
+            }else {
+                // event中的事件类型是当前线程不支持处理的，
+                // 因此不处理当前task，并重新尝试拿到新的task
+
+                continue;
+            }
+        }
+
+        // 登记退出，由线程池join
+        task_container->on_thread_exit();
+        return NULL;
+    }
 
-                // 开始处理recv得到的数据
-                PARSE_STAGE state = task.p_client_data->hrp.parse(\
-                        task.p_client_data->_readbuf, \
-                        task.p_client_data->_read_buf_end_idx
-                    );
+private:
 
-                // 因为上面将task.p_client_data->_readbuf中的数据交给了parser
-                // 因此可以还原read_buf了
-                memset(task.p_client_data->_readbuf, 0, task.p_client_data->READ_BUF_SZ);
-                task.p_client_data->_read_buf_end_idx = 0;
+    // EPOLLONESHOT模式下重新注册事件
+    // 先释放调度权：重新注册之后的事件只会由reactor生成新的任务
+    static void _rearm(ClientData_t *client, int fd, int ev, ChildLoad *load) {
+        client->_scheduled.store(false);
+        if (load) load->epoll_ctl_calls.fetch_add(1, std::memory_order_relaxed);
+        Epoll_Util::modifyfd(fd, ev);
+    }
 
-                if (state == PARSE_STAGE::PS_OK || state == PARSE_STAGE::PS_PARSE_FAIL) {
+    // 反向代理处理完一个事件后，按结果重新注册客户连接的事件
+    static void _handle_proxy_result(ClientData_t *client, int fd, PROXY_RESULT result, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
 
-                    // 请求报文解析完成后，让sender来生成响应
-                    //   之后其他线程处理EPOLLOUT事件时，
-                    //   只需要拿到task.p_client_data->hrs中的响应数据即可
-                    // task.p_client_data->hrs.response(task.p_client_data->hrp);
-                    task.p_client_data->_should_close = false;
-                    Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
+        ChildLoad *load = task_container->load_slot();
+        switch (result) {
+            case PXR_PENDING:
+                // 反向代理已注册了要等待的事件，不能再访问该连接
+                break;
+            case PXR_RESPOND:
+                // 502/504：和普通响应一样发送
+                client->_send_buf_end_idx = 0;
+                client->_should_close = false;
+                _rearm(client, fd, EPOLLOUT, load);
+                break;
+            case PXR_DONE: {
+                // 响应已全部转发；上游响应以关闭连接结束时，客户连接也不能保持
+                bool keep_alive = _finish_response(client, task_container->draining());
+                if (keep_alive && client->_proxy.load()->client_keep_alive) {
+                    // 代理请求之后已经收到的下一个请求（pipelining）直接处理，否则等待EPOLLIN
+                    _dispatch_request(task_container, client, fd, _parse_request(client, task_container));
                 }else {
+                    client->_should_close = true;
+                    _rearm(client, fd, EPOLLOUT, load);
+                }
+                break;
+            }
+            case PXR_CLOSE:
+                client->_should_close = true;
+                _rearm(client, fd, EPOLLOUT, load);
+                break;
+        }
+    }
+
+    // 按解析的结果继续处理连接（EPOLLONESHOT）
+    static void _dispatch_request(ThreadPoolTaskContainer<ClientData_t> *task_container, \
+            ClientData_t *client, int fd, REQUEST_STATE rqs) {
+
+        ChildLoad *load = task_container->load_slot();
+        if (rqs == RQS_PROXY) {
+            Reverse_Proxy *proxy = task_container->reverse_proxy();
+            PROXY_RESULT result = proxy->start(client, fd, task_container->draining(), load);
+            _handle_proxy_result(client, fd, result, task_container);
+        }else if (rqs == RQS_H2) {
+            _serve_h2(task_container, client, fd, 0);
+        }else if (rqs == RQS_WS) {
+            _serve_ws(task_container, client, fd, 0);
+        }else if (rqs == RQS_RESPONSE) {
+
+            // 请求报文解析完成后，sender已生成响应
+            //   之后其他线程处理EPOLLOUT事件时，
+            //   只需要拿到client->hrs()中的响应数据即可
+            client->_should_close = false;
+            _rearm(client, fd, EPOLLOUT, load);
+        }else {
+
+            // 本次操作完成后，由于没有读到一个完整报文，
+            // 因此需要继续EPOLLIN
+            // 因为使用了EPOLLONESHOT，因此需要修改fd的内核事件表
+            // 重新将fd，注册到epollfd中
+            client->_should_close = false;
+            _rearm(client, fd, EPOLLIN, load);
+        }
+    }
+
+    // 读取请求数据，直到EAGAIN，或调用recv达到budget次
+    static IO_STATUS _recv_request(ClientData_t *client, int fd, int budget, ChildLoad *load) {
+
+        // 读缓冲区属于请求对象
+        client->request();
+        for (int i = 0; i < budget; ++i) {
+
+            // 留一个字节给'\0'；缓冲区已满时先交给调用者解析，腾出空间后再读
+            int space = READ_BUF_SZ - 1 - client->_read_buf_end_idx;
+            if (space <= 0) return IOS_BUDGET;
+
+            if (load) load->recv_calls.fetch_add(1, std::memory_order_relaxed);
+            int read_bytes = Tls_Util::recv(client->_tls, fd, client->_readbuf + client->_read_buf_end_idx, space);
 
-                    // 本次操作完成后，由于没有读到一个完整报文，
-                    // 因此需要继续EPOLLIN
-                    // 因为使用了EPOLLONESHOT，因此需要修改fd的内核事件表
-                    // 重新将fd，注册到epollfd中
-                    task.p_client_data->_should_close = false;
-                    Epoll_Util::modifyfd(task._clientfd, EPOLLIN);
+            if (read_bytes == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // 本次的数据已经读完
+                    return IOS_AGAIN;
                 }
-            }else if (task._event & EPOLLOUT) {
-                // 线程给客户端发送数据
+                if (errno == EINTR) continue;
+                return IOS_CLOSE;
+            }else if (read_bytes == 0) {
+                // 说明客户端断开了连接，发送了FIN报文
+                return IOS_CLOSE;
+            }
+
+            // 成功读到数据
+            client->_read_buf_end_idx += read_bytes;
+            client->_readbuf[client->_read_buf_end_idx] = '\0';
+        }
+        return IOS_BUDGET;
+    }
 
-                task.p_client_data->hrs.response(task.p_client_data->hrp);
+    // 解析已读到的数据，得到完整请求（或解析失败）时生成响应
+    // 进程正在排空时响应带上Connection: close；来源IP超过限流时回复429
+    // 注册的路由优先于代理路由和静态文件，由路由的处理器生成响应
+    // 匹配代理路由的请求不生成响应，交给反向代理；WebSocket握手成功时切换协议
+    // 首部交给parser，请求体交给Request_Body流式接收；请求之后的数据留在_readbuf中
+    static REQUEST_STATE _parse_request(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
 
-                int send_bytes = 0;
-                // 将sender中的数据，发送给clientfd
-                // 可能无法一次性将数据全部发送到TCP发送缓冲区
-                while (true) {
-
-                    send_bytes = send(task._clientfd, \ 
-                        task.p_client_data->hrs.get_response_data() + task.p_client_data->_send_buf_end_idx, \
-                            task.p_client_data->hrs.get_response_data_len, 0);
-
-                    if (send_bytes == -1) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            // 说明TCP发送缓冲区没有空间了，
-                            // 需要等待下一次TCP发送缓冲区有足够空间
-                            // 即EPOLLOUT触发，但可能是由其他线程接着干了
-                            std::cout << "发送缓冲区已满" << std::endl;
-                            task.p_client_data->_should_close = false;
-                            Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
-                            break;
-                        }else {
-                            // 数据发送出了问题，该如何处理?断开连接吗
-                            // 书中是断开连接
-                            task.p_client_data->_should_close = true;
-                            Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
-                            break;
-                        }
+        if (client->_read_buf_end_idx == 0) return RQS_INCOMPLETE;
+
+        HTTP_UTILS::HTTPCODE reject = HTTP_UTILS::OK;
+        PARSE_STAGE state = client->_body && client->_body->active() ? \
+            _parse_body(client, &reject) : _parse_head(client, task_container, &reject);
+
+        if (reject != HTTP_UTILS::OK) {
+            // 剩余的请求体不再读取，响应之后关闭连接
+            if (Access_Log::access_enabled()) client->_request_start_us = now_us();
+            if (client->_body) client->_body->reset();
+            client->hrs().set_connection_close();
+            client->hrs().response_error(client->hrp(), reject);
+            client->_send_buf_end_idx = 0;
+            return RQS_RESPONSE;
+        }
+
+        if (state == PARSE_STAGE::PS_OK || state == PARSE_STAGE::PS_PARSE_FAIL) {
+            if (Access_Log::access_enabled()) client->_request_start_us = now_us();
+            if (state == PARSE_STAGE::PS_OK && _upgrade_h2c(client, task_container)) {
+                return RQS_H2;
+            }
+            if (task_container->draining()) client->hrs().set_connection_close();
+
+            Rate_Limiter *limiter = task_container->rate_limiter();
+            if (state == PARSE_STAGE::PS_OK && limiter && \
+                    !limiter->allow_request(client->_peer_ip)) {
+                client->hrs().response_error(client->hrp(), HTTP_UTILS::TOO_MANY_REQUESTS, 1);
+            }else if (state == PARSE_STAGE::PS_OK && _route(client->hrp(), client->hrs(), task_container)) {
+                // 已由处理器生成响应
+            }else if (state == PARSE_STAGE::PS_OK && task_container->reverse_proxy() && \
+                    task_container->reverse_proxy()->match(client->hrp().url()) >= 0) {
+                return RQS_PROXY;
+            }else if (state == PARSE_STAGE::PS_OK && _is_websocket_upgrade(client, task_container)) {
+                if (_upgrade_websocket(client, task_container)) return RQS_WS;
+                client->hrs().response_error(client->hrp(), HTTP_UTILS::BAD_REQUEST);
+            }else if (state == PARSE_STAGE::PS_OK && _resolve_path(client->hrp(), client->hrs())) {
+                // 已回复错误、304或文件
+            }else {
+                client->hrs().response(client->hrp());
+            }
+            client->_send_buf_end_idx = 0;
+            return RQS_RESPONSE;
+        }
+        return RQS_INCOMPLETE;
+    }
+
+    // 按注册的路由分派请求，返回false表示没有匹配的路由
+    static bool _route(Http_Request_Parser &hrp, Http_Response_Sender &hrs, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        const Router *router = task_container->router();
+        if (router == NULL) return false;
+
+        Route_Handler *handler = NULL;
+        Route_Params params;
+        switch (router->match(hrp.method(), hrp.url(), &handler, &params)) {
+            case RR_FOUND:
+                if (hrp.body_fd() >= 0 && !handler->reads_spooled_body()) {
+                    hrs.response_error(hrp, HTTP_UTILS::PAYLOAD_TOO_LARGE);
+                    return true;
+                }
+                // HTTP/1.1的请求体已经逐段交给了流式的处理器；HTTP/2的请求体在内存中，一次交给它
+                if (handler->streams_body() && hrp.has_body()) {
+                    if (handler->on_body_chunk(hrp, params, hrp.body().data(), hrp.body().size())) {
+                        handler->handle(hrp, hrs, params);
+                    }else {
+                        hrs.response_error(hrp, HTTP_UTILS::INTERNAL_SERVER_ERROR);
                     }
-                    
-                    task.p_client_data->_send_buf_end_idx += send_bytes;
-                    if (task.p_client_data->_send_buf_end_idx >= task.p_client_data->hrs.get_response_data_len) {
-                        // 说明一个响应报文的数据已全部发送完成
-                        // 根据请求报文中的Connection字段，
-                        //      告诉主线程是断开连接还是继续连接
-                        // 若持续连接，则继续clientfd的EPOLLIN事件
-                        // 若断开连接，则修改为EPOLLOUT事件，并设置should_close标志
-                        task.p_client_data->_send_buf_end_idx = 0;
-                        bool is_keep_alive = task.p_client_data->hrp.is_keep_alive();
-                        if (is_keep_alive) {
-                            task.p_client_data->_should_close = false;
-                            Epoll_Util::modifyfd(task._clientfd, EPOLLIN);
-                        }else {
-
-                            task.p_client_data->_should_close = true;
-                            Epoll_Util::modifyfd(task._clientfd, EPOLLOUT);
-                        }
+                    handler->on_body_end(hrp, true);
+                    return true;
+                }
+                handler->handle(hrp, hrs, params);
+                return true;
+            case RR_METHOD_NOT_ALLOWED:
+                hrs.response_content(hrp, HTTP_UTILS::METHOD_NOT_ALLOWED, "", "", \
+                    "Allow: " + router->allow(hrp.url()) + "\r\n");
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * 静态文件请求的路径解析：不合法的路径回复400/403，不存在的文件（GET/HEAD）回复404，
+     * 验证器一致的条件请求（GET/HEAD）直接回复304，Accept不接受文件的类型时回复406，
+     * 其余对文件的GET/HEAD回复200（首部由解析结果生成，与304一致），都返回true；
+     * 否则解析到的文件交给hrs，返回false
+     * 请求的URL保持原样（原有流程自己解码，查询串也要保留）
+     */
+    static bool _resolve_path(Http_Request_Parser &hrp, Http_Response_Sender &hrs) {
+
+        Path_Resolver &resolver = Path_Resolver::instance();
+        if (!resolver.enabled()) return false;
+
+        std::shared_ptr<const Resolved_Path> path = resolver.resolve(hrp.url());
+        switch (path->status) {
+            case RP_BAD:
+                hrs.response_error(hrp, HTTP_UTILS::BAD_REQUEST);
+                return true;
+            case RP_FORBIDDEN:
+                hrs.response_error(hrp, HTTP_UTILS::FORBIDDEN);
+                return true;
+            case RP_NOT_FOUND:
+                if (hrp.method() != "GET" && hrp.method() != "HEAD") break;
+                hrs.response_error(hrp, HTTP_UTILS::NOT_FOUND);
+                return true;
+            case RP_FILE:
+                if ((hrp.method() == "GET" || hrp.method() == "HEAD") && \
+                        Conditional_Util::not_modified(_find_header(hrp, "If-None-Match"), \
+                            _find_header(hrp, "If-Modified-Since"), path->etag, path->mtime)) {
+                    hrs.response_not_modified(hrp, *path);
+                    return true;
+                }
+                if (const std::string *accept = _find_header(hrp, "Accept")) {
+                    if (Mime_Util::accept_quality(accept->c_str(), path->content_type) == 0) {
+                        hrs.response_error(hrp, HTTP_UTILS::Not_ACCEPTABLE);
+                        return true;
                     }
                 }
+                hrs.set_resolved_path(path);
+                if (hrp.method() == "GET" || hrp.method() == "HEAD") {
+                    hrs.response_file(hrp);
+                    return true;
+                }
+                break;
+            default:
+                break;
+        }
+        return false;
+    }
+
+    // 已处理的n个字节从_readbuf中移除，剩下的（属于下一个请求）移到开头
+    static void _consume_readbuf(ClientData_t *client, int n) {
+        int rest = client->_read_buf_end_idx - n;
+        if (rest > 0) memmove(client->_readbuf, client->_readbuf + n, rest);
+        client->_read_buf_end_idx = rest;
+        client->_readbuf[rest] = '\0';
+    }
+
+    // 在_readbuf中查找首部的结束（"\r\n\r\n"可能跨越两次读取），返回其后的位置，没有找到返回-1
+    static int _find_head_end(ClientData_t *client) {
+        static const char TERMINATOR[] = "\r\n\r\n";
+        for (int i = 0; i < client->_read_buf_end_idx; ++i) {
+            char c = client->_readbuf[i];
+            if (c == TERMINATOR[client->_head_match]) {
+                if (++client->_head_match == 4) {
+                    client->_head_match = 0;
+                    return i + 1;
+                }
             }else {
-                // event中的事件类型是当前线程不支持处理的，
-                // 因此不处理当前task，并重新尝试拿到新的task
+                client->_head_match = c == '\r' ? 1 : 0;
+            }
+        }
+        return -1;
+    }
 
-                continue;
+    // 解析请求行和首部；首部完整且带有请求体时开始接收请求体
+    static PARSE_STAGE _parse_head(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container, HTTP_UTILS::HTTPCODE *reject) {
+
+        int head_end = _find_head_end(client);
+        int n = head_end < 0 ? client->_read_buf_end_idx : head_end;
+
+        // 只把首部交给parser（要求以'\0'结尾）
+        char saved = client->_readbuf[n];
+        client->_readbuf[n] = '\0';
+        PARSE_STAGE state = client->hrp().parse(client->_readbuf, n);
+        client->_readbuf[n] = saved;
+        _consume_readbuf(client, n);
+
+        client->_head_bytes += n;
+        if (head_end < 0) {
+            if (client->_head_bytes > REQUEST_HEAD_MAX) *reject = HTTP_UTILS::BAD_REQUEST;
+            return state;
+        }
+        client->_head_bytes = 0;
+        if (state == PARSE_STAGE::PS_PARSE_FAIL) return state;
+
+        // 请求体的边界：同时出现Transfer-Encoding和Content-Length的请求不接受（请求走私）
+        const std::string *te = _find_header(client->hrp(), "Transfer-Encoding");
+        const std::string *cl = _find_header(client->hrp(), "Content-Length");
+        if (te == NULL && cl == NULL) return state;
+
+        const Body_Settings &settings = task_container->request_body();
+        bool chunked = te != NULL;
+        uint64_t length = 0;
+        if (chunked ? cl != NULL || strcasecmp(te->c_str(), "chunked") != 0 : \
+                !_parse_content_length(*cl, &length)) {
+            *reject = HTTP_UTILS::BAD_REQUEST;
+            return PARSE_STAGE::PS_PARSE_FAIL;
+        }
+        if (length > settings.max_bytes) {
+            *reject = HTTP_UTILS::PAYLOAD_TOO_LARGE;
+            return PARSE_STAGE::PS_PARSE_FAIL;
+        }
+        if (!chunked && length == 0) return PARSE_STAGE::PS_OK;
+
+        if (client->_body == NULL) client->_body = new Request_Body();
+        client->_body->start(chunked, length, settings);
+        _choose_body_sink(client, task_container);
+        return _parse_body(client, reject);
+    }
+
+    // 首部完整时确定请求体的接收者：流式的路由处理器边收边处理，
+    // 其他路由的处理器和反向代理要完整的请求体（存放），静态文件和405用不到请求体（丢弃）
+    static void _choose_body_sink(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        Http_Request_Parser &hrp = client->hrp();
+        const Router *router = task_container->router();
+        Route_Handler *handler = NULL;
+        Route_Params params;
+        ROUTE_RESULT result = router ? router->match(hrp.method(), hrp.url(), &handler, &params) : RR_NONE;
+        if (result == RR_FOUND) {
+            if (handler->streams_body()) client->_body->stream_to(handler, hrp, params);
+            return;
+        }
+        Reverse_Proxy *proxy = task_container->reverse_proxy();
+        if (result == RR_NONE && proxy && proxy->match(hrp.url()) >= 0) return;
+        client->_body->discard();
+    }
+
+    // 接收请求体：完成时请求才完整
+    static PARSE_STAGE _parse_body(ClientData_t *client, HTTP_UTILS::HTTPCODE *reject) {
+
+        size_t consumed = 0;
+        BODY_STATE state = client->_body->feed(client->_readbuf, client->_read_buf_end_idx, &consumed);
+        _consume_readbuf(client, consumed);
+
+        switch (state) {
+            case BS_MORE:
+                return PARSE_STAGE::PS_BODY;
+            case BS_DONE:
+                client->_body->finish(client->hrp());
+                return PARSE_STAGE::PS_OK;
+            case BS_TOO_LARGE:
+                *reject = HTTP_UTILS::PAYLOAD_TOO_LARGE;
+                break;
+            case BS_BAD:
+                *reject = HTTP_UTILS::BAD_REQUEST;
+                break;
+            default:
+                *reject = HTTP_UTILS::INTERNAL_SERVER_ERROR;
+                break;
+        }
+        return PARSE_STAGE::PS_PARSE_FAIL;
+    }
+
+    // Content-Length只能是十进制数字
+    static bool _parse_content_length(const std::string &value, uint64_t *length) {
+        if (value.empty() || value.size() > 19) return false;
+        uint64_t n = 0;
+        for (char c : value) {
+            if (c < '0' || c > '9') return false;
+            n = n * 10 + (c - '0');
+        }
+        *length = n;
+        return true;
+    }
+
+    /**
+     * 推进TLS握手，返回true表示握手完成、可以继续处理请求
+     * 需要等待时按OpenSSL的要求重新注册EPOLLIN/EPOLLOUT，失败时关闭连接
+     * ALPN协商为h2的连接直接进入HTTP/2
+     */
+    static bool _tls_handshake(ClientData_t *client, int fd, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        ChildLoad *load = task_container->load_slot();
+        int want = 0;
+        if (!Tls_Util::handshake(client->_tls, &want)) {
+            if (want == 0) client->_should_close = true;
+            _rearm(client, fd, want == 0 ? (uint32_t)EPOLLOUT : want, load);
+            return false;
+        }
+
+        if (client->_tls->alpn_h2 && task_container->http2()) {
+            H2_Session *h2 = new H2_Session(*task_container->http2(), client->hrs());
+            h2->start();
+            client->_h2.store(h2);
+            _serve_h2(task_container, client, fd, EPOLLIN);
+            return false;
+        }
+        return true;
+    }
+
+    // 请求首部（名字不区分大小写），没有返回NULL
+    static const std::string *_find_header(const Http_Request_Parser &hrp, const char *name) {
+        for (const auto &kv : hrp.headers()) {
+            if (strcasecmp(kv.first.c_str(), name) == 0) return &kv.second;
+        }
+        return NULL;
+    }
+
+    // 以序言开始的连接：已读到的数据交给新的HTTP/2会话
+    static void _start_h2_prior_knowledge(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        H2_Session *h2 = new H2_Session(*task_container->http2(), client->hrs());
+        h2->start();
+        h2->on_recv(client->_readbuf, client->_read_buf_end_idx);
+        memset(client->_readbuf, 0, READ_BUF_SZ);
+        client->_read_buf_end_idx = 0;
+        client->_h2.store(h2);
+    }
+
+    // Upgrade: h2c：请求成为HTTP/2的流1，连接切换到HTTP/2
+    // 带请求体的升级请求、HTTP2-Settings无效时忽略升级，按HTTP/1.1回复
+    static bool _upgrade_h2c(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        if (!task_container->http2() || client->_tls || task_container->draining()) return false;
+        if (client->hrp().has_body()) return false;
+
+        const std::string *upgrade = _find_header(client->hrp(), "Upgrade");
+        const std::string *settings = _find_header(client->hrp(), "HTTP2-Settings");
+        if (upgrade == NULL || settings == NULL || strcasestr(upgrade->c_str(), "h2c") == NULL) {
+            return false;
+        }
+
+        H2_Session *h2 = new H2_Session(*task_container->http2(), client->hrs());
+        if (!h2->upgrade(client->hrp(), *settings)) {
+            delete h2;
+            return false;
+        }
+        client->hrp().reset();
+        client->_h2.store(h2);
+        return true;
+    }
+
+    // 请求Upgrade: websocket，且URL匹配配置的前缀
+    static bool _is_websocket_upgrade(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        const Ws_Settings *settings = task_container->websocket();
+        if (settings == NULL || task_container->draining()) return false;
+
+        const std::string *upgrade = _find_header(client->hrp(), "Upgrade");
+        if (upgrade == NULL || strcasestr(upgrade->c_str(), "websocket") == NULL) return false;
+
+        const std::string &url = client->hrp().url();
+        for (const std::string &prefix : settings->paths) {
+            if (url.compare(0, prefix.size(), prefix) == 0) return true;
+        }
+        return false;
+    }
+
+    // WebSocket握手（RFC 6455 4.2.1）：不合法时返回false，由调用者回复400
+    static bool _upgrade_websocket(ClientData_t *client, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        const std::string *connection = _find_header(client->hrp(), "Connection");
+        const std::string *version = _find_header(client->hrp(), "Sec-WebSocket-Version");
+        const std::string *key = _find_header(client->hrp(), "Sec-WebSocket-Key");
+        if (client->hrp().method() != "GET" || connection == NULL || \
+                strcasestr(connection->c_str(), "upgrade") == NULL || \
+                version == NULL || *version != "13" || key == NULL || !Ws_Util::valid_key(*key)) {
+            return false;
+        }
+
+        Ws_Session *ws = new Ws_Session(*task_container->websocket());
+        ws->start(*key);
+        client->hrp().reset();
+        client->hrs().clear_data();
+        client->_ws.store(ws);
+        return true;
+    }
+
+    /**
+     * 服务一个WebSocket连接（EPOLLONESHOT）：
+     *  1. 可读且发送队列未超过高水位时读取，每次最多io_budget次recv，
+     *     剩下的数据留在socket中，重新注册后由reactor再次调度（不独占线程）
+     *  2. 写出发送队列
+     *  3. 按需要重新注册EPOLLIN/EPOLLOUT；关闭握手完成或出错时关闭连接
+     * 进程排空时发送Close(1001)
+     */
+    static void _serve_ws(ThreadPoolTaskContainer<ClientData_t> *task_container, \
+            ClientData_t *client, int fd, uint32_t events) {
+
+        Ws_Session *ws = client->_ws.load();
+        ChildLoad *load = task_container->load_slot();
+
+        if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && ws->want_read()) {
+            char buf[WS_RECV_CHUNK];
+            for (int i = 0; i < task_container->io_budget() && ws->want_read(); ++i) {
+                if (load) load->recv_calls.fetch_add(1, std::memory_order_relaxed);
+                ssize_t n = Tls_Util::recv(client->_tls, fd, buf, sizeof(buf));
+                if (n > 0) {
+                    ws->on_recv(buf, n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+                client->_should_close = true;
+                _rearm(client, fd, EPOLLOUT, load);
+                return;
+            }
+        }
+
+        if (task_container->draining()) ws->close(WSC_GOING_AWAY);
+
+        if (ws->want_write() && ws->flush(client->_tls, fd, load) == IOS_CLOSE) {
+            client->_should_close = true;
+            _rearm(client, fd, EPOLLOUT, load);
+            return;
+        }
+
+        if (ws->finished()) {
+            client->_should_close = true;
+            _rearm(client, fd, EPOLLOUT, load);
+            return;
+        }
+        client->_should_close = false;
+        _rearm(client, fd, (ws->want_read() ? (uint32_t)EPOLLIN : 0) | (ws->want_write() ? (uint32_t)EPOLLOUT : 0), load);
+    }
+
+    // HTTP/2的一个请求：和HTTP/1.1相同的限流，代理路由不支持HTTP/2，回复502
+    static void _respond_h2(ClientData_t *client, H2_Stream *st, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        Rate_Limiter *limiter = task_container->rate_limiter();
+        if (st->parse_state != PARSE_STAGE::PS_OK && st->parse_state != PARSE_STAGE::PS_PARSE_FAIL) {
+            st->hrs.response_error(st->hrp, HTTP_UTILS::BAD_REQUEST);
+        }else if (st->parse_state == PARSE_STAGE::PS_OK && limiter && \
+                !limiter->allow_request(client->_peer_ip)) {
+            st->hrs.response_error(st->hrp, HTTP_UTILS::TOO_MANY_REQUESTS, 1);
+        }else if (st->parse_state == PARSE_STAGE::PS_OK && _route(st->hrp, st->hrs, task_container)) {
+            // 已由处理器生成响应
+        }else if (st->parse_state == PARSE_STAGE::PS_OK && task_container->reverse_proxy() && \
+                task_container->reverse_proxy()->match(st->hrp.url()) >= 0) {
+            st->hrs.response_error(st->hrp, HTTP_UTILS::BAD_GATEWAY);
+        }else if (st->parse_state == PARSE_STAGE::PS_OK && _resolve_path(st->hrp, st->hrs)) {
+            // 已回复错误、304或文件
+        }else {
+            st->hrs.response(st->hrp);
+        }
+
+        if (Access_Log::access_enabled()) {
+            Access_Log::access(client->_peer_ip, st->hrp.method(), st->hrp.url(), \
+                st->hrs.status_code(), st->hrs.get_response_data_len(), 0);
+        }
+    }
+
+    /**
+     * 服务一个HTTP/2连接（EPOLLONESHOT）：
+     *  1. 可读就读到EAGAIN，数据交给会话解析成帧
+     *  2. 收完的请求逐个生成响应（每个流各自的hrp/hrs）
+     *  3. 按优先级生成DATA帧并写出，直到写完、EAGAIN或被流量控制窗口挡住
+     *  4. 重新注册EPOLLIN，还有数据要写时加上EPOLLOUT
+     * 协议错误时GOAWAY写出后关闭连接；进程排空时发送GOAWAY，已有的流完成后关闭
+     */
+    static void _serve_h2(ThreadPoolTaskContainer<ClientData_t> *task_container, \
+            ClientData_t *client, int fd, uint32_t events) {
+
+        H2_Session *h2 = client->_h2.load();
+        ChildLoad *load = task_container->load_slot();
+
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            char buf[H2_DEFAULT_FRAME_SIZE];
+            while (true) {
+                if (load) load->recv_calls.fetch_add(1, std::memory_order_relaxed);
+                ssize_t n = Tls_Util::recv(client->_tls, fd, buf, sizeof(buf));
+                if (n > 0) {
+                    if (!h2->on_recv(buf, n)) break;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+                // 对端关闭或出错：未完成的流无法继续
+                client->_should_close = true;
+                _rearm(client, fd, EPOLLOUT, load);
+                return;
             }
         }
+
+        while (H2_Stream *st = h2->next_request()) {
+            _respond_h2(client, st, task_container);
+            h2->submit_response(st);
+        }
+        if (task_container->draining()) h2->goaway();
+
+        while (true) {
+            h2->schedule();
+            IO_STATUS status = h2->flush(client->_tls, fd, load);
+            if (status == IOS_CLOSE) {
+                client->_should_close = true;
+                _rearm(client, fd, EPOLLOUT, load);
+                return;
+            }
+            if (status == IOS_AGAIN || !h2->want_write()) break;
+        }
+
+        if (h2->finished()) {
+            client->_should_close = true;
+            _rearm(client, fd, EPOLLOUT, load);
+            return;
+        }
+        client->_should_close = false;
+        _rearm(client, fd, EPOLLIN | (h2->want_write() ? (uint32_t)EPOLLOUT : 0), load);
+    }
+
+#if CO_SUPPORTED
+    /**
+     * 用协程处理HTTP/1.1连接（coroutine_handler），和上面的状态机行为一致：
+     *  - 读到完整请求后直接尝试发送响应，只有写满时才等待EPOLLOUT
+     *    （状态机总是先注册EPOLLOUT，经过一次reactor再发送）
+     *  - 请求交给反向代理/HTTP/2/WebSocket、或连接需要关闭时协程结束，
+     *    由_serve_coroutine按co_return的值继续处理
+     *  - 响应发送完、没有pipelining的下一个请求时协程也结束：空闲的长连接不占用协程帧，
+     *    下一个请求到来时再创建
+     * 协程帧来自Co_Frame_Pool，除第一次外处理连接不分配内存
+     */
+    static Co_Task _serve_http1(ClientData_t *client, int fd, \
+            ThreadPoolTaskContainer<ClientData_t> *task_container) {
+
+        Co_Conn &conn = client->_co;
+        ChildLoad *load = task_container->load_slot();
+
+        // 读到数据（即使之后遇到EAGAIN）就算完成
+        auto recv_some = [client, fd, load]() {
+            int before = client->_read_buf_end_idx;
+            IO_STATUS status = _recv_request(client, fd, INT_MAX, load);
+            if (status == IOS_AGAIN && client->_read_buf_end_idx > before) status = IOS_DONE;
+            return status;
+        };
+        auto send_all = [client, fd, load]() {
+            return _send_response(client, fd, INT_MAX, load);
+        };
+
+        while (true) {
+
+            // 上一次读到的数据中可能已经有下一个请求（pipelining）
+            REQUEST_STATE rqs = _parse_request(client, task_container);
+            while (rqs == RQS_INCOMPLETE) {
+                IO_STATUS status = co_await conn.read(recv_some);
+
+                // 以HTTP/2序言开始的连接（prior knowledge）
+                if (task_container->http2() && client->_tls == NULL && !client->hrp().has_partial_request() && \
+                        H2_Session::is_preface(client->_readbuf, client->_read_buf_end_idx)) {
+                    if (client->_read_buf_end_idx < H2_PREFACE_LEN && status != IOS_CLOSE) continue;
+                    _start_h2_prior_knowledge(client, task_container);
+                    co_return RQS_H2;
+                }
+                if (status == IOS_CLOSE) co_return RQS_CLOSE;
+
+                rqs = _parse_request(client, task_container);
+            }
+            if (rqs != RQS_RESPONSE) co_return rqs;
+
+            if (co_await conn.write_all(send_all) == IOS_CLOSE) co_return RQS_CLOSE;
+            if (!_finish_response(client, task_container->draining())) co_return RQS_CLOSE;
+
+            // 保持连接：缓冲区中没有下一个请求时结束协程，等待EPOLLIN
+            if (client->_read_buf_end_idx == 0) co_return RQS_IDLE;
+        }
+    }
+
+    // 启动或恢复连接的协程；协程挂起时按它等待的事件重新注册，结束时按结果继续处理
+    static void _serve_coroutine(ThreadPoolTaskContainer<ClientData_t> *task_container, \
+            ClientData_t *client, int fd) {
+
+        ChildLoad *load = task_container->load_slot();
+        bool done = client->_co.active() ? client->_co.on_event() : \
+            client->_co.start(_serve_http1(client, fd, task_container));
+        if (!done) {
+            client->_should_close = false;
+            _rearm(client, fd, client->_co.want, load);
+            return;
+        }
+
+        // 协程帧已销毁，之后才能让其他线程接手该连接
+        REQUEST_STATE rqs = (REQUEST_STATE)client->_co.finish();
+        if (rqs == RQS_PROXY) {
+            Reverse_Proxy *proxy = task_container->reverse_proxy();
+            PROXY_RESULT result = proxy->start(client, fd, task_container->draining(), load);
+            _handle_proxy_result(client, fd, result, task_container);
+        }else if (rqs == RQS_H2) {
+            _serve_h2(task_container, client, fd, EPOLLIN);
+        }else if (rqs == RQS_WS) {
+            _serve_ws(task_container, client, fd, 0);
+        }else if (rqs == RQS_IDLE) {
+            client->_should_close = false;
+            _rearm(client, fd, EPOLLIN, load);
+        }else {
+            client->_should_close = true;
+            _rearm(client, fd, EPOLLOUT, load);
+        }
+    }
+#endif
+
+    // 是否有尚未发送完的响应
+    static bool _has_pending_response(ClientData_t *client) {
+        return client->has_request() && client->_send_buf_end_idx < client->hrs().get_response_data_len();
+    }
+
+    // 发送响应数据，直到全部发送、EAGAIN，或调用sendmsg达到budget次
+    // 状态行、首部和响应体由Write_Policy合并成一次writev发送
+    static IO_STATUS _send_response(ClientData_t *client, int fd, int budget, ChildLoad *load) {
+
+        iovec iov[3];
+        int iovcnt = client->hrs().get_response_iovec(iov);
+
+        return Write_Policy::send_response(fd, iov, iovcnt, &client->_send_buf_end_idx, \
+            client->hrs().is_body_from_file(), client->_write_state, budget, load, client->_tls);
+    }
+
+    // 一个响应发送完成：清理本次请求的数据，返回是否保持连接
+    // 进程排空时不再保持连接
+    static bool _finish_response(ClientData_t *client, bool draining) {
+
+        if (Access_Log::access_enabled()) _log_access(client);
+
+        bool is_keep_alive = client->hrp().is_keep_alive() && !draining && \
+            !client->hrs().connection_close();
+        if (client->_body) client->_body->reset();
+        client->_send_buf_end_idx = 0;
+
+        // 没有pipelining的下一个请求：归还请求对象，空闲的长连接不占用它
+        if (client->_read_buf_end_idx == 0) {
+            client->release_request();
+        }else {
+            client->hrs().clear_data();
+            client->hrp().reset();
+        }
+        return is_keep_alive;
+    }
+
+    // 访问日志：普通响应取自hrs，代理的响应取自代理会话
+    static void _log_access(ClientData_t *client) {
+
+        int status = client->hrs().status_code();
+        uint64_t bytes = client->hrs().get_response_data_len();
+        Proxy_Session *s = client->_proxy.load();
+        if (bytes == 0 && s != NULL) {
+            status = s->status;
+            bytes = s->bytes_out;
+        }
+        Access_Log::access(client->_peer_ip, client->hrp().method(), client->hrp().url(), \
+            status, bytes, client->_request_start_us);
+    }
+
+    // 边缘触发模式下由工作线程直接关闭连接
+    // 注意：_scheduled保持为true，直到reactor accept到复用该fd的新连接时才清除，
+    //      这样关闭前后残留的事件都不会再为这个fd生成任务
+    static void _close_edge_triggered(ClientData_t *client, int fd, ChildLoad *load) {
+
+        client->_read_buf_end_idx = 0;
+        client->_send_buf_end_idx = 0;
+        client->_head_match = 0;
+        client->_head_bytes = 0;
+        if (client->_body) client->_body->reset();
+        client->_should_close = false;
+        client->release_request();
+        client->_readable.store(false);
+        client->_writable.store(false);
+        client->_clientfd = -1;
+
+        close(fd);
+        if (load) --load->active_conns;
+    }
+
+    /**
+     * 边缘触发模式下服务一个连接：
+     *  1. 有待发送的响应就先发送
+     *  2. 可读就读到EAGAIN，并解析；得到完整请求则回到1
+     *  3. 每次读/写最多调用budget次系统调用，用完则把连接重新放回队尾，
+     *     避免一个连接长期占用线程
+     *  4. 没事可做时释放调度权，并再检查一次就绪状态，
+     *     防止丢失reactor在此期间记录的事件
+     * 可读/可写标志总是在读写之前清除，读写未遇到EAGAIN时再恢复
+     */
+    static void _serve_edge_triggered(ThreadPoolTaskContainer<ClientData_t> *task_container, \
+            ThreadPoolTask<ClientData_t> &task) {
+
+        ClientData_t *client = task.p_client_data;
+        int fd = task._clientfd;
+        ChildLoad *load = task_container->load_slot();
+        int budget = task_container->io_budget();
+
+        while (true) {
+
+            // 1. 发送
+            if (_has_pending_response(client)) {
+
+                if (!client->_writable.exchange(false)) goto park;
+
+                IO_STATUS status = _send_response(client, fd, budget, load);
+                if (status == IOS_CLOSE) {
+                    _close_edge_triggered(client, fd, load);
+                    return;
+                }
+                if (status == IOS_AGAIN) goto park;     // 等待EPOLLOUT边沿
+
+                client->_writable.store(true);
+                if (status == IOS_BUDGET) {
+                    task_container->add(task._event, fd, client);
+                    return;
+                }
+
+                if (!_finish_response(client, task_container->draining())) {
+                    _close_edge_triggered(client, fd, load);
+                    return;
+                }
+            }
+
+            // 2. 读取并解析（_readbuf中可能还留有pipelining的下一个请求）
+            if (client->_read_buf_end_idx > 0 && _parse_request(client, task_container) != RQS_INCOMPLETE) continue;
+            if (client->_readable.exchange(false)) {
+
+                IO_STATUS status = _recv_request(client, fd, budget, load);
+                if (status == IOS_CLOSE) {
+                    _close_edge_triggered(client, fd, load);
+                    return;
+                }
+                if (status == IOS_BUDGET) client->_readable.store(true);
+
+                if (_parse_request(client, task_container) != RQS_INCOMPLETE) continue;   // 回到1发送响应
+
+                if (status == IOS_BUDGET) {
+                    task_container->add(task._event, fd, client);
+                    return;
+                }
+            }
+
+        park:
+            // 3. 释放调度权后再检查一次
+            client->_scheduled.store(false);
+            bool has_work = client->_readable.load() || \
+                (_has_pending_response(client) && client->_writable.load());
+            if (!has_work || client->_scheduled.exchange(true)) return;
+        }
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+#include "server_config.h"
+#include "load_table.h"
+#include "tls.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// 一次读/写的结果
+enum IO_STATUS {
+    IOS_AGAIN = 0,  // 遇到EAGAIN：内核缓冲区已读空/已写满
+    IOS_DONE,       // 响应已全部发送
+    IOS_BUDGET,     // 用完了本次调度的预算，但还可以继续读/写
+    IOS_CLOSE       // 对端关闭或出错，应关闭连接
+};
+
+// 每个连接的写状态
+struct Write_State {
+    bool corked = false;        // 当前是否设置了TCP_CORK
+    bool zerocopy = false;      // 该连接是否启用了SO_ZEROCOPY
+    uint32_t zc_sent = 0;       // 以MSG_ZEROCOPY发出的sendmsg次数
+    uint32_t zc_done = 0;       // 已收到完成通知的次数
+};
+
+/**
+ * desc: 响应的写路径策略
+ *      - 状态行、首部、响应体用一次sendmsg(writev)发出，而不是拼接后send
+ *      - 连接默认TCP_NODELAY：小响应一次写完，不需要Nagle等待
+ *      - 较大的文件响应体用TCP_CORK包住，多次写入时内核只发满长度的报文段，
+ *        写完后取消CORK立即发出最后一段
+ *      - 更大的文件响应体可以用MSG_ZEROCOPY发送，完成通知从错误队列读取；
+ *        只用于mmap的文件：这些页不会被我们改写，提前munmap也是安全的
+ *        （内核持有页的引用）；状态行和首部在复用的字符串中，总是普通发送
+ *      - TLS连接：内核TLS可用时写路径不变（CORK照常，不用MSG_ZEROCOPY），
+ *        否则经SSL_write加密发送
+ */
+class Write_Policy final {
+public:
+    static void configure(const ServerConfig &config) {
+        _tcp_nodelay = config.tcp_nodelay;
+        _cork_min_bytes = config.cork_min_bytes;
+        _zerocopy_min_bytes = config.zerocopy_min_bytes;
+    }
+
+    // 新连接的socket选项
+    static void on_accept(int fd, Write_State &state) {
+
+        state = Write_State();
+
+        int on = 1;
+        if (_tcp_nodelay) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        if (_zerocopy_min_bytes > 0) {
+            state.zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+        }
+    }
+
+    /**
+     * 从*offset处开始发送iov描述的整个响应，最多调用budget次sendmsg
+     * file_body: 响应体是否为mmap的文件（决定是否CORK/零拷贝）
+     * tls: TLS连接，明文连接为NULL
+     */
+    static IO_STATUS send_response(int fd, const iovec *iov, int iovcnt, int *offset, \
+            bool file_body, Write_State &state, int budget, ChildLoad *load, Tls_Conn *tls = NULL) {
+
+        bool kernel_path = tls == NULL || tls->ktls_send;   // 数据直接由sendmsg写入socket
+
+        size_t total = 0;
+        for (int i = 0; i < iovcnt; ++i) total += iov[i].iov_len;
+        size_t body_start = iovcnt > 0 ? total - iov[iovcnt - 1].iov_len : 0;    // 响应体是最后一个iov
+
+        if (*offset == 0 && file_body && kernel_path && _cork_min_bytes > 0 && \
+                total >= (size_t)_cork_min_bytes && !state.corked) {
+            _set_cork(fd, state, true);
+        }
+
+        for (int i = 0; i < budget && (size_t)*offset < total; ++i) {
+
+            iovec rest[3];
+            int rest_cnt = _skip(iov, iovcnt, *offset, rest);
+
+            size_t body_remain = total - std::max((size_t)*offset, body_start);
+            int flags = MSG_NOSIGNAL;
+            bool zerocopy = state.zerocopy && tls == NULL && file_body && \
+                _zerocopy_min_bytes > 0 && body_remain >= (size_t)_zerocopy_min_bytes;
+            if (zerocopy && (size_t)*offset < body_start) {
+                // 状态行和首部在请求结束后会被清空、复用，不能零拷贝：
+                // 先普通发送（MSG_MORE让它和响应体合并成满长度的报文段）
+                --rest_cnt;
+                flags |= MSG_MORE;
+                zerocopy = false;
+            }
+            if (zerocopy) flags |= MSG_ZEROCOPY;
+
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = rest;
+            msg.msg_iovlen = rest_cnt;
+
+            if (load) load->send_calls.fetch_add(1, std::memory_order_relaxed);
+            ssize_t n = Tls_Util::sendmsg(tls, fd, &msg, flags);
+
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    reap_zerocopy_completions(fd, state);
+                    return IOS_AGAIN;
+                }
+                if (errno == EINTR) continue;
+                if (errno == ENOBUFS && zerocopy) {
+                    // 零拷贝通知积压（optmem耗尽）：先回收通知，本次退回普通发送
+                    reap_zerocopy_completions(fd, state);
+                    state.zerocopy = false;
+                    continue;
+                }
+                return IOS_CLOSE;
+            }
+
+            if (zerocopy) ++state.zc_sent;
+            *offset += n;
+        }
+
+        if ((size_t)*offset < total) return IOS_BUDGET;
+
+        if (state.corked) _set_cork(fd, state, false);
+        reap_zerocopy_completions(fd, state);
+        return IOS_DONE;
+    }
+
+    // 读取错误队列中的零拷贝完成通知
+    // 若内核实际做了拷贝（如回环接口），则该连接之后不再使用零拷贝
+    static void reap_zerocopy_completions(int fd, Write_State &state) {
+
+        while (state.zc_done < state.zc_sent) {
+
+            char control[128];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+                return;     // EAGAIN：暂时没有更多通知
+            }
+
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+
+                bool is_recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) || \
+                    (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+                if (!is_recverr) continue;
+
+                sock_extended_err *err = (sock_extended_err *)CMSG_DATA(cm);
+                if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+                // [ee_info, ee_data] 是一段连续完成的sendmsg序号
+                state.zc_done += err->ee_data - err->ee_info + 1;
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    state.zerocopy = false;
+                }
+            }
+        }
+    }
+
+private:
+    static inline bool _tcp_nodelay = true;
+    static inline int _cork_min_bytes = 16384;
+    static inline int _zerocopy_min_bytes = 0;
+
+    static void _set_cork(int fd, Write_State &state, bool on) {
+        int val = on ? 1 : 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+        state.corked = on;
+    }
+
+    // 跳过已经发送的offset个字节，得到剩余部分的iov
+    static int _skip(const iovec *iov, int iovcnt, size_t offset, iovec rest[3]) {
+
+        int cnt = 0;
+        for (int i = 0; i < iovcnt && cnt < 3; ++i) {
+            if (offset >= iov[i].iov_len) {
+                offset -= iov[i].iov_len;
+                continue;
+            }
+            rest[cnt].iov_base = (char *)iov[i].iov_base + offset;
+            rest[cnt].iov_len = iov[i].iov_len - offset;
+            offset = 0;
+            ++cnt;
+        }
+        return cnt;
+    }
+};
@@ -0,0 +1,183 @@
+/**
+ * desc: 协程处理HTTP/1.1连接（coroutine_handler）的测试
+ *      1. Co_Conn：EAGAIN时挂起并给出等待的事件，虚假唤醒只重试I/O、不恢复协程，
+ *         挂起中销毁，协程帧在同一线程中复用
+ *      2. 经过进程池：长连接、pipelining、需要多次EPOLLOUT才能写完的4 MiB响应、
+ *         响应中途对端关闭，之后新连接仍然正常
+ *      用-DLWS_SANITIZE=ON构建时在ASan/UBSan下运行
+ */
+
+#include "test_support.h"
+
+#if CO_SUPPORTED
+
+#define LARGE_RESPONSE_BYTES (4 << 20)
+
+// 从fd读到"\r\n\r\n"，再把large_bytes字节写回去
+static Co_Task echo_once(Co_Conn &conn, int fd, size_t large_bytes, std::string *received) {
+
+    auto read_some = [fd, received]() {
+        char buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            received->append(buf, n);
+            return IOS_DONE;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? IOS_AGAIN : IOS_CLOSE;
+    };
+    while (received->find("\r\n\r\n") == std::string::npos) {
+        if (co_await conn.read(read_some) != IOS_DONE) co_return -1;
+    }
+
+    std::string data(large_bytes, 'x');
+    size_t sent = 0;
+    auto write_rest = [fd, &data, &sent]() {
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? IOS_AGAIN : IOS_CLOSE;
+            sent += n;
+        }
+        return IOS_DONE;
+    };
+    if (co_await conn.write_all(write_rest) != IOS_DONE) co_return -1;
+
+    co_await conn.wait(EPOLLIN);
+    co_return 1;
+}
+
+static void test_co_conn() {
+
+    int sv[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    setnonblocking(sv[0]);
+
+    // 没有数据：第一次读就挂起
+    Co_Conn conn;
+    std::string received;
+    TEST_CHECK(!conn.start(echo_once(conn, sv[0], LARGE_RESPONSE_BYTES, &received)));
+    TEST_CHECK(conn.want == EPOLLIN && conn.retry != NULL);
+    void *first_frame = conn.frame;
+
+    // 虚假唤醒：重试读仍然EAGAIN，协程不恢复
+    TEST_CHECK(!conn.on_event());
+    TEST_CHECK(conn.want == EPOLLIN && conn.retry != NULL);
+
+    // 请求分两次到达，第二次才完整；响应写满socket缓冲区后等待EPOLLOUT
+    Test_Util::send_all(sv[1], "GET / HTTP/1.1\r\n");
+    TEST_CHECK(!conn.on_event());
+    TEST_CHECK(conn.want == EPOLLIN);
+    Test_Util::send_all(sv[1], "\r\n");
+    TEST_CHECK(!conn.on_event());
+    TEST_CHECK(conn.want == EPOLLOUT && conn.retry != NULL);
+    TEST_CHECK(received == "GET / HTTP/1.1\r\n\r\n");
+
+    size_t got = 0;
+    int wakeups = 0;
+    char buf[65536];
+    while (conn.want == EPOLLOUT) {
+        ssize_t n;
+        while ((n = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) got += n;
+        TEST_CHECK(!conn.on_event());
+        ++wakeups;
+    }
+    ssize_t n;
+    while ((n = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) got += n;
+    TEST_CHECK(got == LARGE_RESPONSE_BYTES);
+    TEST_CHECK(wakeups > 1);
+
+    // 只等待事件：没有要重试的I/O
+    TEST_CHECK(conn.want == EPOLLIN && conn.retry == NULL);
+    TEST_CHECK(conn.on_event());
+    TEST_CHECK(conn.finish() == 1);
+    TEST_CHECK(!conn.active());
+
+    // 新协程复用刚释放的帧；挂起中销毁同样释放帧
+    std::string again;
+    TEST_CHECK(!conn.start(echo_once(conn, sv[0], 1, &again)));
+    TEST_CHECK(conn.frame == first_frame);
+    conn.destroy();
+    TEST_CHECK(!conn.active() && conn.want == 0 && conn.retry == NULL);
+    TEST_CHECK(!conn.start(echo_once(conn, sv[0], 1, &again)));
+    TEST_CHECK(conn.frame == first_frame);
+    conn.destroy();
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static std::string get(const std::string &url, bool keep_alive = true) {
+    return "GET " + url + " HTTP/1.1\r\nHost: test\r\nConnection: " + \
+        (keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+}
+
+static void test_through_pool() {
+
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    ServerConfig config;
+    config.coroutine_handler = true;
+    config.thread_min = 2;
+    config.thread_max = 4;
+    Test_Util::start_server<ClientData>(listenfd, config);
+
+    // 长连接上的多个请求，以及一次发出的两个请求
+    int fd = Test_Util::connect_loopback(port);
+    std::string buf;
+    Test_Util::Http_Message msg;
+    for (int i = 0; i < 3; ++i) {
+        Test_Util::send_all(fd, get("/index.html"));
+        TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+        TEST_CHECK(msg.body == "static");
+    }
+    Test_Util::send_all(fd, get("/a?bytes=3") + get("/b?bytes=5"));
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.body == "abc");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.body == "abcde");
+
+    // 客户端暂时不读：响应写满socket缓冲区，之后由EPOLLOUT恢复
+    int rcvbuf = 16 << 10;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    Test_Util::send_all(fd, get("/large?bytes=" + std::to_string(LARGE_RESPONSE_BYTES)));
+    usleep(100 * 1000);
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.body.size() == LARGE_RESPONSE_BYTES);
+    for (size_t i = 0; i < msg.body.size(); i += 4093) TEST_CHECK(msg.body[i] == (char)('a' + i % 26));
+    Test_Util::send_all(fd, get("/index.html", false));
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.body == "static");
+    TEST_CHECK(!Test_Util::recv_some(fd, &buf, 1000));     // Connection: close
+    close(fd);
+
+    // 响应写到一半时对端关闭：协程在等待EPOLLOUT时被销毁
+    fd = Test_Util::connect_loopback(port);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    Test_Util::send_all(fd, get("/large?bytes=" + std::to_string(LARGE_RESPONSE_BYTES)));
+    usleep(100 * 1000);
+    close(fd);
+
+    fd = Test_Util::connect_loopback(port);
+    Test_Util::send_all(fd, get("/index.html"));
+    buf.clear();
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.body == "static");
+    close(fd);
+
+    Test_Util::stop_server();
+}
+
+int main() {
+    test_co_conn();
+    test_through_pool();
+    printf("coroutine_test: OK\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    printf("coroutine_test: compiler has no C++20 coroutines, skipped\n");
+    return 77;
+}
+
+#endif
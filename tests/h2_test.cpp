@@ -0,0 +1,437 @@
+/**
+ * desc: HTTP/2和HPACK的测试
+ *      1. RFC 7541附录C的全部示例：整数、字面量、请求和响应序列（含Huffman、动态表淘汰），
+ *         解码得到示例的首部；整数和Huffman字符串的编码与示例逐字节相同；编码器的输出能被解码回来
+ *      2. 不合法的输入：超出64位的整数、截断的整数和字符串、越界的下标、超过SETTINGS的表大小更新、
+ *         出现在首部之后的表大小更新、缩小表之后引用被淘汰的项、Huffman的非法填充、首部列表超过上限
+ *      3. 经过进程池：prior knowledge（RFC中的首部块原样发送）和HTTP/1.1 Upgrade: h2c，
+ *         各在一个连接上完成两个请求（其中一个带请求体，交给流式的路由）；
+ *         格式错误的首部块使连接以COMPRESSION_ERROR的GOAWAY结束
+ */
+
+#include "test_support.h"
+#include "client_data.h"
+#include <map>
+
+// "8286 8441"之类的十六进制串（忽略空白）转成字节
+static std::string hex(const char *s) {
+    std::string out;
+    int hi = -1;
+    for (; *s; ++s) {
+        if (*s == ' ' || *s == '\n') continue;
+        int v = isdigit((unsigned char)*s) ? *s - '0' : tolower((unsigned char)*s) - 'a' + 10;
+        if (hi < 0) {
+            hi = v;
+        }else {
+            out.push_back((char)(hi << 4 | v));
+            hi = -1;
+        }
+    }
+    TEST_CHECK(hi < 0);
+    return out;
+}
+
+static bool decode(Hpack_Decoder &decoder, const std::string &block, std::vector<Header_Field> *headers) {
+    headers->clear();
+    return decoder.decode((const uint8_t *)block.data(), block.size(), *headers);
+}
+
+static void expect_headers(Hpack_Decoder &decoder, const char *block_hex, \
+        const std::vector<Header_Field> &expected) {
+    std::vector<Header_Field> headers;
+    TEST_CHECK(decode(decoder, hex(block_hex), &headers));
+    TEST_CHECK(headers == expected);
+}
+
+// C.1 整数
+static void test_integers() {
+
+    std::string out;
+    Hpack_Util::encode_int(out, 10, 5, 0);
+    TEST_CHECK(out == hex("0a"));
+    out.clear();
+    Hpack_Util::encode_int(out, 1337, 5, 0);
+    TEST_CHECK(out == hex("1f9a0a"));
+    out.clear();
+    Hpack_Util::encode_int(out, 42, 8, 0);
+    TEST_CHECK(out == hex("2a"));
+
+    uint64_t value = 0;
+    size_t pos = 0;
+    std::string in = hex("1f9a0a");
+    TEST_CHECK(Hpack_Util::decode_int((const uint8_t *)in.data(), in.size(), pos, 5, value));
+    TEST_CHECK(value == 1337 && pos == 3);
+
+    // 9个延续字节（63位）可以往返；第10个延续字节超出64位
+    out.clear();
+    Hpack_Util::encode_int(out, (1ULL << 62) + 12345, 5, 0);
+    TEST_CHECK(out.size() == 10);
+    pos = 0;
+    TEST_CHECK(Hpack_Util::decode_int((const uint8_t *)out.data(), out.size(), pos, 5, value));
+    TEST_CHECK(value == (1ULL << 62) + 12345 && pos == out.size());
+    in = hex("1f ff ff ff ff ff ff ff ff ff 01");
+    pos = 0;
+    TEST_CHECK(!Hpack_Util::decode_int((const uint8_t *)in.data(), in.size(), pos, 5, value));
+
+    // 截断
+    in = hex("1f9a");
+    pos = 0;
+    TEST_CHECK(!Hpack_Util::decode_int((const uint8_t *)in.data(), in.size(), pos, 5, value));
+    pos = 0;
+    TEST_CHECK(!Hpack_Util::decode_int((const uint8_t *)in.data(), 0, pos, 5, value));
+}
+
+// C.2 单个首部
+static void test_literals() {
+
+    Hpack_Decoder decoder;
+    expect_headers(decoder, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572", \
+        {{"custom-key", "custom-header"}});
+    expect_headers(decoder, "be", {{"custom-key", "custom-header"}});   // 已加入动态表
+
+    Hpack_Decoder without;
+    expect_headers(without, "040c 2f73 616d 706c 652f 7061 7468", {{":path", "/sample/path"}});
+    std::vector<Header_Field> headers;
+    TEST_CHECK(!decode(without, hex("be"), &headers));                 // 不索引：动态表为空
+
+    Hpack_Decoder never;
+    expect_headers(never, "1008 7061 7373 776f 7264 0673 6563 7265 74", {{"password", "secret"}});
+    TEST_CHECK(!decode(never, hex("be"), &headers));
+
+    Hpack_Decoder indexed;
+    expect_headers(indexed, "82", {{":method", "GET"}});
+}
+
+// C.3 / C.4 请求序列（同一个解码器），不用和用Huffman
+static void test_requests(bool huffman) {
+
+    const std::vector<Header_Field> first = {
+        {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+    std::vector<Header_Field> second = first;
+    second.push_back({"cache-control", "no-cache"});
+    const std::vector<Header_Field> third = {
+        {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+        {":authority", "www.example.com"}, {"custom-key", "custom-value"}};
+
+    Hpack_Decoder decoder;
+    if (!huffman) {
+        expect_headers(decoder, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", first);
+        expect_headers(decoder, "8286 84be 5808 6e6f 2d63 6163 6865", second);
+        expect_headers(decoder, "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65", third);
+    }else {
+        expect_headers(decoder, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", first);
+        expect_headers(decoder, "8286 84be 5886 a8eb 1064 9cbf", second);
+        expect_headers(decoder, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", third);
+    }
+}
+
+// C.5 / C.6 响应序列：动态表256字节，第三个响应淘汰最早的项
+static void test_responses(bool huffman) {
+
+    const std::vector<Header_Field> first = {
+        {":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+        {"location", "https://www.example.com"}};
+    const std::vector<Header_Field> second = {
+        {":status", "307"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+        {"location", "https://www.example.com"}};
+    const std::vector<Header_Field> third = {
+        {":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+        {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+        {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}};
+
+    Hpack_Decoder decoder(256);
+    if (!huffman) {
+        expect_headers(decoder,
+            "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a"
+            "3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", first);
+        expect_headers(decoder, "4803 3330 37c1 c0bf", second);
+        expect_headers(decoder,
+            "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0 5a04"
+            "677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49"
+            "553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31", third);
+    }else {
+        expect_headers(decoder,
+            "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e"
+            "919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3", first);
+        expect_headers(decoder, "4883 640e ffc1 c0bf", second);
+        expect_headers(decoder,
+            "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7"
+            "821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed"
+            "4ee5 b106 3d50 07", third);
+    }
+
+    // 表中只剩set-cookie、content-encoding和新的date（215字节），更早的项都被淘汰
+    std::vector<Header_Field> headers;
+    TEST_CHECK(decode(decoder, hex("be"), &headers) && headers[0].first == "set-cookie");
+    TEST_CHECK(decode(decoder, hex("c0"), &headers) && \
+        headers[0] == Header_Field("date", "Mon, 21 Oct 2013 20:13:22 GMT"));
+    TEST_CHECK(!decode(decoder, hex("c1"), &headers));
+}
+
+// Huffman编码与示例逐字节相同，编码器的输出能被解码回来
+static void test_encoder() {
+
+    std::string out;
+    Hpack_Util::encode_string(out, "www.example.com");
+    TEST_CHECK(out == hex("8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"));
+    out.clear();
+    Hpack_Util::encode_string(out, "no-cache");
+    TEST_CHECK(out == hex("86a8 eb10 649c bf"));
+
+    Hpack_Encoder encoder;
+    Hpack_Decoder decoder;
+    const std::vector<Header_Field> response = {
+        {":status", "200"}, {"content-type", "text/html"}, {"content-length", "1234"},
+        {"cache-control", "max-age=60"}, {"x-custom", std::string(300, 'v')}};
+    for (int i = 0; i < 3; ++i) {
+        std::string block;
+        std::vector<Header_Field> headers;
+        encoder.encode(response, block);
+        TEST_CHECK(decode(decoder, block, &headers) && headers == response);
+        if (i > 0) TEST_CHECK(block.size() < 20);   // 之后的响应都引用动态表
+    }
+
+    // 对端缩小表：下一个首部块以表大小更新开头，两端一起淘汰
+    encoder.set_peer_max_size(0);
+    encoder.set_peer_max_size(256);
+    std::string block;
+    std::vector<Header_Field> headers;
+    encoder.encode(response, block);
+    TEST_CHECK((uint8_t)block[0] == 0x20);
+    TEST_CHECK(decode(decoder, block, &headers) && headers == response);
+}
+
+static void test_malformed() {
+
+    std::vector<Header_Field> headers;
+    Hpack_Decoder decoder;
+
+    // 下标：0、越界
+    TEST_CHECK(!decode(decoder, hex("80"), &headers));
+    TEST_CHECK(!decode(decoder, hex("be"), &headers));
+    TEST_CHECK(!decode(decoder, hex("ff ff ff ff ff ff ff ff ff ff 01"), &headers));
+
+    // 表大小更新：不超过SETTINGS（4096），只能在首部块开头
+    TEST_CHECK(decode(decoder, hex("3fe11f 82"), &headers));
+    TEST_CHECK(!decode(decoder, hex("3fe21f"), &headers));
+    TEST_CHECK(!decode(decoder, hex("3f ff ff ff ff ff ff ff ff ff 01"), &headers));
+    TEST_CHECK(!decode(decoder, hex("82 20"), &headers));
+
+    // 缩小到0淘汰全部项
+    TEST_CHECK(decode(decoder, hex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"), &headers));
+    TEST_CHECK(decode(decoder, hex("be"), &headers));
+    TEST_CHECK(decode(decoder, hex("20 3fe11f"), &headers) && headers.empty());
+    TEST_CHECK(!decode(decoder, hex("be"), &headers));
+
+    // 字符串：长度超过剩余的数据、长度溢出、截断
+    TEST_CHECK(!decode(decoder, hex("400a 6375 7374"), &headers));
+    TEST_CHECK(!decode(decoder, hex("40 7f ff ff ff ff ff ff ff ff ff 01"), &headers));
+    TEST_CHECK(!decode(decoder, hex("40"), &headers));
+    TEST_CHECK(!decode(decoder, hex("0f"), &headers));
+
+    // Huffman：填充必须是EOS的前缀（全1）且不超过7位；EOS本身不能出现
+    TEST_CHECK(!decode(decoder, hex("0082 9f00 8100"), &headers));
+    TEST_CHECK(!decode(decoder, hex("0081 ff 81 ff"), &headers));
+    TEST_CHECK(!decode(decoder, hex("0084 ffff ffff 8100"), &headers));
+
+    // 首部列表（每项加32字节）超过上限
+    Hpack_Decoder small(HPACK_DEFAULT_TABLE_SIZE, 100);
+    TEST_CHECK(decode(small, hex("8286"), &headers));     // 42 + 43字节
+    TEST_CHECK(!decode(small, hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"), &headers));
+}
+
+// 流式的路由：HTTP/2的请求体一次交给on_body_chunk
+class Echo_Handler : public Route_Handler {
+public:
+    void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, const Route_Params &) override {
+        hrs.response_content(hrp, HTTP_UTILS::OK, "text/plain", "echo " + _take(hrp));
+    }
+
+    bool streams_body() const override { return true; }
+
+    bool on_body_chunk(Http_Request_Parser &hrp, const Route_Params &, const char *data, size_t len) override {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _bodies[&hrp].append(data, len);
+        return true;
+    }
+
+    void on_body_end(Http_Request_Parser &hrp, bool) override {
+        _take(hrp);
+    }
+
+private:
+    std::mutex _mutex;
+    std::map<const Http_Request_Parser *, std::string> _bodies;
+
+    std::string _take(Http_Request_Parser &hrp) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::string body = _bodies[&hrp];
+        _bodies.erase(&hrp);
+        return body;
+    }
+};
+
+static Echo_Handler echo_handler;
+
+// 测试用的HTTP/2客户端：帧按到达顺序处理（首部块的解码依赖顺序），响应按流收集
+struct H2_Client {
+    struct Response {
+        std::vector<Header_Field> headers;
+        std::string body;
+        bool done = false;
+    };
+
+    int fd = -1;
+    std::string in;
+    Hpack_Encoder encoder;
+    Hpack_Decoder decoder;
+    std::map<uint32_t, Response> responses;
+    int goaway_error = -1;
+
+    void send_frame(uint8_t type, uint8_t flags, uint32_t stream, const std::string &payload) {
+        std::string frame;
+        frame.push_back((char)(payload.size() >> 16));
+        frame.push_back((char)(payload.size() >> 8));
+        frame.push_back((char)payload.size());
+        frame.push_back((char)type);
+        frame.push_back((char)flags);
+        for (int shift = 24; shift >= 0; shift -= 8) frame.push_back((char)(stream >> shift));
+        Test_Util::send_all(fd, frame + payload);
+    }
+
+    void send_request(uint32_t stream, const std::vector<Header_Field> &headers, const std::string &body = "") {
+        std::string block;
+        encoder.encode(headers, block);
+        send_frame(H2F_HEADERS, H2_FLAG_END_HEADERS | (body.empty() ? H2_FLAG_END_STREAM : 0), stream, block);
+        for (size_t pos = 0; pos < body.size(); pos += H2_DEFAULT_FRAME_SIZE) {
+            bool last = pos + H2_DEFAULT_FRAME_SIZE >= body.size();
+            send_frame(H2F_DATA, last ? H2_FLAG_END_STREAM : 0, stream, body.substr(pos, H2_DEFAULT_FRAME_SIZE));
+        }
+    }
+
+    // 处理帧，直到stream的响应收完或连接被GOAWAY；超时返回false
+    bool wait(uint32_t stream) {
+        while (!responses[stream].done && goaway_error < 0) {
+            if (in.size() < H2_FRAME_HEADER_LEN || in.size() < H2_FRAME_HEADER_LEN + _length()) {
+                if (!Test_Util::recv_some(fd, &in, 3000)) return false;
+                continue;
+            }
+            const uint8_t *h = (const uint8_t *)in.data();
+            size_t len = _length();
+            uint8_t type = h[3], flags = h[4];
+            uint32_t id = (h[5] & 0x7f) << 24 | h[6] << 16 | h[7] << 8 | h[8];
+            std::string payload = in.substr(H2_FRAME_HEADER_LEN, len);
+            in.erase(0, H2_FRAME_HEADER_LEN + len);
+
+            if (type == H2F_SETTINGS && !(flags & H2_FLAG_ACK)) {
+                send_frame(H2F_SETTINGS, H2_FLAG_ACK, 0, "");
+            }else if (type == H2F_HEADERS) {
+                TEST_CHECK(flags & H2_FLAG_END_HEADERS);
+                TEST_CHECK(decode(decoder, payload, &responses[id].headers));
+                if (flags & H2_FLAG_END_STREAM) responses[id].done = true;
+            }else if (type == H2F_DATA) {
+                responses[id].body += payload;
+                if (flags & H2_FLAG_END_STREAM) responses[id].done = true;
+            }else if (type == H2F_GOAWAY) {
+                TEST_CHECK(payload.size() >= 8);
+                goaway_error = (uint8_t)payload[4] << 24 | (uint8_t)payload[5] << 16 | \
+                    (uint8_t)payload[6] << 8 | (uint8_t)payload[7];
+            }
+        }
+        return true;
+    }
+
+    std::string status(uint32_t stream) {
+        for (const Header_Field &h : responses[stream].headers) {
+            if (h.first == ":status") return h.second;
+        }
+        return "";
+    }
+
+    size_t _length() const {
+        const uint8_t *h = (const uint8_t *)in.data();
+        return h[0] << 16 | h[1] << 8 | h[2];
+    }
+};
+
+static const std::vector<Header_Field> POST_ECHO = {
+    {":method", "POST"}, {":scheme", "http"}, {":path", "/echo"}, {":authority", "test"}};
+
+static void test_prior_knowledge(int port) {
+
+    H2_Client client;
+    client.fd = Test_Util::connect_loopback(port);
+    Test_Util::send_all(client.fd, H2_PREFACE);
+    client.send_frame(H2F_SETTINGS, 0, 0, "");
+
+    // RFC 7541 C.4.1的首部块原样发送（GET / ，www.example.com）
+    client.send_frame(H2F_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 1, \
+        hex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"));
+    TEST_CHECK(client.wait(1));
+    TEST_CHECK(client.status(1) == "200" && client.responses[1].body == "static");
+
+    client.send_request(3, POST_ECHO, "hello over h2");
+    TEST_CHECK(client.wait(3));
+    TEST_CHECK(client.status(3) == "200" && client.responses[3].body == "echo hello over h2");
+
+    // 表大小更新出现在首部之后：连接错误
+    client.send_frame(H2F_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 5, hex("82 20"));
+    TEST_CHECK(client.wait(5));
+    TEST_CHECK(client.goaway_error == H2E_COMPRESSION_ERROR);
+    close(client.fd);
+}
+
+static void test_upgrade(int port) {
+
+    H2_Client client;
+    client.fd = Test_Util::connect_loopback(port);
+
+    // HTTP2-Settings：MAX_CONCURRENT_STREAMS 100，INITIAL_WINDOW_SIZE 65535
+    Test_Util::send_all(client.fd, "GET /upgraded HTTP/1.1\r\nHost: test\r\n"
+        "Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n");
+    while (client.in.find("\r\n\r\n") == std::string::npos) {
+        TEST_CHECK(Test_Util::recv_some(client.fd, &client.in, 3000));
+    }
+    size_t end = client.in.find("\r\n\r\n");
+    TEST_CHECK(client.in.compare(0, 34, "HTTP/1.1 101 Switching Protocols\r\n") == 0);
+    TEST_CHECK(client.in.substr(0, end).find("\r\nUpgrade: h2c") != std::string::npos);
+    client.in.erase(0, end + 4);
+
+    // 升级请求成为流1，响应在客户端的序言之后
+    Test_Util::send_all(client.fd, H2_PREFACE);
+    client.send_frame(H2F_SETTINGS, 0, 0, "");
+    TEST_CHECK(client.wait(1));
+    TEST_CHECK(client.status(1) == "200" && client.responses[1].body == "static");
+
+    client.send_request(3, POST_ECHO, std::string(20000, 'x'));
+    TEST_CHECK(client.wait(3));
+    TEST_CHECK(client.status(3) == "200" && client.responses[3].body == "echo " + std::string(20000, 'x'));
+    TEST_CHECK(client.goaway_error < 0);
+    close(client.fd);
+}
+
+int main() {
+
+    signal(SIGPIPE, SIG_IGN);
+    test_integers();
+    test_literals();
+    test_requests(false);
+    test_requests(true);
+    test_responses(false);
+    test_responses(true);
+    test_encoder();
+    test_malformed();
+
+    TEST_CHECK(Router::instance().add("POST", "/echo", &echo_handler));
+    ServerConfig config;
+    config.http2 = true;
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    Test_Util::start_server<ClientData>(listenfd, config);
+    test_prior_knowledge(port);
+    test_upgrade(port);
+    Test_Util::stop_server();
+
+    printf("h2_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * desc: 索引d叉堆（Heap）的基准，比较2/4/8叉
+ *      每种叉数：n次插入（随机优先级）、n次随机句柄的update、n/2次随机句柄的erase、
+ *      然后pop到空，分别计时
+ *      -v 时每一步都与std::set<pair<优先级, 句柄>>对照：堆顶的优先级、大小、
+ *      每个句柄的优先级都必须一致（ctest用较小的n运行这一项）
+ *      用法：heap_bench [-n elements] [-r seed] [-v]
+ */
+
+#include "test_support.h"
+#include <getopt.h>
+#include <random>
+#include <set>
+#include <vector>
+
+struct Heap_Bench_Result {
+    double insert_ms, update_ms, erase_ms, drain_ms;
+};
+
+template<int Arity>
+static Heap_Bench_Result run(int n, unsigned seed, bool verify) {
+
+    std::mt19937 rng(seed);
+    std::vector<int> prio(n);
+    for (int &p : prio) p = rng();
+
+    Heap<int, std::less<int>, Arity> heap(n);
+    std::set<std::pair<int, int>> reference;
+    auto check_top = [&]() {
+        TEST_CHECK(heap.size() == (int)reference.size());
+        if (!reference.empty()) TEST_CHECK(heap.top_priority() == reference.begin()->first);
+    };
+
+    Heap_Bench_Result result;
+    uint64_t start = now_us();
+    for (int h = 0; h < n; ++h) {
+        heap.insert(h, prio[h]);
+        if (verify) {
+            reference.insert({prio[h], h});
+            check_top();
+        }
+    }
+    result.insert_ms = (now_us() - start) / 1000.0;
+
+    start = now_us();
+    for (int i = 0; i < n; ++i) {
+        int h = rng() % n;
+        int p = rng();
+        heap.update(h, p);
+        if (verify) {
+            reference.erase({prio[h], h});
+            reference.insert({p, h});
+            check_top();
+            TEST_CHECK(heap.priority(h) == p);
+        }
+        prio[h] = p;
+    }
+    result.update_ms = (now_us() - start) / 1000.0;
+
+    start = now_us();
+    for (int i = 0; i < n / 2; ++i) {
+        int h = rng() % n;
+        bool present = heap.contains(h);
+        heap.erase(h);
+        if (verify) {
+            TEST_CHECK(present == (reference.erase({prio[h], h}) == 1));
+            TEST_CHECK(!heap.contains(h));
+            check_top();
+        }
+    }
+    result.erase_ms = (now_us() - start) / 1000.0;
+
+    start = now_us();
+    int last = INT_MIN;
+    while (!heap.empty()) {
+        int p = heap.top_priority();
+        int h = heap.pop();
+        TEST_CHECK(p >= last && p == prio[h]);
+        last = p;
+        if (verify) {
+            TEST_CHECK(reference.erase({p, h}) == 1);
+            check_top();
+        }
+    }
+    result.drain_ms = (now_us() - start) / 1000.0;
+    TEST_CHECK(reference.empty());
+    return result;
+}
+
+template<int Arity>
+static void report(int n, unsigned seed, bool verify) {
+    Heap_Bench_Result r = run<Arity>(n, seed, verify);
+    printf("arity %d: insert %.1f ms, update %.1f ms, erase %.1f ms, drain %.1f ms%s\n", Arity, \
+        r.insert_ms, r.update_ms, r.erase_ms, r.drain_ms, verify ? " (verified, timings include std::set)" : "");
+}
+
+int main(int argc, char *argv[]) {
+
+    int n = 1000000;
+    unsigned seed = 1;
+    bool verify = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:v")) != -1) {
+        switch (opt) {
+            case 'n': n = atoi(optarg); break;
+            case 'r': seed = strtoul(optarg, NULL, 10); break;
+            case 'v': verify = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n elements] [-r seed] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    printf("%d elements, seed %u\n", n, seed);
+    report<2>(n, seed, verify);
+    report<4>(n, seed, verify);
+    report<8>(n, seed, verify);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/**
+ * desc: HTTP/1.1长连接的闭环压测
+ *      每种模式启动一个进程池（一个子进程），客户端在一个线程中用epoll维持conns个长连接，
+ *      每个连接收到完整响应后立即发出下一个请求，持续seconds秒，报告吞吐和延迟分位数
+ *      结束时向进程池发送SIGTERM（平滑退出），从它打印的负载表中取出子进程的
+ *      epoll_wait/epoll_ctl/recv/send次数，换算为每个请求的次数（包含建立和关闭连接的开销，
+ *      请求足够多时可以忽略；epoll_ctl只统计重新注册，不含ADD）；
+ *      -c 1 时每次唤醒只有一个就绪的连接，epoll_wait即每个请求的唤醒次数
+ *      模式：
+ *          oneshot     EPOLLONESHOT + 状态机（默认配置）
+ *          et          EPOLLET（edge_triggered）
+ *          coroutine   EPOLLONESHOT + 协程处理（coroutine_handler）
+ *      用法：http_bench [-c conns] [-s seconds] [-b response_bytes] mode...
+ *      同一模式可以重复出现，交替运行可以减少机器状态变化带来的偏差
+ *      不注册为ctest测试：结果取决于机器，只用于比较
+ */
+
+#include "test_support.h"
+#include <getopt.h>
+#include <algorithm>
+#include <vector>
+
+struct Bench_Options {
+    int conns = 32;
+    int seconds = 3;
+    long response_bytes = -1;   // <0：固定的小响应"static"
+};
+
+struct Bench_Result {
+    uint64_t requests = 0;
+    double seconds = 0;
+    uint32_t p50_us = 0;
+    uint32_t p99_us = 0;
+    uint64_t epoll_wait = 0;    // 子进程的系统调用次数（来自负载表）
+    uint64_t epoll_ctl = 0;
+    uint64_t recv = 0;
+    uint64_t send = 0;
+};
+
+struct Bench_Conn {
+    int fd = -1;
+    std::string in;
+    uint64_t start_us = 0;
+    bool waiting = false;
+};
+
+static bool config_for(const std::string &mode, ServerConfig *config) {
+    if (mode == "oneshot") return true;
+    if (mode == "et") {
+        config->edge_triggered = true;
+        return true;
+    }
+    if (mode == "coroutine") {
+        config->coroutine_handler = true;
+        return CO_SUPPORTED;
+    }
+    return false;
+}
+
+// 从buf开头取出一个完整的响应（按Content-Length），不完整返回false
+static bool take_response(std::string &buf) {
+    size_t end = buf.find("\r\n\r\n");
+    if (end == std::string::npos) return false;
+    const char *cl = strcasestr(buf.c_str(), "\r\nContent-Length:");
+    size_t length = cl != NULL && (size_t)(cl - buf.c_str()) < end ? strtoul(cl + 17, NULL, 10) : 0;
+    if (buf.size() < end + 4 + length) return false;
+    buf.erase(0, end + 4 + length);
+    return true;
+}
+
+// 负载表一行中"name N"的N
+static uint64_t counter(const std::string &line, const char *name) {
+    std::string key = std::string(" ") + name + " ";
+    size_t pos = line.find(key);
+    return pos == std::string::npos ? 0 : strtoull(line.c_str() + pos + key.size(), NULL, 10);
+}
+
+// 平滑退出进程池，读出它的标准输出直到全部进程退出，取子进程的计数
+static void stop_and_count(int out_fd, Bench_Result *result) {
+
+    kill(Test_Util::server_group(), SIGTERM);
+    std::string output;
+    while (Test_Util::recv_some(out_fd, &output, 60000)) {}
+    close(out_fd);
+    waitpid(Test_Util::server_group(), NULL, 0);
+    Test_Util::server_group() = 0;
+
+    size_t pos = output.find("process 0 conns");
+    TEST_CHECK(pos != std::string::npos);
+    std::string line = output.substr(pos, output.find('\n', pos) - pos);
+    result->epoll_wait = counter(line, "epoll_wait");
+    result->epoll_ctl = counter(line, "epoll_ctl");
+    result->recv = counter(line, "recv");
+    result->send = counter(line, "send");
+}
+
+static Bench_Result run_load(int port, const Bench_Options &options) {
+
+    std::string url = options.response_bytes < 0 ? "/index.html" : \
+        "/bench?bytes=" + std::to_string(options.response_bytes);
+    std::string request = "GET " + url + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Bench_Conn> conns(options.conns);
+    for (size_t i = 0; i < conns.size(); ++i) {
+        conns[i].fd = Test_Util::connect_loopback(port);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+
+    std::vector<uint32_t> latencies;
+    latencies.reserve(1 << 20);
+    uint64_t start = now_us();
+    uint64_t deadline = start + options.seconds * 1000000ULL;
+    for (Bench_Conn &conn : conns) {
+        conn.start_us = now_us();
+        conn.waiting = true;
+        Test_Util::send_all(conn.fd, request);
+    }
+
+    int waiting = conns.size();
+    epoll_event events[256];
+    char buf[65536];
+    while (waiting > 0) {
+        int n = epoll_wait(epfd, events, 256, 1000);
+        TEST_CHECK(n > 0);
+        for (int i = 0; i < n; ++i) {
+            Bench_Conn &conn = conns[events[i].data.u64];
+            ssize_t len = recv(conn.fd, buf, sizeof(buf), 0);
+            TEST_CHECK(len > 0);
+            conn.in.append(buf, len);
+            while (conn.waiting && take_response(conn.in)) {
+                uint64_t now = now_us();
+                latencies.push_back(now - conn.start_us);
+                conn.waiting = false;
+                if (now < deadline) {
+                    conn.start_us = now;
+                    conn.waiting = true;
+                    Test_Util::send_all(conn.fd, request);
+                }else {
+                    --waiting;
+                }
+            }
+        }
+    }
+
+    Bench_Result result;
+    result.seconds = (now_us() - start) / 1e6;
+    result.requests = latencies.size();
+    std::sort(latencies.begin(), latencies.end());
+    result.p50_us = latencies[latencies.size() / 2];
+    result.p99_us = latencies[latencies.size() * 99 / 100];
+
+    for (Bench_Conn &conn : conns) close(conn.fd);
+    close(epfd);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+
+    Bench_Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:b:")) != -1) {
+        switch (opt) {
+            case 'c': options.conns = atoi(optarg); break;
+            case 's': options.seconds = atoi(optarg); break;
+            case 'b': options.response_bytes = atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-c conns] [-s seconds] [-b response_bytes] mode...\n", argv[0]);
+                return 2;
+        }
+    }
+    std::vector<std::string> modes(argv + optind, argv + argc);
+    if (modes.empty()) modes = {"oneshot", "et", "coroutine"};
+
+    for (const std::string &mode : modes) {
+        ServerConfig config;
+        if (!config_for(mode, &config)) {
+            printf("%-10s unsupported\n", mode.c_str());
+            continue;
+        }
+
+        // 进程池的输出经socketpair读回（recv_some需要socket）
+        int out[2];
+        TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, out) == 0);
+        int port = 0;
+        int listenfd = Test_Util::listen_loopback(&port);
+        Test_Util::start_server<ClientData>(listenfd, config, 1, out[1]);
+        close(out[1]);
+        Bench_Result result = run_load(port, options);
+        stop_and_count(out[0], &result);
+
+        double requests = result.requests;
+        printf("%-10s conns %d requests %lu rps %.0f p50_us %u p99_us %u | per request: "
+            "epoll_wait %.2f epoll_ctl %.2f recv %.2f send %.2f\n", mode.c_str(), options.conns, \
+            (unsigned long)result.requests, requests / result.seconds, result.p50_us, result.p99_us, \
+            result.epoll_wait / requests, result.epoll_ctl / requests, result.recv / requests, \
+            result.send / requests);
+        fflush(stdout);
+    }
+    return 0;
+}
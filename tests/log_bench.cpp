@@ -0,0 +1,230 @@
+/**
+ * desc: 异步日志（Access_Log）的基准
+ *      threads个线程各写records条访问日志，每次连续写LOG_BENCH_BURST条（不超过环形缓冲区），
+ *      然后等后台线程写出；报告工作线程上每条记录的纳秒数（填记录、发布head）和丢弃的记录数
+ *      日志写到/dev/null（或-o指定的文件），后台线程照常格式化和写出
+ *      -v 时先检查日志的行为（ctest运行这一项）：
+ *          过长的行截断为LOG_LINE_MAX - 1字节，仍以换行结尾
+ *          缓冲区满时丢弃新记录，丢弃数计入负载表并写一行错误日志
+ *          文件超过log_rotate_bytes时轮转为path.1 ~ path.N，更早的文件被删除
+ *      用法：log_bench [-n records] [-t threads] [-f flush_interval_ms] [-o path] [-v]
+ */
+
+#include "test_support.h"
+#include <getopt.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#define LOG_BENCH_BURST 1000
+
+static std::string g_dir;
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+static std::vector<std::string> read_lines(const std::string &path) {
+    std::vector<std::string> lines;
+    std::istringstream in(read_file(path));
+    std::string line;
+    while (std::getline(in, line)) lines.push_back(line);
+    return lines;
+}
+
+static bool exists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static off_t file_size(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static void remove_logs(const std::string &path) {
+    unlink(path.c_str());
+    for (int i = 1; i <= 3; ++i) unlink((path + "." + std::to_string(i)).c_str());
+}
+
+// 一行访问日志：时间、IP、"方法 URL"、状态、字节数、耗时
+static bool well_formed_access(const std::string &line) {
+    return line.size() > 24 && line[10] == 'T' && line[23] == 'Z' && \
+        line.find(" 10.0.0.1 \"GET /") != std::string::npos && line.compare(line.size() - 2, 2, "us") == 0;
+}
+
+// 错误消息和URL都比一行长：截断到LOG_LINE_MAX - 1字节（含换行）
+static void check_truncation(Load_Table &table) {
+
+    static const char LONG_MESSAGE[] =
+        "a very long error message that does not fit in one log line: "
+        "0123456789012345678901234567890123456789012345678901234567890123456789"
+        "0123456789012345678901234567890123456789012345678901234567890123456789"
+        "0123456789012345678901234567890123456789012345678901234567890123456789"
+        "0123456789012345678901234567890123456789012345678901234567890123456789";
+    static_assert(sizeof(LONG_MESSAGE) > LOG_LINE_MAX, "message must overflow a log line");
+
+    ServerConfig config;
+    config.access_log_path = g_dir + "/access.log";
+    config.error_log_path = g_dir + "/error.log";
+    TEST_CHECK(Access_Log::start(config, &table[0]));
+    Access_Log::error(LONG_MESSAGE, ENOSPC, 42);
+    Access_Log::access(htonl(0x0a000001), "GET", "/" + std::string(200, 'u'), 200, 1, now_us());
+    Access_Log::stop();
+
+    std::string error = read_file(config.error_log_path);
+    TEST_CHECK(error.size() == LOG_LINE_MAX - 1);
+    TEST_CHECK(error.back() == '\n' && error.find('\n') == error.size() - 1);
+    TEST_CHECK(error.find("Z [error] a very long error message") == 23);
+
+    // URL在记录中截断为LOG_URL_LEN - 1字节，整行不超过上限
+    std::vector<std::string> access = read_lines(config.access_log_path);
+    TEST_CHECK(access.size() == 1 && well_formed_access(access[0]));
+    TEST_CHECK(access[0].find("/" + std::string(LOG_URL_LEN - 2, 'u') + "\" 200 1 ") != std::string::npos);
+    remove_logs(config.access_log_path);
+    remove_logs(config.error_log_path);
+}
+
+// 后台线程在一个写出周期内不读缓冲区：超出容量的记录被丢弃
+static void check_drop(Load_Table &table) {
+
+    ServerConfig config;
+    config.access_log_path = g_dir + "/access.log";
+    config.error_log_path = g_dir + "/error.log";
+    config.log_flush_interval_ms = 2000;
+    TEST_CHECK(Access_Log::start(config, &table[0]));
+    usleep(100 * 1000);     // 启动时的第一次写出已经完成，下一次在2秒之后
+
+    const int extra = 500;
+    uint64_t start = now_us();
+    for (int i = 0; i < LOG_RING_RECORDS + extra; ++i) {
+        Access_Log::access(htonl(0x0a000001), "GET", "/drop/" + std::to_string(i), 200, i, start);
+    }
+    TEST_CHECK(now_us() - start < 1000 * 1000ULL);
+    Access_Log::stop();
+
+    // 保留的是最早的LOG_RING_RECORDS条
+    std::vector<std::string> access = read_lines(config.access_log_path);
+    TEST_CHECK(access.size() == LOG_RING_RECORDS);
+    TEST_CHECK(access.back().find("\"GET /drop/" + std::to_string(LOG_RING_RECORDS - 1) + "\"") != std::string::npos);
+    TEST_CHECK(table[0].log_dropped.load() == (uint64_t)extra);
+    TEST_CHECK(read_file(config.error_log_path).find("[error] log buffers full, records dropped: 500\n") != \
+        std::string::npos);
+    table[0].log_dropped.store(0);
+    remove_logs(config.access_log_path);
+    remove_logs(config.error_log_path);
+}
+
+// 每次写出之后检查大小：超过log_rotate_bytes时path -> path.1 -> path.2，更早的删除
+static void check_rotation(Load_Table &table) {
+
+    ServerConfig config;
+    config.access_log_path = g_dir + "/access.log";
+    config.error_log_path = g_dir + "/error.log";
+    config.log_flush_interval_ms = 5;
+    config.log_rotate_bytes = 4096;
+    config.log_rotate_keep = 2;
+    TEST_CHECK(Access_Log::start(config, &table[0]));
+
+    // 每批约7 KB，每次写出之后都会轮转
+    for (int batch = 0; batch < 6; ++batch) {
+        for (int i = 0; i < 100; ++i) {
+            Access_Log::access(htonl(0x0a000001), "GET", "/rotate/" + std::to_string(batch), 200, i, now_us());
+        }
+        usleep(30 * 1000);
+    }
+    Access_Log::stop();
+
+    const std::string &path = config.access_log_path;
+    TEST_CHECK(exists(path) && file_size(path + ".1") >= 4096 && file_size(path + ".2") >= 4096);
+    TEST_CHECK(!exists(path + ".3"));
+
+    // 新的在前：path.1是最后一批，path.2是倒数第二批
+    std::vector<std::string> newer = read_lines(path + ".1"), older = read_lines(path + ".2");
+    TEST_CHECK(newer.size() == 100 && older.size() == 100);
+    for (const std::string &line : newer) TEST_CHECK(well_formed_access(line) && line.find("/rotate/5\"") != std::string::npos);
+    for (const std::string &line : older) TEST_CHECK(well_formed_access(line) && line.find("/rotate/4\"") != std::string::npos);
+    TEST_CHECK(table[0].log_dropped.load() == 0);
+    remove_logs(config.access_log_path);
+    remove_logs(config.error_log_path);
+}
+
+static void run(int records, int threads, int flush_ms, const std::string &path) {
+
+    Load_Table table;
+    TEST_CHECK(table.create(1));
+    ServerConfig config;
+    config.access_log_path = path;
+    config.error_log_path = "/dev/null";
+    config.log_flush_interval_ms = flush_ms;
+    config.log_rotate_bytes = 0;
+    TEST_CHECK(Access_Log::start(config, &table[0]));
+
+    std::vector<double> ns(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::string method = "GET", url = "/static/css/site.css?v=" + std::to_string(t);
+            uint64_t spent = 0;
+            for (int done = 0; done < records; done += LOG_BENCH_BURST) {
+                uint64_t start = now_us();
+                for (int i = 0; i < LOG_BENCH_BURST; ++i) {
+                    Access_Log::access(htonl(0x0a000001 + t), method, url, 200, 1234, start);
+                }
+                spent += now_us() - start;
+                usleep(2 * flush_ms * 1000);    // 等后台线程读空缓冲区，不计时
+            }
+            ns[t] = spent * 1000.0 / records;
+        });
+    }
+    for (std::thread &w : workers) w.join();
+    Access_Log::stop();
+
+    double total = 0;
+    for (double v : ns) total += v;
+    printf("%d thread(s), %d records each: %.1f ns/record, dropped %lu\n", threads, records, \
+        total / threads, (unsigned long)table[0].log_dropped.load());
+}
+
+int main(int argc, char *argv[]) {
+
+    int records = 1000000;
+    int threads = 1;
+    int flush_ms = 1;
+    std::string path = "/dev/null";
+    bool verify = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:f:o:v")) != -1) {
+        switch (opt) {
+            case 'n': records = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'f': flush_ms = atoi(optarg); break;
+            case 'o': path = optarg; break;
+            case 'v': verify = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n records] [-t threads] [-f flush_interval_ms] [-o path] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (verify) {
+        char dir[] = "/tmp/log_bench.XXXXXX";
+        TEST_CHECK(mkdtemp(dir) != NULL);
+        g_dir = dir;
+        Load_Table table;
+        TEST_CHECK(table.create(1));
+        check_truncation(table);
+        check_drop(table);
+        check_rotation(table);
+        rmdir(dir);
+        printf("access log checks: OK\n");
+    }
+
+    run(records, threads, flush_ms, path);
+    return 0;
+}
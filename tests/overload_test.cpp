@@ -0,0 +1,185 @@
+/**
+ * desc: 过载保护的端到端测试（一个子进程，一个工作线程）
+ *      1. /slow的处理器每个请求睡眠SERVICE_MS，OVERLOAD_CLIENTS个客户端闭环地发请求，
+ *         到达速率远超处理能力：CoDel拒绝新请求（503带Retry-After），被接纳的请求的
+ *         延迟受控（p99远小于不拒绝时的排队时间 OVERLOAD_CLIENTS * SERVICE_MS）；
+ *         queue_max足够大，拒绝只能来自CoDel；负载消失后请求重新被接纳
+ *         开始时同时到达的一批请求在CoDel有出队间隔之前全部被接纳，它们的延迟不计入
+ *      2. 子进程的连接数达到conn_high_watermark时父进程暂停accept，新连接留在监听队列中；
+ *         连接数降到conn_low_watermark以下后恢复accept，排队的连接得到响应
+ */
+
+#include "test_support.h"
+#include "client_data.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SERVICE_MS 10
+#define OVERLOAD_CLIENTS 32
+#define OVERLOAD_SECONDS 2
+#define WARMUP_MS 500
+#define CODEL_TARGET_US 5000
+#define CODEL_INTERVAL_US 30000
+#define HIGH_WATERMARK 8
+#define LOW_WATERMARK 4
+
+// 模拟一个慢的处理器
+class Slow_Handler : public Route_Handler {
+public:
+    void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, const Route_Params &) override {
+        usleep(SERVICE_MS * 1000);
+        hrs.response_content(hrp, HTTP_UTILS::OK, "text/plain", "slow");
+    }
+};
+
+static Slow_Handler slow_handler;
+
+static const char SLOW_REQUEST[] = "GET /slow HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+
+// 进程池的标准输出（父进程暂停/恢复accept时打印）
+static std::string read_available(int fd) {
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+    return out;
+}
+
+static void test_codel_shedding(int port) {
+
+    std::mutex mutex;
+    std::vector<uint64_t> latencies_us;
+    std::atomic<int> shed{0}, shed_without_retry_after{0};
+    uint64_t warm_us = now_us() + WARMUP_MS * 1000ULL;
+    uint64_t stop_us = now_us() + OVERLOAD_SECONDS * 1000000ULL;
+
+    std::vector<std::thread> clients;
+    for (int c = 0; c < OVERLOAD_CLIENTS; ++c) {
+        clients.emplace_back([&]() {
+            std::vector<uint64_t> local;
+            int fd = Test_Util::connect_loopback(port);
+            std::string buf;
+            while (now_us() < stop_us) {
+                uint64_t start = now_us();
+                Test_Util::send_all(fd, SLOW_REQUEST);
+                Test_Util::Http_Message msg;
+                TEST_CHECK(Test_Util::read_message(fd, &buf, &msg, 10000));
+                if (msg.start_line.compare(0, 13, "HTTP/1.1 200 ") == 0) {
+                    if (start >= warm_us) local.push_back(now_us() - start);
+                    continue;
+                }
+
+                // 被拒绝：503之后服务器关闭连接，稍后用新连接重试
+                TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 503 ") == 0);
+                ++shed;
+                if (msg.head.find("\r\nRetry-After: 1\r\n") == std::string::npos) ++shed_without_retry_after;
+                close(fd);
+                usleep(SERVICE_MS * 1000);
+                fd = Test_Util::connect_loopback(port);
+                buf.clear();
+            }
+            close(fd);
+            std::lock_guard<std::mutex> guard(mutex);
+            latencies_us.insert(latencies_us.end(), local.begin(), local.end());
+        });
+    }
+    for (std::thread &c : clients) c.join();
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    TEST_CHECK(!latencies_us.empty());
+    uint64_t p50 = latencies_us[latencies_us.size() / 2];
+    uint64_t p99 = latencies_us[latencies_us.size() * 99 / 100];
+    printf("overload: %zu admitted (p50 %lu us, p99 %lu us), %d shed\n", latencies_us.size(), \
+        (unsigned long)p50, (unsigned long)p99, shed.load());
+
+    // 不拒绝时每个请求要等前面OVERLOAD_CLIENTS - 1个；过载时排在前面的不超过几个
+    TEST_CHECK(shed.load() > 0);
+    TEST_CHECK(shed_without_retry_after.load() == 0);
+    TEST_CHECK(p99 < 10 * SERVICE_MS * 1000);
+
+    // 负载消失、观察窗口过去之后，新请求不再被拒绝
+    usleep(CODEL_INTERVAL_US * 3);
+    int fd = Test_Util::connect_loopback(port);
+    std::string buf;
+    for (int i = 0; i < 3; ++i) {
+        Test_Util::Http_Message msg;
+        Test_Util::send_all(fd, SLOW_REQUEST);
+        TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+        TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 200 ") == 0 && msg.body == "slow");
+    }
+    close(fd);
+}
+
+static void test_accept_pause(int port, int out_fd) {
+
+    read_available(out_fd);
+
+    // 占满高水位：空闲的长连接，各完成一个请求以确认已被子进程accept
+    std::vector<int> idle;
+    for (int i = 0; i < HIGH_WATERMARK; ++i) {
+        int fd = Test_Util::connect_loopback(port);
+        std::string buf;
+        Test_Util::Http_Message msg;
+        Test_Util::send_all(fd, "GET /static.txt HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+        TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+        idle.push_back(fd);
+    }
+
+    // 下一个连接：内核完成握手，但父进程暂停了accept，请求得不到处理
+    int fd = Test_Util::connect_loopback(port);
+    Test_Util::send_all(fd, "GET /static.txt HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    std::string buf;
+    TEST_CHECK(!Test_Util::recv_some(fd, &buf, 300));
+    TEST_CHECK(read_available(out_fd).find("pause accept") != std::string::npos);
+
+    // 关闭到低水位以下：父进程在ACCEPT_PAUSE_POLL_MS内恢复accept
+    for (int i = 0; i < HIGH_WATERMARK - LOW_WATERMARK + 1; ++i) {
+        close(idle.back());
+        idle.pop_back();
+    }
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg, 2000));
+    TEST_CHECK(msg.body == "static");
+    TEST_CHECK(read_available(out_fd).find("resume accept") != std::string::npos);
+
+    close(fd);
+    for (int idle_fd : idle) close(idle_fd);
+}
+
+int main() {
+
+    signal(SIGPIPE, SIG_IGN);
+    TEST_CHECK(Router::instance().add("GET", "/slow", &slow_handler));
+
+    ServerConfig config;
+    config.thread_min = 1;
+    config.thread_max = 1;
+    config.queue_max = 4096;                // 队列不会满：拒绝都来自CoDel
+    config.codel_target_us = CODEL_TARGET_US;
+    config.codel_interval_us = CODEL_INTERVAL_US;
+    config.shed_retry_after_s = 1;
+
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    Test_Util::start_server<ClientData>(listenfd, config);
+    test_codel_shedding(port);
+    Test_Util::stop_server();
+
+    // 高低水位：标准输出接到socketpair上，检查父进程的暂停/恢复
+    int out[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, out) == 0);
+    config.conn_high_watermark = HIGH_WATERMARK;
+    config.conn_low_watermark = LOW_WATERMARK;
+    listenfd = Test_Util::listen_loopback(&port);
+    Test_Util::start_server<ClientData>(listenfd, config, 1, out[1]);
+    close(out[1]);
+    test_accept_pause(port, out[0]);
+    Test_Util::stop_server();
+    close(out[0]);
+
+    printf("overload_test: OK\n");
+    return 0;
+}
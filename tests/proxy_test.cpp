@@ -0,0 +1,419 @@
+/**
+ * desc: 反向代理的端到端测试
+ *      测试进程中的线程充当上游服务器，fork出的进程池（一个子进程）把/api/的请求转发给它：
+ *      1. 1xx中间响应和最终响应在同一个报文段中到达，客户端只收到最终响应；Expect不转发给上游
+ *      2. 长连接上紧跟在代理请求之后的请求（同一次send）也得到响应
+ *      3. 上游不回复时，客户端在proxy_read_timeout_ms之后收到504
+ *      4. 接近PROXY_HEADER_MAX的响应头和很长的响应体一起到达：响应体完整转发；
+ *         超过PROXY_HEADER_MAX的响应头回复502
+ *      5. 超过request_body_memory_bytes的请求体（转存到临时文件）完整转发给上游
+ *      微缓存（另一个进程池，microcache打开）：
+ *      6. 同一URL的并发未命中只回源一次，其余请求等待并命中
+ *      7. 过期后一个请求回源更新，期间其他请求立即得到旧响应
+ *      8. TinyLFU：组满时频率不高于被替换项的新键不被接纳，访问多了之后被接纳
+ */
+
+#include "test_support.h"
+#include "client_data.h"
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <atomic>
+
+#define UPSTREAM_READ_TIMEOUT_MS 300
+#define CACHE_FILL_DELAY_MS 200     // 可缓存的响应在上游的处理时间（让并发的请求都赶上回源）
+#define CACHE_CLIENTS 8
+
+#define BIG_BODY_BYTES 40000
+#define UPLOAD_BYTES (3 << 20)
+
+static std::string big_body() {
+    std::string body(BIG_BODY_BYTES, '\0');
+    for (size_t i = 0; i < body.size(); ++i) body[i] = 'a' + i % 26;
+    return body;
+}
+
+static const std::string &upload_body() {
+    static std::string body = []() {
+        std::string b(UPLOAD_BYTES, '\0');
+        uint32_t x = 1;
+        for (size_t i = 0; i < b.size(); ++i) {
+            x = x * 1103515245 + 12345;
+            b[i] = (char)(x >> 24);
+        }
+        return b;
+    }();
+    return body;
+}
+
+// 上游收到的请求头（按到达顺序）
+static std::mutex g_heads_mutex;
+static std::vector<std::string> g_heads;
+
+// 可缓存的路径在上游被请求的次数（响应体中带上序号）
+static std::atomic<int> g_cached_hits{0}, g_swr_hits{0};
+
+static void upstream_conn(int fd) {
+
+    std::string buf;
+    while (true) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+            if (!Test_Util::recv_some(fd, &buf, 10000)) {
+                close(fd);
+                return;
+            }
+        }
+        std::string head = buf.substr(0, end + 4);
+        size_t length = 0;
+        const char *cl = strcasestr(head.c_str(), "\r\nContent-Length:");
+        if (cl != NULL) length = strtoul(cl + 17, NULL, 10);
+        while (buf.size() < end + 4 + length) {
+            if (!Test_Util::recv_some(fd, &buf, 10000)) {
+                close(fd);
+                return;
+            }
+        }
+        std::string body = buf.substr(end + 4, length);
+        buf.erase(0, end + 4 + length);
+        {
+            std::lock_guard<std::mutex> guard(g_heads_mutex);
+            g_heads.push_back(head);
+        }
+
+        std::string path = head.substr(head.find(' ') + 1);
+        path = path.substr(0, path.find(' '));
+        if (path == "/api/slow") continue;     // 不回复，等待代理超时
+        if (path == "/api/upload") {
+            // 回复收到的请求体是否与客户端发送的一致
+            std::string reply = body == upload_body() ? "same" : "differs, " + std::to_string(body.size()) + " bytes";
+            Test_Util::send_all(fd, "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(reply.size()) + \
+                "\r\n\r\n" + reply);
+            continue;
+        }
+        if (path == "/api/continue") {
+            // 中间响应和最终响应一次发出，代理读到的第一块数据同时包含两者
+            Test_Util::send_all(fd, "HTTP/1.1 100 Continue\r\n\r\n"
+                "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfinal");
+            continue;
+        }
+        if (path == "/api/cached") {
+            int n = ++g_cached_hits;
+            usleep(CACHE_FILL_DELAY_MS * 1000);
+            std::string body = "cached-" + std::to_string(n);
+            Test_Util::send_all(fd, "HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nContent-Length: " + \
+                std::to_string(body.size()) + "\r\n\r\n" + body);
+            continue;
+        }
+        if (path == "/api/swr") {
+            // 第一次立即回复，之后的更新慢一些：更新期间其他请求使用旧响应
+            int n = ++g_swr_hits;
+            if (n > 1) usleep(CACHE_FILL_DELAY_MS * 1000);
+            std::string body = "swr-" + std::to_string(n);
+            Test_Util::send_all(fd, "HTTP/1.1 200 OK\r\nCache-Control: max-age=1, stale-while-revalidate=30\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+            continue;
+        }
+        if (path == "/api/bighead") {
+            // 1xx、接近上限的响应头和响应体一次发出：1xx和最终响应头合起来超过PROXY_HEADER_MAX，
+            // 去掉1xx之后还要再读一次才有完整的响应头
+            Test_Util::send_all(fd, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nX-Filler: " + \
+                std::string(PROXY_HEADER_MAX - 64, 'f') + "\r\nContent-Length: " + \
+                std::to_string(BIG_BODY_BYTES) + "\r\n\r\n" + big_body());
+            continue;
+        }
+        if (path == "/api/hugehead") {
+            Test_Util::send_all(fd, "HTTP/1.1 200 OK\r\nX-Filler: " + std::string(PROXY_HEADER_MAX, 'f'));
+            continue;
+        }
+        Test_Util::send_all(fd, "HTTP/1.1 200 OK\r\nContent-Length: " + \
+            std::to_string(path.size()) + "\r\n\r\n" + path);
+    }
+}
+
+static void upstream_main(int listenfd) {
+    while (true) {
+        int fd = accept(listenfd, NULL, NULL);
+        if (fd < 0) return;
+        std::thread(upstream_conn, fd).detach();
+    }
+}
+
+static std::string last_head_for(const std::string &path) {
+    std::lock_guard<std::mutex> guard(g_heads_mutex);
+    for (auto it = g_heads.rbegin(); it != g_heads.rend(); ++it) {
+        if (it->find(" " + path + " ") != std::string::npos) return *it;
+    }
+    return std::string();
+}
+
+// 1xx和最终响应在同一次recv中：最终响应不能等到超时才被处理
+static void test_interim_response(int port) {
+
+    int fd = Test_Util::connect_loopback(port);
+    uint64_t start = now_us();
+    Test_Util::send_all(fd, "POST /api/continue HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+        "Expect: 100-continue\r\nContent-Length: 3\r\n\r\nabc");
+
+    std::string buf;
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.start_line == "HTTP/1.1 200 OK");
+    TEST_CHECK(msg.body == "final");
+    TEST_CHECK(now_us() - start < UPSTREAM_READ_TIMEOUT_MS * 1000ULL);
+
+    std::string head = last_head_for("/api/continue");
+    TEST_CHECK(!head.empty());
+    TEST_CHECK(strcasestr(head.c_str(), "\r\nExpect:") == NULL);
+    close(fd);
+}
+
+// 两个请求一次发出：第二个请求在代理完成第一个时已经在读缓冲区中
+static void test_pipelined_behind_proxy(int port) {
+
+    int fd = Test_Util::connect_loopback(port);
+    Test_Util::send_all(fd, "GET /api/a HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n"
+        "GET /api/b HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+
+    std::string buf;
+    Test_Util::Http_Message first, second;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &first));
+    TEST_CHECK(first.body == "/api/a");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &second));
+    TEST_CHECK(second.body == "/api/b");
+
+    // 非代理的请求同样可以紧跟在代理请求之后
+    Test_Util::send_all(fd, "GET /api/c HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n"
+        "GET /static.txt HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &first));
+    TEST_CHECK(first.body == "/api/c");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &second));
+    TEST_CHECK(second.body == "static");
+    close(fd);
+}
+
+// 上游不回复：读超时之后回复504，不能提前，也不能拖到客户端自己放弃
+static void test_upstream_timeout(int port) {
+
+    int fd = Test_Util::connect_loopback(port);
+    uint64_t start = now_us();
+    Test_Util::send_all(fd, "GET /api/slow HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+
+    std::string buf;
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    uint64_t elapsed_ms = (now_us() - start) / 1000;
+    TEST_CHECK(msg.start_line.compare(0, 12, "HTTP/1.1 504") == 0);
+    TEST_CHECK(elapsed_ms >= UPSTREAM_READ_TIMEOUT_MS);
+    TEST_CHECK(elapsed_ms < UPSTREAM_READ_TIMEOUT_MS + 1000);
+    close(fd);
+}
+
+// 转存到临时文件的请求体用sendfile转发：Content-Length和chunked上传的都完整到达上游
+static void test_spooled_upload(int port) {
+
+    const std::string &body = upload_body();
+    int fd = Test_Util::connect_loopback(port);
+    std::string buf;
+    Test_Util::Http_Message msg;
+    Test_Util::send_all(fd, "POST /api/upload HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n");
+    Test_Util::send_all(fd, body);
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg, 10000));
+    TEST_CHECK(msg.start_line == "HTTP/1.1 200 OK" && msg.body == "same");
+
+    std::string chunked = "POST /api/upload HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n";
+    for (size_t off = 0; off < body.size(); off += 100000) {
+        size_t len = std::min<size_t>(100000, body.size() - off);
+        char size_line[32];
+        snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+        chunked += size_line + body.substr(off, len) + "\r\n";
+    }
+    chunked += "0\r\n\r\n";
+    Test_Util::send_all(fd, chunked);
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg, 10000));
+    TEST_CHECK(msg.start_line == "HTTP/1.1 200 OK" && msg.body == "same");
+    close(fd);
+}
+
+// 读响应头时最多读到PROXY_HEADER_MAX：跟在后面的响应体部分总能放进转发缓冲区
+static void test_header_bound(int port) {
+
+    int fd = Test_Util::connect_loopback(port);
+    Test_Util::send_all(fd, "GET /api/bighead HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    std::string buf;
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.start_line == "HTTP/1.1 200 OK");
+    TEST_CHECK(msg.head.find("X-Filler: " + std::string(PROXY_HEADER_MAX - 64, 'f') + "\r\n") != std::string::npos);
+    TEST_CHECK(msg.body == big_body());
+
+    // 到了上限仍没有空行：上游出错
+    Test_Util::send_all(fd, "GET /api/hugehead HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.start_line.compare(0, 12, "HTTP/1.1 502") == 0);
+    close(fd);
+}
+
+// 发出一个GET并读取响应，X-Cache-Status的值放在status中
+static Test_Util::Http_Message cached_get(int fd, const std::string &path, std::string *status) {
+
+    Test_Util::send_all(fd, "GET " + path + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    std::string buf;
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.start_line == "HTTP/1.1 200 OK" && buf.empty());
+    const char *value = strcasestr(msg.head.c_str(), "\r\nX-Cache-Status: ");
+    TEST_CHECK(value != NULL);
+    value += 18;
+    status->assign(value, strcspn(value, "\r"));
+    return msg;
+}
+
+// 并发的未命中：第一个请求回源，其余的等待它写入缓存
+static void test_microcache_coalescing(int port) {
+
+    std::vector<std::string> bodies(CACHE_CLIENTS), statuses(CACHE_CLIENTS);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < CACHE_CLIENTS; ++i) {
+        clients.emplace_back([&, i]() {
+            int fd = Test_Util::connect_loopback(port);
+            bodies[i] = cached_get(fd, "/api/cached", &statuses[i]).body;
+            close(fd);
+        });
+    }
+    for (std::thread &c : clients) c.join();
+
+    TEST_CHECK(g_cached_hits.load() == 1);
+    int misses = 0;
+    for (int i = 0; i < CACHE_CLIENTS; ++i) {
+        TEST_CHECK(bodies[i] == "cached-1");
+        TEST_CHECK(statuses[i] == "MISS" || statuses[i] == "HIT");
+        misses += statuses[i] == "MISS";
+    }
+    TEST_CHECK(misses == 1);
+
+    // 之后的请求直接命中
+    int fd = Test_Util::connect_loopback(port);
+    std::string status;
+    TEST_CHECK(cached_get(fd, "/api/cached", &status).body == "cached-1" && status == "HIT");
+    close(fd);
+    TEST_CHECK(g_cached_hits.load() == 1);
+}
+
+// stale-while-revalidate：过期后一个请求回源，其他请求不等待它
+static void test_microcache_stale(int port) {
+
+    int fd = Test_Util::connect_loopback(port);
+    std::string status;
+    TEST_CHECK(cached_get(fd, "/api/swr", &status).body == "swr-1" && status == "MISS");
+    usleep(1100 * 1000);    // max-age=1
+
+    std::string refresh_body, refresh_status;
+    std::thread refresher([&]() {
+        int rfd = Test_Util::connect_loopback(port);
+        refresh_body = cached_get(rfd, "/api/swr", &refresh_status).body;
+        close(rfd);
+    });
+    usleep(50 * 1000);      // 更新已经开始，上游还要CACHE_FILL_DELAY_MS才回复
+
+    for (int i = 0; i < 3; ++i) {
+        uint64_t start = now_us();
+        TEST_CHECK(cached_get(fd, "/api/swr", &status).body == "swr-1" && status == "UPDATING");
+        TEST_CHECK(now_us() - start < CACHE_FILL_DELAY_MS / 2 * 1000ULL);
+    }
+    refresher.join();
+    TEST_CHECK(refresh_body == "swr-2" && refresh_status == "EXPIRED");
+
+    TEST_CHECK(cached_get(fd, "/api/swr", &status).body == "swr-2" && status == "HIT");
+    TEST_CHECK(g_swr_hits.load() == 2);
+    close(fd);
+}
+
+// TinyLFU：只有一组（8个槽）的缓存，组满之后新键要比最久未访问的项更常被访问才能替换它
+static void test_microcache_admission() {
+
+    ServerConfig config;
+    config.microcache = true;
+    config.microcache_entry_bytes = 1024;
+    config.microcache_bytes = 16 << 10;
+    Micro_Cache cache;
+    TEST_CHECK(cache.create(config) && cache.enabled());
+
+    Cache_Handle handle;
+    std::string header, body;
+    uint32_t age_s;
+    for (int i = 0; i < MICROCACHE_WAYS; ++i) {
+        std::string key = "test/hot/" + std::to_string(i);
+        TEST_CHECK(cache.lookup(key, &handle, &header, &body, &age_s) == CL_FILL);
+        cache.commit(handle, "HTTP/1.1 200 OK", key, 60000, 0);
+    }
+    TEST_CHECK(cache.lookup("test/one-more-set", &handle, &header, &body, &age_s) == CL_BYPASS);
+    TEST_CHECK(cache.metrics()->admission_rejects.load() == 1);
+
+    // 热门的键各被访问4次
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < MICROCACHE_WAYS; ++i) {
+            std::string key = "test/hot/" + std::to_string(i);
+            TEST_CHECK(cache.lookup(key, &handle, &header, &body, &age_s) == CL_HIT && body == key);
+        }
+    }
+
+    // 新键的频率达到5之前都不被接纳，之后替换一个热门的项
+    for (int i = 1; i <= 4; ++i) {
+        TEST_CHECK(cache.lookup("test/cold", &handle, &header, &body, &age_s) == CL_BYPASS);
+    }
+    TEST_CHECK(cache.metrics()->admission_rejects.load() == 5);
+    TEST_CHECK(cache.metrics()->evictions.load() == 0);
+    TEST_CHECK(cache.lookup("test/cold", &handle, &header, &body, &age_s) == CL_FILL);
+    TEST_CHECK(cache.metrics()->evictions.load() == 1);
+    cache.commit(handle, "HTTP/1.1 200 OK", "cold", 60000, 0);
+    TEST_CHECK(cache.lookup("test/cold", &handle, &header, &body, &age_s) == CL_HIT && body == "cold");
+
+    // 被替换的是最久未访问的hot/0，其他热门的项还在
+    for (int i = 1; i < MICROCACHE_WAYS; ++i) {
+        std::string key = "test/hot/" + std::to_string(i);
+        TEST_CHECK(cache.lookup(key, &handle, &header, &body, &age_s) == CL_HIT);
+    }
+    TEST_CHECK(cache.lookup("test/hot/0", &handle, &header, &body, &age_s) != CL_HIT);
+}
+
+int main() {
+
+    int upstream_port = 0;
+    int upstream_fd = Test_Util::listen_loopback(&upstream_port);
+    int server_port = 0;
+    int server_fd = Test_Util::listen_loopback(&server_port);
+
+    ServerConfig config;
+    config.thread_min = 2;
+    config.thread_max = 4;
+    config.proxy_routes.push_back(Proxy_Route_Config());
+    config.proxy_routes.back().prefix = "/api/";
+    config.proxy_routes.back().upstreams.push_back("127.0.0.1:" + std::to_string(upstream_port));
+    config.proxy_read_timeout_ms = UPSTREAM_READ_TIMEOUT_MS;
+    config.proxy_health_interval_ms = 0;
+    Test_Util::start_server<ClientData>(server_fd, config);
+
+    std::thread(upstream_main, upstream_fd).detach();
+
+    test_interim_response(server_port);
+    test_pipelined_behind_proxy(server_port);
+    test_upstream_timeout(server_port);
+    test_header_bound(server_port);
+    test_spooled_upload(server_port);
+    Test_Util::stop_server();
+
+    // 打开微缓存的进程池
+    server_fd = Test_Util::listen_loopback(&server_port);
+    config.microcache = true;
+    Test_Util::start_server<ClientData>(server_fd, config);
+    test_microcache_coalescing(server_port);
+    test_microcache_stale(server_port);
+    test_microcache_admission();
+
+    Test_Util::stop_server();
+    printf("proxy_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * desc: 按IP/前缀限流（Rate_Limiter）的基准
+ *      requests次allow_request，来源IP在ips个不同的地址中轮转（分布在多个/24前缀中），
+ *      每次检查单个IP和所在前缀两个令牌桶，报告每个请求的纳秒数、放行/拒绝的次数和限流表的统计
+ *      -v 时先检查限流的行为（ctest运行这一项）：
+ *          令牌桶的容量和补充、前缀由其中的IP共同消耗、拒绝计数、
+ *          表满时放行（fail open）、空闲项被新键替换
+ *      用法：rate_bench [-n requests] [-i ips] [-t threads] [-v]
+ */
+
+#include "test_support.h"
+#include <getopt.h>
+#include <thread>
+#include <vector>
+
+static uint32_t ip_of(uint32_t i) {
+    return htonl(0x0a000000u | i);      // 10.x.y.z
+}
+
+static void check_buckets() {
+
+    ServerConfig config;
+    config.req_rate_per_ip = 10;        // 每毫秒补充10个毫令牌：100 ms一个令牌
+    config.req_burst_per_ip = 5;
+    config.req_rate_per_prefix = 10;
+    config.req_burst_per_prefix = 8;
+    config.conn_rate_per_ip = 10;
+    config.conn_burst_per_ip = 2;
+    Rate_Limiter limiter;
+    TEST_CHECK(limiter.create(config) && limiter.enabled());
+
+    // 单个IP：容量用完之后拒绝，连接和请求是两个桶
+    uint32_t a = inet_addr("192.0.2.1");
+    for (int i = 0; i < 5; ++i) TEST_CHECK(limiter.allow_request(a));
+    TEST_CHECK(!limiter.allow_request(a));
+    TEST_CHECK(limiter.allow_connection(a) && limiter.allow_connection(a));
+    TEST_CHECK(!limiter.allow_connection(a));
+
+    // 同一/24中的其他IP：自己的桶是满的，前缀只剩3个令牌
+    uint32_t b = inet_addr("192.0.2.2"), c = inet_addr("192.0.2.3");
+    TEST_CHECK(limiter.allow_request(b) && limiter.allow_request(b) && limiter.allow_request(c));
+    TEST_CHECK(!limiter.allow_request(c));
+    TEST_CHECK(limiter.allow_request(inet_addr("198.51.100.1")));    // 其他前缀
+
+    const RateLimiterMetrics *metrics = limiter.metrics();
+    TEST_CHECK(metrics->reqs_rejected.load() == 2);
+    TEST_CHECK(metrics->conns_rejected.load() == 1);
+    TEST_CHECK(metrics->occupied.load() == 6);      // 4个IP、2个前缀
+    TEST_CHECK(limiter.report().find("reqs_rejected 2") != std::string::npos);
+
+    // 补充：200 ms后至少有一个令牌
+    usleep(250 * 1000);
+    TEST_CHECK(limiter.allow_request(a));
+}
+
+static void check_table_full_and_eviction() {
+
+    ServerConfig config;
+    config.req_rate_per_ip = 1;
+    config.req_burst_per_ip = 1;
+    config.rate_table_slots = 8;
+    config.rate_idle_evict_ms = 20;
+    Rate_Limiter limiter;
+    TEST_CHECK(limiter.create(config));
+
+    // 8个槽被占满后，新的IP找不到槽：放行，计入table_full
+    for (uint32_t i = 0; i < 64; ++i) TEST_CHECK(limiter.allow_request(ip_of(i)));
+    const RateLimiterMetrics *metrics = limiter.metrics();
+    TEST_CHECK(metrics->occupied.load() == 8);
+    TEST_CHECK(metrics->table_full.load() > 0);
+    TEST_CHECK(metrics->evictions.load() == 0);
+
+    // 空闲超过rate_idle_evict_ms之后，新的IP替换旧项，并从满桶开始
+    usleep(50 * 1000);
+    uint32_t fresh = inet_addr("203.0.113.7");
+    TEST_CHECK(limiter.allow_request(fresh));
+    TEST_CHECK(metrics->evictions.load() == 1);
+    TEST_CHECK(!limiter.allow_request(fresh));
+    TEST_CHECK(metrics->occupied.load() == 8);
+}
+
+struct Rate_Bench_Result {
+    double ns_per_request;
+    uint64_t allowed;
+};
+
+static void run(int requests, int ips, int threads, bool limited) {
+
+    ServerConfig config;
+    config.req_rate_per_ip = limited ? 100 : 1000000;
+    config.req_burst_per_ip = limited ? 100 : 1000000;
+    config.req_rate_per_prefix = limited ? 1000 : 1000000;
+    config.req_burst_per_prefix = limited ? 1000 : 1000000;
+    Rate_Limiter limiter;
+    TEST_CHECK(limiter.create(config));
+
+    std::vector<Rate_Bench_Result> results(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            uint64_t allowed = 0;
+            uint32_t next = t * 7919;
+            uint64_t start = now_us();
+            for (int i = 0; i < requests; ++i) {
+                allowed += limiter.allow_request(ip_of(next));
+                if (++next == (uint32_t)ips) next = 0;
+            }
+            results[t].ns_per_request = (now_us() - start) * 1000.0 / requests;
+            results[t].allowed = allowed;
+        });
+    }
+    for (std::thread &w : workers) w.join();
+
+    double ns = 0;
+    uint64_t allowed = 0;
+    for (const Rate_Bench_Result &r : results) {
+        ns += r.ns_per_request;
+        allowed += r.allowed;
+    }
+    printf("%-9s %d thread(s), %d ips: %.1f ns/request, allowed %lu rejected %lu | %s", \
+        limited ? "limited" : "unlimited", threads, ips, ns / threads, (unsigned long)allowed, \
+        (unsigned long)((uint64_t)requests * threads - allowed), limiter.report().c_str());
+}
+
+int main(int argc, char *argv[]) {
+
+    int requests = 10000000;
+    int ips = 10000;
+    int threads = 1;
+    bool verify = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:t:v")) != -1) {
+        switch (opt) {
+            case 'n': requests = atoi(optarg); break;
+            case 'i': ips = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'v': verify = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n requests] [-i ips] [-t threads] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (verify) {
+        check_buckets();
+        check_table_full_and_eviction();
+        printf("rate limiter checks: OK\n");
+    }
+
+    // 不拒绝（每次都写令牌桶）和大部分被拒绝（拒绝时不写）两种情况
+    run(requests, ips, threads, false);
+    run(requests, ips, threads, true);
+    return 0;
+}
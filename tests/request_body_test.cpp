@@ -0,0 +1,402 @@
+/**
+ * desc: 请求体的测试
+ *      1. Chunk_Tracker：边界（之后的数据不消耗）、逐字节输入、扩展、trailer、
+ *         块大小溢出、没有数字的块大小行、块数据之后缺少CRLF
+ *      2. Request_Body::feed：Content-Length和chunked的边界、逐字节输入、上限、转存到临时文件、
+ *         流式交给处理器（on_body_end的complete）、丢弃
+ *      3. 经过进程池：流式的路由不存放请求体；读临时文件的路由收到完整的请求体，其他路由回复413；
+ *         静态文件的请求体被跳过，之后的请求（同一次send）照常处理；
+ *         TE+CL、不支持的Transfer-Encoding、格式错误的分块回复400，超过上限回复413，之后关闭连接
+ */
+
+#include "test_support.h"
+#include "client_data.h"
+#include <map>
+#include <mutex>
+
+#define MEMORY_BYTES 4096
+#define MAX_BYTES (1 << 20)
+#define UPLOAD_BYTES (512 << 10)
+
+static uint64_t fnv1a(uint64_t h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)p[i]) * 1099511628211ULL;
+    return h;
+}
+
+static const uint64_t FNV_BASIS = 14695981039346656037ULL;
+
+static std::string upload_body() {
+    std::string body(UPLOAD_BYTES, '\0');
+    for (size_t i = 0; i < body.size(); ++i) body[i] = (char)(i * 7 + i / 1000);
+    return body;
+}
+
+static std::string chunked(const std::string &body, size_t chunk) {
+    std::string out;
+    for (size_t off = 0; off < body.size(); off += chunk) {
+        size_t len = std::min(chunk, body.size() - off);
+        char line[32];
+        snprintf(line, sizeof(line), "%zx\r\n", len);
+        out += line + body.substr(off, len) + "\r\n";
+    }
+    return out + "0\r\n\r\n";
+}
+
+// 整段输入，返回消耗的字节数
+static size_t track(Chunk_Tracker &ct, const std::string &data) {
+    return ct.feed(data.data(), data.size());
+}
+
+static void test_chunk_tracker() {
+
+    Chunk_Tracker ct;
+    std::string msg = "5\r\nhello\r\n1a\r\n" + std::string(26, 'x') + "\r\n0\r\n\r\n";
+    TEST_CHECK(track(ct, msg + "GET /") == msg.size() && ct.done());
+
+    // 逐字节：在同一个位置结束
+    ct.reset();
+    size_t consumed = 0;
+    std::string with_next = msg + "GET /";
+    for (size_t i = 0; i < with_next.size() && !ct.done(); ++i) consumed += ct.feed(&with_next[i], 1);
+    TEST_CHECK(ct.done() && consumed == msg.size());
+
+    // 扩展和trailer
+    ct.reset();
+    std::string ext = "5;name=value\r\nhello\r\n0;last\r\nX-Checksum: 1\r\nX-More: 2\r\n\r\n";
+    TEST_CHECK(track(ct, ext + "NEXT") == ext.size() && ct.done());
+
+    // 块大小：15个十六进制数字可以，再多一个就溢出
+    ct.reset();
+    TEST_CHECK(track(ct, "7fffffffffffffff") == 16 && !ct.bad());
+    ct.reset();
+    track(ct, "10000000000000000\r\n");
+    TEST_CHECK(ct.bad());
+    ct.reset();
+    track(ct, "0000000000000000000005\r\nhello\r\n0\r\n\r\n");
+    TEST_CHECK(ct.done());
+
+    // 没有数字的块大小行不是最后一块
+    for (const char *line : {"\r\n", ";ext\r\n", " \r\n", "g\r\n", "5\n"}) {
+        ct.reset();
+        track(ct, line);
+        TEST_CHECK(ct.bad());
+    }
+
+    // 块数据之后必须是CRLF
+    ct.reset();
+    track(ct, "3\r\nabcX\r\n");
+    TEST_CHECK(ct.bad());
+}
+
+// 记录收到的块数据和on_body_end
+class Recording_Handler : public Route_Handler {
+public:
+    void handle(Http_Request_Parser &, Http_Response_Sender &, const Route_Params &) override {}
+    bool streams_body() const override { return true; }
+
+    bool on_body_chunk(Http_Request_Parser &, const Route_Params &params, const char *data, size_t len) override {
+        data_.append(data, len);
+        ++chunks_;
+        id_ = params.value("id");
+        return !fail_;
+    }
+
+    void on_body_end(Http_Request_Parser &, bool complete) override {
+        ++ends_;
+        complete_ = complete;
+    }
+
+    std::string data_, id_;
+    int chunks_ = 0, ends_ = 0;
+    bool complete_ = false, fail_ = false;
+};
+
+static BODY_STATE feed_all(Request_Body &body, const std::string &data, size_t *consumed) {
+    return body.feed(data.data(), data.size(), consumed);
+}
+
+static void test_request_body() {
+
+    Body_Settings settings;
+    settings.memory_bytes = 64;
+    settings.max_bytes = 1000;
+    Request_Body body;
+    Http_Request_Parser hrp;
+    size_t consumed = 0;
+
+    // Content-Length：之后的数据属于下一个请求
+    body.start(false, 5, settings);
+    TEST_CHECK(feed_all(body, "he", &consumed) == BS_MORE && consumed == 2 && body.active());
+    TEST_CHECK(feed_all(body, "lloGET /", &consumed) == BS_DONE && consumed == 3 && !body.active());
+    body.finish(hrp);
+    TEST_CHECK(hrp.body() == "hello" && hrp.body_fd() < 0);
+    body.reset();
+    hrp.reset();
+
+    // chunked：逐字节输入，trailer之后的数据不消耗
+    std::string msg = "4\r\nWiki\r\n5\r\npedia\r\n0\r\nX-Trailer: x\r\n\r\n";
+    std::string data = msg + "GET /";
+    body.start(true, 0, settings);
+    size_t total = 0;
+    BODY_STATE state = BS_MORE;
+    for (size_t i = 0; i < data.size() && state == BS_MORE; ++i) {
+        state = body.feed(&data[i], 1, &consumed);
+        total += consumed;
+    }
+    TEST_CHECK(state == BS_DONE && total == msg.size() && body.received() == 9);
+    body.finish(hrp);
+    TEST_CHECK(hrp.body() == "Wikipedia");
+    body.reset();
+    hrp.reset();
+
+    // 整段输入也一样
+    body.start(true, 0, settings);
+    TEST_CHECK(feed_all(body, data, &consumed) == BS_DONE && consumed == msg.size());
+    body.reset();
+
+    // 上限：进入超过上限的块时立即停止，不等块数据到达
+    body.start(true, 0, settings);
+    TEST_CHECK(feed_all(body, "1f4\r\n" + std::string(500, 'a') + "\r\n1f5\r\n", &consumed) == BS_TOO_LARGE);
+    TEST_CHECK(body.received() == 500 && !body.active());
+    body.reset();
+    body.start(true, 0, settings);
+    TEST_CHECK(feed_all(body, "3e8\r\n" + std::string(1000, 'a') + "\r\n0\r\n\r\n", &consumed) == BS_DONE);
+    body.reset();
+    hrp.reset();
+
+    // 格式错误
+    body.start(true, 0, settings);
+    TEST_CHECK(feed_all(body, "10000000000000000\r\n", &consumed) == BS_BAD);
+    body.reset();
+    body.start(true, 0, settings);
+    TEST_CHECK(feed_all(body, "\r\n", &consumed) == BS_BAD);
+    body.reset();
+
+    // 超过memory_bytes转存到临时文件，finish交出fd
+    std::string big(300, '\0');
+    for (size_t i = 0; i < big.size(); ++i) big[i] = 'a' + i % 26;
+    body.start(true, 0, settings);
+    TEST_CHECK(feed_all(body, chunked(big, 50), &consumed) == BS_DONE && body.spilled());
+    body.finish(hrp);
+    TEST_CHECK(hrp.body().empty() && hrp.body_fd() >= 0 && hrp.body_size() == big.size());
+    std::string read_back(big.size(), '\0');
+    TEST_CHECK(pread(hrp.body_fd(), &read_back[0], read_back.size(), 0) == (ssize_t)big.size() && read_back == big);
+    int spool_fd = hrp.body_fd();
+    body.reset();
+    hrp.reset();
+    TEST_CHECK(fcntl(spool_fd, F_GETFD) < 0);
+
+    // 流式：块数据按到达顺序交给处理器，不存放；请求结束时on_body_end
+    Recording_Handler handler;
+    std::string url = "/upload/7";
+    Route_Params params;
+    params.count = 1;
+    params.items[0] = {"id", url.data() + 8, 2, 1};
+    body.start(true, 0, settings);
+    body.stream_to(&handler, hrp, params);
+    std::string stream = chunked(big, 100);
+    TEST_CHECK(feed_all(body, stream.substr(0, 150), &consumed) == BS_MORE && consumed == 150);
+    TEST_CHECK(feed_all(body, stream.substr(150), &consumed) == BS_DONE);
+    TEST_CHECK(handler.data_ == big && handler.id_ == "7" && handler.chunks_ >= 3);
+    TEST_CHECK(!body.spilled() && handler.ends_ == 0);
+    body.finish(hrp);
+    TEST_CHECK(hrp.body().empty() && hrp.body_fd() < 0);
+    body.reset();
+    TEST_CHECK(handler.ends_ == 1 && handler.complete_);
+    body.reset();
+    TEST_CHECK(handler.ends_ == 1);
+
+    // 中途结束（连接关闭）和处理器出错
+    body.start(false, 100, settings);
+    body.stream_to(&handler, hrp, params);
+    TEST_CHECK(feed_all(body, "partial", &consumed) == BS_MORE);
+    body.reset();
+    TEST_CHECK(handler.ends_ == 2 && !handler.complete_);
+    handler.fail_ = true;
+    body.start(false, 100, settings);
+    body.stream_to(&handler, hrp, params);
+    TEST_CHECK(feed_all(body, "oops", &consumed) == BS_ERROR);
+    body.reset();
+    TEST_CHECK(handler.ends_ == 3 && !handler.complete_);
+
+    // 丢弃：只跟踪边界
+    body.start(false, 300, settings);
+    body.discard();
+    TEST_CHECK(feed_all(body, big + "GET /", &consumed) == BS_DONE && consumed == big.size());
+    body.finish(hrp);
+    TEST_CHECK(!body.spilled() && hrp.body().empty() && hrp.body_fd() < 0);
+    body.reset();
+}
+
+// 流式接收：按&hrp记录每个请求收到的字节数和散列，响应中报告
+class Stream_Handler : public Route_Handler {
+public:
+    void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, const Route_Params &) override {
+        Upload upload = _take(hrp);
+        hrs.response_content(hrp, HTTP_UTILS::OK, "text/plain", "streamed " + std::to_string(upload.bytes) + \
+            " " + std::to_string(upload.hash) + " stored " + std::to_string(hrp.body_size()));
+    }
+
+    bool streams_body() const override { return true; }
+
+    bool on_body_chunk(Http_Request_Parser &hrp, const Route_Params &, const char *data, size_t len) override {
+        std::lock_guard<std::mutex> guard(_mutex);
+        Upload &upload = _uploads[&hrp];
+        upload.bytes += len;
+        upload.hash = fnv1a(upload.hash, data, len);
+        return true;
+    }
+
+    void on_body_end(Http_Request_Parser &hrp, bool) override {
+        _take(hrp);
+    }
+
+private:
+    struct Upload {
+        uint64_t bytes = 0;
+        uint64_t hash = FNV_BASIS;
+    };
+    std::mutex _mutex;
+    std::map<const Http_Request_Parser *, Upload> _uploads;
+
+    Upload _take(Http_Request_Parser &hrp) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        Upload upload = _uploads[&hrp];
+        _uploads.erase(&hrp);
+        return upload;
+    }
+};
+
+// 从临时文件（或内存）读取完整的请求体
+class Spool_Handler : public Route_Handler {
+public:
+    void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, const Route_Params &) override {
+        uint64_t hash = FNV_BASIS;
+        if (hrp.body_fd() >= 0) {
+            char buf[8192];
+            off_t off = 0;
+            ssize_t n;
+            while ((n = pread(hrp.body_fd(), buf, sizeof(buf), off)) > 0) {
+                hash = fnv1a(hash, buf, n);
+                off += n;
+            }
+        }else {
+            hash = fnv1a(hash, hrp.body().data(), hrp.body().size());
+        }
+        hrs.response_content(hrp, HTTP_UTILS::OK, "text/plain", "spooled " + \
+            std::to_string(hrp.body_size()) + " " + std::to_string(hash));
+    }
+
+    bool reads_spooled_body() const override { return true; }
+};
+
+class Memory_Handler : public Route_Handler {
+public:
+    void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, const Route_Params &) override {
+        hrs.response_content(hrp, HTTP_UTILS::OK, "text/plain", "memory " + std::to_string(hrp.body().size()));
+    }
+};
+
+static Stream_Handler stream_handler;
+static Spool_Handler spool_handler;
+static Memory_Handler memory_handler;
+
+static std::string post(const char *path, const std::string &framing) {
+    return std::string("POST ") + path + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n" + framing + "\r\n";
+}
+
+static std::string expect_ok(int fd, std::string *buf) {
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, buf, &msg, 10000));
+    TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 200 ") == 0);
+    return msg.body;
+}
+
+static void test_through_pool(int port) {
+
+    const std::string body = upload_body();
+    const std::string digest = std::to_string(body.size()) + " " + \
+        std::to_string(fnv1a(FNV_BASIS, body.data(), body.size()));
+
+    int fd = Test_Util::connect_loopback(port);
+    std::string buf;
+
+    // 流式的路由：远超MEMORY_BYTES的请求体也不存放
+    Test_Util::send_all(fd, post("/upload", "Transfer-Encoding: chunked\r\n") + chunked(body, 10000));
+    TEST_CHECK(expect_ok(fd, &buf) == "streamed " + digest + " stored 0");
+    Test_Util::send_all(fd, post("/upload", "Content-Length: " + std::to_string(body.size()) + "\r\n") + body);
+    TEST_CHECK(expect_ok(fd, &buf) == "streamed " + digest + " stored 0");
+
+    // 读临时文件的路由收到完整的请求体；只认内存中请求体的路由回复413
+    Test_Util::send_all(fd, post("/spool", "Transfer-Encoding: chunked\r\n") + chunked(body, 4000));
+    TEST_CHECK(expect_ok(fd, &buf) == "spooled " + digest);
+    Test_Util::send_all(fd, post("/memory", "Content-Length: 10\r\n") + "0123456789");
+    TEST_CHECK(expect_ok(fd, &buf) == "memory 10");
+
+    // 静态文件和405：请求体被跳过，同一次send中之后的请求照常处理
+    Test_Util::send_all(fd, post("/file.txt", "Content-Length: " + std::to_string(body.size()) + "\r\n") + body + \
+        post("/health", "Transfer-Encoding: chunked\r\n") + chunked(body, 30000) + \
+        "GET /file.txt HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    TEST_CHECK(expect_ok(fd, &buf) == "static");
+    Test_Util::Http_Message msg;
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg, 10000));
+    TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 405 ") == 0);
+    TEST_CHECK(expect_ok(fd, &buf) == "static");
+
+    Test_Util::send_all(fd, post("/memory", "Content-Length: " + std::to_string(MEMORY_BYTES + 1) + "\r\n") + \
+        std::string(MEMORY_BYTES + 1, 'm'));
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg, 10000));
+    TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 413 ") == 0);
+    close(fd);
+
+    // 拒绝之后不再读取剩余的请求体，关闭连接
+    struct Rejected {
+        std::string request;
+        const char *status;
+    };
+    const Rejected rejected[] = {
+        {post("/upload", "Transfer-Encoding: chunked\r\nContent-Length: 5\r\n") + "0\r\n\r\n", "400"},
+        {post("/upload", "Content-Length: 5\r\nTransfer-Encoding: chunked\r\n") + "hello", "400"},
+        {post("/upload", "Transfer-Encoding: gzip, chunked\r\n") + "0\r\n\r\n", "400"},
+        {post("/upload", "Content-Length: 5x\r\n") + "hello", "400"},
+        {post("/upload", "Content-Length: " + std::to_string(MAX_BYTES + 1) + "\r\n"), "413"},
+        {post("/upload", "Transfer-Encoding: chunked\r\n") + "10000000000000000\r\n", "400"},
+        {post("/upload", "Transfer-Encoding: chunked\r\n") + "\r\n", "400"},
+        {post("/upload", "Transfer-Encoding: chunked\r\n") + "5\r\nhelloXX", "400"},
+        {post("/upload", "Transfer-Encoding: chunked\r\n") + "100001\r\n", "413"},
+        {post("/file.txt", "Transfer-Encoding: chunked\r\n") + "100001\r\n", "413"},
+    };
+    for (const Rejected &r : rejected) {
+        fd = Test_Util::connect_loopback(port);
+        buf.clear();
+        Test_Util::send_all(fd, r.request);
+        TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+        TEST_CHECK(msg.start_line.compare(0, 13, std::string("HTTP/1.1 ") + r.status + " ") == 0);
+        TEST_CHECK(buf.empty() && !Test_Util::recv_some(fd, &buf, 1000) && buf.empty());
+        close(fd);
+    }
+}
+
+int main() {
+
+    signal(SIGPIPE, SIG_IGN);
+    test_chunk_tracker();
+    test_request_body();
+
+    TEST_CHECK(Router::instance().add("POST", "/upload", &stream_handler));
+    TEST_CHECK(Router::instance().add("POST", "/spool", &spool_handler));
+    TEST_CHECK(Router::instance().add("POST", "/memory", &memory_handler));
+    TEST_CHECK(Router::instance().add("GET", "/health", &memory_handler));
+
+    ServerConfig config;
+    config.request_body_memory_bytes = MEMORY_BYTES;
+    config.request_body_max_bytes = MAX_BYTES;
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    Test_Util::start_server<ClientData>(listenfd, config);
+    test_through_pool(port);
+    Test_Util::stop_server();
+
+    printf("request_body_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * desc: URL路由的测试
+ *      1. 注册：重复的方法+模式、同一位置不同名的参数、不在最后的通配符、冻结之后的注册都被拒绝
+ *      2. 查找：静态 > 参数 > 通配符的优先级、后面的段不匹配时回溯、查询串被忽略、
+ *         405和Allow的值、HEAD退回GET、不限方法的处理器
+ *      3. 经过进程池：路由的响应、405带Allow首部、HEAD没有响应体
+ */
+
+#include "test_support.h"
+#include "client_data.h"
+
+// 回复处理器的名字和参数（"name id=42 path=a/b"）
+class Named_Handler : public Route_Handler {
+public:
+    explicit Named_Handler(const char *name): _name(name) {}
+
+    void handle(Http_Request_Parser &hrp, Http_Response_Sender &hrs, const Route_Params &params) override {
+        hrs.response_content(hrp, HTTP_UTILS::OK, "text/plain", describe(params));
+    }
+
+    std::string describe(const Route_Params &params) const {
+        std::string s = _name;
+        for (int i = 0; i < params.count; ++i) {
+            s += " " + std::string(params.items[i].name, params.items[i].name_len) + "=" + \
+                std::string(params.items[i].value, params.items[i].value_len);
+        }
+        return s;
+    }
+
+private:
+    const char *_name;
+};
+
+static Named_Handler health("health"), user_new("user_new"), user_get("user_get"), user_put("user_put"), \
+    user_post("user_post"), user_file("user_file"), static_files("static"), abc("abc"), axd("axd"), \
+    a_rest("a_rest"), head_only("head_only"), any("any");
+
+// 查找method url，返回"处理器名 参数..."；没有匹配时返回"none"，405时返回"405 <Allow>"
+// 参数引用url中的字节，url要在describe之后才能释放
+static std::string lookup(const std::string &method, const std::string &url) {
+
+    Router &router = Router::instance();
+    Route_Handler *handler = NULL;
+    Route_Params params;
+    switch (router.match(method, url, &handler, &params)) {
+        case RR_FOUND:
+            return static_cast<Named_Handler *>(handler)->describe(params);
+        case RR_METHOD_NOT_ALLOWED:
+            return "405 " + router.allow(url);
+        default:
+            return "none";
+    }
+}
+
+static void test_register() {
+
+    Router &router = Router::instance();
+    TEST_CHECK(router.add("GET", "/health", &health));
+    TEST_CHECK(router.add("GET", "/users/new", &user_new));
+    TEST_CHECK(router.add("GET", "/users/:id", &user_get));
+    TEST_CHECK(router.add("PUT", "/users/:id", &user_put));
+    TEST_CHECK(router.add("GET", "/users/:id/files/*path", &user_file));
+    TEST_CHECK(router.add("GET", "/static/*path", &static_files));
+    TEST_CHECK(router.add("GET", "/a/b/c", &abc));
+    TEST_CHECK(router.add("GET", "/a/:x/d", &axd));
+    TEST_CHECK(router.add("GET", "/a/*rest", &a_rest));
+    TEST_CHECK(router.add("GET", "/page", &user_get));
+    TEST_CHECK(router.add("HEAD", "/page", &head_only));
+    TEST_CHECK(router.add("*", "/any", &any));
+    TEST_CHECK(router.add("POST", "/users", &user_post));
+
+    // 重复注册：同一方法和模式（参数名相同），不影响其他方法
+    TEST_CHECK(!router.add("GET", "/health", &abc));
+    TEST_CHECK(!router.add("GET", "/users/:id", &abc));
+    TEST_CHECK(!router.add("*", "/any", &abc));
+    TEST_CHECK(router.add("DELETE", "/health", &health));
+
+    // 同一位置的参数/通配符必须同名
+    TEST_CHECK(!router.add("GET", "/users/:name/avatar", &abc));
+    TEST_CHECK(!router.add("DELETE", "/static/*file", &abc));
+
+    // 不合法的模式和方法
+    TEST_CHECK(!router.add("GET", "/files/*path/raw", &abc));
+    TEST_CHECK(!router.add("GET", "/users/:", &abc));
+    TEST_CHECK(!router.add("GET", "relative", &abc));
+    TEST_CHECK(!router.add("BREW", "/coffee", &abc));
+    TEST_CHECK(!router.add("GET", "/coffee", NULL));
+    TEST_CHECK(!router.add("GET", "/:a/:b/:c/:d/:e/:f/:g/:h/:i", &abc));
+
+    TEST_CHECK(router.empty());
+    router.freeze();
+    TEST_CHECK(!router.empty());
+    TEST_CHECK(!router.add("GET", "/late", &abc));
+}
+
+static void test_match() {
+
+    // 优先级：静态 > 参数 > 通配符
+    TEST_CHECK(lookup("GET", "/users/new") == "user_new");
+    TEST_CHECK(lookup("GET", "/users/newer") == "user_get id=newer");
+    TEST_CHECK(lookup("GET", "/users/42") == "user_get id=42");
+    TEST_CHECK(lookup("GET", "/users/42/files/docs/a.txt") == "user_file id=42 path=docs/a.txt");
+    TEST_CHECK(lookup("GET", "/static/css/site.css") == "static path=css/site.css");
+    TEST_CHECK(lookup("GET", "/static/") == "static path=");
+
+    // 回溯：静态分支在后面的段失败时退回参数，参数失败时退回通配符
+    TEST_CHECK(lookup("GET", "/a/b/c") == "abc");
+    TEST_CHECK(lookup("GET", "/a/b/d") == "axd x=b");
+    TEST_CHECK(lookup("GET", "/a/b/e") == "a_rest rest=b/e");
+    TEST_CHECK(lookup("GET", "/a/z/d") == "axd x=z");
+    TEST_CHECK(lookup("GET", "/a/z/d/more") == "a_rest rest=z/d/more");
+    TEST_CHECK(lookup("GET", "/users/new/files/x") == "user_file id=new path=x");
+
+    // 查询串被忽略，参数不能为空，不匹配的路径交给静态文件
+    TEST_CHECK(lookup("GET", "/users/42?fields=name") == "user_get id=42");
+    TEST_CHECK(lookup("GET", "/users/") == "none");
+    TEST_CHECK(lookup("GET", "/users/42/avatar") == "none");
+    TEST_CHECK(lookup("GET", "/healthz") == "none");
+    TEST_CHECK(lookup("GET", "/") == "none");
+
+    // 405：Allow按方法的固定顺序列出，有GET时也列出HEAD
+    TEST_CHECK(lookup("POST", "/users/42") == "405 GET, HEAD, PUT");
+    TEST_CHECK(lookup("DELETE", "/users/new?x=1") == "405 GET, HEAD");
+    TEST_CHECK(lookup("GET", "/users") == "405 POST");
+    TEST_CHECK(lookup("PATCH", "/health") == "405 GET, HEAD, DELETE");
+    TEST_CHECK(lookup("DELETE", "/health") == "health");
+
+    // HEAD：没有HEAD处理器时用GET的，有时用自己的
+    TEST_CHECK(lookup("HEAD", "/users/42") == "user_get id=42");
+    TEST_CHECK(lookup("HEAD", "/page") == "head_only");
+    TEST_CHECK(lookup("GET", "/page") == "user_get");
+
+    // 不限方法的处理器（包括不认识的方法）
+    TEST_CHECK(lookup("OPTIONS", "/any") == "any");
+    TEST_CHECK(lookup("BREW", "/any") == "any");
+}
+
+// 经过进程池（ProcessPool::create冻结路由表，路由已经冻结时不受影响）
+static void test_through_pool() {
+
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    ServerConfig config;
+    Test_Util::start_server<ClientData>(listenfd, config);
+
+    int fd = Test_Util::connect_loopback(port);
+    std::string buf;
+    Test_Util::Http_Message msg;
+    Test_Util::send_all(fd, "GET /users/7 HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 200 ") == 0);
+    TEST_CHECK(msg.body == "user_get id=7");
+
+    Test_Util::send_all(fd, "POST /users/7 HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nContent-Length: 0\r\n\r\n");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.start_line.compare(0, 13, "HTTP/1.1 405 ") == 0);
+    TEST_CHECK(msg.head.find("\r\nAllow: GET, HEAD, PUT\r\n") != std::string::npos);
+
+    // HEAD退回GET的处理器：Content-Length是GET的，没有响应体
+    Test_Util::send_all(fd, "HEAD /users/7 HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    size_t end;
+    while ((end = buf.find("\r\n\r\n")) == std::string::npos) TEST_CHECK(Test_Util::recv_some(fd, &buf, 3000));
+    TEST_CHECK(buf.compare(0, 13, "HTTP/1.1 200 ") == 0);
+    TEST_CHECK(buf.find("\r\nContent-Length: 13\r\n") != std::string::npos);
+    buf.erase(0, end + 4);
+
+    // 不匹配的路径按静态文件处理
+    Test_Util::send_all(fd, "GET /users/7/avatar HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    TEST_CHECK(Test_Util::read_message(fd, &buf, &msg));
+    TEST_CHECK(msg.body == "static");
+    TEST_CHECK(buf.empty() && !Test_Util::recv_some(fd, &buf, 100));
+
+    close(fd);
+    Test_Util::stop_server();
+}
+
+int main() {
+
+    signal(SIGPIPE, SIG_IGN);
+    test_register();
+    test_match();
+    test_through_pool();
+    printf("router_test: OK\n");
+    return 0;
+}
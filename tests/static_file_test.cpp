@@ -0,0 +1,350 @@
+/**
+ * desc: 静态文件路径解析的测试
+ *      1. Path_Resolver::normalize：".."越过根目录、编码的'/'和NUL、错误的百分号编码、
+ *         重复的'/'、结尾的"/.."，查询串和片段不参与解析
+ *      2. 以根目录fd为起点打开（RESOLVE_BENEATH）：指向根目录之外的符号链接被拒绝，
+ *         根目录之内的可以访问；缓存按路径部分，查询串不同的URL命中同一项
+ *      3. 条件请求：If-None-Match的弱比较、列表、"*"和格式错误的值，IMF-fixdate的解析；
+ *         已解析文件的200和304带同样的验证器和Cache-Control，200的ETag能再验证成功
+ *      4. MIME：扩展名不区分大小写的查找，Accept的q值（最具体的匹配优先、q=0、
+ *         格式错误的q、媒体范围的参数）
+ */
+
+#include "test_support.h"
+
+struct Normalize_Case {
+    const char *url;
+    RESOLVE_STATUS status;
+    const char *rel;            // RP_FILE时规范化的相对路径
+    bool trailing_slash;
+};
+
+static const Normalize_Case NORMALIZE_CASES[] = {
+    {"/", RP_FILE, "", true},
+    {"/index.html", RP_FILE, "index.html", false},
+    {"/a/b.html", RP_FILE, "a/b.html", false},
+    {"//a///b", RP_FILE, "a/b", false},
+    {"/a/./b/.", RP_FILE, "a/b", false},
+    {"/a/../b", RP_FILE, "b", false},
+    {"/a/b/..", RP_FILE, "a", true},
+    {"/a/..", RP_FILE, "", true},
+    {"/a/b/", RP_FILE, "a/b", true},
+    {"/a%20b.html", RP_FILE, "a b.html", false},
+    {"/%61/%62", RP_FILE, "a/b", false},
+    {"/a.css?v=1", RP_FILE, "a.css", false},
+    {"/a.css?x=%zz", RP_FILE, "a.css", false},      // 查询串中的错误编码与路径无关
+    {"/a.css#%00", RP_FILE, "a.css", false},
+    {"/..", RP_FORBIDDEN, "", false},
+    {"/../etc/passwd", RP_FORBIDDEN, "", false},
+    {"/a/../../b", RP_FORBIDDEN, "", false},
+    {"/a/b/../../..", RP_FORBIDDEN, "", false},
+    {"/%2e%2e/etc/passwd", RP_FORBIDDEN, "", false},
+    {"/a%2Fb", RP_BAD, "", false},
+    {"/a%2fb", RP_BAD, "", false},
+    {"/..%2F..%2Fetc", RP_BAD, "", false},
+    {"/a%00b", RP_BAD, "", false},
+    {"/a%zz", RP_BAD, "", false},
+    {"/a%4", RP_BAD, "", false},
+    {"/a%", RP_BAD, "", false},
+    {"/a%4?x", RP_BAD, "", false},
+};
+
+static void test_normalize() {
+
+    for (const Normalize_Case &c : NORMALIZE_CASES) {
+        std::string rel = "junk";
+        bool trailing_slash = false;
+        RESOLVE_STATUS status = Path_Resolver::normalize(c.url, &rel, &trailing_slash);
+        if (status != c.status || (status == RP_FILE && \
+                (rel != c.rel || trailing_slash != c.trailing_slash))) {
+            fprintf(stderr, "normalize(\"%s\"): status %d rel \"%s\" trailing %d\n", \
+                c.url, status, rel.c_str(), trailing_slash);
+        }
+        TEST_CHECK(status == c.status);
+        if (status == RP_FILE) {
+            TEST_CHECK(rel == c.rel);
+            TEST_CHECK(trailing_slash == c.trailing_slash);
+        }
+    }
+}
+
+static void write_file(const std::string &path, const std::string &content) {
+    FILE *fp = fopen(path.c_str(), "w");
+    TEST_CHECK(fp != NULL);
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+}
+
+/**
+ * 临时目录dir下：
+ *  secret.txt             根目录之外的文件
+ *  www/index.html
+ *  www/sub/               目录
+ *  www/inside -> index.html
+ *  www/up -> ../secret.txt
+ *  www/abs -> <dir>/secret.txt
+ *  www/sub/escape -> ../../secret.txt
+ */
+static void test_resolve_beneath(const std::string &dir) {
+
+    std::string www = dir + "/www";
+    TEST_CHECK(mkdir(www.c_str(), 0755) == 0);
+    TEST_CHECK(mkdir((www + "/sub").c_str(), 0755) == 0);
+    write_file(dir + "/secret.txt", "secret");
+    write_file(www + "/index.html", "<html></html>");
+    TEST_CHECK(symlink("index.html", (www + "/inside").c_str()) == 0);
+    TEST_CHECK(symlink("../secret.txt", (www + "/up").c_str()) == 0);
+    TEST_CHECK(symlink((dir + "/secret.txt").c_str(), (www + "/abs").c_str()) == 0);
+    TEST_CHECK(symlink("../../secret.txt", (www + "/sub/escape").c_str()) == 0);
+
+    ServerConfig config;
+    Path_Resolver &resolver = Path_Resolver::instance();
+    TEST_CHECK(resolver.open_root(www, config));
+
+    std::shared_ptr<const Resolved_Path> path = resolver.resolve("/index.html");
+    TEST_CHECK(path->status == RP_FILE);
+    TEST_CHECK(path->rel == "index.html" && path->abs == www + "/index.html");
+    TEST_CHECK(path->size == 13);
+    TEST_CHECK(strcmp(path->content_type, "text/html; charset=utf-8") == 0);
+
+    struct stat st;
+    char *addr = resolver.map(*path, &st);
+    TEST_CHECK(addr != NULL && st.st_size == 13 && memcmp(addr, "<html></html>", 13) == 0);
+    munmap(addr, st.st_size);
+
+    TEST_CHECK(resolver.resolve("/inside")->status == RP_FILE);
+    TEST_CHECK(resolver.resolve("/sub/../inside")->status == RP_FILE);
+    TEST_CHECK(resolver.resolve("/up")->status == RP_FORBIDDEN);
+    TEST_CHECK(resolver.resolve("/abs")->status == RP_FORBIDDEN);
+    TEST_CHECK(resolver.resolve("/sub/escape")->status == RP_FORBIDDEN);
+    TEST_CHECK(resolver.resolve("/../secret.txt")->status == RP_FORBIDDEN);
+    TEST_CHECK(resolver.resolve("/missing.html")->status == RP_NOT_FOUND);
+    TEST_CHECK(resolver.resolve("/index.html/x")->status == RP_NOT_FOUND);
+    TEST_CHECK(resolver.resolve("/sub")->status == RP_OTHER);
+    TEST_CHECK(resolver.resolve("/index.html/")->status == RP_OTHER);
+    TEST_CHECK(resolver.resolve("/a%2Fb")->status == RP_BAD);
+
+    // 只有查询串不同：同一个缓存项
+    std::shared_ptr<const Resolved_Path> v1 = resolver.resolve("/index.html?v=1");
+    std::shared_ptr<const Resolved_Path> v2 = resolver.resolve("/index.html?v=2");
+    TEST_CHECK(v1.get() == path.get() && v2.get() == path.get());
+    TEST_CHECK(resolver.resolve("/index.html#top").get() == path.get());
+
+    unlink((www + "/sub/escape").c_str());
+    unlink((www + "/abs").c_str());
+    unlink((www + "/up").c_str());
+    unlink((www + "/inside").c_str());
+    unlink((www + "/index.html").c_str());
+    unlink((dir + "/secret.txt").c_str());
+    rmdir((www + "/sub").c_str());
+    rmdir(www.c_str());
+}
+
+struct Etag_Case {
+    const char *if_none_match;
+    bool match;                 // 与"5f-d"比较
+};
+
+static const Etag_Case ETAG_CASES[] = {
+    {"\"5f-d\"", true},
+    {"W/\"5f-d\"", true},
+    {"\"1-1\", W/\"5f-d\"", true},
+    {"  ,\"1-1\" ,\"5f-d\"", true},
+    {"*", true},
+    {"\"1-1\", *", true},
+    {"\"5f-d", false},          // 没有结尾的引号
+    {"5f-d", false},            // 没有引号
+    {"\"1-1\", 5f-d", false},
+    {"W/", false},
+    {"\"5f-\"", false},
+    {"\"5f-d0\"", false},
+    {"", false},
+};
+
+static void test_conditional() {
+
+    for (const Etag_Case &c : ETAG_CASES) {
+        if (Conditional_Util::etag_match(c.if_none_match, "\"5f-d\"") != c.match) {
+            fprintf(stderr, "etag_match(%s)\n", c.if_none_match);
+        }
+        TEST_CHECK(Conditional_Util::etag_match(c.if_none_match, "\"5f-d\"") == c.match);
+    }
+
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+    TEST_CHECK(Conditional_Util::parse_http_date("Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+    TEST_CHECK(Conditional_Util::parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT") == -1);   // RFC 850
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun Nov  6 08:49:37 1994") == -1);         // asctime
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun, 06 Nov 1994 08:49:37 UTC") == -1);
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun, 06 Foo 1994 08:49:37 GMT") == -1);
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun, 0x Nov 1994 08:49:37 GMT") == -1);
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun, 06 Nov 1969 08:49:37 GMT") == -1);
+    TEST_CHECK(Conditional_Util::parse_http_date("Sun, 06 Nov 1994") == -1);
+    TEST_CHECK(Conditional_Util::parse_http_date("") == -1);
+
+    char buf[HTTP_DATE_LEN + 1];
+    Conditional_Util::format_http_date(784111777, buf);
+    TEST_CHECK(strcmp(buf, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    TEST_CHECK(Conditional_Util::parse_http_date(buf) == 784111777);
+
+    // If-None-Match优先：不匹配时不看If-Modified-Since
+    std::string inm = "\"1-1\"", ims = "Sun, 06 Nov 1994 08:49:37 GMT";
+    TEST_CHECK(!Conditional_Util::not_modified(&inm, &ims, "\"5f-d\"", 784111777));
+    TEST_CHECK(Conditional_Util::not_modified(NULL, &ims, "\"5f-d\"", 784111777));
+    TEST_CHECK(Conditional_Util::not_modified(NULL, &ims, "\"5f-d\"", 784111776));
+    TEST_CHECK(!Conditional_Util::not_modified(NULL, &ims, "\"5f-d\"", 784111778));
+    TEST_CHECK(!Conditional_Util::not_modified(NULL, NULL, "\"5f-d\"", 0));
+}
+
+// 首部中name的值（不含\r\n），没有时为空
+static std::string header_value(const std::string &lines, const std::string &name) {
+    size_t pos = lines.find(name + ": ");
+    if (pos == std::string::npos) return "";
+    pos += name.size() + 2;
+    return lines.substr(pos, lines.find("\r\n", pos) - pos);
+}
+
+static void request(Http_Request_Parser &hrp, const std::string &method, const std::string &url) {
+    std::string req = method + " " + url + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+    TEST_CHECK(hrp.parse(&req[0], req.size()) == PS_OK);
+}
+
+// 已解析文件的200与304：验证器、Cache-Control来自同一处，Content-Type来自解析结果
+static void test_response_file(const std::string &dir) {
+
+    std::string www = dir + "/files";
+    TEST_CHECK(mkdir(www.c_str(), 0755) == 0);
+    write_file(www + "/style.CSS", "body{}");
+    ServerConfig config;
+    Path_Resolver &resolver = Path_Resolver::instance();
+    TEST_CHECK(resolver.open_root(www, config));
+    std::shared_ptr<const Resolved_Path> path = resolver.resolve("/style.CSS?v=3");
+    TEST_CHECK(path->status == RP_FILE);
+
+    std::vector<std::string> types;
+    Http_Request_Parser hrp;
+    request(hrp, "GET", "/style.CSS?v=3");
+    Http_Response_Sender ok(types);
+    ok.set_resolved_path(path);
+    ok.response_file(hrp);
+    TEST_CHECK(ok.status_code() == HTTP_UTILS::OK);
+    TEST_CHECK(ok.status_line().compare(0, 13, "HTTP/1.1 200 ") == 0);
+    const std::string &lines = ok.header_lines();
+    TEST_CHECK(lines.find(path->validator_lines) != std::string::npos);
+    TEST_CHECK(header_value(lines, "ETag") == path->etag);
+    TEST_CHECK(header_value(lines, "Cache-Control") == "private, max-age=3600");
+    TEST_CHECK(header_value(lines, "Content-Type") == "text/css; charset=utf-8");
+    TEST_CHECK(header_value(lines, "Content-Length") == "6");
+    TEST_CHECK(header_value(lines, "Connection") == "keep-alive");
+    TEST_CHECK(ok.get_response_body_len() == 6 && memcmp(ok.body_data(), "body{}", 6) == 0);
+
+    // 用200拿到的验证器发出条件请求：304带同样的验证器首部
+    std::string etag = header_value(lines, "ETag");
+    std::string last_modified = header_value(lines, "Last-Modified");
+    TEST_CHECK(Conditional_Util::not_modified(&etag, NULL, path->etag, path->mtime));
+    TEST_CHECK(Conditional_Util::not_modified(NULL, &last_modified, path->etag, path->mtime));
+    Http_Response_Sender not_modified(types);
+    not_modified.response_not_modified(hrp, *path);
+    TEST_CHECK(not_modified.status_code() == HTTP_UTILS::NOT_MODIFIED);
+    const std::string &lines_304 = not_modified.header_lines();
+    TEST_CHECK(header_value(lines_304, "ETag") == etag);
+    TEST_CHECK(header_value(lines_304, "Last-Modified") == last_modified);
+    TEST_CHECK(header_value(lines_304, "Cache-Control") == header_value(lines, "Cache-Control"));
+    TEST_CHECK(not_modified.get_response_body_len() == 0);
+
+    // HEAD：长度来自解析结果，没有响应体
+    Http_Request_Parser head;
+    request(head, "HEAD", "/style.CSS");
+    Http_Response_Sender head_ok(types);
+    head_ok.set_resolved_path(path);
+    head_ok.response_file(head);
+    TEST_CHECK(header_value(head_ok.header_lines(), "Content-Length") == "6");
+    TEST_CHECK(header_value(head_ok.header_lines(), "ETag") == etag);
+    TEST_CHECK(head_ok.get_response_body_len() == 0);
+
+    // 解析之后文件被删除：404
+    unlink((www + "/style.CSS").c_str());
+    Http_Response_Sender gone(types);
+    gone.set_resolved_path(path);
+    gone.response_file(hrp);
+    TEST_CHECK(gone.status_code() == HTTP_UTILS::NOT_FOUND);
+    TEST_CHECK(gone.get_response_body_len() == 0);
+
+    rmdir(www.c_str());
+}
+
+static void test_mime() {
+
+    TEST_CHECK(strcmp(Mime_Util::lookup("html", 4), "text/html; charset=utf-8") == 0);
+    TEST_CHECK(strcmp(Mime_Util::lookup("HTML", 4), "text/html; charset=utf-8") == 0);
+    TEST_CHECK(strcmp(Mime_Util::lookup("Woff2", 5), "font/woff2") == 0);
+    TEST_CHECK(strcmp(Mime_Util::lookup("JPG", 3), "image/jpeg") == 0);
+    TEST_CHECK(strcmp(Mime_Util::lookup("webmanifest", 11), "application/manifest+json") == 0);
+    TEST_CHECK(Mime_Util::lookup("htmlx", 5) == NULL);
+    TEST_CHECK(Mime_Util::lookup("htm", 2) == NULL);       // 只比较给出的长度
+    TEST_CHECK(Mime_Util::lookup("exe", 3) == NULL);
+    TEST_CHECK(Mime_Util::lookup("", 0) == NULL);
+    TEST_CHECK(Mime_Util::lookup("averyveryverylongext", 20) == NULL);
+    for (size_t i = 0; i < MIME_COUNT; ++i) {
+        TEST_CHECK(Mime_Util::lookup(MIME_TYPES[i].ext, strlen(MIME_TYPES[i].ext)) == MIME_TYPES[i].type);
+    }
+
+    TEST_CHECK(strcmp(Mime_Util::for_path("a/b/index.HTML"), "text/html; charset=utf-8") == 0);
+    TEST_CHECK(strcmp(Mime_Util::for_path("x.tar.gz"), "application/gzip") == 0);
+    TEST_CHECK(strcmp(Mime_Util::for_path("v1.2/README"), MIME_DEFAULT) == 0);
+    TEST_CHECK(strcmp(Mime_Util::for_path("file."), MIME_DEFAULT) == 0);
+    TEST_CHECK(strcmp(Mime_Util::for_path(""), MIME_DEFAULT) == 0);
+
+    const char *html = "text/html; charset=utf-8";
+    const char *css = "text/css; charset=utf-8";
+    const char *png = "image/png";
+    TEST_CHECK(Mime_Util::accept_quality(NULL, html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("text/html", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("TEXT/HTML", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("image/png", html) == 0);
+    TEST_CHECK(Mime_Util::accept_quality("text/htmlx", html) == 0);
+
+    // 最具体的匹配决定q值，与出现的顺序无关
+    const char *ranges = "*/*;q=0.1, text/*;q=0.5, text/html;q=0.8";
+    TEST_CHECK(Mime_Util::accept_quality(ranges, html) == 800);
+    TEST_CHECK(Mime_Util::accept_quality(ranges, css) == 500);
+    TEST_CHECK(Mime_Util::accept_quality(ranges, png) == 100);
+    TEST_CHECK(Mime_Util::accept_quality("text/html, text/*;q=0.2", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("*/*;q=0.2, text/*", css) == 1000);
+
+    // q=0：明确不接受，即使有更宽的范围
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=0", html) == 0);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=0, */*", html) == 0);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=0, */*", png) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("text/*;q=0.000", css) == 0);
+
+    // 格式错误的q按1000，多余的小数位忽略
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=abc", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=1.5", html) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=0.12345", html) == 123);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;Q=0.4", html) == 400);
+
+    // 媒体范围的参数：跳过，q之前或之后都可以
+    TEST_CHECK(Mime_Util::accept_quality("text/html;level=1;q=0.3", html) == 300);
+    TEST_CHECK(Mime_Util::accept_quality("text/html;q=0.3;level=1", html) == 300);
+    TEST_CHECK(Mime_Util::accept_quality("text/html ; q=0.7 , image/png", html) == 700);
+    TEST_CHECK(Mime_Util::accept_quality("text/html ; q=0.7 , image/png", png) == 1000);
+    TEST_CHECK(Mime_Util::accept_quality("text/plain;format=\"a,b\";q=0.9, text/html", html) == 1000);
+}
+
+int main() {
+
+    char dir[] = "/tmp/static_file_test.XXXXXX";
+    TEST_CHECK(mkdtemp(dir) != NULL);
+
+    test_normalize();
+    test_resolve_beneath(dir);
+    test_conditional();
+    test_response_file(dir);
+    test_mime();
+
+    rmdir(dir);
+    printf("static_file_test: OK\n");
+    return 0;
+}
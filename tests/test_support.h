@@ -0,0 +1,261 @@
+#pragma once
+
+/**
+ * desc: 测试程序共用的支撑代码
+ *      头文件中只声明、由服务器主程序提供的函数（Epoll_Util、信号、请求行解析、静态文件响应）
+ *      在这里给出最小的实现，使测试可以直接驱动进程池、工作线程和各协议的状态机
+ *      http_response_sender.h中定义了server_root，每个测试程序只能有一个翻译单元
+ *      静态请求经过response()的前提是server_root（/var/www/html）不存在
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include "process_pool.h"
+
+namespace Test_Util {
+
+// start_server启动的进程池所在的进程组，失败退出时一起杀死（否则ctest会等它们关闭输出）
+inline pid_t &server_group() {
+    static pid_t pgid = 0;
+    return pgid;
+}
+
+inline void stop_server() {
+    if (server_group() <= 0) return;
+    kill(-server_group(), SIGKILL);
+    waitpid(server_group(), NULL, 0);
+    server_group() = 0;
+}
+
+} // namespace Test_Util
+
+// 失败时打印位置并退出，测试之间不共享状态，第一个失败之后的结果没有意义
+#define TEST_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            Test_Util::stop_server(); \
+            exit(1); \
+        } \
+    } while (0)
+
+int Epoll_Util::_epoll_fd = -1;
+int Epoll_Util::_max_fd = MAX_EVENT_NUMBER;
+epoll_event *Epoll_Util::events = NULL;
+
+void Epoll_Util::init() {
+    if (events == NULL) events = new epoll_event[MAX_EVENT_NUMBER];
+}
+
+void Epoll_Util::create() {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    assert(_epoll_fd >= 0);
+}
+
+std::pair<epoll_event*, int> Epoll_Util::wait_for_events() {
+    int len = epoll_wait(_epoll_fd, events, MAX_EVENT_NUMBER, -1);
+    return {events, len};
+}
+
+void Epoll_Util::addfd(int fd, bool oneshot) {
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    if (oneshot) event.events |= EPOLLONESHOT;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void Epoll_Util::removefd(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+void Epoll_Util::modifyfd(int fd, int ev) {
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = ev | EPOLLRDHUP | EPOLLONESHOT;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+int setnonblocking(int fd) {
+    int old_option = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, old_option | O_NONBLOCK);
+    return old_option;
+}
+
+void addsig(int sig, sig_hander handler, bool restart) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    if (restart) sa.sa_flags |= SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    int ret = sigaction(sig, &sa, NULL);
+    assert(ret != -1);
+    (void)ret;
+}
+
+std::string _exec_command(const char *cmd) {
+    std::string result;
+    FILE *fp = popen(cmd, "r");
+    if (fp == NULL) return result;
+    char buf[256];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) result.append(buf, n);
+    pclose(fp);
+    return result;
+}
+
+template<typename ClientData_t>
+ProcessPool<ClientData_t> *ProcessPool<ClientData_t>::Instance = NULL;
+
+template<typename ClientData_t>
+int ProcessPool<ClientData_t>::_sig_pipefd[2];
+
+// 首部可能分几次到达：收齐"\r\n\r\n"之后解析请求行和首部
+PARSE_STAGE Http_Request_Parser::parse(char *read_buf, int read_bytes) {
+
+    req_buffer_to_parse.append(read_buf, read_bytes);
+    size_t end = req_buffer_to_parse.find("\r\n\r\n");
+    if (end == std::string::npos) return PS_HEADER;
+
+    size_t line_end = req_buffer_to_parse.find("\r\n");
+    std::string line = req_buffer_to_parse.substr(0, line_end);
+    size_t a = line.find(' '), b = line.rfind(' ');
+    if (a == std::string::npos || a == b) return PS_PARSE_FAIL;
+    req_method = line.substr(0, a);
+    req_url = line.substr(a + 1, b - a - 1);
+    req_http_version = line.substr(b + 1);
+
+    size_t pos = line_end + 2;
+    while (pos < end + 2) {
+        size_t eol = req_buffer_to_parse.find("\r\n", pos);
+        std::string field = req_buffer_to_parse.substr(pos, eol - pos);
+        size_t colon = field.find(':');
+        if (colon == std::string::npos) return PS_PARSE_FAIL;
+        size_t value = field.find_first_not_of(' ', colon + 1);
+        key_val[field.substr(0, colon)] = value == std::string::npos ? "" : field.substr(value);
+        pos = eol + 2;
+    }
+    req_buffer_to_parse.clear();
+    return PS_OK;
+}
+
+// 不读文件：静态资源回复固定的内容"static"；URL带?bytes=N时回复N字节（'a'~'z'循环）
+void Http_Response_Sender::response(Http_Request_Parser &http_request_parser) {
+
+    size_t query = http_request_parser.url().find("?bytes=");
+    if (query == std::string::npos) {
+        response_content(http_request_parser, HTTP_UTILS::OK, "text/plain", "static");
+        return;
+    }
+    std::string body(strtoul(http_request_parser.url().c_str() + query + 7, NULL, 10), '\0');
+    for (size_t i = 0; i < body.size(); ++i) body[i] = 'a' + i % 26;
+    response_content(http_request_parser, HTTP_UTILS::OK, "text/plain", std::move(body));
+}
+
+namespace Test_Util {
+
+// 监听127.0.0.1上的一个临时端口，port得到端口号
+inline int listen_loopback(int *port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_CHECK(bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+    TEST_CHECK(listen(fd, 128) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// 在单独的进程组中启动进程池（父进程和process_number个子进程），由stop_server结束
+// stdout_fd >= 0时进程池的标准输出重定向到它
+template<typename ClientData_t>
+inline void start_server(int listenfd, const ServerConfig &config, int process_number = 1, \
+        int stdout_fd = -1) {
+    pid_t pid = fork();
+    TEST_CHECK(pid >= 0);
+    if (pid == 0) {
+        setpgid(0, 0);
+        if (stdout_fd >= 0) dup2(stdout_fd, STDOUT_FILENO);
+        ProcessPool<ClientData_t>::create(listenfd, Worker<ClientData_t>::work, \
+            process_number, config).run();
+        exit(0);
+    }
+    setpgid(pid, pid);
+    close(listenfd);
+    server_group() = pid;
+}
+
+inline int connect_loopback(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    TEST_CHECK(connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+inline void send_all(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        TEST_CHECK(n > 0);
+        sent += n;
+    }
+}
+
+// 向buf追加数据，最多等待timeout_ms毫秒；对端关闭或超时返回false
+inline bool recv_some(int fd, std::string *buf, int timeout_ms) {
+    pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+    char tmp[16384];
+    ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0) return false;
+    buf->append(tmp, n);
+    return true;
+}
+
+// 一个按Content-Length定界的HTTP/1.1报文
+struct Http_Message {
+    std::string start_line;
+    std::string head;       // 起始行和首部（含结尾的空行）
+    std::string body;
+};
+
+// 从buf开头取出一个完整的报文（按Content-Length），不完整时继续接收；超时返回false
+inline bool read_message(int fd, std::string *buf, Http_Message *msg, int timeout_ms = 3000) {
+    while (true) {
+        size_t end = buf->find("\r\n\r\n");
+        if (end != std::string::npos) {
+            size_t length = 0;
+            const char *cl = strcasestr(buf->c_str(), "\r\nContent-Length:");
+            if (cl != NULL && (size_t)(cl - buf->c_str()) < end) length = strtoul(cl + 17, NULL, 10);
+            if (buf->size() >= end + 4 + length) {
+                msg->start_line = buf->substr(0, buf->find("\r\n"));
+                msg->head = buf->substr(0, end + 4);
+                msg->body = buf->substr(end + 4, length);
+                buf->erase(0, end + 4 + length);
+                return true;
+            }
+        }
+        if (!recv_some(fd, buf, timeout_ms)) return false;
+    }
+}
+
+} // namespace Test_Util
@@ -0,0 +1,74 @@
+/**
+ * desc: 弹性线程池的测试
+ *      工作函数处理每个任务时睡眠一段时间：任务积压时线程池扩容到thread_max，
+ *      队列清空并持续空闲之后缩回thread_min；线程数、扩容/缩容次数和排队时间
+ *      都要出现在负载项和负载表的报告中
+ */
+
+#include "test_support.h"
+
+#define TASK_SLEEP_MS 20
+
+// 每个任务睡眠TASK_SLEEP_MS，收到退出请求时登记并结束
+static void *slow_routine(void *arg) {
+
+    auto *container = (ThreadPoolTaskContainer<ClientData> *)arg;
+    ThreadPoolTask<ClientData> task;
+    bool should_exit = false;
+    while (!should_exit) {
+        if (container->try_remove(task, &should_exit)) usleep(TASK_SLEEP_MS * 1000);
+    }
+    container->on_thread_exit();
+    return NULL;
+}
+
+// 等待cond成立，最多timeout_ms
+template<typename Cond>
+static bool wait_until(Cond cond, int timeout_ms) {
+    for (int i = 0; i < timeout_ms / 5; ++i) {
+        if (cond()) return true;
+        usleep(5 * 1000);
+    }
+    return cond();
+}
+
+int main() {
+
+    Load_Table table;
+    TEST_CHECK(table.create(1));
+    ChildLoad &load = table[0];
+
+    ServerConfig config;
+    config.thread_min = 1;
+    config.thread_max = 4;
+    config.queue_target_us = 2000;
+    config.thread_adjust_interval_ms = 10;
+    config.thread_idle_cooldown_ms = 50;
+
+    ThreadPoolTaskContainer<ClientData> container;
+    container.set_load_slot(&load);
+    ThreadPool<ClientData> pool(slow_routine, &container, config);
+    pool.create();
+    TEST_CHECK(load.live_threads.load() == 1);
+
+    // 积压：排队时间超过目标，每个决策周期扩容一个线程，直到thread_max
+    for (int i = 0; i < 60; ++i) container.add(epoll_event(), -1, NULL);
+    TEST_CHECK(wait_until([&]() { return load.live_threads.load() == 4; }, 2000));
+    TEST_CHECK(load.thread_grows.load() == 3);
+    TEST_CHECK(load.queue_sojourn_us.load() > 2000);
+
+    // 队列清空之后空闲：每个冷却时间缩容一个线程，直到thread_min
+    TEST_CHECK(wait_until([&]() { return load.queue_depth.load() == 0; }, 5000));
+    TEST_CHECK(wait_until([&]() { return load.live_threads.load() == 1; }, 3000));
+    TEST_CHECK(load.thread_shrinks.load() == 3);
+    TEST_CHECK(load.thread_grows.load() == 3);
+
+    std::string report = table.report();
+    TEST_CHECK(report.find(" threads 1 ") != std::string::npos);
+    TEST_CHECK(report.find(" thread_grows 3 thread_shrinks 3 ") != std::string::npos);
+
+    pool.stop();
+    TEST_CHECK(load.live_threads.load() == 0);
+    printf("thread_pool_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,271 @@
+/**
+ * desc: TLS握手和写路径的测试，证书在运行时生成（自签名）
+ *      tls_test userspace: tls_ktls关闭，响应经SSL_write加密
+ *      tls_test ktls:      tls_ktls打开，发送方向卸载到内核，响应直接sendmsg明文；
+ *                          内核或OpenSSL不支持kTLS时返回SKIP_RETURN_CODE（ctest记为跳过）
+ *      每种模式先在进程内直接驱动Tls_Context/Write_Policy（可以检查走的是哪条路径），
+ *      再经过进程池完成一次请求
+ *      直接驱动时还检查空闲TLS连接的实测大小
+ *      userspace模式还检查票据密钥的轮换：上一个密钥签发的票据可以恢复（并续签），
+ *      轮换两次之后的票据做完整握手
+ */
+
+#include "test_support.h"
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <thread>
+
+#define SKIP_RETURN_CODE 77
+#define RESPONSE_BODY_BYTES (256 << 10)
+
+// 在dir中生成自签名证书（CN=localhost）和私钥
+static void make_self_signed(const std::string &dir, std::string *cert_file, std::string *key_file) {
+
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    TEST_CHECK(pkey != NULL);
+    X509 *x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), -60);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME *name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    TEST_CHECK(X509_sign(x509, pkey, EVP_sha256()) > 0);
+
+    *cert_file = dir + "/cert.pem";
+    *key_file = dir + "/key.pem";
+    FILE *fp = fopen(cert_file->c_str(), "w");
+    TEST_CHECK(fp != NULL && PEM_write_X509(fp, x509) == 1);
+    fclose(fp);
+    fp = fopen(key_file->c_str(), "w");
+    TEST_CHECK(fp != NULL && PEM_write_PrivateKey(fp, pkey, NULL, NULL, 0, NULL, NULL) == 1);
+    fclose(fp);
+
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+}
+
+// 校验服务器证书的客户端（阻塞socket）
+static SSL *client_connect(SSL_CTX *client_ctx, int fd) {
+    SSL *ssl = SSL_new(client_ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_set1_host(ssl, "localhost");
+    TEST_CHECK(SSL_connect(ssl) == 1);
+    TEST_CHECK(SSL_get_verify_result(ssl) == X509_V_OK);
+    return ssl;
+}
+
+// 读到对端关闭为止
+static std::string client_read_all(SSL *ssl) {
+    std::string data;
+    char buf[65536];
+    int n;
+    while ((n = SSL_read(ssl, buf, sizeof(buf))) > 0) data.append(buf, n);
+    return data;
+}
+
+static std::string expected_body() {
+    std::string body(RESPONSE_BODY_BYTES, '\0');
+    for (size_t i = 0; i < body.size(); ++i) body[i] = 'a' + i % 26;
+    return body;
+}
+
+/**
+ * 服务端在本线程以非阻塞方式握手，用Write_Policy发送响应（和子进程的写路径相同），
+ * 客户端在另一个线程；返回服务端是否把发送方向交给了内核
+ */
+static bool serve_one_direct(const ServerConfig &config, SSL_CTX *client_ctx) {
+
+    Tls_Context context;
+    TEST_CHECK(context.create(config) && context.enabled());
+
+    // 空闲TLS连接的实测大小：SSL对象比Tls_Conn大得多，读写缓冲区已经释放
+    size_t idle_bytes = context.measure_idle_conn_bytes();
+    printf("idle tls connection: %zu bytes\n", idle_bytes);
+#ifndef __SANITIZE_ADDRESS__
+    TEST_CHECK(idle_bytes > 4 * sizeof(Tls_Conn) && idle_bytes < 32 * 1024);
+#else
+    TEST_CHECK(idle_bytes >= sizeof(Tls_Conn));    // ASan的分配器不计入mallinfo2，只得到下限
+#endif
+
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    std::string received;
+    std::thread client([&]() {
+        int fd = Test_Util::connect_loopback(port);
+        SSL *ssl = client_connect(client_ctx, fd);
+        TEST_CHECK(SSL_write(ssl, "GET / HTTP/1.1\r\n\r\n", 18) == 18);
+        received = client_read_all(ssl);
+        SSL_free(ssl);
+        close(fd);
+    });
+
+    int fd = accept(listenfd, NULL, NULL);
+    TEST_CHECK(fd >= 0);
+    close(listenfd);
+    setnonblocking(fd);
+
+    Tls_Conn *tls = context.accept(fd);
+    TEST_CHECK(tls != NULL);
+    int want = 0;
+    while (!Tls_Util::handshake(tls, &want)) {
+        TEST_CHECK(want != 0);
+        pollfd pfd = {fd, (short)(want == EPOLLIN ? POLLIN : POLLOUT), 0};
+        poll(&pfd, 1, 1000);
+    }
+
+    char buf[256];
+    ssize_t n;
+    while ((n = Tls_Util::recv(tls, fd, buf, sizeof(buf))) < 0 && errno == EAGAIN) {
+        pollfd pfd = {fd, POLLIN, 0};
+        poll(&pfd, 1, 1000);
+    }
+    TEST_CHECK(n > 0);
+
+    std::string body = expected_body();
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    iovec iov[2] = {{(void *)head.data(), head.size()}, {(void *)body.data(), body.size()}};
+    int offset = 0;
+    Write_State state;
+    IO_STATUS status;
+    while ((status = Write_Policy::send_response(fd, iov, 2, &offset, true, state, 16, NULL, tls)) == IOS_AGAIN) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        poll(&pfd, 1, 1000);
+    }
+    TEST_CHECK(status == IOS_DONE);
+    bool ktls_send = tls->ktls_send;
+
+    Tls_Util::shutdown(tls);
+    delete tls;
+    close(fd);
+    client.join();
+    TEST_CHECK(received == head + body);
+    return ktls_send;
+}
+
+/**
+ * 一次只握手的连接：*session不为NULL时尝试用它恢复，结束后换成服务端新签发的票据
+ * 返回会话是否被恢复
+ */
+static bool handshake_direct(Tls_Context &context, SSL_CTX *client_ctx, SSL_SESSION **session) {
+
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    bool reused = false;
+    std::thread client([&]() {
+        int fd = Test_Util::connect_loopback(port);
+        SSL *ssl = SSL_new(client_ctx);
+        SSL_set_fd(ssl, fd);
+        SSL_set1_host(ssl, "localhost");
+        if (*session) SSL_set_session(ssl, *session);
+        TEST_CHECK(SSL_connect(ssl) == 1);
+        client_read_all(ssl);       // TLS 1.3的票据在握手之后到达
+        reused = SSL_session_reused(ssl) == 1;
+        SSL_shutdown(ssl);          // 没有关闭就释放的会话会被标记为不可恢复
+        if (*session) SSL_SESSION_free(*session);
+        *session = SSL_get1_session(ssl);
+        SSL_free(ssl);
+        close(fd);
+    });
+
+    int fd = accept(listenfd, NULL, NULL);
+    TEST_CHECK(fd >= 0);
+    close(listenfd);
+    setnonblocking(fd);
+    Tls_Conn *tls = context.accept(fd);
+    TEST_CHECK(tls != NULL);
+    int want = 0;
+    while (!Tls_Util::handshake(tls, &want)) {
+        TEST_CHECK(want != 0);
+        pollfd pfd = {fd, (short)(want == EPOLLIN ? POLLIN : POLLOUT), 0};
+        poll(&pfd, 1, 1000);
+    }
+    Tls_Util::shutdown(tls);
+    delete tls;
+    close(fd);
+    client.join();
+    return reused;
+}
+
+// 票据密钥由父进程轮换：当前和上一个密钥签发的票据可以恢复，更早的做完整握手
+static void check_ticket_rotation(const ServerConfig &config, SSL_CTX *client_ctx) {
+
+    Tls_Context context;
+    TEST_CHECK(context.create(config) && context.rotates_keys());
+    SSL_SESSION *session = NULL;
+    TEST_CHECK(!handshake_direct(context, client_ctx, &session));
+    TEST_CHECK(session != NULL && SSL_SESSION_has_ticket(session));
+
+    context.rotate_keys();          // 未到轮换时间
+    TEST_CHECK(handshake_direct(context, client_ctx, &session));
+
+    context.rotate_keys(true);      // 票据的密钥成为上一个：恢复，并用当前密钥续签
+    TEST_CHECK(handshake_direct(context, client_ctx, &session));
+
+    context.rotate_keys(true);
+    context.rotate_keys(true);      // 票据的密钥已经不在共享内存中
+    TEST_CHECK(!handshake_direct(context, client_ctx, &session));
+    TEST_CHECK(handshake_direct(context, client_ctx, &session));
+    SSL_SESSION_free(session);
+}
+
+// 经过进程池：握手在子进程的EPOLLONESHOT状态机中完成，响应由工作线程发送
+static void serve_one_through_pool(const ServerConfig &config, SSL_CTX *client_ctx) {
+
+    int port = 0;
+    int listenfd = Test_Util::listen_loopback(&port);
+    Test_Util::start_server<ClientData>(listenfd, config);
+
+    int fd = Test_Util::connect_loopback(port);
+    SSL *ssl = client_connect(client_ctx, fd);
+    std::string request = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    TEST_CHECK(SSL_write(ssl, request.data(), request.size()) == (int)request.size());
+    std::string response = client_read_all(ssl);
+    TEST_CHECK(response.compare(0, 13, "HTTP/1.1 200 ") == 0);
+    TEST_CHECK(response.size() > 6 && response.compare(response.size() - 6, 6, "static") == 0);
+    SSL_free(ssl);
+    close(fd);
+    Test_Util::stop_server();
+}
+
+int main(int argc, char *argv[]) {
+
+    std::string mode = argc > 1 ? argv[1] : "userspace";
+    TEST_CHECK(mode == "userspace" || mode == "ktls");
+    signal(SIGPIPE, SIG_IGN);
+
+    char dir[] = "/tmp/tls_test.XXXXXX";
+    TEST_CHECK(mkdtemp(dir) != NULL);
+    ServerConfig config;
+    make_self_signed(dir, &config.tls_cert_file, &config.tls_key_file);
+    config.tls_ktls = mode == "ktls";
+    config.thread_min = 2;
+    config.thread_max = 4;
+
+    SSL_CTX *client_ctx = SSL_CTX_new(TLS_client_method());
+    TEST_CHECK(SSL_CTX_load_verify_locations(client_ctx, config.tls_cert_file.c_str(), NULL) == 1);
+    SSL_CTX_set_verify(client_ctx, SSL_VERIFY_PEER, NULL);
+
+    int ret = 0;
+    bool ktls_send = serve_one_direct(config, client_ctx);
+    if (mode == "userspace") {
+        TEST_CHECK(!ktls_send);
+        check_ticket_rotation(config, client_ctx);
+    }else if (!ktls_send) {
+        printf("tls_test: kernel TLS offload unavailable (tls module or OpenSSL ktls support missing), skipped\n");
+        ret = SKIP_RETURN_CODE;
+    }
+
+    if (ret == 0) {
+        serve_one_through_pool(config, client_ctx);
+        printf("tls_test %s: OK\n", mode.c_str());
+    }
+
+    SSL_CTX_free(client_ctx);
+    unlink(config.tls_cert_file.c_str());
+    unlink(config.tls_key_file.c_str());
+    rmdir(dir);
+    return ret;
+}
@@ -0,0 +1,116 @@
+/**
+ * desc: WebSocket帧解析的测试
+ *      重点是64位的帧长度：最高位为1的长度（包括分片消息中与已缓存的部分相加会溢出的长度）
+ *      必须以1002关闭，超过消息上限的长度在收完帧之前以1009关闭，不能回绕后被当作小帧
+ */
+
+#include "test_support.h"
+#include "websocket.h"
+
+// 客户端发出的帧：带掩码，len64为非0时用它作为127形式的长度（只写帧头，不带负载）
+static std::string client_frame(int op, const std::string &payload, bool fin = true, uint64_t len64 = 0) {
+
+    static const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    std::string f;
+    f += (char)((fin ? 0x80 : 0) | op);
+    if (len64 != 0) {
+        f += (char)(0x80 | 127);
+        for (int shift = 56; shift >= 0; shift -= 8) f += (char)(len64 >> shift);
+        f.append((const char *)mask, 4);
+        return f;
+    }
+    if (payload.size() < 126) {
+        f += (char)(0x80 | payload.size());
+    }else {
+        f += (char)(0x80 | 126);
+        f += (char)(payload.size() >> 8);
+        f += (char)payload.size();
+    }
+    f.append((const char *)mask, 4);
+    for (size_t i = 0; i < payload.size(); ++i) f += (char)(payload[i] ^ mask[i & 3]);
+    return f;
+}
+
+// 把发送队列写到socketpair的另一端并取出
+static std::string drain(Ws_Session &session) {
+    int sv[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    TEST_CHECK(session.flush(NULL, sv[0], NULL) == IOS_DONE);
+    std::string out;
+    char buf[65536];
+    ssize_t n;
+    while ((n = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+    close(sv[0]);
+    close(sv[1]);
+    return out;
+}
+
+static std::string close_frame(uint16_t code) {
+    return std::string("\x88\x02", 2) + (char)(code >> 8) + (char)code;
+}
+
+static bool feed(Ws_Session &session, std::string data) {
+    return session.on_recv(&data[0], data.size());
+}
+
+static void test_echo(const Ws_Settings &settings) {
+    Ws_Session session(settings);
+    TEST_CHECK(feed(session, client_frame(WSO_TEXT, "hel", false) + client_frame(WSO_CONTINUATION, "lo")));
+    TEST_CHECK(drain(session) == std::string("\x81\x05hello", 7));
+    TEST_CHECK(session.idle());
+}
+
+// 5字节的分片之后，续帧的长度为2^64-1：与已缓存的5字节相加会回绕成4
+static void test_continuation_length_overflow(const Ws_Settings &settings) {
+    Ws_Session session(settings);
+    TEST_CHECK(feed(session, client_frame(WSO_TEXT, "hello", false)));
+    TEST_CHECK(!feed(session, client_frame(WSO_CONTINUATION, "", true, 0xFFFFFFFFFFFFFFFFULL) + "abcd"));
+    TEST_CHECK(drain(session) == close_frame(WSC_PROTOCOL_ERROR));
+    TEST_CHECK(session.finished());
+}
+
+static void test_length_msb_set(const Ws_Settings &settings) {
+    Ws_Session session(settings);
+    TEST_CHECK(!feed(session, client_frame(WSO_BINARY, "", true, 0x8000000000000000ULL)));
+    TEST_CHECK(drain(session) == close_frame(WSC_PROTOCOL_ERROR));
+}
+
+// 合法但超过上限的长度：只凭帧头就关闭
+static void test_length_over_limit(const Ws_Settings &settings) {
+    Ws_Session first(settings);
+    TEST_CHECK(!feed(first, client_frame(WSO_BINARY, "", true, 0x7FFFFFFFFFFFFFFFULL)));
+    TEST_CHECK(drain(first) == close_frame(WSC_TOO_BIG));
+
+    // 分片合计刚好超过上限
+    Ws_Session second(settings);
+    TEST_CHECK(feed(second, client_frame(WSO_BINARY, "hello", false)));
+    TEST_CHECK(!feed(second, client_frame(WSO_CONTINUATION, "", true, settings.max_message - 4)));
+    TEST_CHECK(drain(second) == close_frame(WSC_TOO_BIG));
+}
+
+// 不限制消息大小时，巨大的长度只是一个没有收完的帧
+static void test_unlimited_incomplete(const Ws_Settings &settings) {
+    Ws_Settings unlimited = settings;
+    unlimited.max_message = SIZE_MAX;
+    Ws_Session session(unlimited);
+    TEST_CHECK(feed(session, client_frame(WSO_BINARY, "hello", false)));
+    TEST_CHECK(feed(session, client_frame(WSO_CONTINUATION, "", true, 0x7FFFFFFFFFFFFFFFULL) + "abcd"));
+    TEST_CHECK(!session.idle() && !session.want_write());
+}
+
+int main() {
+
+    Ws_Echo_Handler echo;
+    Ws_Settings settings;
+    settings.handler = &echo;
+    settings.max_message = 1 << 20;
+
+    test_echo(settings);
+    test_continuation_length_overflow(settings);
+    test_length_msb_set(settings);
+    test_length_over_limit(settings);
+    test_unlimited_incomplete(settings);
+
+    printf("websocket_test: OK\n");
+    return 0;
+}